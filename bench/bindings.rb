@@ -0,0 +1,61 @@
+# Binding call-overhead micro-benchmark
+#
+# Measures calls per second for the hot SDL::Video bindings. Run it with an
+# mruby built with this gem and mruby-time, using the dummy video driver so no
+# window is opened:
+#
+#   SDL_VIDEODRIVER=dummy bin/mruby path/to/mruby-sdl/bench/bindings.rb
+#
+# Run it before and after a change to the bindings and compare the calls/s
+# column. The cost of the loop and block call is subtracted from every
+# measurement.
+
+ITERATIONS = 200_000
+
+def measure(iterations)
+  start = Time.now
+  i = 0
+  while i < iterations
+    yield
+    i += 1
+  end
+  Time.now - start
+end
+
+def report(name, iterations, elapsed, overhead)
+  net = elapsed - overhead
+  net = 0.000001 if net <= 0
+  rate = (iterations / net).to_i
+  puts "#{name.ljust(24)} #{rate.to_s.rjust(12)} calls/s  #{(net * 1_000_000_000 / iterations).to_i} ns/call"
+end
+
+SDL.init(0x20) # SDL_INIT_VIDEO
+
+screen = SDL::Video.set_mode(320, 240, 32, 0)
+sprite = SDL::Video.create_rgb_surface(0, 32, 32, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0)
+src_rect = SDL::Rect.new(0, 0, 32, 32)
+dest_rect = SDL::Rect.new(16, 16, 32, 32)
+noop = lambda { }
+overhead = measure(ITERATIONS) { noop.call }
+
+benchmarks = [
+  ["blit_surface", lambda { SDL::Video.blit_surface(sprite, src_rect, screen, dest_rect) }],
+  ["fill_rect", lambda { SDL::Video.fill_rect(screen, dest_rect, 0x00ff00ff) }],
+  ["update_rect", lambda { SDL::Video.update_rect(screen, 0, 0, 32, 32) }],
+  ["set_color_key", lambda { SDL::Video.set_color_key(sprite, 0, 0) }],
+  ["set_alpha", lambda { SDL::Video.set_alpha(sprite, 0, 255) }],
+  ["lock/unlock_surface", lambda { SDL::Video.lock_surface(screen); SDL::Video.unlock_surface(screen) }],
+  ["mode_ok", lambda { SDL::Video.mode_ok(320, 240, 32, 0) }],
+  ["Rect.new", lambda { SDL::Rect.new(1, 2, 3, 4) }],
+  ["Rect#x / Rect#x=", lambda { dest_rect.x = dest_rect.x }],
+  ["create/free_surface", lambda {
+    SDL::Video.free_surface(SDL::Video.create_rgb_surface(0, 8, 8, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0))
+  }],
+]
+
+puts "#{'binding'.ljust(24)} #{'rate'.rjust(12)}"
+benchmarks.each do |name, body|
+  report(name, ITERATIONS, measure(ITERATIONS) { body.call }, overhead)
+end
+
+SDL.quit
@@ -0,0 +1,62 @@
+# Blit kernel benchmark
+#
+# Compares the gem's 32bpp blit and fill kernels with stock SDL for each kind
+# of blit they take over. Run it with an mruby built with this gem and
+# mruby-time, using the dummy video driver so no window is opened:
+#
+#   SDL_VIDEODRIVER=dummy bin/mruby path/to/mruby-sdl/bench/blit_kernels.rb
+#
+# Every case runs once with SDL::Video.use_blit_kernels(false) and once with
+# the kernel picked at init. The speedup column is sdl time / kernel time.
+
+ITERATIONS = 2_000
+SIZE = 256
+
+def measure(iterations)
+  start = Time.now
+  i = 0
+  while i < iterations
+    yield
+    i += 1
+  end
+  Time.now - start
+end
+
+SDL.init(0x20) # SDL_INIT_VIDEO
+
+SRCCOLORKEY = 0x00001000
+SRCALPHA = 0x00010000
+
+target = SDL::Video.create_rgb_surface(0, SIZE, SIZE, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0)
+opaque = SDL::Video.create_rgb_surface(0, SIZE, SIZE, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0)
+keyed = SDL::Video.create_rgb_surface(0, SIZE, SIZE, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0)
+SDL::Video.set_color_key(keyed, SRCCOLORKEY, 0x00ff00ff)
+blended = SDL::Video.create_rgb_surface(0, SIZE, SIZE, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0)
+SDL::Video.set_alpha(blended, SRCALPHA, 128)
+pixel_alpha = SDL::Video.create_rgb_surface(0, SIZE, SIZE, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000)
+SDL::Video.fill_rect(pixel_alpha, nil, 0x80ff8040)
+
+area = SDL::Rect.new(0, 0, SIZE, SIZE)
+
+benchmarks = [
+  ["copy", lambda { SDL::Video.blit_surface(opaque, nil, target, nil) }],
+  ["color key", lambda { SDL::Video.blit_surface(keyed, nil, target, nil) }],
+  ["per-pixel alpha", lambda { SDL::Video.blit_surface(pixel_alpha, nil, target, nil) }],
+  ["per-surface alpha", lambda { SDL::Video.blit_surface(blended, nil, target, nil) }],
+  ["fill", lambda { SDL::Video.fill_rect(target, area, 0x00336699) }],
+]
+
+kernel = SDL::Video.blit_kernel
+puts "#{SIZE}x#{SIZE} surfaces, #{ITERATIONS} iterations, kernel: #{kernel}"
+puts "#{'case'.ljust(20)} #{'sdl ms'.rjust(10)} #{(kernel + ' ms').rjust(10)} #{'speedup'.rjust(8)}"
+benchmarks.each do |name, body|
+  SDL::Video.use_blit_kernels(false)
+  stock = measure(ITERATIONS) { body.call }
+  SDL::Video.use_blit_kernels(true)
+  fast = measure(ITERATIONS) { body.call }
+  fast = 0.000001 if fast <= 0
+  speedup = ((stock / fast) * 100).to_i / 100.0
+  puts "#{name.ljust(20)} #{(stock * 1000).to_i.to_s.rjust(10)} #{(fast * 1000).to_i.to_s.rjust(10)} #{speedup.to_s.rjust(8)}"
+end
+
+SDL.quit
@@ -0,0 +1,50 @@
+# Throughput regression check for bench/suite.rb
+#
+# Run with CRuby, not mruby:
+#
+#   ruby bench/compare.rb baseline.json current.json [tolerance]
+#
+# Prints every case side by side and exits with status 1 if any case's
+# ops/s fell by more than the tolerance, 0.1 (10%) by default. Cases only
+# present in one file are listed but don't fail the check.
+
+require 'json'
+
+if ARGV.size < 2
+  puts "usage: compare.rb baseline.json current.json [tolerance]"
+  exit 2
+end
+
+tolerance = (ARGV[2] || 0.1).to_f
+
+def load_results(path)
+  JSON.parse(File.read(path))["results"].each_with_object({}) do |result, cases|
+    key = "#{result['name']} #{result['depth']}bpp #{result['width']}x#{result['height']}"
+    cases[key] = result["ops_per_sec"].to_f
+  end
+end
+
+baseline = load_results(ARGV[0])
+current = load_results(ARGV[1])
+regressions = 0
+
+puts "#{'case'.ljust(44)} #{'baseline'.rjust(12)} #{'current'.rjust(12)} #{'change'.rjust(8)}"
+(baseline.keys | current.keys).each do |key|
+  before = baseline[key]
+  after = current[key]
+  unless before && after
+    puts "#{key.ljust(44)} #{(before || '-').to_s.rjust(12)} #{(after || '-').to_s.rjust(12)}"
+    next
+  end
+
+  change = before > 0 ? after / before - 1 : 0
+  failed = change < -tolerance
+  regressions += 1 if failed
+  puts "#{key.ljust(44)} #{before.round.to_s.rjust(12)} #{after.round.to_s.rjust(12)} " \
+    "#{format('%+.1f%%', change * 100).rjust(8)}#{failed ? '  REGRESSION' : ''}"
+end
+
+if regressions > 0
+  puts "#{regressions} case(s) slower than the baseline by more than #{(tolerance * 100).round}%"
+  exit 1
+end
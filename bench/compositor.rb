@@ -0,0 +1,68 @@
+# Compositor scaling benchmark
+#
+# Composes a 1920x1080 frame of alpha sprites and fills, first directly and
+# then through SDL::Video.use_compositor with 1, 2, 4 and 8 threads. Run it
+# with an mruby built with this gem and mruby-time:
+#
+#   SDL_VIDEODRIVER=dummy bin/mruby path/to/mruby-sdl/bench/compositor.rb
+#
+# Frame times should drop close to linearly with the thread count until
+# memory bandwidth runs out.
+
+FRAMES = 50
+SPRITES = 400
+WIDTH = 1920
+HEIGHT = 1080
+
+def measure(iterations)
+  start = Time.now
+  i = 0
+  while i < iterations
+    yield
+    i += 1
+  end
+  Time.now - start
+end
+
+SDL.init(0x20) # SDL_INIT_VIDEO
+
+SRCALPHA = 0x00010000
+
+frame = SDL::Video.create_rgb_surface(0, WIDTH, HEIGHT, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0)
+sprite = SDL::Video.create_rgb_surface(SRCALPHA, 128, 128, 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000)
+SDL::Video.fill_rect(sprite, nil, 0x80c08040)
+
+# The same pseudo-random layout every frame: src, dest pairs for blit_batch
+layout = SDL::RectArray.new(SPRITES * 2)
+seed = 12345
+SPRITES.times do
+  seed = (seed * 1103515245 + 12345) % 2147483648
+  x = seed % WIDTH - 64
+  seed = (seed * 1103515245 + 12345) % 2147483648
+  y = seed % HEIGHT - 64
+  layout.push(0, 0, 128, 128)
+  layout.push(x, y, 0, 0)
+end
+background = SDL::Rect.new(0, 0, WIDTH, HEIGHT)
+
+compose = lambda do
+  SDL::Video.fill_rect(frame, background, 0x00202020)
+  SDL::Video.blit_batch(sprite, frame, layout)
+  SDL::Video.composite
+end
+
+puts "#{WIDTH}x#{HEIGHT}, #{SPRITES} sprites, kernel: #{SDL::Video.blit_kernel}"
+puts "#{'threads'.ljust(10)} #{'ms/frame'.rjust(10)} #{'speedup'.rjust(8)}"
+
+direct = measure(FRAMES) { compose.call } / FRAMES
+puts "#{'direct'.ljust(10)} #{((direct * 100_000).to_i / 100.0).to_s.rjust(10)}"
+
+[1, 2, 4, 8].each do |threads|
+  SDL::Video.use_compositor(threads)
+  elapsed = measure(FRAMES) { compose.call } / FRAMES
+  SDL::Video.use_compositor(nil)
+  speedup = ((direct / elapsed) * 100).to_i / 100.0
+  puts "#{threads.to_s.ljust(10)} #{((elapsed * 100_000).to_i / 100.0).to_s.rjust(10)} #{speedup.to_s.rjust(8)}"
+end
+
+SDL.quit
@@ -0,0 +1,179 @@
+# Headless benchmark suite
+#
+# Times the main SDL::Video paths across 8, 16, 24 and 32bpp surfaces of a
+# few sizes and prints the results as JSON. Run it with an mruby built with
+# this gem and mruby-time, on the dummy drivers so no window or sound device
+# is opened:
+#
+#   SDL_VIDEODRIVER=dummy SDL_AUDIODRIVER=dummy \
+#     bin/mruby path/to/mruby-sdl/bench/suite.rb > current.json
+#
+# BMP round trips go through /tmp/mruby-sdl-bench.bmp, or the path given as
+# the first argument. Each case repeats, doubling its iteration count, until
+# it has run for at least MIN_SECONDS, so fast and slow cases are measured
+# equally well.
+#
+# To gate a release, compare against a saved run with CRuby:
+#
+#   ruby bench/compare.rb baseline.json current.json
+
+MIN_SECONDS = 0.2
+MAX_ITERATIONS = 1 << 22
+DEPTHS = [8, 16, 24, 32]
+SIZES = [[64, 64], [256, 256], [640, 480]]
+SCREEN_W = 640
+SCREEN_H = 480
+
+MASKS = {
+  8 => [0, 0, 0, 0],
+  16 => [0xf800, 0x07e0, 0x001f, 0],
+  24 => [0xff0000, 0x00ff00, 0x0000ff, 0],
+  32 => [0x00ff0000, 0x0000ff00, 0x000000ff, 0],
+}
+
+BMP_PATH = ARGV[0] || "/tmp/mruby-sdl-bench.bmp"
+
+def measure(iterations)
+  start = Time.now
+  i = 0
+  while i < iterations
+    yield
+    i += 1
+  end
+  Time.now - start
+end
+
+def create_surface(depth, w, h)
+  r, g, b, a = MASKS[depth]
+  SDL::Video.create_rgb_surface(0, w, h, depth, r, g, b, a)
+end
+
+def number(value)
+  value = (value * 1000).to_i / 1000.0
+  value.to_s
+end
+
+$results = []
+
+# pixels is how many pixels one iteration touches, or 0 if that means nothing
+def bench(name, depth, w, h, pixels, &body)
+  iterations = 1
+  elapsed = 0
+  while true
+    elapsed = measure(iterations, &body)
+    break if elapsed >= MIN_SECONDS || iterations >= MAX_ITERATIONS
+    iterations *= 2
+  end
+  elapsed = 0.000001 if elapsed <= 0
+
+  ops = iterations / elapsed
+  fields = [
+    "\"name\": \"#{name}\"",
+    "\"depth\": #{depth}",
+    "\"width\": #{w}",
+    "\"height\": #{h}",
+    "\"iterations\": #{iterations}",
+    "\"seconds\": #{number(elapsed)}",
+    "\"ops_per_sec\": #{number(ops)}",
+    "\"mpixels_per_sec\": #{number(ops * pixels / 1_000_000.0)}",
+  ]
+  $results << "    {#{fields.join(', ')}}"
+end
+
+SDL.init(0x20) # SDL_INIT_VIDEO
+SDL::Video.cache_conversions(nil)
+
+# Mode switches first, since each one replaces the screen
+DEPTHS.each do |depth|
+  bench("set_mode", depth, SCREEN_W, SCREEN_H, 0) { SDL::Video.set_mode(SCREEN_W, SCREEN_H, depth, 0) }
+end
+
+screen = SDL::Video.set_mode(SCREEN_W, SCREEN_H, 32, 0)
+screen_format = SDL::Video.pixel_format(screen)
+
+SIZES.each do |w, h|
+  area = w * h
+  rects = SDL::RectArray.new(16)
+  16.times { |i| rects.push((i % 4) * (SCREEN_W / 4), (i / 4) * (SCREEN_H / 4), w / 4, h / 4) }
+  bench("update_rects", 32, w, h, area) { SDL::Video.update_rects(screen, rects) }
+
+  DEPTHS.each do |depth|
+    src = create_surface(depth, w, h)
+    dest = create_surface(depth, w, h)
+    full = SDL::Rect.new(0, 0, w, h)
+    origin = SDL::Rect.new(0, 0, 0, 0)
+    SDL::Video.fill_rect(src, nil, 0x00808080)
+
+    bench("create_rgb_surface", depth, w, h, area) { SDL::Video.free_surface(create_surface(depth, w, h)) }
+    bench("fill_rect", depth, w, h, area) { SDL::Video.fill_rect(dest, full, 0x00406080) }
+    bench("blit_surface", depth, w, h, area) do
+      origin.x = 0
+      origin.y = 0
+      SDL::Video.blit_surface(src, full, dest, origin)
+    end
+    bench("blit_surface_to_screen", depth, w, h, area) do
+      origin.x = 0
+      origin.y = 0
+      SDL::Video.blit_surface(src, full, screen, origin)
+    end
+    bench("convert_surface", depth, w, h, area) do
+      SDL::Video.free_surface(SDL::Video.convert_surface(src, screen_format, 0))
+    end
+    bench("display_format", depth, w, h, area) { SDL::Video.free_surface(SDL::Video.display_format(src)) }
+    bench("save_bmp", depth, w, h, area) { SDL::Video.save_bmp(src, BMP_PATH) }
+    bench("load_bmp", depth, w, h, area) { SDL::Video.free_surface(SDL::Video.load_bmp(BMP_PATH)) }
+
+    format = SDL::Video.pixel_format(src)
+    rgba = "\x80\x40\x20\xff" * area
+    pixels = SDL::Video.map_rgba_buffer(format, rgba)
+    bench("map_rgba_buffer", depth, w, h, area) { SDL::Video.map_rgba_buffer(format, rgba) }
+    bench("rgba_buffer", depth, w, h, area) { SDL::Video.rgba_buffer(format, pixels) }
+
+    SDL::Video.free_surface(src)
+    SDL::Video.free_surface(dest)
+  end
+end
+
+# Software gamma around a full-screen flip
+SDL::Video.use_software_gamma(true)
+SDL::Video.set_gamma(1.8, 1.8, 1.8)
+bench("flip_software_gamma", 32, SCREEN_W, SCREEN_H, SCREEN_W * SCREEN_H) { SDL::Video.flip(screen) }
+SDL::Video.use_software_gamma(false)
+
+# Palette cycling: rotate, upload and expand an 8bpp surface every frame
+SIZES.each do |w, h|
+  src = create_surface(8, w, h)
+  palette = SDL::Palette.new(256)
+  256.times { |i| palette.set(i, i, 255 - i, (i * 4) & 0xff) }
+  bench("palette_cycle", 8, w, h, w * h) do
+    palette.rotate(16, 224)
+    SDL::Video.set_colors(src, palette)
+    SDL::Video.blit_surface(src, nil, screen, nil)
+  end
+  SDL::Video.free_surface(src)
+end
+
+# YV12 and YUY2 overlays, filled from a 32bpp surface
+SIZES.each do |w, h|
+  src = create_surface(32, w, h)
+  SDL::Video.fill_rect(src, nil, 0x00808080)
+  [["yv12", 0x32315659], ["yuy2", 0x32595559]].each do |name, format|
+    overlay = SDL::Video.create_yuv_overlay(w, h, format, screen)
+    bench("convert_to_yuv_#{name}", 32, w, h, w * h) { SDL::Video.convert_to_yuv(src, overlay) }
+    SDL::Video.free_yuv_overlay(overlay)
+  end
+  SDL::Video.free_surface(src)
+end
+
+puts "{"
+puts "  \"suite\": \"mruby-sdl\","
+puts "  \"driver\": \"#{SDL::Video.driver_name}\","
+puts "  \"blit_kernel\": \"#{SDL::Video.blit_kernel}\","
+puts "  \"yuv_kernel\": \"#{SDL::Video.yuv_kernel}\","
+puts "  \"format_kernel\": \"#{SDL::Video.format_kernel}\","
+puts "  \"results\": ["
+puts $results.join(",\n")
+puts "  ]"
+puts "}"
+
+SDL.quit
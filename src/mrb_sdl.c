@@ -6,6 +6,8 @@
  * API Reference: http://www.libsdl.org/cgi/docwiki.fcg/SDL_API
  */
 #define _GNU_SOURCE
+#include <limits.h>
+#include <stdint.h>
 #include <SDL/SDL.h>
 #include <mruby.h>
 #include <mruby/proc.h>
@@ -15,6 +17,22 @@
 #include <mruby/hash.h>
 #include <mruby/class.h>
 #include <mruby/variable.h>
+#include <mruby/error.h>
+#include "mrb_sdl_damage.h"
+#include "mrb_sdl_blit.h"
+#include "mrb_sdl_compositor.h"
+#include "mrb_sdl_convert_cache.h"
+#include "mrb_sdl_pack.h"
+#include "mrb_sdl_atlas.h"
+#include "mrb_sdl_events.h"
+#include "mrb_sdl_audio.h"
+#include "mrb_sdl_stream.h"
+#include "mrb_sdl_clock.h"
+#include "mrb_sdl_stats.h"
+#include "mrb_sdl_pool.h"
+#include "mrb_sdl_yuv.h"
+#include "mrb_sdl_gamma.h"
+#include "mrb_sdl_format.h"
 
 /*******************************************************************************
  * Expose SDL struct types through a context union
@@ -23,18 +41,19 @@ typedef struct {
   union {
     SDL_Surface* surface;
     const SDL_VideoInfo* video_info;
-    SDL_Rect* rect;
     SDL_Rect** modes;
-    SDL_Color* color;
     SDL_PixelFormat* pixel_format;
     SDL_GLattr* gl_attr;
     SDL_Overlay* overlay;
-    SDL_Palette* palette;
   } any;
   mrb_value instance;
   mrb_state* mrb;
+  // Set for surfaces the gem made, which the wrapper frees when collected
+  int owned;
 } mrb_sdl_context;
 
+static void sdl_surface_free(mrb_state* mrb, SDL_Surface* surface);
+
 static mrb_sdl_context* sdl_context_alloc (mrb_state* mrb) {
   mrb_sdl_context* context = (mrb_sdl_context*) malloc(sizeof(mrb_sdl_context));
   if ( ! context) return NULL;
@@ -46,6 +65,7 @@ static mrb_sdl_context* sdl_context_alloc (mrb_state* mrb) {
 static void sdl_context_free (mrb_state *mrb, void *p) {
   mrb_sdl_context* context = (mrb_sdl_context*) p;
   if (context) {
+    if (context->owned && context->any.surface) sdl_surface_free(mrb, context->any.surface);
     context->instance = mrb_nil_value();
     context->mrb = NULL;
   }
@@ -57,61 +77,545 @@ static const struct mrb_data_type sdl_context_type = {
 };
 
 
+/*******************************************************************************
+ * Argument decoding
+ *
+ * Bindings decode all of their arguments with a single mrb_get_args call and
+ * then unwrap them with these helpers. Fixnums and wrapped structs take the
+ * direct path; anything else falls back to the slower generic lookup.
+ ******************************************************************************/
+static mrb_sdl_context* sdl_context_get (mrb_state *mrb, mrb_value value) {
+  if (mrb_type(value) == MRB_TT_DATA && DATA_TYPE(value) == &sdl_context_type) {
+    return (mrb_sdl_context*) DATA_PTR(value);
+  }
+  return NULL;
+}
+
+// Flags, masks and pixel values use the full 32 bits, which may not fit in a
+// Fixnum, so accept Floats as well.
+static inline Uint32 sdl_arg_uint32 (mrb_state *mrb, mrb_value value) {
+  if (mrb_fixnum_p(value)) return (Uint32) mrb_fixnum(value);
+  if (mrb_float_p(value)) return (Uint32) (int64_t) mrb_float(value);
+  mrb_raise(mrb, E_TYPE_ERROR, "expected Integer");
+  return 0;
+}
+
+
 /*******************************************************************************
  * Use macros to construct to/from mrb value converters
  ******************************************************************************/
+// Each struct type gets its own class, set up at gem init, and the wrapper
+// is returned as is rather than parked in an ivar on the receiver
 #define SDL_TO_MRB(type, key)\
+  static struct RClass* sdl_##key##_class;\
   static mrb_value sdl_##key##_to_mrb_value (mrb_state *mrb, mrb_value self, type* key) {\
     mrb_sdl_context* context = sdl_context_alloc(mrb);\
     if ( ! context) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");\
     context->any.key = key;\
-    context->instance = self;\
-    mrb_iv_set(mrb, self, mrb_intern(mrb, "context"), mrb_obj_value(\
-      Data_Wrap_Struct(mrb, mrb->object_class,\
-      &sdl_context_type, (void*) context)));\
-    return self;\
+    mrb_value wrapped = mrb_obj_value(Data_Wrap_Struct(mrb, sdl_##key##_class,\
+      &sdl_context_type, (void*) context));\
+    context->instance = wrapped;\
+    return wrapped;\
   }
 #define MRB_TO_SDL(type, key)\
   type* mrb_value_to_sdl_##key (mrb_state *mrb, mrb_value self) {\
-    mrb_sdl_context* context = NULL;\
-    mrb_value value_context = mrb_iv_get(mrb, self, mrb_intern(mrb, "context"));\
-    Data_Get_Struct(mrb, value_context, &sdl_context_type, context);\
+    mrb_sdl_context* context = sdl_context_get(mrb, self);\
     if ( ! context) {\
       mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");\
     }\
     return context->any.key;\
   }
+#define MRB_TO_SDL_OPT(type, key)\
+  type* mrb_value_to_sdl_##key##_opt (mrb_state *mrb, mrb_value self) {\
+    if (mrb_nil_p(self)) return NULL;\
+    return mrb_value_to_sdl_##key(mrb, self);\
+  }
 
 
-SDL_TO_MRB(SDL_Surface, surface);
-MRB_TO_SDL(SDL_Surface, surface);
+// Like MRB_TO_SDL, but a freed or released surface raises rather than
+// reaching SDL as NULL
+SDL_Surface* mrb_value_to_sdl_surface (mrb_state *mrb, mrb_value self) {
+  mrb_sdl_context* context = sdl_context_get(mrb, self);
+  if ( ! context) mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");
+  if ( ! context->any.surface) mrb_raise(mrb, E_ARGUMENT_ERROR, "surface has been freed");
+  return context->any.surface;
+}
 
 SDL_TO_MRB(const SDL_VideoInfo, video_info);
 MRB_TO_SDL(const SDL_VideoInfo, video_info);
 
-SDL_TO_MRB(SDL_Rect, rect);
-MRB_TO_SDL(SDL_Rect, rect);
-
 SDL_TO_MRB(SDL_Rect*, modes);
 MRB_TO_SDL(SDL_Rect*, modes);
 
-SDL_TO_MRB(SDL_Color, color);
-MRB_TO_SDL(SDL_Color, color);
-
 SDL_TO_MRB(SDL_PixelFormat, pixel_format);
 MRB_TO_SDL(SDL_PixelFormat, pixel_format);
+MRB_TO_SDL_OPT(SDL_PixelFormat, pixel_format);
 
-SDL_TO_MRB(SDL_GLattr, gl_attr);
 MRB_TO_SDL(SDL_GLattr, gl_attr);
 
+// Like surfaces, a freed overlay raises rather than reaching SDL
 SDL_TO_MRB(SDL_Overlay, overlay);
-MRB_TO_SDL(SDL_Overlay, overlay);
+SDL_Overlay* mrb_value_to_sdl_overlay (mrb_state *mrb, mrb_value self) {
+  mrb_sdl_context* context = sdl_context_get(mrb, self);
+  if ( ! context) mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");
+  if ( ! context->any.overlay) mrb_raise(mrb, E_ARGUMENT_ERROR, "overlay has been freed");
+  return context->any.overlay;
+}
+
+
+
+/*******************************************************************************
+ * Small structs stored directly in RData
+ *
+ * Rect, Color and Palette objects own their SDL struct through DATA_PTR, so
+ * unwrapping one is a type check and a pointer load. Rects and colors are
+ * created by the thousand each frame, so their storage comes from a free list
+ * that grows in blocks and is never handed back to malloc.
+ ******************************************************************************/
+typedef union sdl_struct_node {
+  union sdl_struct_node* next;
+  SDL_Rect rect;
+  SDL_Color color;
+} sdl_struct_node;
+
+#define SDL_STRUCT_POOL_BLOCK 256
+
+static sdl_struct_node* sdl_struct_free_list = NULL;
+
+static void* sdl_struct_alloc (void) {
+  if ( ! sdl_struct_free_list) {
+    sdl_struct_node* block = (sdl_struct_node*) malloc(sizeof(sdl_struct_node) * SDL_STRUCT_POOL_BLOCK);
+    if ( ! block) return NULL;
+    int i;
+    for (i = 0; i < SDL_STRUCT_POOL_BLOCK - 1; i++) {
+      block[i].next = &block[i + 1];
+    }
+    block[SDL_STRUCT_POOL_BLOCK - 1].next = NULL;
+    sdl_struct_free_list = block;
+  }
+  sdl_struct_node* node = sdl_struct_free_list;
+  sdl_struct_free_list = node->next;
+  memset(node, 0, sizeof(sdl_struct_node));
+  return node;
+}
+
+static void sdl_struct_free (mrb_state *mrb, void *p) {
+  sdl_struct_node* node = (sdl_struct_node*) p;
+  if ( ! node) return;
+  node->next = sdl_struct_free_list;
+  sdl_struct_free_list = node;
+}
+
+// Palettes keep their colors in the same allocation, right after the header.
+typedef struct {
+  SDL_Palette palette;
+  SDL_Color colors[1];
+} mrb_sdl_palette;
+
+static void sdl_palette_free (mrb_state *mrb, void *p) {
+  free(p);
+}
+
+static const struct mrb_data_type sdl_rect_type = {
+  "SDL::Rect", sdl_struct_free,
+};
+static const struct mrb_data_type sdl_color_type = {
+  "SDL::Color", sdl_struct_free,
+};
+static const struct mrb_data_type sdl_palette_type = {
+  "SDL::Palette", sdl_palette_free,
+};
+
+#define MRB_TO_SDL_DATA(type, key)\
+  type* mrb_value_to_sdl_##key (mrb_state *mrb, mrb_value self) {\
+    if (mrb_type(self) == MRB_TT_DATA && DATA_TYPE(self) == &sdl_##key##_type && DATA_PTR(self)) {\
+      return (type*) DATA_PTR(self);\
+    }\
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");\
+    return NULL;\
+  }
+
+MRB_TO_SDL_DATA(SDL_Rect, rect);
+MRB_TO_SDL_OPT(SDL_Rect, rect);
+
+MRB_TO_SDL_DATA(SDL_Color, color);
+static struct RClass* sdl_color_class = NULL;
+
+MRB_TO_SDL_DATA(SDL_Palette, palette);
+
+// RectArray keeps a growable, contiguous SDL_Rect[] that can be handed to SDL
+// as-is. Pushing only allocates when the array has to grow.
+typedef struct {
+  SDL_Rect* rects;
+  int length;
+  int capacity;
+} mrb_sdl_rect_array;
+
+static void sdl_rect_array_free (mrb_state *mrb, void *p) {
+  mrb_sdl_rect_array* array = (mrb_sdl_rect_array*) p;
+  if ( ! array) return;
+  free(array->rects);
+  free(array);
+}
+
+static const struct mrb_data_type sdl_rect_array_type = {
+  "SDL::RectArray", sdl_rect_array_free,
+};
+
+MRB_TO_SDL_DATA(mrb_sdl_rect_array, rect_array);
+
+static inline int sdl_data_p (mrb_value value, const struct mrb_data_type* type) {
+  return mrb_type(value) == MRB_TT_DATA && DATA_TYPE(value) == type && DATA_PTR(value);
+}
+
+// PixelBuffer is a view onto memory owned by a surface, only valid while the
+// surface is locked. Unlocking clears the pointer so stale views raise
+// instead of touching freed or moved pixels.
+typedef struct {
+  Uint8* pixels;
+  int length;
+  int pitch;
+  int width;
+  int height;
+  int bytes_per_pixel;
+} mrb_sdl_pixel_buffer;
+
+static void sdl_pixel_buffer_free (mrb_state *mrb, void *p) {
+  free(p);
+}
+
+static const struct mrb_data_type sdl_pixel_buffer_type = {
+  "SDL::PixelBuffer", sdl_pixel_buffer_free,
+};
+
+static struct RClass* sdl_pixel_buffer_class = NULL;
+
+static mrb_sdl_pixel_buffer* mrb_value_to_sdl_pixel_buffer (mrb_state *mrb, mrb_value self) {
+  if ( ! sdl_data_p(self, &sdl_pixel_buffer_type)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");
+  }
+  mrb_sdl_pixel_buffer* buffer = (mrb_sdl_pixel_buffer*) DATA_PTR(self);
+  if ( ! buffer->pixels) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "pixel buffer used outside of its lock block");
+  }
+  return buffer;
+}
+
+// The block forms of the lock functions run through mrb_ensure, so the views
+// they yield are invalidated and the lock released even if the block raises.
+// The ensure data is [block, yielded value, views, locked object, kind]; the
+// views are a private Array, as the block may change what it was given.
+typedef enum {
+  SDL_LOCK_SURFACE = 0,
+  SDL_LOCK_OVERLAY
+} sdl_lock_kind;
+
+static mrb_value sdl_lock_body (mrb_state *mrb, mrb_value data) {
+  return mrb_yield(mrb, RARRAY_PTR(data)[0], RARRAY_PTR(data)[1]);
+}
+static mrb_value sdl_lock_ensure (mrb_state *mrb, mrb_value data) {
+  mrb_value views = RARRAY_PTR(data)[2];
+  int i;
+  for (i = 0; i < RARRAY_LEN(views); i++) {
+    mrb_value view = RARRAY_PTR(views)[i];
+    if (sdl_data_p(view, &sdl_pixel_buffer_type)) ((mrb_sdl_pixel_buffer*) DATA_PTR(view))->pixels = NULL;
+  }
+
+  // A surface or overlay freed inside the block has nothing left to unlock
+  mrb_sdl_context* context = sdl_context_get(mrb, RARRAY_PTR(data)[3]);
+  if ( ! context || ! context->any.surface) return mrb_nil_value();
+  if (mrb_fixnum(RARRAY_PTR(data)[4]) == SDL_LOCK_OVERLAY) {
+    SDL_UnlockYUVOverlay(context->any.overlay);
+  } else {
+    SDL_UnlockSurface(context->any.surface);
+  }
+  return mrb_nil_value();
+}
+static mrb_value sdl_lock_yield (mrb_state *mrb, mrb_value block, mrb_value yielded, mrb_value views,
+    mrb_value locked, sdl_lock_kind kind) {
+  mrb_value data = mrb_ary_new_capa(mrb, 5);
+  mrb_ary_push(mrb, data, block);
+  mrb_ary_push(mrb, data, yielded);
+  mrb_ary_push(mrb, data, views);
+  mrb_ary_push(mrb, data, locked);
+  mrb_ary_push(mrb, data, mrb_fixnum_value(kind));
+  return mrb_ensure(mrb, sdl_lock_body, data, sdl_lock_ensure, data);
+}
+
+// AtlasRegion names a rect on an SDL::Atlas page. The Ruby object keeps its
+// atlas alive, so the page surface outlives the handle.
+typedef struct {
+  SDL_Surface* page;
+  SDL_Rect rect;
+  int page_index;
+} mrb_sdl_atlas_region;
+
+static void sdl_atlas_region_free (mrb_state *mrb, void *p) {
+  free(p);
+}
+
+static const struct mrb_data_type sdl_atlas_region_type = {
+  "SDL::AtlasRegion", sdl_atlas_region_free,
+};
+
+static struct RClass* sdl_atlas_region_class = NULL;
+
+static mrb_sdl_atlas_region* mrb_value_to_sdl_atlas_region (mrb_state *mrb, mrb_value self) {
+  if ( ! sdl_data_p(self, &sdl_atlas_region_type)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");
+  }
+  return (mrb_sdl_atlas_region*) DATA_PTR(self);
+}
+
+// Blits accept a region wherever they take a source surface. Any source rect
+// is then relative to the region and clipped to it, the way SDL clips to a
+// surface, with dest shifted when the rect hangs off the top or left.
+static SDL_Surface* sdl_blit_source (mrb_state *mrb, mrb_value value, const SDL_Rect** region) {
+  if (sdl_data_p(value, &sdl_atlas_region_type)) {
+    mrb_sdl_atlas_region* atlas_region = (mrb_sdl_atlas_region*) DATA_PTR(value);
+    *region = &atlas_region->rect;
+    return atlas_region->page;
+  }
+  *region = NULL;
+  return mrb_value_to_sdl_surface(mrb, value);
+}
+
+static void sdl_region_rect (const SDL_Rect* region, const SDL_Rect* src, SDL_Rect* out, SDL_Rect* dest) {
+  if ( ! src) {
+    *out = *region;
+    return;
+  }
+
+  int x = src->x;
+  int y = src->y;
+  int w = src->w;
+  int h = src->h;
+  if (x < 0) {
+    w += x;
+    dest->x -= x;
+    x = 0;
+  }
+  if (y < 0) {
+    h += y;
+    dest->y -= y;
+    y = 0;
+  }
+  if (w > region->w - x) w = region->w - x;
+  if (h > region->h - y) h = region->h - y;
+
+  out->x = region->x + x;
+  out->y = region->y + y;
+  out->w = w > 0 ? w : 0;
+  out->h = h > 0 ? h : 0;
+}
+
+
+/*******************************************************************************
+ * GC table
+ *
+ * Ruby objects that native code holds on to (such as Strings lent to SDL as
+ * pixel memory) are kept in SDL::$GC so the collector can see them.
+ ******************************************************************************/
+static mrb_value sdl_gc_table;
+
+static void sdl_gc_protect (mrb_state *mrb, mrb_value value) {
+  mrb_ary_push(mrb, sdl_gc_table, value);
+}
+
+static void sdl_gc_release (mrb_state *mrb, mrb_value value) {
+  int i;
+  // Surfaces collected after gem_final have nothing left to release
+  if (mrb_nil_p(sdl_gc_table)) return;
+  int last = RARRAY_LEN(sdl_gc_table) - 1;
+  for (i = last; i >= 0; i--) {
+    if (mrb_ptr(RARRAY_PTR(sdl_gc_table)[i]) == mrb_ptr(value)) {
+      RARRAY_PTR(sdl_gc_table)[i] = RARRAY_PTR(sdl_gc_table)[last];
+      mrb_ary_pop(mrb, sdl_gc_table);
+      return;
+    }
+  }
+}
+
+// Surfaces and music made from an SDL::Pack borrow its mapping. The lender
+// stays pinned until the borrower hands it back.
+typedef struct {
+  const void* borrower;
+  mrb_value pixels;
+} sdl_borrowed_pixels;
+
+static sdl_borrowed_pixels* sdl_borrowed = NULL;
+static int sdl_borrowed_count = 0;
+static int sdl_borrowed_capa = 0;
+
+static int sdl_borrow (mrb_state *mrb, const void* borrower, mrb_value pixels) {
+  if (sdl_borrowed_count == sdl_borrowed_capa) {
+    int capa = sdl_borrowed_capa ? sdl_borrowed_capa * 2 : 16;
+    sdl_borrowed_pixels* borrowed = (sdl_borrowed_pixels*) realloc(sdl_borrowed, sizeof(sdl_borrowed_pixels) * capa);
+    if ( ! borrowed) return -1;
+    sdl_borrowed = borrowed;
+    sdl_borrowed_capa = capa;
+  }
+  sdl_borrowed[sdl_borrowed_count].borrower = borrower;
+  sdl_borrowed[sdl_borrowed_count].pixels = pixels;
+  sdl_borrowed_count++;
+  sdl_gc_protect(mrb, pixels);
+  return 0;
+}
+
+static void sdl_borrow_pixels (mrb_state *mrb, SDL_Surface* surface, mrb_value pixels) {
+  if (sdl_borrow(mrb, surface, pixels) < 0) {
+    SDL_FreeSurface(surface);
+    mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  }
+}
+
+static int sdl_borrowed_from (mrb_value pixels) {
+  int count = 0;
+  int i;
+  for (i = 0; i < sdl_borrowed_count; i++) {
+    if (mrb_ptr(sdl_borrowed[i].pixels) == mrb_ptr(pixels)) count++;
+  }
+  return count;
+}
+
+static void sdl_return_pixels (mrb_state *mrb, const void* borrower) {
+  int i;
+  for (i = 0; i < sdl_borrowed_count; i++) {
+    if (sdl_borrowed[i].borrower == borrower) {
+      sdl_gc_release(mrb, sdl_borrowed[i].pixels);
+      sdl_borrowed[i] = sdl_borrowed[--sdl_borrowed_count];
+      return;
+    }
+  }
+}
+
+
+/*******************************************************************************
+ * Surface wrappers
+ *
+ * Surfaces reach Ruby as SDL::Surface objects. A surface the gem made is
+ * owned by its wrapper and freed along with it. The screen and atlas pages
+ * are handed out over and over, so each gets a single wrapper, found through
+ * an identity map and pinned in the GC table until the surface goes away.
+ * Asking for the screen every frame then allocates nothing.
+ ******************************************************************************/
+static struct RClass* sdl_surface_class;
+
+typedef struct {
+  SDL_Surface* surface;
+  struct RData* wrapper;
+} sdl_surface_entry;
+
+static sdl_surface_entry* sdl_surface_map = NULL;
+static int sdl_surface_map_count = 0;
+static int sdl_surface_map_capa = 0;
+
+static mrb_value sdl_surface_wrap (mrb_state *mrb, SDL_Surface* surface, int owned) {
+  mrb_sdl_context* context = sdl_context_alloc(mrb);
+  if ( ! context) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  context->any.surface = surface;
+  context->owned = owned;
+  mrb_value wrapped = mrb_obj_value(Data_Wrap_Struct(mrb, sdl_surface_class, &sdl_context_type, context));
+  context->instance = wrapped;
+  return wrapped;
+}
+
+// For surfaces the caller now owns: the wrapper frees them when collected
+static mrb_value sdl_owned_surface_to_mrb_value (mrb_state *mrb, mrb_value self, SDL_Surface* surface) {
+  if ( ! surface) return mrb_nil_value();
+  return sdl_surface_wrap(mrb, surface, 1);
+}
+
+// For surfaces that belong to SDL or an atlas: the same wrapper every time
+static mrb_value sdl_surface_to_mrb_value (mrb_state *mrb, mrb_value self, SDL_Surface* surface) {
+  int i;
+  if ( ! surface) return mrb_nil_value();
+  for (i = 0; i < sdl_surface_map_count; i++) {
+    if (sdl_surface_map[i].surface == surface) return mrb_obj_value(sdl_surface_map[i].wrapper);
+  }
+
+  if (sdl_surface_map_count == sdl_surface_map_capa) {
+    int capa = sdl_surface_map_capa ? sdl_surface_map_capa * 2 : 16;
+    sdl_surface_entry* map = (sdl_surface_entry*) realloc(sdl_surface_map, sizeof(sdl_surface_entry) * capa);
+    if ( ! map) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+    sdl_surface_map = map;
+    sdl_surface_map_capa = capa;
+  }
+  mrb_value wrapped = sdl_surface_wrap(mrb, surface, 0);
+  sdl_gc_protect(mrb, wrapped);
+  sdl_surface_map[sdl_surface_map_count].surface = surface;
+  sdl_surface_map[sdl_surface_map_count].wrapper = (struct RData*) mrb_ptr(wrapped);
+  sdl_surface_map_count++;
+  return wrapped;
+}
+
+// The surface is about to go away: unpin its wrapper, which raises if it
+// is used after this
+static void sdl_surface_unmap (mrb_state *mrb, SDL_Surface* surface) {
+  int i;
+  if ( ! surface) return;
+  for (i = 0; i < sdl_surface_map_count; i++) {
+    if (sdl_surface_map[i].surface == surface) {
+      mrb_value wrapped = mrb_obj_value(sdl_surface_map[i].wrapper);
+      ((mrb_sdl_context*) DATA_PTR(wrapped))->any.surface = NULL;
+      sdl_gc_release(mrb, wrapped);
+      sdl_surface_map[i] = sdl_surface_map[--sdl_surface_map_count];
+      return;
+    }
+  }
+}
+
+
+/*******************************************************************************
+ * Conversion cache
+ ******************************************************************************/
+// Results of convert_surface and display_format(_alpha). Anything that
+// writes to a surface through the bindings drops its cached conversions.
+static sdl_convert_cache sdl_video_conversions;
+
+
+/*******************************************************************************
+ * Compositor
+ ******************************************************************************/
+// When enabled, blits and fills the kernels can handle are queued
+// and run across the worker pool on composite, or before anything that reads
+// or shows the pixels they touch.
+static sdl_compositor* sdl_video_compositor = NULL;
+
+static inline void sdl_video_sync (void) {
+  if (sdl_video_compositor) sdl_compositor_flush(sdl_video_compositor);
+}
+static inline int sdl_video_blit (SDL_Surface* src, SDL_Rect* srcrect, SDL_Surface* dst, SDL_Rect* dstrect) {
+  sdl_convert_cache_forget(&sdl_video_conversions, dst);
+  if (sdl_video_compositor) return sdl_compositor_blit(sdl_video_compositor, src, srcrect, dst, dstrect);
+  return sdl_blit_surface(src, srcrect, dst, dstrect);
+}
+static inline int sdl_video_fill (SDL_Surface* dst, SDL_Rect* dstrect, Uint32 color) {
+  sdl_convert_cache_forget(&sdl_video_conversions, dst);
+  if (sdl_video_compositor) return sdl_compositor_fill(sdl_video_compositor, dst, dstrect, color);
+  return sdl_fill_rect(dst, dstrect, color);
+}
 
-SDL_TO_MRB(SDL_Palette, palette);
-MRB_TO_SDL(SDL_Palette, palette);
 
+/*******************************************************************************
+ * Surface lifetime
+ ******************************************************************************/
+static void sdl_surface_free (mrb_state* mrb, SDL_Surface* surface) {
+  sdl_video_sync();
+  sdl_convert_cache_release(&sdl_video_conversions, surface);
+  // Once video is shut down SDL can't free hardware surfaces, and their
+  // memory went with the device
+  if ( ! (surface->flags & SDL_HWSURFACE) || SDL_WasInit(SDL_INIT_VIDEO)) SDL_FreeSurface(surface);
+  sdl_return_pixels(mrb, surface);
+}
 
 
+/*******************************************************************************
+ * Audio output
+ ******************************************************************************/
+// There is one SDL audio device, so one ring. Quitting the audio subsystem
+// closes the device behind our back, so quit closes it first.
+static sdl_audio_device sdl_audio_output;
 
 
 /*******************************************************************************
@@ -125,33 +629,43 @@ MRB_TO_SDL(SDL_Palette, palette);
  ******************************************************************************/
 // Init
 static mrb_value mrb_sdl_init (mrb_state *mrb, mrb_value self) {
-  mrb_int flags = SDL_INIT_EVERYTHING;
-  mrb_get_args(mrb, "|i", &flags);
-  return mrb_fixnum_value(SDL_Init(flags));
+  mrb_value arg_flags = mrb_fixnum_value(SDL_INIT_EVERYTHING);
+  mrb_get_args(mrb, "|o", &arg_flags);
+  return mrb_fixnum_value(SDL_Init(sdl_arg_uint32(mrb, arg_flags)));
 }
 static mrb_value mrb_sdl_init_sub_system (mrb_state *mrb, mrb_value self) {
-  mrb_int flags;
-  mrb_get_args(mrb, "|i", &flags);
-  return mrb_fixnum_value(SDL_InitSubSystem(flags));
+  mrb_value arg_flags;
+  mrb_get_args(mrb, "o", &arg_flags);
+  return mrb_fixnum_value(SDL_InitSubSystem(sdl_arg_uint32(mrb, arg_flags)));
 }
 
 // Quit
 static mrb_value mrb_sdl_quit (mrb_state *mrb, mrb_value self) {
+  sdl_video_sync();
+  if (SDL_GetVideoSurface()) sdl_surface_unmap(mrb, SDL_GetVideoSurface());
+  sdl_convert_cache_clear(&sdl_video_conversions);
+  sdl_audio_close(&sdl_audio_output);
   SDL_Quit();
   return mrb_nil_value();
 }
 static mrb_value mrb_sdl_quit_sub_system (mrb_state *mrb, mrb_value self) {
-  mrb_int flags;
-  mrb_get_args(mrb, "|i", &flags);
+  mrb_value arg_flags;
+  mrb_get_args(mrb, "o", &arg_flags);
+  Uint32 flags = sdl_arg_uint32(mrb, arg_flags);
+  if (flags & SDL_INIT_AUDIO) sdl_audio_close(&sdl_audio_output);
+  if (flags & SDL_INIT_VIDEO) {
+    sdl_video_sync();
+    if (SDL_GetVideoSurface()) sdl_surface_unmap(mrb, SDL_GetVideoSurface());
+  }
   SDL_QuitSubSystem(flags);
   return mrb_nil_value();
 }
 
 // Checking
 static mrb_value mrb_sdl_was_init (mrb_state *mrb, mrb_value self) {
-  mrb_int flags;
-  mrb_get_args(mrb, "|i", &flags);
-  return mrb_fixnum_value(SDL_WasInit(flags));
+  mrb_value arg_flags;
+  mrb_get_args(mrb, "o", &arg_flags);
+  return mrb_fixnum_value(SDL_WasInit(sdl_arg_uint32(mrb, arg_flags)));
 }
 
 // Errors
@@ -160,7 +674,7 @@ static mrb_value mrb_sdl_get_error (mrb_state *mrb, mrb_value self) {
 }
 static mrb_value mrb_sdl_error (mrb_state *mrb, mrb_value self) {
   mrb_int code;
-  mrb_get_args(mrb, "|i", &code);
+  mrb_get_args(mrb, "i", &code);
   SDL_Error(code);
   return mrb_nil_value();
 }
@@ -172,46 +686,203 @@ static mrb_value mrb_sdl_clear_error (mrb_state *mrb, mrb_value self) {
 
 /*******************************************************************************
  * Video module
- *
- * TODO:
- *  - Figure out SDL_CreateRGBSurfaceFrom
  ******************************************************************************/
+// Damage tracking. When enabled, blits and fills onto the video surface
+// record their clipped destination rects, and present pushes just those.
+static sdl_damage sdl_video_damage;
+static int sdl_video_damage_enabled = 0;
+
+// Software gamma, used when the driver has no hardware ramp or when asked
+// for. It corrects the screen around every update and flip.
+static sdl_gamma sdl_video_gamma;
+static int sdl_video_gamma_forced = 0;
+
+static inline int sdl_video_gamma_apply (SDL_Surface* surface, const SDL_Rect* rects, int count) {
+  if ( ! sdl_video_gamma.enabled || surface != SDL_GetVideoSurface()) return 0;
+  return sdl_gamma_apply(&sdl_video_gamma, surface, rects, count);
+}
+static inline void sdl_video_gamma_restore (SDL_Surface* surface, const SDL_Rect* rects, int count) {
+  sdl_gamma_restore(&sdl_video_gamma, surface, rects, count);
+}
+// Switch to the software ramps, if the screen is one they can correct
+static int sdl_video_gamma_fallback (const Uint16* red, const Uint16* green, const Uint16* blue) {
+  SDL_Surface* screen = SDL_GetVideoSurface();
+  if ( ! screen || ! sdl_gamma_supported(screen)) {
+    SDL_SetError("Gamma correction isn't supported on this screen");
+    return -1;
+  }
+  sdl_gamma_set_ramps(&sdl_video_gamma, red, green, blue);
+  return 0;
+}
+
+static inline void sdl_video_note_damage (SDL_Surface* dest, const SDL_Rect* rect) {
+  if ( ! sdl_video_damage_enabled || dest != SDL_GetVideoSurface()) return;
+  sdl_damage_add(&sdl_video_damage, dest, rect);
+}
+
+static mrb_value mrb_sdl_video_track_damage (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_enabled;
+  mrb_int max_rects = 32;
+
+  mrb_get_args(mrb, "o|i", &arg_enabled, &max_rects);
+
+  if (mrb_test(arg_enabled)) {
+    int tile_size = sdl_video_damage_enabled ? sdl_video_damage.tile_size : 0;
+    sdl_damage_destroy(&sdl_video_damage);
+    sdl_damage_init(&sdl_video_damage, max_rects);
+    sdl_damage_set_tiles(&sdl_video_damage, tile_size);
+    sdl_video_damage_enabled = 1;
+  } else {
+    sdl_damage_destroy(&sdl_video_damage);
+    sdl_video_damage_enabled = 0;
+  }
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_video_track_damage_tiles (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_tile_size;
+  mrb_get_args(mrb, "o", &arg_tile_size);
+  if ( ! sdl_video_damage_enabled) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "damage tracking is not enabled");
+  }
+  sdl_damage_set_tiles(&sdl_video_damage, mrb_nil_p(arg_tile_size) ? 0 : (int) sdl_arg_uint32(mrb, arg_tile_size));
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_video_add_damage (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_rects;
+  mrb_get_args(mrb, "o", &arg_rects);
+
+  SDL_Surface* surface = SDL_GetVideoSurface();
+  if ( ! sdl_video_damage_enabled || ! surface) return mrb_nil_value();
+
+  if (sdl_data_p(arg_rects, &sdl_rect_array_type)) {
+    mrb_sdl_rect_array* array = mrb_value_to_sdl_rect_array(mrb, arg_rects);
+    int i;
+    for (i = 0; i < array->length; i++) {
+      sdl_damage_add(&sdl_video_damage, surface, &array->rects[i]);
+    }
+  } else if (mrb_nil_p(arg_rects)) {
+    sdl_damage_add_all(&sdl_video_damage, surface);
+  } else {
+    sdl_damage_add(&sdl_video_damage, surface, mrb_value_to_sdl_rect(mrb, arg_rects));
+  }
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_video_damage_count (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(sdl_video_damage_enabled ? sdl_video_damage.count : 0);
+}
+static mrb_value mrb_sdl_video_present (mrb_state *mrb, mrb_value self) {
+  SDL_Surface* surface = SDL_GetVideoSurface();
+  if ( ! surface) return mrb_fixnum_value(0);
+  sdl_video_sync();
+
+  // Without tracking there is nothing to narrow it down, so update it all
+  if ( ! sdl_video_damage_enabled) {
+    SDL_Rect all = { 0, 0, 0, 0 };
+    sdl_video_gamma_apply(surface, &all, 1);
+    SDL_UpdateRect(surface, 0, 0, 0, 0);
+    sdl_video_gamma_restore(surface, &all, 1);
+    return mrb_fixnum_value(1);
+  }
+
+  if (sdl_damage_diff_tiles(&sdl_video_damage, surface) < 0) {
+    sdl_damage_add_all(&sdl_video_damage, surface);
+  }
+  // Flushing empties the tracker but leaves its rects in place to restore
+  int count = sdl_video_damage.count;
+  sdl_video_gamma_apply(surface, sdl_video_damage.rects, count);
+  int result = sdl_damage_flush(&sdl_video_damage, surface);
+  sdl_video_gamma_restore(surface, sdl_video_damage.rects, count);
+  return mrb_fixnum_value(result);
+}
+
+// Blit kernels. blit_surface, blit_batch and fill_rect run a vectorised
+// kernel for plain 32bpp software surfaces, and SDL for everything else.
+static mrb_value mrb_sdl_video_blit_kernel (mrb_state *mrb, mrb_value self) {
+  return mrb_str_new_cstr(mrb, sdl_blit_kernel_name());
+}
+static mrb_value mrb_sdl_video_use_blit_kernels (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_enabled;
+  mrb_get_args(mrb, "o", &arg_enabled);
+  sdl_blit_set_enabled(mrb_test(arg_enabled));
+  return sdl_blit_enabled() ? mrb_true_value() : mrb_false_value();
+}
+
+static mrb_value mrb_sdl_video_use_compositor (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_threads;
+  mrb_int band_height = 64;
+
+  mrb_get_args(mrb, "o|i", &arg_threads, &band_height);
+
+  if (sdl_video_compositor) {
+    sdl_compositor_flush(sdl_video_compositor);
+    sdl_compositor_free(sdl_video_compositor);
+    sdl_video_compositor = NULL;
+  }
+  if (mrb_test(arg_threads)) {
+    sdl_video_compositor = sdl_compositor_new(sdl_arg_uint32(mrb, arg_threads), band_height);
+    if ( ! sdl_video_compositor) mrb_raise(mrb, E_RUNTIME_ERROR, "can't start compositor");
+  }
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_video_compositor_threads (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(sdl_video_compositor ? sdl_video_compositor->thread_count : 0);
+}
+static mrb_value mrb_sdl_video_composite (mrb_state *mrb, mrb_value self) {
+  Uint64 start = sdl_stat_begin();
+  int ops = sdl_video_compositor ? sdl_compositor_flush(sdl_video_compositor) : 0;
+  sdl_stat_end(SDL_STAT_COMPOSITE, start, 0, 0);
+  return mrb_fixnum_value(ops);
+}
+
 // Video surface
 static mrb_value mrb_sdl_get_video_surface (mrb_state *mrb, mrb_value self) {
   return sdl_surface_to_mrb_value(mrb, self, SDL_GetVideoSurface());
 }
 
-// Display info
+// Display info. SDL hands back the same info and mode list until the driver
+// changes, so the last wrapper of each is kept and handed out again.
+static struct RData* sdl_video_info_last = NULL;
+static struct RData* sdl_modes_last = NULL;
+
+static int sdl_context_wraps (struct RData* data, const void* pointer) {
+  return data && (const void*) ((mrb_sdl_context*) data->data)->any.surface == pointer;
+}
+static mrb_value sdl_context_keep (mrb_state *mrb, struct RData** last, mrb_value wrapped) {
+  if (*last) sdl_gc_release(mrb, mrb_obj_value(*last));
+  sdl_gc_protect(mrb, wrapped);
+  *last = (struct RData*) mrb_ptr(wrapped);
+  return wrapped;
+}
 static mrb_value mrb_sdl_get_video_info (mrb_state *mrb, mrb_value self) {
-  return sdl_video_info_to_mrb_value(mrb, self, SDL_GetVideoInfo());
+  const SDL_VideoInfo* info = SDL_GetVideoInfo();
+  if (sdl_context_wraps(sdl_video_info_last, info)) return mrb_obj_value(sdl_video_info_last);
+  return sdl_context_keep(mrb, &sdl_video_info_last, sdl_video_info_to_mrb_value(mrb, self, info));
 }
 static mrb_value mrb_sdl_video_driver_name (mrb_state *mrb, mrb_value self) {
-  char* name_buf;
-  mrb_int max_len;
-  mrb_get_args(mrb, "s", &name_buf);
-  mrb_get_args(mrb, "|i", &max_len);
-  return mrb_str_new_cstr(mrb, SDL_VideoDriverName(name_buf, max_len));
+  char name_buf[256];
+  if ( ! SDL_VideoDriverName(name_buf, sizeof(name_buf))) {
+    return mrb_nil_value();
+  }
+  return mrb_str_new_cstr(mrb, name_buf);
 }
 static mrb_value mrb_sdl_video_list_modes (mrb_state *mrb, mrb_value self) {
   mrb_value arg_format = mrb_nil_value();
-  mrb_int flags;
+  mrb_value arg_flags = mrb_fixnum_value(0);
 
-  mrb_get_args(mrb, "|o", &arg_format);
-  mrb_get_args(mrb, "|i", &flags);
-  
-  SDL_PixelFormat* format = mrb_value_to_sdl_pixel_format(mrb, arg_format);
-  return sdl_modes_to_mrb_value(mrb, self, SDL_ListModes(format, flags));
+  mrb_get_args(mrb, "|oo", &arg_format, &arg_flags);
+
+  SDL_PixelFormat* format = mrb_value_to_sdl_pixel_format_opt(mrb, arg_format);
+  SDL_Rect** modes = SDL_ListModes(format, sdl_arg_uint32(mrb, arg_flags));
+  if (sdl_context_wraps(sdl_modes_last, modes)) return mrb_obj_value(sdl_modes_last);
+  return sdl_context_keep(mrb, &sdl_modes_last, sdl_modes_to_mrb_value(mrb, self, modes));
 }
 static mrb_value mrb_sdl_video_mode_ok (mrb_state *mrb, mrb_value self) {
   mrb_int width;
   mrb_int height;
   mrb_int depth;
-  mrb_int flags;
-  mrb_get_args(mrb, "|i", &width);
-  mrb_get_args(mrb, "|i", &height);
-  mrb_get_args(mrb, "|i", &depth);
-  mrb_get_args(mrb, "|i", &flags);
-  return mrb_fixnum_value(SDL_VideoModeOK(width, height, depth, flags));
+  mrb_value arg_flags;
+  mrb_get_args(mrb, "iiio", &width, &height, &depth, &arg_flags);
+  return mrb_fixnum_value(SDL_VideoModeOK(width, height, depth, sdl_arg_uint32(mrb, arg_flags)));
 }
 
 // Display settings
@@ -219,355 +890,601 @@ static mrb_value mrb_sdl_video_set_mode (mrb_state *mrb, mrb_value self) {
   mrb_int w;
   mrb_int h;
   mrb_int d;
-  mrb_int f;
-  mrb_get_args(mrb, "|i", &w);
-  mrb_get_args(mrb, "|i", &h);
-  mrb_get_args(mrb, "|i", &d);
-  mrb_get_args(mrb, "|i", &f);
-  return sdl_surface_to_mrb_value(mrb, self, SDL_SetVideoMode(w, h, d, f));
+  mrb_value arg_flags;
+  mrb_get_args(mrb, "iiio", &w, &h, &d, &arg_flags);
+  sdl_video_sync();
+  SDL_Surface* old_screen = SDL_GetVideoSurface();
+  if (old_screen) sdl_convert_cache_forget(&sdl_video_conversions, old_screen);
+  SDL_Surface* screen = SDL_SetVideoMode(w, h, d, sdl_arg_uint32(mrb, arg_flags));
+  // SDL may have freed the old screen; its wrapper mustn't outlive it
+  if (old_screen != screen) sdl_surface_unmap(mrb, old_screen);
+  return sdl_surface_to_mrb_value(mrb, self, screen);
 }
 
 // Screen buffer
 static mrb_value mrb_sdl_video_update_rect (mrb_state *mrb, mrb_value self) {
-  mrb_value surface = mrb_nil_value();
+  mrb_value surface;
   mrb_int x;
   mrb_int y;
   mrb_int w;
   mrb_int h;
 
-  mrb_get_args(mrb, "|o", &surface);
-  mrb_get_args(mrb, "|i", &x);
-  mrb_get_args(mrb, "|i", &y);
-  mrb_get_args(mrb, "|i", &w);
-  mrb_get_args(mrb, "|i", &h);
-
-  SDL_UpdateRect(mrb_value_to_sdl_surface(mrb, surface), x, y, w, h);
+  mrb_get_args(mrb, "oiiii", &surface, &x, &y, &w, &h);
+
+  SDL_Surface* sdl_surface = mrb_value_to_sdl_surface(mrb, surface);
+  Uint64 start = sdl_stat_begin();
+  sdl_video_sync();
+  SDL_Rect rect = { x, y, w, h };
+  sdl_video_gamma_apply(sdl_surface, &rect, 1);
+  SDL_UpdateRect(sdl_surface, x, y, w, h);
+  sdl_video_gamma_restore(sdl_surface, &rect, 1);
+  // All zeroes means the whole surface
+  sdl_stat_end(SDL_STAT_UPDATE_RECTS, start, (x | y | w | h) ? (Uint64) w * h : (Uint64) sdl_surface->w * sdl_surface->h, 0);
   return mrb_nil_value();
 }
 static mrb_value mrb_sdl_video_update_rects (mrb_state *mrb, mrb_value self) {
-  mrb_value surface = mrb_nil_value();
-  mrb_int num;
-  mrb_value rects = mrb_nil_value();
+  mrb_value surface;
+  mrb_value arg_rects;
+  mrb_value arg_extra = mrb_nil_value();
+
+  int argc = mrb_get_args(mrb, "oo|o", &surface, &arg_rects, &arg_extra);
+
+  // Takes (surface, rects) or the SDL-style (surface, num, rects)
+  int num = -1;
+  if (argc > 2) {
+    if ( ! mrb_fixnum_p(arg_rects)) mrb_raise(mrb, E_TYPE_ERROR, "expected Integer");
+    num = mrb_fixnum(arg_rects);
+    arg_rects = arg_extra;
+  }
 
-  mrb_get_args(mrb, "|o", &surface);
-  mrb_get_args(mrb, "|i", &num);
-  mrb_get_args(mrb, "|o", &rects);
+  SDL_Surface* sdl_surface = mrb_value_to_sdl_surface(mrb, surface);
+  SDL_Rect* rects = NULL;
+  if (sdl_data_p(arg_rects, &sdl_rect_array_type)) {
+    mrb_sdl_rect_array* array = mrb_value_to_sdl_rect_array(mrb, arg_rects);
+    if (num < 0 || num > array->length) num = array->length;
+    rects = array->rects;
+  } else if (num != 0) {
+    num = 1;
+    rects = mrb_value_to_sdl_rect(mrb, arg_rects);
+  }
 
-  SDL_UpdateRects(mrb_value_to_sdl_surface(mrb, surface), num, mrb_value_to_sdl_rect(mrb, rects));
+  Uint64 start = sdl_stat_begin();
+  sdl_video_sync();
+  if (num > 0) {
+    sdl_video_gamma_apply(sdl_surface, rects, num);
+    SDL_UpdateRects(sdl_surface, num, rects);
+    sdl_video_gamma_restore(sdl_surface, rects, num);
+  }
+  if (start) {
+    Uint64 pixels = 0;
+    int i;
+    for (i = 0; i < num; i++) pixels += (Uint64) rects[i].w * rects[i].h;
+    sdl_stat_end(SDL_STAT_UPDATE_RECTS, start, pixels, 0);
+  }
   return mrb_nil_value();
 }
 static mrb_value mrb_sdl_video_flip (mrb_state *mrb, mrb_value self) {
-  mrb_value surface = mrb_nil_value();
-  mrb_get_args(mrb, "|o", &surface);
-  return mrb_fixnum_value(SDL_Flip(mrb_value_to_sdl_surface(mrb, surface)));
+  mrb_value surface;
+  mrb_get_args(mrb, "o", &surface);
+  SDL_Surface* sdl_surface = mrb_value_to_sdl_surface(mrb, surface);
+  Uint64 start = sdl_stat_begin();
+  sdl_video_sync();
+  SDL_Rect all = { 0, 0, 0, 0 };
+  sdl_video_gamma_apply(sdl_surface, &all, 1);
+  int result = SDL_Flip(sdl_surface);
+  sdl_video_gamma_restore(sdl_surface, &all, 1);
+  sdl_stat_end(SDL_STAT_FLIP, start, (Uint64) sdl_surface->w * sdl_surface->h, 0);
+  return mrb_fixnum_value(result);
 }
 
-// Colors
+// Colors. set_colors and set_palette take an SDL::Palette, a String of
+// packed SDL_Color entries (r, g, b, unused) or a single SDL::Color, and
+// never pass SDL more entries than that holds.
+static SDL_Color* sdl_color_array (mrb_state *mrb, mrb_value arg_colors, mrb_int* n_colors) {
+  SDL_Color* colors;
+  mrb_int count;
+  if (sdl_data_p(arg_colors, &sdl_palette_type)) {
+    SDL_Palette* palette = mrb_value_to_sdl_palette(mrb, arg_colors);
+    colors = palette->colors;
+    count = palette->ncolors;
+  } else if (mrb_string_p(arg_colors)) {
+    colors = (SDL_Color*) RSTRING_PTR(arg_colors);
+    count = RSTRING_LEN(arg_colors) / sizeof(SDL_Color);
+  } else {
+    colors = mrb_value_to_sdl_color(mrb, arg_colors);
+    count = 1;
+  }
+  if (*n_colors < 0 || *n_colors > count) *n_colors = count;
+  return colors;
+}
 static mrb_value mrb_sdl_video_set_colors (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_surface = mrb_nil_value();
-  mrb_value arg_colors = mrb_nil_value();
-  mrb_int first_color;
-  mrb_int n_colors;
+  mrb_value arg_surface;
+  mrb_value arg_colors;
+  mrb_int first_color = 0;
+  mrb_int n_colors = -1;
 
-  mrb_get_args(mrb, "|o", &arg_surface);
-  mrb_get_args(mrb, "|o", &arg_colors);
-  mrb_get_args(mrb, "|i", &first_color);
-  mrb_get_args(mrb, "|i", &n_colors);
+  mrb_get_args(mrb, "oo|ii", &arg_surface, &arg_colors, &first_color, &n_colors);
 
   SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
-  SDL_Color* colors = mrb_value_to_sdl_color(mrb, arg_colors);
+  SDL_Color* colors = sdl_color_array(mrb, arg_colors, &n_colors);
 
+  sdl_convert_cache_forget(&sdl_video_conversions, surface);
   return mrb_fixnum_value(SDL_SetColors(surface, colors, first_color, n_colors));
 }
 static mrb_value mrb_sdl_video_set_palette (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_surface = mrb_nil_value();
+  mrb_value arg_surface;
   mrb_int flags;
-  mrb_value arg_colors = mrb_nil_value();
-  mrb_int first_color;
-  mrb_int n_colors;
+  mrb_value arg_colors;
+  mrb_int first_color = 0;
+  mrb_int n_colors = -1;
 
-  mrb_get_args(mrb, "|o", &arg_surface);
-  mrb_get_args(mrb, "|i", &flags);
-  mrb_get_args(mrb, "|o", &arg_colors);
-  mrb_get_args(mrb, "|i", &first_color);
-  mrb_get_args(mrb, "|i", &n_colors);
+  mrb_get_args(mrb, "oio|ii", &arg_surface, &flags, &arg_colors, &first_color, &n_colors);
 
   SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
-  SDL_Color* colors = mrb_value_to_sdl_color(mrb, arg_colors);
+  SDL_Color* colors = sdl_color_array(mrb, arg_colors, &n_colors);
 
+  sdl_convert_cache_forget(&sdl_video_conversions, surface);
   return mrb_fixnum_value(SDL_SetPalette(surface, flags, colors, first_color, n_colors));
 }
+// How many palette lookup tables 8bpp blits have built, which only grows
+// when a palette or destination format changes
+static mrb_value mrb_sdl_video_palette_lut_builds (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(sdl_blit_lut_builds());
+}
 static mrb_value mrb_sdl_video_set_color_key (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_surface = mrb_nil_value();
-  mrb_int flag;
-  mrb_int key;
+  mrb_value arg_surface;
+  mrb_value arg_flag;
+  mrb_value arg_key;
+
+  mrb_get_args(mrb, "ooo", &arg_surface, &arg_flag, &arg_key);
 
-  mrb_get_args(mrb, "|o", &arg_surface);
-  mrb_get_args(mrb, "|i", &flag);
-  mrb_get_args(mrb, "|i", &key);
-  
   SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
-  return mrb_fixnum_value(SDL_SetColorKey(surface, flag, key));
+  return mrb_fixnum_value(SDL_SetColorKey(surface, sdl_arg_uint32(mrb, arg_flag), sdl_arg_uint32(mrb, arg_key)));
 }
 static mrb_value mrb_sdl_video_set_alpha (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_surface = mrb_nil_value();
-  mrb_int flag;
-  mrb_int key;
+  mrb_value arg_surface;
+  mrb_value arg_flag;
+  mrb_int alpha;
+
+  mrb_get_args(mrb, "ooi", &arg_surface, &arg_flag, &alpha);
 
-  mrb_get_args(mrb, "|o", &arg_surface);
-  mrb_get_args(mrb, "|i", &flag);
-  mrb_get_args(mrb, "|i", &key);
-  
   SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
-  return mrb_fixnum_value(SDL_SetAlpha(surface, flag, key));
+  return mrb_fixnum_value(SDL_SetAlpha(surface, sdl_arg_uint32(mrb, arg_flag), alpha));
 }
 
-// Gamma
+// Gamma. Drivers without hardware gamma fall back to software ramps, as
+// does everything after use_software_gamma(true). Screens the software path
+// can't correct return -1, as SDL does.
 static mrb_value mrb_sdl_video_set_gamma (mrb_state *mrb, mrb_value self) {
   mrb_float red;
   mrb_float green;
   mrb_float blue;
 
-  mrb_get_args(mrb, "|f", &red);
-  mrb_get_args(mrb, "|f", &green);
-  mrb_get_args(mrb, "|f", &blue);
+  mrb_get_args(mrb, "fff", &red, &green, &blue);
 
-  return mrb_fixnum_value(SDL_SetGamma(red, green, blue));
+  if ( ! sdl_video_gamma_forced && SDL_SetGamma(red, green, blue) == 0) {
+    return mrb_fixnum_value(0);
+  }
+  Uint16 ramps[3][256];
+  sdl_gamma_calculate(red, ramps[0]);
+  sdl_gamma_calculate(green, ramps[1]);
+  sdl_gamma_calculate(blue, ramps[2]);
+  return mrb_fixnum_value(sdl_video_gamma_fallback(ramps[0], ramps[1], ramps[2]));
+}
+// A ramp is 256 entries, as an Array of Integers or a String of native
+// Uint16s. nil leaves that channel as it is.
+static Uint16* sdl_gamma_ramp_arg (mrb_state *mrb, mrb_value arg, Uint16* ramp) {
+  int i;
+  if (mrb_nil_p(arg)) return NULL;
+  if (mrb_string_p(arg)) {
+    if (RSTRING_LEN(arg) != sizeof(Uint16) * 256) {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "gamma ramp must have 256 entries");
+    }
+    memcpy(ramp, RSTRING_PTR(arg), sizeof(Uint16) * 256);
+    return ramp;
+  }
+  if ( ! mrb_array_p(arg) || RARRAY_LEN(arg) != 256) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "gamma ramp must have 256 entries");
+  }
+  for (i = 0; i < 256; i++) {
+    ramp[i] = (Uint16) sdl_arg_uint32(mrb, RARRAY_PTR(arg)[i]);
+  }
+  return ramp;
 }
 static mrb_value mrb_sdl_video_set_gamma_ramp (mrb_state *mrb, mrb_value self) {
-  mrb_int r;
-  mrb_int g;
-  mrb_int b;
+  mrb_value arg_red;
+  mrb_value arg_green;
+  mrb_value arg_blue;
 
-  mrb_get_args(mrb, "|i", &r);
-  mrb_get_args(mrb, "|i", &g);
-  mrb_get_args(mrb, "|i", &b);
+  mrb_get_args(mrb, "ooo", &arg_red, &arg_green, &arg_blue);
 
-  uint16_t red = (uint16_t) r;
-  uint16_t green = (uint16_t) g;
-  uint16_t blue = (uint16_t) b;
+  Uint16 ramps[3][256];
+  Uint16* red = sdl_gamma_ramp_arg(mrb, arg_red, ramps[0]);
+  Uint16* green = sdl_gamma_ramp_arg(mrb, arg_green, ramps[1]);
+  Uint16* blue = sdl_gamma_ramp_arg(mrb, arg_blue, ramps[2]);
 
-  return mrb_fixnum_value(SDL_SetGammaRamp(&red, &green, &blue));
+  if ( ! sdl_video_gamma_forced && SDL_SetGammaRamp(red, green, blue) == 0) {
+    return mrb_fixnum_value(0);
+  }
+  return mrb_fixnum_value(sdl_video_gamma_fallback(red, green, blue));
 }
+// [red, green, blue], each an Array of 256 Integers, or nil if the driver
+// can't say
 static mrb_value mrb_sdl_video_get_gamma_ramp (mrb_state *mrb, mrb_value self) {
-  mrb_int r;
-  mrb_int g;
-  mrb_int b;
+  Uint16 ramps[3][256];
+  int i, j;
 
-  mrb_get_args(mrb, "|i", &r);
-  mrb_get_args(mrb, "|i", &g);
-  mrb_get_args(mrb, "|i", &b);
-
-  uint16_t red = (uint16_t) r;
-  uint16_t green = (uint16_t) g;
-  uint16_t blue = (uint16_t) b;
+  if (sdl_video_gamma.enabled) {
+    memcpy(ramps, sdl_video_gamma.ramps, sizeof(ramps));
+  } else if (SDL_GetGammaRamp(ramps[0], ramps[1], ramps[2]) < 0) {
+    return mrb_nil_value();
+  }
 
-  return mrb_fixnum_value(SDL_GetGammaRamp(&red, &green, &blue));
+  mrb_value result = mrb_ary_new_capa(mrb, 3);
+  for (i = 0; i < 3; i++) {
+    mrb_value ramp = mrb_ary_new_capa(mrb, 256);
+    for (j = 0; j < 256; j++) {
+      mrb_ary_push(mrb, ramp, mrb_fixnum_value(ramps[i][j]));
+    }
+    mrb_ary_push(mrb, result, ramp);
+  }
+  return result;
+}
+// Turning software gamma off also resets its ramps to identity
+static mrb_value mrb_sdl_video_use_software_gamma (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_enabled;
+  mrb_get_args(mrb, "o", &arg_enabled);
+  sdl_video_gamma_forced = mrb_test(arg_enabled);
+  if (sdl_video_gamma_forced) {
+    sdl_gamma_set_ramps(&sdl_video_gamma, NULL, NULL, NULL);
+  } else {
+    sdl_gamma_destroy(&sdl_video_gamma);
+  }
+  return sdl_video_gamma.enabled ? mrb_true_value() : mrb_false_value();
+}
+static mrb_value mrb_sdl_video_gamma_kernel (mrb_state *mrb, mrb_value self) {
+  return mrb_str_new_cstr(mrb, sdl_video_gamma.enabled ? sdl_gamma_kernel_name() : "sdl");
 }
 
 // Map colors to/from pixel format
 static mrb_value mrb_sdl_video_map_rgb (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_format = mrb_nil_value();
+  mrb_value arg_format;
   mrb_int red;
   mrb_int green;
   mrb_int blue;
 
-  mrb_get_args(mrb, "|o", &arg_format);
-  mrb_get_args(mrb, "|i", &red);
-  mrb_get_args(mrb, "|i", &green);
-  mrb_get_args(mrb, "|i", &blue);
+  mrb_get_args(mrb, "oiii", &arg_format, &red, &green, &blue);
 
   SDL_PixelFormat* format = mrb_value_to_sdl_pixel_format(mrb, arg_format);
   return mrb_fixnum_value(SDL_MapRGB(format, red, green, blue));
 }
 static mrb_value mrb_sdl_video_map_rgba (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_format = mrb_nil_value();
+  mrb_value arg_format;
   mrb_int red;
   mrb_int green;
   mrb_int blue;
   mrb_int alpha;
 
-  mrb_get_args(mrb, "|o", &arg_format);
-  mrb_get_args(mrb, "|i", &red);
-  mrb_get_args(mrb, "|i", &green);
-  mrb_get_args(mrb, "|i", &blue);
-  mrb_get_args(mrb, "|i", &alpha);
+  mrb_get_args(mrb, "oiiii", &arg_format, &red, &green, &blue, &alpha);
 
   SDL_PixelFormat* format = mrb_value_to_sdl_pixel_format(mrb, arg_format);
   return mrb_fixnum_value(SDL_MapRGBA(format, red, green, blue, alpha));
 }
 static mrb_value mrb_sdl_video_get_rgb (mrb_state *mrb, mrb_value self) {
-  mrb_int pixel;
-  mrb_value arg_format = mrb_nil_value();
-  mrb_int r;
-  mrb_int g;
-  mrb_int b;
-
-  mrb_get_args(mrb, "|i", &pixel);
-  mrb_get_args(mrb, "|o", &arg_format);
-  mrb_get_args(mrb, "|i", &r);
-  mrb_get_args(mrb, "|i", &g);
-  mrb_get_args(mrb, "|i", &b);
+  mrb_value arg_pixel;
+  mrb_value arg_format;
+  Uint8 red, green, blue;
 
-  uint8_t red = (uint8_t) r;
-  uint8_t green = (uint8_t) g;
-  uint8_t blue = (uint8_t) b;
+  mrb_get_args(mrb, "oo", &arg_pixel, &arg_format);
 
   SDL_PixelFormat* format = mrb_value_to_sdl_pixel_format(mrb, arg_format);
-  SDL_GetRGB(pixel, format, &red, &green, &blue);
-  return mrb_nil_value();
+  SDL_GetRGB(sdl_arg_uint32(mrb, arg_pixel), format, &red, &green, &blue);
+
+  mrb_value result = mrb_ary_new_capa(mrb, 3);
+  mrb_ary_push(mrb, result, mrb_fixnum_value(red));
+  mrb_ary_push(mrb, result, mrb_fixnum_value(green));
+  mrb_ary_push(mrb, result, mrb_fixnum_value(blue));
+  return result;
 }
 static mrb_value mrb_sdl_video_get_rgba (mrb_state *mrb, mrb_value self) {
-  mrb_int pixel;
-  mrb_value arg_format = mrb_nil_value();
-  mrb_int r;
-  mrb_int g;
-  mrb_int b;
-  mrb_int a;
-
-  mrb_get_args(mrb, "|i", &pixel);
-  mrb_get_args(mrb, "|o", &arg_format);
-  mrb_get_args(mrb, "|i", &r);
-  mrb_get_args(mrb, "|i", &g);
-  mrb_get_args(mrb, "|i", &b);
-  mrb_get_args(mrb, "|i", &a);
-
-  uint8_t red = (uint8_t) r;
-  uint8_t green = (uint8_t) g;
-  uint8_t blue = (uint8_t) b;
-  uint8_t alpha = (uint8_t) a;
+  mrb_value arg_pixel;
+  mrb_value arg_format;
+  Uint8 red, green, blue, alpha;
+
+  mrb_get_args(mrb, "oo", &arg_pixel, &arg_format);
 
   SDL_PixelFormat* format = mrb_value_to_sdl_pixel_format(mrb, arg_format);
-  SDL_GetRGBA(pixel, format, &red, &green, &blue, &alpha);
-  return mrb_nil_value();
+  SDL_GetRGBA(sdl_arg_uint32(mrb, arg_pixel), format, &red, &green, &blue, &alpha);
+
+  mrb_value result = mrb_ary_new_capa(mrb, 4);
+  mrb_ary_push(mrb, result, mrb_fixnum_value(red));
+  mrb_ary_push(mrb, result, mrb_fixnum_value(green));
+  mrb_ary_push(mrb, result, mrb_fixnum_value(blue));
+  mrb_ary_push(mrb, result, mrb_fixnum_value(alpha));
+  return result;
+}
+// Bulk mapping between Strings of r, g, b, a bytes and Strings of packed
+// pixels, BytesPerPixel apart in native byte order, in one call
+static mrb_value mrb_sdl_video_map_rgba_buffer (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_format;
+  mrb_value rgba;
+
+  mrb_get_args(mrb, "oS", &arg_format, &rgba);
+
+  SDL_PixelFormat* format = mrb_value_to_sdl_pixel_format(mrb, arg_format);
+  if (RSTRING_LEN(rgba) % 4) mrb_raise(mrb, E_ARGUMENT_ERROR, "RGBA buffer length must be a multiple of 4");
+
+  size_t count = RSTRING_LEN(rgba) / 4;
+  mrb_value pixels = mrb_str_resize(mrb, mrb_str_buf_new(mrb, count * format->BytesPerPixel), count * format->BytesPerPixel);
+  sdl_format_map_rgba(format, (const Uint8*) RSTRING_PTR(rgba), (Uint8*) RSTRING_PTR(pixels), count);
+  return pixels;
+}
+static mrb_value mrb_sdl_video_rgba_buffer (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_format;
+  mrb_value pixels;
+
+  mrb_get_args(mrb, "oS", &arg_format, &pixels);
+
+  SDL_PixelFormat* format = mrb_value_to_sdl_pixel_format(mrb, arg_format);
+  if (RSTRING_LEN(pixels) % format->BytesPerPixel) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "pixel buffer length must be a multiple of the bytes per pixel");
+  }
+
+  size_t count = RSTRING_LEN(pixels) / format->BytesPerPixel;
+  mrb_value rgba = mrb_str_resize(mrb, mrb_str_buf_new(mrb, count * 4), count * 4);
+  sdl_format_get_rgba(format, (const Uint8*) RSTRING_PTR(pixels), (Uint8*) RSTRING_PTR(rgba), count);
+  return rgba;
+}
+static mrb_value mrb_sdl_video_format_kernel (mrb_state *mrb, mrb_value self) {
+  return mrb_str_new_cstr(mrb, sdl_format_kernel_name());
 }
 
 // Surfaces
 static mrb_value mrb_sdl_video_create_rgb_surface (mrb_state *mrb, mrb_value self) {
-  mrb_int flags;
+  mrb_value arg_flags;
   mrb_int width;
   mrb_int height;
   mrb_int depth;
-  mrb_int r_mask;
-  mrb_int g_mask;
-  mrb_int b_mask;
-  mrb_int a_mask;
-  
-  mrb_get_args(mrb, "|i", &flags);
-  mrb_get_args(mrb, "|i", &width);
-  mrb_get_args(mrb, "|i", &height);
-  mrb_get_args(mrb, "|i", &depth);
-  mrb_get_args(mrb, "|i", &r_mask);
-  mrb_get_args(mrb, "|i", &g_mask);
-  mrb_get_args(mrb, "|i", &b_mask);
-  mrb_get_args(mrb, "|i", &a_mask);
-
-  SDL_Surface* surface = SDL_CreateRGBSurface(flags, width, height, depth, r_mask, g_mask, b_mask, a_mask);
-  return sdl_surface_to_mrb_value(mrb, self, surface);
-}
-// static mrb_value mrb_sdl_video_create_rgb_surface_from (mrb_state *mrb, mrb_value self) {
-//   mrb_value pixels = mrb_nil_value();
-//   mrb_int width;
-//   mrb_int height;
-//   mrb_int depth;
-//   mrb_int pitch;
-//   mrb_int r_mask;
-//   mrb_int g_mask;
-//   mrb_int b_mask;
-//   mrb_int a_mask;
-  
-//   mrb_get_args(mrb, "|o", &pixels);
-//   mrb_get_args(mrb, "|i", &width);
-//   mrb_get_args(mrb, "|i", &height);
-//   mrb_get_args(mrb, "|i", &depth);
-//   mrb_get_args(mrb, "|i", &r_mask);
-//   mrb_get_args(mrb, "|i", &g_mask);
-//   mrb_get_args(mrb, "|i", &b_mask);
-//   mrb_get_args(mrb, "|i", &a_mask);
-
-//   SDL_Surface* surface = SDL_CreateRGBSurfaceFrom(pixels, width, height, depth, pitch, r_mask, g_mask, b_mask, a_mask);
-//   return sdl_surface_to_mrb_value(mrb, self, surface);
-// }
-static mrb_value mrb_sdl_video_free_surface (mrb_state *mrb, mrb_value self) {
-  mrb_value surface = mrb_nil_value();
-  mrb_get_args(mrb, "|o", &surface);
-  SDL_FreeSurface(mrb_value_to_sdl_surface(mrb, surface));
+  mrb_value arg_r_mask;
+  mrb_value arg_g_mask;
+  mrb_value arg_b_mask;
+  mrb_value arg_a_mask;
+
+  mrb_get_args(mrb, "oiiioooo", &arg_flags, &width, &height, &depth,
+    &arg_r_mask, &arg_g_mask, &arg_b_mask, &arg_a_mask);
+
+  SDL_Surface* surface = SDL_CreateRGBSurface(sdl_arg_uint32(mrb, arg_flags), width, height, depth,
+    sdl_arg_uint32(mrb, arg_r_mask), sdl_arg_uint32(mrb, arg_g_mask),
+    sdl_arg_uint32(mrb, arg_b_mask), sdl_arg_uint32(mrb, arg_a_mask));
+  return sdl_owned_surface_to_mrb_value(mrb, self, surface);
+}
+// create_rgb_surface_from(pixels, w, h, depth, pitch, rmask, gmask, bmask,
+// amask) copies pitch-spaced rows out of the String into a new surface. The
+// surface doesn't see later changes to the String; write frames in place
+// through lock_surface instead.
+static mrb_value mrb_sdl_video_create_rgb_surface_from (mrb_state *mrb, mrb_value self) {
+  mrb_value pixels;
+  mrb_int width;
+  mrb_int height;
+  mrb_int depth;
+  mrb_int pitch;
+  mrb_value arg_r_mask;
+  mrb_value arg_g_mask;
+  mrb_value arg_b_mask;
+  mrb_value arg_a_mask;
+
+  mrb_get_args(mrb, "Siiiioooo", &pixels, &width, &height, &depth, &pitch,
+    &arg_r_mask, &arg_g_mask, &arg_b_mask, &arg_a_mask);
+
+  if (depth != 8 && depth != 16 && depth != 24 && depth != 32) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "depth must be 8, 16, 24 or 32");
+  }
+  // SDL pads rows to 4 bytes and keeps the pitch in a Uint16
+  Uint64 row = (Uint64) (width > 0 ? width : 0) * (depth / 8);
+  if (width < 0 || height < 0 || ((row + 3) & ~(Uint64) 3) > 0xffff || pitch < 0 || (Uint64) pitch < row) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid surface dimensions");
+  }
+  if (height > 0 && (Uint64) pitch > (Uint64) RSTRING_LEN(pixels) / height) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "pixel string is too short");
+  }
+
+  // Copy the bytes into pixels the surface owns. A String can be resized or
+  // share its buffer, and this mruby can't freeze one, so pointing the
+  // surface at it isn't safe.
+  SDL_Surface* surface = SDL_CreateRGBSurface(SDL_SWSURFACE, width, height, depth,
+    sdl_arg_uint32(mrb, arg_r_mask), sdl_arg_uint32(mrb, arg_g_mask),
+    sdl_arg_uint32(mrb, arg_b_mask), sdl_arg_uint32(mrb, arg_a_mask));
+  if (surface && surface->pitch < row) {
+    SDL_FreeSurface(surface);
+    mrb_raise(mrb, E_RUNTIME_ERROR, "surface rows are shorter than requested");
+  }
+  if (surface) {
+    const Uint8* src = (const Uint8*) RSTRING_PTR(pixels);
+    Uint8* dst = (Uint8*) surface->pixels;
+    int y;
+    for (y = 0; y < height; y++) memcpy(dst + (size_t) y * surface->pitch, src + (size_t) y * pitch, row);
+  }
+  return sdl_owned_surface_to_mrb_value(mrb, self, surface);
+}
+// Frees now rather than at collection. Freeing twice, or freeing a surface
+// the gem doesn't own such as the screen or an atlas page, does nothing.
+static void sdl_free_surface_value (mrb_state *mrb, mrb_value value) {
+  mrb_sdl_context* context = sdl_context_get(mrb, value);
+  if ( ! context) mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");
+  if (context->owned && context->any.surface) {
+    sdl_surface_free(mrb, context->any.surface);
+    context->any.surface = NULL;
+    context->owned = 0;
+  }
+}
+static mrb_value mrb_sdl_video_free_surface (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_surface;
+  mrb_get_args(mrb, "o", &arg_surface);
+  sdl_free_surface_value(mrb, arg_surface);
   return mrb_nil_value();
 }
 static mrb_value mrb_sdl_video_lock_surface (mrb_state *mrb, mrb_value self) {
-  mrb_value surface = mrb_nil_value();
-  mrb_get_args(mrb, "|o", &surface);
-  return mrb_fixnum_value(SDL_LockSurface(mrb_value_to_sdl_surface(mrb, surface)));
+  mrb_value arg_surface;
+  mrb_value block = mrb_nil_value();
+
+  mrb_get_args(mrb, "o&", &arg_surface, &block);
+
+  SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
+  // Only the lock itself is timed, not the block
+  Uint64 start = sdl_stat_begin();
+  sdl_video_sync();
+  sdl_convert_cache_forget(&sdl_video_conversions, surface);
+  int result = SDL_LockSurface(surface);
+  sdl_stat_end(SDL_STAT_LOCK_SURFACE, start, 0, (Uint64) surface->pitch * surface->h);
+  if (mrb_nil_p(block) || result < 0) {
+    return mrb_fixnum_value(result);
+  }
+
+  // With a block, yield a view of the locked pixels and unlock afterwards
+  mrb_sdl_pixel_buffer* buffer = (mrb_sdl_pixel_buffer*) malloc(sizeof(mrb_sdl_pixel_buffer));
+  if ( ! buffer) {
+    SDL_UnlockSurface(surface);
+    mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  }
+  buffer->pixels = (Uint8*) surface->pixels;
+  buffer->length = surface->pitch * surface->h;
+  buffer->pitch = surface->pitch;
+  buffer->width = surface->w;
+  buffer->height = surface->h;
+  buffer->bytes_per_pixel = surface->format->BytesPerPixel;
+
+  mrb_value view = mrb_obj_value(Data_Wrap_Struct(mrb, sdl_pixel_buffer_class, &sdl_pixel_buffer_type, buffer));
+  mrb_value views = mrb_ary_new_capa(mrb, 1);
+  mrb_ary_push(mrb, views, view);
+  return sdl_lock_yield(mrb, block, view, views, arg_surface, SDL_LOCK_SURFACE);
 }
 static mrb_value mrb_sdl_video_unlock_surface (mrb_state *mrb, mrb_value self) {
-  mrb_value surface = mrb_nil_value();
-  mrb_get_args(mrb, "|o", &surface);
+  mrb_value surface;
+  mrb_get_args(mrb, "o", &surface);
   SDL_UnlockSurface(mrb_value_to_sdl_surface(mrb, surface));
   return mrb_nil_value();
 }
 static mrb_value mrb_sdl_video_convert_surface (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_surface = mrb_nil_value();
-  mrb_value arg_format = mrb_nil_value();
-  mrb_int flags;
+  mrb_value arg_surface;
+  mrb_value arg_format;
+  mrb_value arg_flags;
 
-  mrb_get_args(mrb, "|o", &arg_surface);
-  mrb_get_args(mrb, "|o", &arg_format);
-  mrb_get_args(mrb, "|i", &flags);
+  mrb_get_args(mrb, "ooo", &arg_surface, &arg_format, &arg_flags);
 
   SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
   SDL_PixelFormat* format = mrb_value_to_sdl_pixel_format(mrb, arg_format);
-  return sdl_surface_to_mrb_value(mrb, self, SDL_ConvertSurface(surface, format, flags));
+  Uint32 flags = sdl_arg_uint32(mrb, arg_flags);
+  Uint64 start = sdl_stat_begin();
+  sdl_video_sync();
+  SDL_Surface* result = sdl_convert_cache_get(&sdl_video_conversions, surface, SDL_CONVERT_SURFACE, format, flags);
+  sdl_stat_end(SDL_STAT_CONVERT_SURFACE, start, (Uint64) surface->w * surface->h, (Uint64) surface->pitch * surface->h);
+  return sdl_owned_surface_to_mrb_value(mrb, self, result);
 }
 static mrb_value mrb_sdl_video_display_format (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_surface = mrb_nil_value();
-  mrb_get_args(mrb, "|o", &arg_surface);
+  mrb_value arg_surface;
+  mrb_get_args(mrb, "o", &arg_surface);
   SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
-  return sdl_surface_to_mrb_value(mrb, self, SDL_DisplayFormat(surface));
+  Uint64 start = sdl_stat_begin();
+  sdl_video_sync();
+  SDL_Surface* result = sdl_convert_cache_get(&sdl_video_conversions, surface, SDL_CONVERT_DISPLAY_FORMAT, NULL, 0);
+  sdl_stat_end(SDL_STAT_DISPLAY_FORMAT, start, (Uint64) surface->w * surface->h, (Uint64) surface->pitch * surface->h);
+  return sdl_owned_surface_to_mrb_value(mrb, self, result);
 }
 static mrb_value mrb_sdl_video_display_format_alpha (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_surface = mrb_nil_value();
-  mrb_get_args(mrb, "|o", &arg_surface);
+  mrb_value arg_surface;
+  mrb_get_args(mrb, "o", &arg_surface);
   SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
-  return sdl_surface_to_mrb_value(mrb, self, SDL_DisplayFormatAlpha(surface));
+  Uint64 start = sdl_stat_begin();
+  sdl_video_sync();
+  SDL_Surface* result = sdl_convert_cache_get(&sdl_video_conversions, surface, SDL_CONVERT_DISPLAY_FORMAT_ALPHA, NULL, 0);
+  sdl_stat_end(SDL_STAT_DISPLAY_FORMAT, start, (Uint64) surface->w * surface->h, (Uint64) surface->pitch * surface->h);
+  return sdl_owned_surface_to_mrb_value(mrb, self, result);
+}
+
+// The format lives in the surface, so it is only good until the surface is
+// freed. It keeps the surface from being collected in the meantime, and the
+// surface keeps it, so asking again returns the same object.
+static mrb_value mrb_sdl_video_pixel_format (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_surface;
+  mrb_get_args(mrb, "o", &arg_surface);
+  SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
+
+  mrb_sym format_sym = mrb_intern(mrb, "format");
+  mrb_value format = mrb_iv_get(mrb, arg_surface, format_sym);
+  mrb_sdl_context* context = sdl_context_get(mrb, format);
+  if (context && context->any.pixel_format == surface->format) return format;
+
+  format = sdl_pixel_format_to_mrb_value(mrb, self, surface->format);
+  mrb_iv_set(mrb, format, mrb_intern(mrb, "surface"), arg_surface);
+  mrb_iv_set(mrb, arg_surface, format_sym, format);
+  return format;
+}
+
+// Conversion cache. Lookups hand out a new reference each time, so every
+// surface they return is freed with free_surface as before.
+static mrb_value mrb_sdl_video_cache_conversions (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_budget;
+  mrb_get_args(mrb, "o", &arg_budget);
+  size_t budget = mrb_test(arg_budget) ? sdl_arg_uint32(mrb, arg_budget) : 0;
+  sdl_convert_cache_set_budget(&sdl_video_conversions, budget);
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_video_clear_conversion_cache (mrb_state *mrb, mrb_value self) {
+  sdl_convert_cache_clear(&sdl_video_conversions);
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_video_invalidate_conversions (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_surface;
+  mrb_get_args(mrb, "o", &arg_surface);
+  sdl_convert_cache_forget(&sdl_video_conversions, mrb_value_to_sdl_surface(mrb, arg_surface));
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_video_conversion_cache_stats (mrb_state *mrb, mrb_value self) {
+  mrb_value stats = mrb_hash_new(mrb);
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern(mrb, "hits")), mrb_fixnum_value(sdl_video_conversions.hits));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern(mrb, "misses")), mrb_fixnum_value(sdl_video_conversions.misses));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern(mrb, "evictions")), mrb_fixnum_value(sdl_video_conversions.evictions));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern(mrb, "entries")), mrb_fixnum_value(sdl_video_conversions.count));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern(mrb, "bytes")), mrb_fixnum_value((mrb_int) sdl_video_conversions.bytes));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern(mrb, "budget")), mrb_fixnum_value((mrb_int) sdl_video_conversions.budget));
+  return stats;
 }
 
 // Bitmaps
 static mrb_value mrb_sdl_video_load_bmp (mrb_state *mrb, mrb_value self) {
-  const char *file;
-  mrb_get_args(mrb, "|s", &file);
-  return sdl_surface_to_mrb_value(mrb, self, SDL_LoadBMP(file));
+  char *file;
+  mrb_get_args(mrb, "z", &file);
+  return sdl_owned_surface_to_mrb_value(mrb, self, SDL_LoadBMP(file));
 }
 static mrb_value mrb_sdl_video_save_bmp (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_surface = mrb_nil_value();
-  const char *file;
+  mrb_value arg_surface;
+  char *file;
+
+  mrb_get_args(mrb, "oz", &arg_surface, &file);
 
-  mrb_get_args(mrb, "|o", &arg_surface);
-  mrb_get_args(mrb, "|s", &file);
-  
   SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
+  sdl_video_sync();
   return mrb_fixnum_value(SDL_SaveBMP(surface, file));
 }
 
 // Clipping
 static mrb_value mrb_sdl_video_set_clipping_rect (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_surface = mrb_nil_value();
-  mrb_value arg_rect = mrb_nil_value();
+  mrb_value arg_surface;
+  mrb_value arg_rect;
+
+  mrb_get_args(mrb, "oo", &arg_surface, &arg_rect);
 
-  mrb_get_args(mrb, "|o", &arg_surface);
-  mrb_get_args(mrb, "|o", &arg_rect);
-  
   SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
-  SDL_Rect* rect = mrb_value_to_sdl_rect(mrb, arg_rect);
+  SDL_Rect* rect = mrb_value_to_sdl_rect_opt(mrb, arg_rect);
   SDL_SetClipRect(surface, rect);
   return mrb_nil_value();
 }
 static mrb_value mrb_sdl_video_get_clipping_rect (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_surface = mrb_nil_value();
-  mrb_value arg_rect = mrb_nil_value();
+  mrb_value arg_surface;
+  mrb_value arg_rect;
+
+  mrb_get_args(mrb, "oo", &arg_surface, &arg_rect);
 
-  mrb_get_args(mrb, "|o", &arg_surface);
-  mrb_get_args(mrb, "|o", &arg_rect);
-  
   SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
   SDL_Rect* rect = mrb_value_to_sdl_rect(mrb, arg_rect);
   SDL_GetClipRect(surface, rect);
@@ -576,79 +1493,311 @@ static mrb_value mrb_sdl_video_get_clipping_rect (mrb_state *mrb, mrb_value self
 
 // Blitting
 static mrb_value mrb_sdl_video_blit_surface (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_src_surface = mrb_nil_value();
-  mrb_value arg_src_rect = mrb_nil_value();
-  mrb_value arg_dest_surface = mrb_nil_value();
-  mrb_value arg_dest_rect = mrb_nil_value();
+  mrb_value arg_src_surface;
+  mrb_value arg_src_rect;
+  mrb_value arg_dest_surface;
+  mrb_value arg_dest_rect;
+
+  mrb_get_args(mrb, "oooo", &arg_src_surface, &arg_src_rect, &arg_dest_surface, &arg_dest_rect);
+
+  const SDL_Rect* region;
+  SDL_Surface* src_surface = sdl_blit_source(mrb, arg_src_surface, &region);
+  SDL_Surface* dest_surface = mrb_value_to_sdl_surface(mrb, arg_dest_surface);
+  SDL_Rect* src_rect = mrb_value_to_sdl_rect_opt(mrb, arg_src_rect);
+  SDL_Rect* dest_rect = mrb_value_to_sdl_rect_opt(mrb, arg_dest_rect);
+
+  // A zeroed rect blits to the origin like NULL does, but SDL still reports
+  // back where the blit landed
+  SDL_Rect origin = { 0, 0, 0, 0 };
+  if ( ! dest_rect) dest_rect = &origin;
+
+  SDL_Rect page_rect;
+  if (region) {
+    sdl_region_rect(region, src_rect, &page_rect, dest_rect);
+    src_rect = &page_rect;
+  }
 
-  mrb_get_args(mrb, "|o", &arg_src_surface);
-  mrb_get_args(mrb, "|o", &arg_src_rect);
-  mrb_get_args(mrb, "|o", &arg_dest_surface);
-  mrb_get_args(mrb, "|o", &arg_dest_rect);
+  Uint64 start = sdl_stat_begin();
+  int result = sdl_video_blit(src_surface, src_rect, dest_surface, dest_rect);
+  if (result == 0) sdl_video_note_damage(dest_surface, dest_rect);
+  sdl_stat_end(SDL_STAT_BLIT_SURFACE, start, result == 0 ? (Uint64) dest_rect->w * dest_rect->h : 0, 0);
+  return mrb_fixnum_value(result);
+}
+// Batched blits take a String of packed SDL_Rect pairs (src, dest), each rect
+// laid out as native-endian Sint16 x, y and Uint16 w, h. With sort, blits are
+// reordered by source position, but never past one whose destination they
+// overlap, so the result matches blitting them in order.
+typedef struct {
+  SDL_Rect src;
+  SDL_Rect dest;
+} sdl_blit_pair;
+
+typedef struct {
+  sdl_blit_pair pair;
+  int index;
+} sdl_blit_sort_entry;
+
+static sdl_blit_sort_entry* sdl_blit_sort_buf = NULL;
+static int sdl_blit_sort_capa = 0;
+
+// Sorting only reorders runs of blits whose destinations don't overlap, so
+// whatever ends up on top is the same as blitting in order. Runs are capped
+// to keep the overlap checks linear in the batch size.
+#define SDL_BLIT_SORT_RUN 64
+
+// The blit covers the source rect's size at the destination's position
+static inline int sdl_blit_pairs_overlap (const sdl_blit_pair* a, const sdl_blit_pair* b) {
+  return a->dest.x < b->dest.x + b->src.w && b->dest.x < a->dest.x + a->src.w &&
+    a->dest.y < b->dest.y + b->src.h && b->dest.y < a->dest.y + a->src.h;
+}
+
+// Order by source row then column so consecutive blits read neighbouring
+// source memory. Ties keep submission order, so blits that share a source
+// rect still land in the order they were queued.
+static int sdl_blit_sort_compare (const void* a, const void* b) {
+  const sdl_blit_sort_entry* left = (const sdl_blit_sort_entry*) a;
+  const sdl_blit_sort_entry* right = (const sdl_blit_sort_entry*) b;
+  if (left->pair.src.y != right->pair.src.y) return left->pair.src.y - right->pair.src.y;
+  if (left->pair.src.x != right->pair.src.x) return left->pair.src.x - right->pair.src.x;
+  return left->index - right->index;
+}
+
+// Adds the clipped area blitted to *pixels
+static int sdl_blit_pairs (SDL_Surface* src, const SDL_Rect* region, SDL_Surface* dest, const void* packed, int count, int sort, Uint64* pixels) {
+  const Uint8* bytes = (const Uint8*) packed;
+  int i;
+
+  if (sort && count > 1) {
+    if (count > sdl_blit_sort_capa) {
+      sdl_blit_sort_entry* buf = (sdl_blit_sort_entry*) realloc(sdl_blit_sort_buf, sizeof(sdl_blit_sort_entry) * count);
+      if ( ! buf) return -1;
+      sdl_blit_sort_buf = buf;
+      sdl_blit_sort_capa = count;
+    }
+    for (i = 0; i < count; i++) {
+      sdl_blit_pair* pair = &sdl_blit_sort_buf[i].pair;
+      memcpy(pair, bytes + i * sizeof(sdl_blit_pair), sizeof(sdl_blit_pair));
+      if (region) sdl_region_rect(region, &pair->src, &pair->src, &pair->dest);
+      sdl_blit_sort_buf[i].index = i;
+    }
+    int run = 0;
+    while (run < count) {
+      int end = run + 1;
+      while (end < count && end - run < SDL_BLIT_SORT_RUN) {
+        int j;
+        for (j = run; j < end; j++) {
+          if (sdl_blit_pairs_overlap(&sdl_blit_sort_buf[j].pair, &sdl_blit_sort_buf[end].pair)) break;
+        }
+        if (j < end) break;
+        end++;
+      }
+      qsort(&sdl_blit_sort_buf[run], end - run, sizeof(sdl_blit_sort_entry), sdl_blit_sort_compare);
+      run = end;
+    }
+    for (i = 0; i < count; i++) {
+      int result = sdl_video_blit(src, &sdl_blit_sort_buf[i].pair.src, dest, &sdl_blit_sort_buf[i].pair.dest);
+      if (result < 0) return result;
+      sdl_video_note_damage(dest, &sdl_blit_sort_buf[i].pair.dest);
+      *pixels += (Uint64) sdl_blit_sort_buf[i].pair.dest.w * sdl_blit_sort_buf[i].pair.dest.h;
+    }
+    return 0;
+  }
+
+  for (i = 0; i < count; i++) {
+    // SDL writes the clipped rect back, and packed buffers may be unaligned,
+    // so blit from a copy
+    sdl_blit_pair pair;
+    memcpy(&pair, bytes + i * sizeof(sdl_blit_pair), sizeof(sdl_blit_pair));
+    if (region) sdl_region_rect(region, &pair.src, &pair.src, &pair.dest);
+    int result = sdl_video_blit(src, &pair.src, dest, &pair.dest);
+    if (result < 0) return result;
+    sdl_video_note_damage(dest, &pair.dest);
+    *pixels += (Uint64) pair.dest.w * pair.dest.h;
+  }
+  return 0;
+}
 
-  SDL_Surface* src_surface = mrb_value_to_sdl_surface(mrb, arg_src_surface);
+static mrb_value mrb_sdl_video_blit_batch (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_src_surface;
+  mrb_value arg_dest_surface;
+  mrb_value arg_rects;
+  mrb_value arg_sort = mrb_false_value();
+
+  mrb_get_args(mrb, "ooo|o", &arg_src_surface, &arg_dest_surface, &arg_rects, &arg_sort);
+
+  const SDL_Rect* region;
+  SDL_Surface* src_surface = sdl_blit_source(mrb, arg_src_surface, &region);
   SDL_Surface* dest_surface = mrb_value_to_sdl_surface(mrb, arg_dest_surface);
-  SDL_Rect* src_rect = mrb_value_to_sdl_rect(mrb, arg_src_rect);
-  SDL_Rect* dest_rect = mrb_value_to_sdl_rect(mrb, arg_dest_rect);
-  return mrb_fixnum_value(SDL_BlitSurface(src_surface, src_rect, dest_surface, dest_rect));
+
+  // A RectArray holding src, dest, src, dest, ... is already in pair layout
+  const void* packed;
+  int count;
+  if (sdl_data_p(arg_rects, &sdl_rect_array_type)) {
+    mrb_sdl_rect_array* array = mrb_value_to_sdl_rect_array(mrb, arg_rects);
+    if (array->length % 2) {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "rect array must hold src/dest pairs");
+    }
+    packed = array->rects;
+    count = array->length / 2;
+  } else {
+    if ( ! mrb_string_p(arg_rects)) {
+      mrb_raise(mrb, E_TYPE_ERROR, "expected String or SDL::RectArray");
+    }
+    if (RSTRING_LEN(arg_rects) % sizeof(sdl_blit_pair)) {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "packed rects must be a whole number of rect pairs");
+    }
+    packed = RSTRING_PTR(arg_rects);
+    count = RSTRING_LEN(arg_rects) / sizeof(sdl_blit_pair);
+  }
+
+  Uint64 pixels = 0;
+  Uint64 start = sdl_stat_begin();
+  int result = sdl_blit_pairs(src_surface, region, dest_surface, packed, count, mrb_test(arg_sort), &pixels);
+  sdl_stat_end(SDL_STAT_BLIT_BATCH, start, pixels, 0);
+  return mrb_fixnum_value(result);
 }
 static mrb_value mrb_sdl_video_fill_rect (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_surface = mrb_nil_value();
-  mrb_value arg_rect = mrb_nil_value();
-  mrb_int color;
+  mrb_value arg_surface;
+  mrb_value arg_rect;
+  mrb_value arg_color;
 
-  mrb_get_args(mrb, "|o", &arg_surface);
-  mrb_get_args(mrb, "|o", &arg_rect);
-  mrb_get_args(mrb, "|i", &color);
+  mrb_get_args(mrb, "ooo", &arg_surface, &arg_rect, &arg_color);
 
   SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
-  SDL_Rect* rect = mrb_value_to_sdl_rect(mrb, arg_rect);
-  return mrb_fixnum_value(SDL_FillRect(surface, rect, color));
+  Uint32 color = sdl_arg_uint32(mrb, arg_color);
+
+  if (sdl_data_p(arg_rect, &sdl_rect_array_type)) {
+    mrb_sdl_rect_array* array = mrb_value_to_sdl_rect_array(mrb, arg_rect);
+    Uint64 pixels = 0;
+    Uint64 start = sdl_stat_begin();
+    int result = 0;
+    int i;
+    for (i = 0; i < array->length; i++) {
+      // SDL clips the rect in place, so fill from a copy
+      SDL_Rect rect = array->rects[i];
+      result = sdl_video_fill(surface, &rect, color);
+      if (result < 0) break;
+      sdl_video_note_damage(surface, &rect);
+      pixels += (Uint64) rect.w * rect.h;
+    }
+    sdl_stat_end(SDL_STAT_FILL_RECT, start, pixels, 0);
+    return mrb_fixnum_value(result);
+  }
+
+  SDL_Rect* rect = mrb_value_to_sdl_rect_opt(mrb, arg_rect);
+  Uint64 start = sdl_stat_begin();
+  int result = sdl_video_fill(surface, rect, color);
+  SDL_Rect* filled = rect ? rect : &surface->clip_rect;
+  if (result == 0) sdl_video_note_damage(surface, filled);
+  sdl_stat_end(SDL_STAT_FILL_RECT, start, result == 0 ? (Uint64) filled->w * filled->h : 0, 0);
+  return mrb_fixnum_value(result);
 }
 
 // YUV Overlay
 static mrb_value mrb_sdl_video_create_yuv_overlay (mrb_state *mrb, mrb_value self) {
   mrb_int width;
   mrb_int height;
-  mrb_int format;
-  mrb_value arg_surface = mrb_nil_value();
-  
-  mrb_get_args(mrb, "|i", &width);
-  mrb_get_args(mrb, "|i", &height);
-  mrb_get_args(mrb, "|i", &format);
-  mrb_get_args(mrb, "|o", &arg_surface);
+  mrb_value arg_format;
+  mrb_value arg_surface;
+
+  mrb_get_args(mrb, "iioo", &width, &height, &arg_format, &arg_surface);
 
   SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
-  SDL_Overlay* overlay = SDL_CreateYUVOverlay(width, height, format, surface);
+  SDL_Overlay* overlay = SDL_CreateYUVOverlay(width, height, sdl_arg_uint32(mrb, arg_format), surface);
   return sdl_overlay_to_mrb_value(mrb, self, overlay);
 }
 static mrb_value mrb_sdl_video_lock_yuv_overlay (mrb_state *mrb, mrb_value self) {
-  mrb_value overlay = mrb_nil_value();
-  mrb_get_args(mrb, "|o", &overlay);
-  return mrb_fixnum_value(SDL_LockYUVOverlay(mrb_value_to_sdl_overlay(mrb, overlay)));
+  mrb_value arg_overlay;
+  mrb_value block = mrb_nil_value();
+
+  mrb_get_args(mrb, "o&", &arg_overlay, &block);
+
+  SDL_Overlay* overlay = mrb_value_to_sdl_overlay(mrb, arg_overlay);
+  int result = SDL_LockYUVOverlay(overlay);
+  if (mrb_nil_p(block) || result < 0) {
+    return mrb_fixnum_value(result);
+  }
+
+  // With a block, yield one view per plane, as lock_surface does for pixels.
+  // Planar formats have a full size Y plane and quarter size chroma planes;
+  // packed ones a single plane of two bytes per pixel.
+  int packed = overlay->planes == 1;
+  mrb_sdl_pixel_buffer* buffers[3] = { NULL, NULL, NULL };
+  mrb_value planes = mrb_ary_new_capa(mrb, overlay->planes);
+  int i;
+  for (i = 0; i < overlay->planes && i < 3; i++) {
+    mrb_sdl_pixel_buffer* buffer = (mrb_sdl_pixel_buffer*) malloc(sizeof(mrb_sdl_pixel_buffer));
+    if ( ! buffer) {
+      while (i--) buffers[i]->pixels = NULL;
+      SDL_UnlockYUVOverlay(overlay);
+      mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+    }
+    buffer->pixels = overlay->pixels[i];
+    buffer->pitch = overlay->pitches[i];
+    buffer->width = packed ? overlay->w : (i ? overlay->w / 2 : overlay->w);
+    buffer->height = i ? overlay->h / 2 : overlay->h;
+    buffer->length = buffer->pitch * buffer->height;
+    buffer->bytes_per_pixel = packed ? 2 : 1;
+    buffers[i] = buffer;
+    mrb_ary_push(mrb, planes, mrb_obj_value(Data_Wrap_Struct(mrb, sdl_pixel_buffer_class, &sdl_pixel_buffer_type, buffer)));
+  }
+
+  // Keep a copy of the views, so the ensure reaches all of them whatever the
+  // block does to the Array it was given
+  mrb_value views = mrb_ary_new_capa(mrb, RARRAY_LEN(planes));
+  for (i = 0; i < RARRAY_LEN(planes); i++) mrb_ary_push(mrb, views, RARRAY_PTR(planes)[i]);
+  return sdl_lock_yield(mrb, block, planes, views, arg_overlay, SDL_LOCK_OVERLAY);
 }
 static mrb_value mrb_sdl_video_unlock_yuv_overlay (mrb_state *mrb, mrb_value self) {
-  mrb_value overlay = mrb_nil_value();
-  mrb_get_args(mrb, "|o", &overlay);
+  mrb_value overlay;
+  mrb_get_args(mrb, "o", &overlay);
   SDL_UnlockYUVOverlay(mrb_value_to_sdl_overlay(mrb, overlay));
   return mrb_nil_value();
 }
+// Convert a 32bpp surface straight into the overlay's planes
+static mrb_value mrb_sdl_video_convert_to_yuv (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_surface;
+  mrb_value arg_overlay;
+
+  mrb_get_args(mrb, "oo", &arg_surface, &arg_overlay);
+
+  SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
+  SDL_Overlay* overlay = mrb_value_to_sdl_overlay(mrb, arg_overlay);
+
+  sdl_video_sync();
+  if (SDL_MUSTLOCK(surface) && SDL_LockSurface(surface) < 0) {
+    return mrb_fixnum_value(-1);
+  }
+  int result = SDL_LockYUVOverlay(overlay);
+  if (result == 0) {
+    result = sdl_yuv_convert(surface, overlay);
+    SDL_UnlockYUVOverlay(overlay);
+  }
+  if (SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
+  return mrb_fixnum_value(result);
+}
+static mrb_value mrb_sdl_video_yuv_kernel (mrb_state *mrb, mrb_value self) {
+  return mrb_str_new_cstr(mrb, sdl_yuv_kernel_name());
+}
 static mrb_value mrb_sdl_video_display_yuv_overlay (mrb_state *mrb, mrb_value self) {
-  mrb_value arg_overlay = mrb_nil_value();
-  mrb_value arg_rect = mrb_nil_value();
+  mrb_value arg_overlay;
+  mrb_value arg_rect;
+
+  mrb_get_args(mrb, "oo", &arg_overlay, &arg_rect);
 
-  mrb_get_args(mrb, "|o", &arg_overlay);
-  mrb_get_args(mrb, "|o", &arg_rect);
-  
   SDL_Overlay* overlay = mrb_value_to_sdl_overlay(mrb, arg_overlay);
   SDL_Rect* rect = mrb_value_to_sdl_rect(mrb, arg_rect);
 
+  sdl_video_sync();
   return mrb_fixnum_value(SDL_DisplayYUVOverlay(overlay, rect));
 }
 static mrb_value mrb_sdl_video_free_yuv_overlay (mrb_state *mrb, mrb_value self) {
-  mrb_value overlay = mrb_nil_value();
-  mrb_get_args(mrb, "|o", &overlay);
+  mrb_value overlay;
+  mrb_get_args(mrb, "o", &overlay);
+  mrb_sdl_context* context = sdl_context_get(mrb, overlay);
   SDL_FreeYUVOverlay(mrb_value_to_sdl_overlay(mrb, overlay));
+  // Forget the overlay, so an enclosing lock block doesn't unlock freed memory
+  context->any.overlay = NULL;
   return mrb_nil_value();
 }
 
@@ -660,13 +1809,13 @@ static mrb_value mrb_sdl_video_free_yuv_overlay (mrb_state *mrb, mrb_value self)
  *  - Figure out SDL_GL_GetProcAddress, SDL_GL_GetAttribute, SDL_GL_SetAttribute
  ******************************************************************************/
 static mrb_value mrb_sdl_gl_load_library (mrb_state *mrb, mrb_value self) {
-  const char *path;
-  mrb_get_args(mrb, "|s", &path);
+  char *path;
+  mrb_get_args(mrb, "z", &path);
   return mrb_fixnum_value(SDL_GL_LoadLibrary(path));
 }
 // static mrb_value mrb_sdl_gl_get_proc_address (mrb_state *mrb, mrb_value self) {
-//   const char *proc;
-//   mrb_get_args(mrb, "|s", &proc);
+//   char *proc;
+//   mrb_get_args(mrb, "z", &proc);
 //   SDL_GL_GetProcAddress(proc);
 //   return mrb_nil_value();
 // }
@@ -674,8 +1823,7 @@ static mrb_value mrb_sdl_gl_load_library (mrb_state *mrb, mrb_value self) {
 //   mrb_value arg_attr = mrb_nil_value();
 //   mrb_int value;
 
-//   mrb_get_args(mrb, "|o", &arg_attr);
-//   mrb_get_args(mrb, "|i", &value);
+//   mrb_get_args(mrb, "oi", &arg_attr, &value);
 
 //   SDL_GLattr* attr = mrb_value_to_sdl_gl_attr(mrb, arg_attr);
 //   return mrb_fixnum_value(SDL_GL_GetAttribute(attr, value));
@@ -684,8 +1832,7 @@ static mrb_value mrb_sdl_gl_load_library (mrb_state *mrb, mrb_value self) {
 //   mrb_value arg_attr = mrb_nil_value();
 //   mrb_int value;
 
-//   mrb_get_args(mrb, "|o", &arg_attr);
-//   mrb_get_args(mrb, "|i", &value);
+//   mrb_get_args(mrb, "oi", &arg_attr, &value);
 
 //   SDL_GLattr* attr = mrb_value_to_sdl_gl_attr(mrb, arg_attr);
 //   return mrb_fixnum_value(SDL_GL_SetAttribute(attr, value));
@@ -697,188 +1844,2123 @@ static mrb_value mrb_sdl_gl_swap_buffers (mrb_state *mrb, mrb_value self) {
 
 
 /*******************************************************************************
- * Rect class
+ * Struct field accessors
  ******************************************************************************/
-static mrb_value mrb_sdl_rect_init (mrb_state *mrb, mrb_value self) {
-  SDL_Rect rect;
+#define SDL_STRUCT_ACCESSOR(key, name, field, type)\
+  static mrb_value mrb_sdl_##key##_get_##name (mrb_state *mrb, mrb_value self) {\
+    return mrb_fixnum_value(mrb_value_to_sdl_##key(mrb, self)->field);\
+  }\
+  static mrb_value mrb_sdl_##key##_set_##name (mrb_state *mrb, mrb_value self) {\
+    mrb_int value;\
+    mrb_get_args(mrb, "i", &value);\
+    mrb_value_to_sdl_##key(mrb, self)->field = (type) value;\
+    return mrb_fixnum_value(value);\
+  }
 
-  mrb_get_args(mrb, "|i", &rect.x);
-  mrb_get_args(mrb, "|i", &rect.y);
-  mrb_get_args(mrb, "|i", &rect.w);
-  mrb_get_args(mrb, "|i", &rect.h);
+#define SDL_DEFINE_ACCESSOR(klass, key, name)\
+  mrb_define_method(mrb, klass, #name, mrb_sdl_##key##_get_##name, ARGS_NONE());\
+  mrb_define_method(mrb, klass, #name "=", mrb_sdl_##key##_set_##name, ARGS_REQ(1));
 
-  mrb_sdl_context* context = sdl_context_alloc(mrb);
-  context->any.rect = &rect;
 
-  context->instance = mrb_nil_value();
-  mrb_iv_set(mrb, self, mrb_intern(mrb, "context"), mrb_obj_value(
-    Data_Wrap_Struct(mrb, mrb->object_class, &sdl_context_type, (void*) context)
-  ));
+/*******************************************************************************
+ * Surface class
+ ******************************************************************************/
+static mrb_value mrb_sdl_surface_w (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_surface(mrb, self)->w);
+}
+static mrb_value mrb_sdl_surface_h (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_surface(mrb, self)->h);
+}
+static mrb_value mrb_sdl_surface_pitch (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_surface(mrb, self)->pitch);
+}
+static mrb_value mrb_sdl_surface_depth (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_surface(mrb, self)->format->BitsPerPixel);
+}
+static mrb_value mrb_sdl_surface_flags (mrb_state *mrb, mrb_value self) {
+  Uint32 flags = mrb_value_to_sdl_surface(mrb, self)->flags;
+  // The top flags don't fit in a Fixnum on 32-bit builds
+  if (flags > 0x3fffffff) return mrb_float_value(flags);
+  return mrb_fixnum_value(flags);
+}
+static mrb_value mrb_sdl_surface_free (mrb_state *mrb, mrb_value self) {
+  sdl_free_surface_value(mrb, self);
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_surface_is_owned (mrb_state *mrb, mrb_value self) {
+  mrb_sdl_context* context = sdl_context_get(mrb, self);
+  return context && context->owned ? mrb_true_value() : mrb_false_value();
+}
+static mrb_value mrb_sdl_surface_is_freed (mrb_state *mrb, mrb_value self) {
+  mrb_sdl_context* context = sdl_context_get(mrb, self);
+  return context && context->any.surface ? mrb_false_value() : mrb_true_value();
+}
+
+
+/*******************************************************************************
+ * Rect class
+ ******************************************************************************/
+static mrb_value mrb_sdl_rect_init (mrb_state *mrb, mrb_value self) {
+  mrb_int x = 0, y = 0, w = 0, h = 0;
+
+  mrb_get_args(mrb, "|iiii", &x, &y, &w, &h);
 
+  SDL_Rect* rect = (SDL_Rect*) DATA_PTR(self);
+  if ( ! rect) {
+    rect = (SDL_Rect*) sdl_struct_alloc();
+    if ( ! rect) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+    DATA_PTR(self) = rect;
+    DATA_TYPE(self) = &sdl_rect_type;
+  }
+  rect->x = x;
+  rect->y = y;
+  rect->w = w;
+  rect->h = h;
   return self;
 }
 static mrb_value mrb_sdl_rect_destroy (mrb_state *mrb, mrb_value self) {
-  mrb_sdl_context* context = NULL;
-  mrb_value value_context = mrb_iv_get(mrb, self, mrb_intern(mrb, "context"));
-  Data_Get_Struct(mrb, value_context, &sdl_context_type, context);
-  sdl_context_free(mrb, context);
+  sdl_struct_free(mrb, DATA_PTR(self));
+  DATA_PTR(self) = NULL;
   return self;
 }
 
+SDL_STRUCT_ACCESSOR(rect, x, x, Sint16);
+SDL_STRUCT_ACCESSOR(rect, y, y, Sint16);
+SDL_STRUCT_ACCESSOR(rect, w, w, Uint16);
+SDL_STRUCT_ACCESSOR(rect, h, h, Uint16);
+
 
 /*******************************************************************************
  * Color class
  ******************************************************************************/
 static mrb_value mrb_sdl_color_init (mrb_state *mrb, mrb_value self) {
-  SDL_Color color;
-
-  mrb_get_args(mrb, "|i", &color.r);
-  mrb_get_args(mrb, "|i", &color.g);
-  mrb_get_args(mrb, "|i", &color.b);
-  mrb_get_args(mrb, "|i", &color.unused);
-
-  mrb_sdl_context* context = sdl_context_alloc(mrb);
-  context->any.color = &color;
+  mrb_int r = 0, g = 0, b = 0, a = 0;
 
-  context->instance = mrb_nil_value();
-  mrb_iv_set(mrb, self, mrb_intern(mrb, "context"), mrb_obj_value(
-    Data_Wrap_Struct(mrb, mrb->object_class, &sdl_context_type, (void*) context)
-  ));
+  mrb_get_args(mrb, "|iiii", &r, &g, &b, &a);
 
+  SDL_Color* color = (SDL_Color*) DATA_PTR(self);
+  if ( ! color) {
+    color = (SDL_Color*) sdl_struct_alloc();
+    if ( ! color) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+    DATA_PTR(self) = color;
+    DATA_TYPE(self) = &sdl_color_type;
+  }
+  color->r = r;
+  color->g = g;
+  color->b = b;
+  color->unused = a;
   return self;
 }
 static mrb_value mrb_sdl_color_destroy (mrb_state *mrb, mrb_value self) {
-  mrb_sdl_context* context = NULL;
-  mrb_value value_context = mrb_iv_get(mrb, self, mrb_intern(mrb, "context"));
-  Data_Get_Struct(mrb, value_context, &sdl_context_type, context);
-  sdl_context_free(mrb, context);
+  sdl_struct_free(mrb, DATA_PTR(self));
+  DATA_PTR(self) = NULL;
   return self;
 }
 
+SDL_STRUCT_ACCESSOR(color, r, r, Uint8);
+SDL_STRUCT_ACCESSOR(color, g, g, Uint8);
+SDL_STRUCT_ACCESSOR(color, b, b, Uint8);
+SDL_STRUCT_ACCESSOR(color, a, unused, Uint8);
+
 
 /*******************************************************************************
  * Palette class
  ******************************************************************************/
 static mrb_value mrb_sdl_palette_init (mrb_state *mrb, mrb_value self) {
-  SDL_Palette palette;
+  mrb_int ncolors;
   mrb_value arg_colors = mrb_nil_value();
+  int i;
 
-  mrb_get_args(mrb, "|i", &palette.ncolors);
-  mrb_get_args(mrb, "|o", &arg_colors);
+  mrb_get_args(mrb, "i|o", &ncolors, &arg_colors);
+  if (ncolors < 1 || ncolors > 256) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "palette must have 1 to 256 colors");
+  }
 
-  palette.colors = mrb_value_to_sdl_color(mrb, arg_colors);
+  // Accept a single color to fill with, or an array of colors. Unwrap them
+  // all before allocating so a bad argument can't leak the palette.
+  SDL_Color* fill = NULL;
+  int n = 0;
+  if (mrb_array_p(arg_colors)) {
+    n = RARRAY_LEN(arg_colors) < ncolors ? RARRAY_LEN(arg_colors) : ncolors;
+    for (i = 0; i < n; i++) {
+      mrb_value_to_sdl_color(mrb, RARRAY_PTR(arg_colors)[i]);
+    }
+  } else if ( ! mrb_nil_p(arg_colors)) {
+    fill = mrb_value_to_sdl_color(mrb, arg_colors);
+  }
 
-  mrb_sdl_context* context = sdl_context_alloc(mrb);
-  context->any.palette = &palette;
+  mrb_sdl_palette* palette = (mrb_sdl_palette*) calloc(1,
+    sizeof(mrb_sdl_palette) + sizeof(SDL_Color) * (ncolors - 1));
+  if ( ! palette) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  palette->palette.ncolors = ncolors;
+  palette->palette.colors = palette->colors;
 
-  context->instance = mrb_nil_value();
-  mrb_iv_set(mrb, self, mrb_intern(mrb, "context"), mrb_obj_value(
-    Data_Wrap_Struct(mrb, mrb->object_class, &sdl_context_type, (void*) context)
-  ));
+  for (i = 0; i < n; i++) {
+    palette->colors[i] = *mrb_value_to_sdl_color(mrb, RARRAY_PTR(arg_colors)[i]);
+  }
+  if (fill) {
+    for (i = 0; i < ncolors; i++) {
+      palette->colors[i] = *fill;
+    }
+  }
 
+  sdl_palette_free(mrb, DATA_PTR(self));
+  DATA_PTR(self) = palette;
+  DATA_TYPE(self) = &sdl_palette_type;
   return self;
 }
 static mrb_value mrb_sdl_palette_destroy (mrb_state *mrb, mrb_value self) {
-  mrb_sdl_context* context = NULL;
-  mrb_value value_context = mrb_iv_get(mrb, self, mrb_intern(mrb, "context"));
-  Data_Get_Struct(mrb, value_context, &sdl_context_type, context);
-  sdl_context_free(mrb, context);
+  sdl_palette_free(mrb, DATA_PTR(self));
+  DATA_PTR(self) = NULL;
+  return self;
+}
+static mrb_value mrb_sdl_palette_size (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_palette(mrb, self)->ncolors);
+}
+static SDL_Color* sdl_palette_entry (mrb_state *mrb, mrb_value self, mrb_int index) {
+  SDL_Palette* palette = mrb_value_to_sdl_palette(mrb, self);
+  if (index < 0 || index >= palette->ncolors) mrb_raise(mrb, E_INDEX_ERROR, "palette index out of range");
+  return &palette->colors[index];
+}
+static mrb_value mrb_sdl_palette_get (mrb_state *mrb, mrb_value self) {
+  mrb_int index;
+  mrb_get_args(mrb, "i", &index);
+  SDL_Color* entry = sdl_palette_entry(mrb, self, index);
+  SDL_Color* color = (SDL_Color*) sdl_struct_alloc();
+  if ( ! color) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  *color = *entry;
+  return mrb_obj_value(Data_Wrap_Struct(mrb, sdl_color_class, &sdl_color_type, color));
+}
+static mrb_value mrb_sdl_palette_set (mrb_state *mrb, mrb_value self) {
+  mrb_int index;
+  mrb_value arg_color;
+  mrb_get_args(mrb, "io", &index, &arg_color);
+  *sdl_palette_entry(mrb, self, index) = *mrb_value_to_sdl_color(mrb, arg_color);
+  return arg_color;
+}
+static mrb_value mrb_sdl_palette_set_rgb (mrb_state *mrb, mrb_value self) {
+  mrb_int index, r, g, b;
+  mrb_get_args(mrb, "iiii", &index, &r, &g, &b);
+  SDL_Color* entry = sdl_palette_entry(mrb, self, index);
+  entry->r = r;
+  entry->g = g;
+  entry->b = b;
+  return self;
+}
+// Colors as packed SDL_Color entries, four bytes each
+static mrb_value mrb_sdl_palette_read (mrb_state *mrb, mrb_value self) {
+  SDL_Palette* palette = mrb_value_to_sdl_palette(mrb, self);
+  return mrb_str_new(mrb, (const char*) palette->colors, sizeof(SDL_Color) * palette->ncolors);
+}
+static mrb_value mrb_sdl_palette_write (mrb_state *mrb, mrb_value self) {
+  mrb_int first;
+  mrb_value data;
+  mrb_get_args(mrb, "iS", &first, &data);
+  SDL_Palette* palette = mrb_value_to_sdl_palette(mrb, self);
+  mrb_int count = RSTRING_LEN(data) / sizeof(SDL_Color);
+  if (RSTRING_LEN(data) % sizeof(SDL_Color) || first < 0 || first + count > palette->ncolors) {
+    mrb_raise(mrb, E_INDEX_ERROR, "write out of range");
+  }
+  memcpy(palette->colors + first, RSTRING_PTR(data), sizeof(SDL_Color) * count);
+  return mrb_fixnum_value(count);
+}
+// Rotate count entries from first by step places, for color cycling
+static mrb_value mrb_sdl_palette_rotate (mrb_state *mrb, mrb_value self) {
+  mrb_int first, count, step = 1;
+  mrb_get_args(mrb, "ii|i", &first, &count, &step);
+  SDL_Palette* palette = mrb_value_to_sdl_palette(mrb, self);
+  if (first < 0 || count < 0 || first + count > palette->ncolors) {
+    mrb_raise(mrb, E_INDEX_ERROR, "rotate out of range");
+  }
+  if (count < 2) return self;
+  step %= count;
+  if (step < 0) step += count;
+  if ( ! step) return self;
+
+  SDL_Color rotated[256];
+  SDL_Color* colors = palette->colors + first;
+  memcpy(rotated, colors + count - step, sizeof(SDL_Color) * step);
+  memcpy(rotated + step, colors, sizeof(SDL_Color) * (count - step));
+  memcpy(colors, rotated, sizeof(SDL_Color) * count);
   return self;
 }
 
 
 /*******************************************************************************
- * Register module
+ * RectArray class
  ******************************************************************************/
-void mrb_mruby_sdl_gem_init (mrb_state* mrb) {
-  int ai = mrb_gc_arena_save(mrb);
+static mrb_value mrb_sdl_rect_array_init (mrb_state *mrb, mrb_value self) {
+  mrb_int capacity = 16;
+
+  mrb_get_args(mrb, "|i", &capacity);
+  if (capacity < 1) capacity = 1;
+
+  mrb_sdl_rect_array* array = (mrb_sdl_rect_array*) calloc(1, sizeof(mrb_sdl_rect_array));
+  if ( ! array) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  array->rects = (SDL_Rect*) malloc(sizeof(SDL_Rect) * capacity);
+  if ( ! array->rects) {
+    free(array);
+    mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  }
+  array->capacity = capacity;
 
-  struct RClass* _class_sdl;
-  struct RClass* _class_sdl_rect;
-  struct RClass* _class_sdl_video;
-  struct RClass* _class_sdl_gl;
-  mrb_value sdl_gc_table;
-  
-  // Basic SDL setup
-  _class_sdl = mrb_define_module(mrb, "SDL");
-  mrb_define_module_function(mrb, _class_sdl, "init", mrb_sdl_init, ARGS_NONE());
-  mrb_define_module_function(mrb, _class_sdl, "init_subsystem", mrb_sdl_init_sub_system, ARGS_REQ(1));
-  mrb_define_module_function(mrb, _class_sdl, "quit", mrb_sdl_quit, ARGS_NONE());
-  mrb_define_module_function(mrb, _class_sdl, "quit_subsystem", mrb_sdl_quit_sub_system, ARGS_REQ(1));
-  mrb_define_module_function(mrb, _class_sdl, "was_init", mrb_sdl_was_init, ARGS_REQ(1));
-  mrb_define_module_function(mrb, _class_sdl, "get_error", mrb_sdl_get_error, ARGS_NONE());
-  mrb_define_module_function(mrb, _class_sdl, "set_error_by_code", mrb_sdl_error, ARGS_REQ(1));
-  mrb_define_module_function(mrb, _class_sdl, "clear_error", mrb_sdl_clear_error, ARGS_NONE());
-  mrb_gc_arena_restore(mrb, ai);
+  sdl_rect_array_free(mrb, DATA_PTR(self));
+  DATA_PTR(self) = array;
+  DATA_TYPE(self) = &sdl_rect_array_type;
+  return self;
+}
+static mrb_value mrb_sdl_rect_array_push (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_x;
+  mrb_int y = 0, w = 0, h = 0;
 
-  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "Rect", mrb->object_class);
-  mrb_define_method(mrb, _class_sdl_rect, "initialize", mrb_sdl_rect_init, ARGS_REQ(4));
-  mrb_define_method(mrb, _class_sdl_rect, "destroy", mrb_sdl_rect_destroy, ARGS_NONE());
-  mrb_gc_arena_restore(mrb, ai);
+  // Takes either an SDL::Rect or x, y, w, h
+  int argc = mrb_get_args(mrb, "o|iii", &arg_x, &y, &w, &h);
 
-  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "Color", mrb->object_class);
-  mrb_define_method(mrb, _class_sdl_rect, "initialize", mrb_sdl_color_init, ARGS_REQ(4));
-  mrb_define_method(mrb, _class_sdl_rect, "destroy", mrb_sdl_color_destroy, ARGS_NONE());
-  mrb_gc_arena_restore(mrb, ai);
+  mrb_sdl_rect_array* array = mrb_value_to_sdl_rect_array(mrb, self);
+  SDL_Rect rect;
+  if (argc == 1) {
+    rect = *mrb_value_to_sdl_rect(mrb, arg_x);
+  } else {
+    if ( ! mrb_fixnum_p(arg_x)) mrb_raise(mrb, E_TYPE_ERROR, "expected Integer");
+    rect.x = mrb_fixnum(arg_x);
+    rect.y = y;
+    rect.w = w;
+    rect.h = h;
+  }
 
-  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "Palette", mrb->object_class);
-  mrb_define_method(mrb, _class_sdl_rect, "initialize", mrb_sdl_palette_init, ARGS_REQ(2));
-  mrb_define_method(mrb, _class_sdl_rect, "destroy", mrb_sdl_palette_destroy, ARGS_NONE());
-  mrb_gc_arena_restore(mrb, ai);
+  if (array->length == array->capacity) {
+    SDL_Rect* rects = (SDL_Rect*) realloc(array->rects, sizeof(SDL_Rect) * array->capacity * 2);
+    if ( ! rects) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+    array->rects = rects;
+    array->capacity *= 2;
+  }
+  array->rects[array->length++] = rect;
+  return self;
+}
+static mrb_value mrb_sdl_rect_array_clear (mrb_state *mrb, mrb_value self) {
+  mrb_value_to_sdl_rect_array(mrb, self)->length = 0;
+  return self;
+}
+static mrb_value mrb_sdl_rect_array_length (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_rect_array(mrb, self)->length);
+}
+static mrb_value mrb_sdl_rect_array_capacity (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_rect_array(mrb, self)->capacity);
+}
 
-  // Video setup
-  _class_sdl_video = mrb_define_module_under(mrb, _class_sdl, "Video");
-  mrb_define_module_function(mrb, _class_sdl_video, "surface", mrb_sdl_get_video_surface, ARGS_NONE());
-  mrb_define_module_function(mrb, _class_sdl_video, "info", mrb_sdl_get_video_info, ARGS_NONE());
-  mrb_define_module_function(mrb, _class_sdl_video, "driver_name", mrb_sdl_video_driver_name, ARGS_REQ(2));
-  mrb_define_module_function(mrb, _class_sdl_video, "modes", mrb_sdl_video_list_modes, ARGS_NONE());
-  mrb_define_module_function(mrb, _class_sdl_video, "mode_ok", mrb_sdl_video_mode_ok, ARGS_REQ(4));
-  mrb_define_module_function(mrb, _class_sdl_video, "set_mode", mrb_sdl_video_set_mode, ARGS_REQ(4));
-  mrb_define_module_function(mrb, _class_sdl_video, "update_rect", mrb_sdl_video_update_rect, ARGS_REQ(5));
-  mrb_define_module_function(mrb, _class_sdl_video, "update_rects", mrb_sdl_video_update_rects, ARGS_REQ(3));
-  mrb_define_module_function(mrb, _class_sdl_video, "flip", mrb_sdl_video_flip, ARGS_REQ(1));
-  mrb_define_module_function(mrb, _class_sdl_video, "set_colors", mrb_sdl_video_set_colors, ARGS_REQ(4));
-  mrb_define_module_function(mrb, _class_sdl_video, "set_palette", mrb_sdl_video_set_palette, ARGS_REQ(5));
-  mrb_define_module_function(mrb, _class_sdl_video, "set_gamma", mrb_sdl_video_set_gamma, ARGS_REQ(3));
-  mrb_define_module_function(mrb, _class_sdl_video, "set_gamma_ramp", mrb_sdl_video_set_gamma_ramp, ARGS_REQ(3));
-  mrb_define_module_function(mrb, _class_sdl_video, "gamma_ramp", mrb_sdl_video_get_gamma_ramp, ARGS_REQ(3));
-  mrb_define_module_function(mrb, _class_sdl_video, "map_rgb", mrb_sdl_video_map_rgb, ARGS_REQ(4));
-  mrb_define_module_function(mrb, _class_sdl_video, "map_rgba", mrb_sdl_video_map_rgba, ARGS_REQ(5));
-  mrb_define_module_function(mrb, _class_sdl_video, "rgb", mrb_sdl_video_get_rgb, ARGS_REQ(5));
-  mrb_define_module_function(mrb, _class_sdl_video, "rgba", mrb_sdl_video_get_rgba, ARGS_REQ(6));
-  mrb_define_module_function(mrb, _class_sdl_video, "create_rgb_surface", mrb_sdl_video_create_rgb_surface, ARGS_REQ(8));
-  mrb_define_module_function(mrb, _class_sdl_video, "free_surface", mrb_sdl_video_free_surface, ARGS_REQ(1));
-  mrb_define_module_function(mrb, _class_sdl_video, "lock_surface", mrb_sdl_video_lock_surface, ARGS_REQ(1));
-  mrb_define_module_function(mrb, _class_sdl_video, "unlock_surface", mrb_sdl_video_unlock_surface, ARGS_REQ(1));
-  mrb_define_module_function(mrb, _class_sdl_video, "convert_surface", mrb_sdl_video_convert_surface, ARGS_REQ(3));
-  mrb_define_module_function(mrb, _class_sdl_video, "display_format", mrb_sdl_video_display_format, ARGS_REQ(1));
-  mrb_define_module_function(mrb, _class_sdl_video, "display_format_alpha", mrb_sdl_video_display_format_alpha, ARGS_REQ(1));
-  mrb_define_module_function(mrb, _class_sdl_video, "load_bmp", mrb_sdl_video_load_bmp, ARGS_REQ(1));
-  mrb_define_module_function(mrb, _class_sdl_video, "save_bmp", mrb_sdl_video_save_bmp, ARGS_REQ(2));
-  mrb_define_module_function(mrb, _class_sdl_video, "set_color_key", mrb_sdl_video_set_color_key, ARGS_REQ(3));
-  mrb_define_module_function(mrb, _class_sdl_video, "set_alpha", mrb_sdl_video_set_alpha, ARGS_REQ(3));
-  mrb_define_module_function(mrb, _class_sdl_video, "set_clipping_rect", mrb_sdl_video_set_clipping_rect, ARGS_REQ(2));
-  mrb_define_module_function(mrb, _class_sdl_video, "get_clipping_rect", mrb_sdl_video_get_clipping_rect, ARGS_REQ(2));
-  mrb_define_module_function(mrb, _class_sdl_video, "blit_surface", mrb_sdl_video_blit_surface, ARGS_REQ(4));
-  mrb_define_module_function(mrb, _class_sdl_video, "fill_rect", mrb_sdl_video_fill_rect, ARGS_REQ(3));
-  mrb_define_module_function(mrb, _class_sdl_video, "create_yuv_overlay", mrb_sdl_video_create_yuv_overlay, ARGS_REQ(4));
-  mrb_define_module_function(mrb, _class_sdl_video, "lock_yuv_overlay", mrb_sdl_video_lock_yuv_overlay, ARGS_REQ(1));
-  mrb_define_module_function(mrb, _class_sdl_video, "unlock_yuv_overlay", mrb_sdl_video_unlock_yuv_overlay, ARGS_REQ(1));
-  mrb_define_module_function(mrb, _class_sdl_video, "display_yuv_overlay", mrb_sdl_video_display_yuv_overlay, ARGS_REQ(2));
-  mrb_define_module_function(mrb, _class_sdl_video, "free_yuv_overlay", mrb_sdl_video_free_yuv_overlay, ARGS_REQ(1));
-  mrb_gc_arena_restore(mrb, ai);
 
-  _class_sdl_gl = mrb_define_module_under(mrb, _class_sdl, "GL");
-  mrb_define_module_function(mrb, _class_sdl_gl, "load_library", mrb_sdl_gl_load_library, ARGS_REQ(1));
-  // mrb_define_module_function(mrb, _class_sdl_gl, "proc_address", mrb_sdl_gl_get_proc_address, ARGS_REQ(1));
-  // mrb_define_module_function(mrb, _class_sdl_gl, "attribute", mrb_sdl_gl_get_attribute, ARGS_REQ(2));
-  // mrb_define_module_function(mrb, _class_sdl_gl, "set_attribute", mrb_sdl_gl_set_attribute, ARGS_REQ(2));
-  mrb_define_module_function(mrb, _class_sdl_gl, "swap_buffers", mrb_sdl_gl_swap_buffers, ARGS_NONE());
-  mrb_gc_arena_restore(mrb, ai);
+/*******************************************************************************
+ * PixelBuffer class
+ ******************************************************************************/
+static inline Uint32 sdl_read_pixel (const Uint8* p, int bytes_per_pixel) {
+  switch (bytes_per_pixel) {
+    case 1: return *p;
+    case 2: return *(const Uint16*) p;
+    case 3:
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+      return (p[0] << 16) | (p[1] << 8) | p[2];
+#else
+      return p[0] | (p[1] << 8) | (p[2] << 16);
+#endif
+    default: return *(const Uint32*) p;
+  }
+}
 
-  // Do I really need a GC table?
-  sdl_gc_table = mrb_ary_new(mrb);
-  mrb_define_const(mrb, _class_sdl, "$GC", sdl_gc_table);
+static inline void sdl_write_pixel (Uint8* p, int bytes_per_pixel, Uint32 pixel) {
+  switch (bytes_per_pixel) {
+    case 1: *p = pixel; break;
+    case 2: *(Uint16*) p = pixel; break;
+    case 3:
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+      p[0] = (pixel >> 16) & 0xff;
+      p[1] = (pixel >> 8) & 0xff;
+      p[2] = pixel & 0xff;
+#else
+      p[0] = pixel & 0xff;
+      p[1] = (pixel >> 8) & 0xff;
+      p[2] = (pixel >> 16) & 0xff;
+#endif
+      break;
+    default: *(Uint32*) p = pixel; break;
+  }
+}
+
+static Uint8* sdl_pixel_buffer_at (mrb_state *mrb, mrb_sdl_pixel_buffer* buffer, mrb_int x, mrb_int y) {
+  if (x < 0 || y < 0 || x >= buffer->width || y >= buffer->height) {
+    mrb_raise(mrb, E_INDEX_ERROR, "pixel out of range");
+  }
+  return buffer->pixels + y * buffer->pitch + x * buffer->bytes_per_pixel;
+}
+
+static mrb_value mrb_sdl_pixel_buffer_get (mrb_state *mrb, mrb_value self) {
+  mrb_int x, y;
+  mrb_get_args(mrb, "ii", &x, &y);
+  mrb_sdl_pixel_buffer* buffer = mrb_value_to_sdl_pixel_buffer(mrb, self);
+  return mrb_fixnum_value(sdl_read_pixel(sdl_pixel_buffer_at(mrb, buffer, x, y), buffer->bytes_per_pixel));
+}
+static mrb_value mrb_sdl_pixel_buffer_set (mrb_state *mrb, mrb_value self) {
+  mrb_int x, y;
+  mrb_value arg_pixel;
+  mrb_get_args(mrb, "iio", &x, &y, &arg_pixel);
+  mrb_sdl_pixel_buffer* buffer = mrb_value_to_sdl_pixel_buffer(mrb, self);
+  sdl_write_pixel(sdl_pixel_buffer_at(mrb, buffer, x, y), buffer->bytes_per_pixel, sdl_arg_uint32(mrb, arg_pixel));
+  return arg_pixel;
+}
+static mrb_value mrb_sdl_pixel_buffer_read (mrb_state *mrb, mrb_value self) {
+  mrb_int offset = 0;
+  mrb_int length = -1;
+  mrb_get_args(mrb, "|ii", &offset, &length);
+  mrb_sdl_pixel_buffer* buffer = mrb_value_to_sdl_pixel_buffer(mrb, self);
+  if (length < 0) length = buffer->length - offset;
+  if (offset < 0 || length < 0 || offset + length > buffer->length) {
+    mrb_raise(mrb, E_INDEX_ERROR, "read out of range");
+  }
+  return mrb_str_new(mrb, (const char*) buffer->pixels + offset, length);
+}
+static mrb_value mrb_sdl_pixel_buffer_write (mrb_state *mrb, mrb_value self) {
+  mrb_int offset;
+  mrb_value data;
+  mrb_get_args(mrb, "iS", &offset, &data);
+  mrb_sdl_pixel_buffer* buffer = mrb_value_to_sdl_pixel_buffer(mrb, self);
+  if (offset < 0 || offset + RSTRING_LEN(data) > buffer->length) {
+    mrb_raise(mrb, E_INDEX_ERROR, "write out of range");
+  }
+  memcpy(buffer->pixels + offset, RSTRING_PTR(data), RSTRING_LEN(data));
+  return mrb_fixnum_value(RSTRING_LEN(data));
+}
+static mrb_value mrb_sdl_pixel_buffer_length (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_pixel_buffer(mrb, self)->length);
+}
+static mrb_value mrb_sdl_pixel_buffer_pitch (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_pixel_buffer(mrb, self)->pitch);
+}
+static mrb_value mrb_sdl_pixel_buffer_width (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_pixel_buffer(mrb, self)->width);
+}
+static mrb_value mrb_sdl_pixel_buffer_height (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_pixel_buffer(mrb, self)->height);
+}
+static mrb_value mrb_sdl_pixel_buffer_bytes_per_pixel (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_pixel_buffer(mrb, self)->bytes_per_pixel);
+}
+static mrb_value mrb_sdl_pixel_buffer_valid (mrb_state *mrb, mrb_value self) {
+  if (sdl_data_p(self, &sdl_pixel_buffer_type) && ((mrb_sdl_pixel_buffer*) DATA_PTR(self))->pixels) {
+    return mrb_true_value();
+  }
+  return mrb_false_value();
+}
+
+
+/*******************************************************************************
+ * Pack class
+ *
+ * Asset packs are written once with SDL::Pack.write and then mapped. Images
+ * come back as surfaces over the mapping, and music streams straight from it,
+ * so the pack stays open until every surface made from it has been freed and
+ * every music closed.
+ ******************************************************************************/
+static void sdl_pack_free (mrb_state *mrb, void *p) {
+  if ( ! p) return;
+  sdl_pack_close((sdl_pack*) p);
+  free(p);
+}
+
+static const struct mrb_data_type sdl_pack_type = {
+  "SDL::Pack", sdl_pack_free,
+};
+
+static sdl_pack* mrb_value_to_sdl_pack (mrb_state *mrb, mrb_value self) {
+  if ( ! sdl_data_p(self, &sdl_pack_type)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");
+  }
+  sdl_pack* pack = (sdl_pack*) DATA_PTR(self);
+  if ( ! pack->base) mrb_raise(mrb, E_RUNTIME_ERROR, "pack is closed");
+  return pack;
+}
+
+static int sdl_pack_lookup (mrb_state *mrb, mrb_value self, mrb_value name) {
+  sdl_pack* pack = mrb_value_to_sdl_pack(mrb, self);
+  if ( ! mrb_string_p(name)) mrb_raise(mrb, E_TYPE_ERROR, "expected String");
+  return sdl_pack_find(pack, RSTRING_PTR(name), RSTRING_LEN(name));
 }
 
-void mrb_mruby_uv_gem_final (mrb_state* mrb) {}
\ No newline at end of file
+static mrb_value mrb_sdl_pack_init (mrb_state *mrb, mrb_value self) {
+  char* path;
+  mrb_get_args(mrb, "z", &path);
+
+  sdl_pack* pack = (sdl_pack*) malloc(sizeof(sdl_pack));
+  if ( ! pack) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  if (sdl_pack_open(pack, path) < 0) {
+    free(pack);
+    mrb_raise(mrb, E_RUNTIME_ERROR, SDL_GetError());
+  }
+
+  sdl_pack_free(mrb, DATA_PTR(self));
+  DATA_PTR(self) = pack;
+  DATA_TYPE(self) = &sdl_pack_type;
+  return self;
+}
+static mrb_value mrb_sdl_pack_write (mrb_state *mrb, mrb_value self) {
+  char* path;
+  mrb_value arg_entries;
+  int i;
+
+  mrb_get_args(mrb, "zA", &path, &arg_entries);
+
+  // Check every entry before allocating, since unwrapping a bad one raises
+  mrb_int length = RARRAY_LEN(arg_entries);
+  if (length < 0 || length > INT_MAX || (size_t) length > SIZE_MAX / sizeof(sdl_pack_item)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "too many pack entries");
+  }
+  int count = (int) length;
+  for (i = 0; i < count; i++) {
+    mrb_value pair = RARRAY_PTR(arg_entries)[i];
+    if ( ! mrb_array_p(pair) || RARRAY_LEN(pair) != 2 || ! mrb_string_p(RARRAY_PTR(pair)[0])) {
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "entries must be [name, surface or String] pairs");
+    }
+    if ( ! mrb_string_p(RARRAY_PTR(pair)[1])) mrb_value_to_sdl_surface(mrb, RARRAY_PTR(pair)[1]);
+  }
+
+  size_t capacity = count > 0 ? (size_t) count : 1;
+  sdl_pack_item* items = (sdl_pack_item*) calloc(capacity, sizeof(sdl_pack_item));
+  if ( ! items) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  for (i = 0; i < count; i++) {
+    mrb_value name = RARRAY_PTR(RARRAY_PTR(arg_entries)[i])[0];
+    mrb_value value = RARRAY_PTR(RARRAY_PTR(arg_entries)[i])[1];
+    items[i].name = RSTRING_PTR(name);
+    items[i].name_length = RSTRING_LEN(name);
+    if (mrb_string_p(value)) {
+      items[i].data = RSTRING_PTR(value);
+      items[i].length = RSTRING_LEN(value);
+    } else {
+      items[i].surface = mrb_value_to_sdl_surface(mrb, value);
+    }
+  }
+
+  // Queued blits may still be drawing into the images
+  sdl_video_sync();
+  int result = sdl_pack_write(path, items, count);
+  free(items);
+  if (result < 0) mrb_raise(mrb, E_RUNTIME_ERROR, SDL_GetError());
+  return mrb_fixnum_value(count);
+}
+static mrb_value mrb_sdl_pack_surface (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_name;
+  mrb_get_args(mrb, "S", &arg_name);
+
+  int index = sdl_pack_lookup(mrb, self, arg_name);
+  if (index < 0) return mrb_nil_value();
+  SDL_Surface* surface = sdl_pack_surface(mrb_value_to_sdl_pack(mrb, self), index);
+  if ( ! surface) mrb_raise(mrb, E_RUNTIME_ERROR, SDL_GetError());
+  sdl_borrow_pixels(mrb, surface, self);
+  return sdl_owned_surface_to_mrb_value(mrb, self, surface);
+}
+static mrb_value mrb_sdl_pack_load_bmp (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_name;
+  mrb_get_args(mrb, "S", &arg_name);
+
+  int index = sdl_pack_lookup(mrb, self, arg_name);
+  if (index < 0) return mrb_nil_value();
+  SDL_RWops* rw = sdl_pack_rwops(mrb_value_to_sdl_pack(mrb, self), index);
+  if ( ! rw) mrb_raise(mrb, E_RUNTIME_ERROR, SDL_GetError());
+  return sdl_owned_surface_to_mrb_value(mrb, self, SDL_LoadBMP_RW(rw, 1));
+}
+static mrb_value mrb_sdl_pack_read (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_name;
+  mrb_get_args(mrb, "S", &arg_name);
+
+  int index = sdl_pack_lookup(mrb, self, arg_name);
+  if (index < 0) return mrb_nil_value();
+  sdl_pack* pack = mrb_value_to_sdl_pack(mrb, self);
+  const sdl_pack_entry* entry = &pack->entries[index];
+  return mrb_str_new(mrb, (const char*) pack->base + entry->data_offset, entry->data_length);
+}
+static mrb_value mrb_sdl_pack_include (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_name;
+  mrb_get_args(mrb, "S", &arg_name);
+  return sdl_pack_lookup(mrb, self, arg_name) < 0 ? mrb_false_value() : mrb_true_value();
+}
+static mrb_value mrb_sdl_pack_names (mrb_state *mrb, mrb_value self) {
+  sdl_pack* pack = mrb_value_to_sdl_pack(mrb, self);
+  mrb_value names = mrb_ary_new_capa(mrb, pack->header->count);
+  Uint32 i;
+  for (i = 0; i < pack->header->count; i++) {
+    const sdl_pack_entry* entry = &pack->entries[i];
+    mrb_ary_push(mrb, names, mrb_str_new(mrb, pack->names + entry->name_offset, entry->name_length));
+  }
+  return names;
+}
+static mrb_value mrb_sdl_pack_length (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_pack(mrb, self)->header->count);
+}
+static mrb_value mrb_sdl_pack_close (mrb_state *mrb, mrb_value self) {
+  sdl_pack* pack = mrb_value_to_sdl_pack(mrb, self);
+  if (sdl_borrowed_from(self)) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "pack still has surfaces or music; free or close them first");
+  }
+  sdl_pack_close(pack);
+  return mrb_nil_value();
+}
+
+
+/*******************************************************************************
+ * Atlas class
+ *
+ * An atlas copies small surfaces onto shared pages as they are added and
+ * hands back an SDL::AtlasRegion for each, which blit_surface and blit_batch
+ * take in place of a source surface. Drawing many sprites from one page keeps
+ * the blits reading the same surface instead of hopping between dozens.
+ ******************************************************************************/
+static void sdl_atlas_free (mrb_state *mrb, void *p) {
+  sdl_atlas* atlas = (sdl_atlas*) p;
+  int i;
+  if ( ! atlas) return;
+  // Queued blits may still be reading the pages
+  sdl_video_sync();
+  for (i = 0; i < atlas->page_count; i++) {
+    sdl_surface_unmap(mrb, atlas->pages[i].surface);
+  }
+  sdl_atlas_destroy(atlas);
+  free(p);
+}
+
+static const struct mrb_data_type sdl_atlas_type = {
+  "SDL::Atlas", sdl_atlas_free,
+};
+
+static sdl_atlas* mrb_value_to_sdl_atlas (mrb_state *mrb, mrb_value self) {
+  if ( ! sdl_data_p(self, &sdl_atlas_type)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");
+  }
+  return (sdl_atlas*) DATA_PTR(self);
+}
+
+static mrb_value mrb_sdl_atlas_init (mrb_state *mrb, mrb_value self) {
+  mrb_int width = 1024;
+  mrb_int height = 1024;
+  mrb_int padding = 1;
+  mrb_get_args(mrb, "|iii", &width, &height, &padding);
+
+  if (width <= 0 || height <= 0 || width > 0x7fff || height > 0x7fff) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "atlas pages must be 1 to 32767 pixels a side");
+  }
+  if (padding < 0) mrb_raise(mrb, E_ARGUMENT_ERROR, "padding can't be negative");
+
+  sdl_atlas* atlas = (sdl_atlas*) malloc(sizeof(sdl_atlas));
+  if ( ! atlas) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  sdl_atlas_init(atlas, width, height, padding);
+
+  sdl_atlas_free(mrb, DATA_PTR(self));
+  DATA_PTR(self) = atlas;
+  DATA_TYPE(self) = &sdl_atlas_type;
+  return self;
+}
+static mrb_value mrb_sdl_atlas_add (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_surface;
+  mrb_get_args(mrb, "o", &arg_surface);
+
+  sdl_atlas* atlas = mrb_value_to_sdl_atlas(mrb, self);
+  SDL_Surface* surface = mrb_value_to_sdl_surface(mrb, arg_surface);
+  mrb_sdl_atlas_region* region = (mrb_sdl_atlas_region*) malloc(sizeof(mrb_sdl_atlas_region));
+  if ( ! region) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+
+  // Queued blits may still be drawing into the image
+  sdl_video_sync();
+  region->page_index = sdl_atlas_insert(atlas, surface, &region->rect);
+  if (region->page_index < 0) {
+    free(region);
+    mrb_raise(mrb, E_RUNTIME_ERROR, SDL_GetError());
+  }
+  region->page = atlas->pages[region->page_index].surface;
+  sdl_convert_cache_forget(&sdl_video_conversions, region->page);
+
+  mrb_value value = mrb_obj_value(Data_Wrap_Struct(mrb, sdl_atlas_region_class, &sdl_atlas_region_type, region));
+  mrb_iv_set(mrb, value, mrb_intern(mrb, "atlas"), self);
+  return value;
+}
+static mrb_value mrb_sdl_atlas_page_count (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_atlas(mrb, self)->page_count);
+}
+// Pages belong to the atlas; blit from them, but don't free them
+static mrb_value mrb_sdl_atlas_page (mrb_state *mrb, mrb_value self) {
+  mrb_int index;
+  mrb_get_args(mrb, "i", &index);
+  sdl_atlas* atlas = mrb_value_to_sdl_atlas(mrb, self);
+  if (index < 0 || index >= atlas->page_count) return mrb_nil_value();
+  return sdl_surface_to_mrb_value(mrb, self, atlas->pages[index].surface);
+}
+static mrb_value mrb_sdl_atlas_occupancy (mrb_state *mrb, mrb_value self) {
+  return mrb_float_value(sdl_atlas_occupancy(mrb_value_to_sdl_atlas(mrb, self)));
+}
+
+
+/*******************************************************************************
+ * AtlasRegion class
+ ******************************************************************************/
+static mrb_value mrb_sdl_atlas_region_x (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_atlas_region(mrb, self)->rect.x);
+}
+static mrb_value mrb_sdl_atlas_region_y (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_atlas_region(mrb, self)->rect.y);
+}
+static mrb_value mrb_sdl_atlas_region_w (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_atlas_region(mrb, self)->rect.w);
+}
+static mrb_value mrb_sdl_atlas_region_h (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_atlas_region(mrb, self)->rect.h);
+}
+static mrb_value mrb_sdl_atlas_region_page_index (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_atlas_region(mrb, self)->page_index);
+}
+static mrb_value mrb_sdl_atlas_region_surface (mrb_state *mrb, mrb_value self) {
+  return sdl_surface_to_mrb_value(mrb, self, mrb_value_to_sdl_atlas_region(mrb, self)->page);
+}
+
+
+/*******************************************************************************
+ * SurfacePool class
+ *
+ * Hands out scratch surfaces and takes them back for reuse, so a surface
+ * needed every frame isn't allocated and freed every frame:
+ *
+ *   scratch = pool.acquire(0, 256, 256, 32, rmask, gmask, bmask, 0)
+ *   ...
+ *   pool.release(scratch)
+ *
+ * acquire takes the same arguments as create_rgb_surface. A recycled
+ * surface keeps its old pixels. Released wrappers can't be used again.
+ ******************************************************************************/
+static void sdl_surface_pool_free (mrb_state *mrb, void *p) {
+  if ( ! p) return;
+  // Queued blits may still be reading pooled surfaces
+  sdl_video_sync();
+  sdl_surface_pool_destroy((sdl_surface_pool*) p);
+  free(p);
+}
+
+static const struct mrb_data_type sdl_surface_pool_type = {
+  "SDL::SurfacePool", sdl_surface_pool_free,
+};
+
+static sdl_surface_pool* mrb_value_to_sdl_surface_pool (mrb_state *mrb, mrb_value self) {
+  if ( ! sdl_data_p(self, &sdl_surface_pool_type)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");
+  }
+  return (sdl_surface_pool*) DATA_PTR(self);
+}
+
+// SurfacePool.new(capacity = 32), the most surfaces it holds on to
+static mrb_value mrb_sdl_surface_pool_init (mrb_state *mrb, mrb_value self) {
+  mrb_int capacity = 32;
+  mrb_get_args(mrb, "|i", &capacity);
+  if (capacity < 1) mrb_raise(mrb, E_ARGUMENT_ERROR, "capacity must be at least 1");
+
+  sdl_surface_pool* pool = (sdl_surface_pool*) malloc(sizeof(sdl_surface_pool));
+  if ( ! pool || sdl_surface_pool_init(pool, capacity) < 0) {
+    free(pool);
+    mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  }
+
+  sdl_surface_pool_free(mrb, DATA_PTR(self));
+  DATA_PTR(self) = pool;
+  DATA_TYPE(self) = &sdl_surface_pool_type;
+  return self;
+}
+static mrb_value mrb_sdl_surface_pool_acquire (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_flags;
+  mrb_int width;
+  mrb_int height;
+  mrb_int depth;
+  mrb_value arg_r_mask;
+  mrb_value arg_g_mask;
+  mrb_value arg_b_mask;
+  mrb_value arg_a_mask;
+
+  mrb_get_args(mrb, "oiiioooo", &arg_flags, &width, &height, &depth,
+    &arg_r_mask, &arg_g_mask, &arg_b_mask, &arg_a_mask);
+
+  SDL_Surface* surface = sdl_surface_pool_acquire(mrb_value_to_sdl_surface_pool(mrb, self),
+    sdl_arg_uint32(mrb, arg_flags), width, height, depth,
+    sdl_arg_uint32(mrb, arg_r_mask), sdl_arg_uint32(mrb, arg_g_mask),
+    sdl_arg_uint32(mrb, arg_b_mask), sdl_arg_uint32(mrb, arg_a_mask));
+  return sdl_owned_surface_to_mrb_value(mrb, self, surface);
+}
+// Returns true if the pool kept the surface, false if it was freed instead
+static mrb_value mrb_sdl_surface_pool_release (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_surface;
+  mrb_get_args(mrb, "o", &arg_surface);
+
+  sdl_surface_pool* pool = mrb_value_to_sdl_surface_pool(mrb, self);
+  mrb_sdl_context* context = sdl_context_get(mrb, arg_surface);
+  if ( ! context || ! context->any.surface) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "surface has been freed");
+  }
+  if ( ! context->owned) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "can't release a surface the gem doesn't own");
+  }
+
+  SDL_Surface* surface = context->any.surface;
+  context->any.surface = NULL;
+  context->owned = 0;
+
+  sdl_video_sync();
+  sdl_convert_cache_release(&sdl_video_conversions, surface);
+  if (sdl_surface_pool_release(pool, surface) < 0) {
+    sdl_surface_free(mrb, surface);
+    return mrb_false_value();
+  }
+  return mrb_true_value();
+}
+static mrb_value mrb_sdl_surface_pool_size (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_surface_pool(mrb, self)->count);
+}
+static mrb_value mrb_sdl_surface_pool_capacity (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_surface_pool(mrb, self)->capacity);
+}
+static mrb_value mrb_sdl_surface_pool_clear (mrb_state *mrb, mrb_value self) {
+  sdl_surface_pool* pool = mrb_value_to_sdl_surface_pool(mrb, self);
+  sdl_video_sync();
+  sdl_surface_pool_clear(pool);
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_surface_pool_stats (mrb_state *mrb, mrb_value self) {
+  sdl_surface_pool* pool = mrb_value_to_sdl_surface_pool(mrb, self);
+  mrb_value stats = mrb_hash_new(mrb);
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern(mrb, "hits")), mrb_fixnum_value(pool->hits));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern(mrb, "misses")), mrb_fixnum_value(pool->misses));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern(mrb, "pooled")), mrb_fixnum_value(pool->count));
+  return stats;
+}
+
+
+/*******************************************************************************
+ * Events
+ *
+ * SDL::EventRing drains SDL's queue into a fixed native buffer. Events are
+ * read in place, either by index on the ring or through the one SDL::Event
+ * cursor each ring owns, so handling a frame's input allocates nothing.
+ * Fields an event doesn't have read as nil.
+ ******************************************************************************/
+typedef struct {
+  sdl_event_ring* ring;
+  int index;
+} mrb_sdl_event_cursor;
+
+static void sdl_event_ring_free (mrb_state *mrb, void *p) {
+  if ( ! p) return;
+  sdl_event_ring_destroy((sdl_event_ring*) p);
+  free(p);
+}
+
+static void sdl_event_cursor_free (mrb_state *mrb, void *p) {
+  free(p);
+}
+
+static const struct mrb_data_type sdl_event_ring_type = {
+  "SDL::EventRing", sdl_event_ring_free,
+};
+
+static const struct mrb_data_type sdl_event_cursor_type = {
+  "SDL::Event", sdl_event_cursor_free,
+};
+
+static struct RClass* sdl_event_cursor_class = NULL;
+
+static sdl_event_ring* mrb_value_to_sdl_event_ring (mrb_state *mrb, mrb_value self) {
+  if ( ! sdl_data_p(self, &sdl_event_ring_type)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");
+  }
+  return (sdl_event_ring*) DATA_PTR(self);
+}
+
+static mrb_sdl_event_cursor* sdl_event_ring_cursor (mrb_state *mrb, mrb_value self) {
+  mrb_value cursor = mrb_iv_get(mrb, self, mrb_intern(mrb, "cursor"));
+  if ( ! sdl_data_p(cursor, &sdl_event_cursor_type)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");
+  }
+  return (mrb_sdl_event_cursor*) DATA_PTR(cursor);
+}
+
+// Field readers are shared: on a cursor they read its event, on a ring they
+// take the index of the event to read
+static SDL_Event* sdl_event_arg (mrb_state *mrb, mrb_value self) {
+  sdl_event_ring* ring;
+  mrb_int index;
+  if (sdl_data_p(self, &sdl_event_cursor_type)) {
+    mrb_sdl_event_cursor* cursor = (mrb_sdl_event_cursor*) DATA_PTR(self);
+    ring = cursor->ring;
+    index = cursor->index;
+  } else {
+    mrb_get_args(mrb, "i", &index);
+    ring = mrb_value_to_sdl_event_ring(mrb, self);
+    if (index < 0) index += ring->count;
+  }
+  SDL_Event* event = sdl_event_ring_at(ring, index);
+  if ( ! event) mrb_raise(mrb, E_INDEX_ERROR, "event no longer buffered");
+  return event;
+}
+
+static mrb_value mrb_sdl_event_ring_init (mrb_state *mrb, mrb_value self) {
+  mrb_int capacity = 256;
+  mrb_get_args(mrb, "|i", &capacity);
+  if (capacity <= 0) mrb_raise(mrb, E_ARGUMENT_ERROR, "capacity must be positive");
+
+  sdl_event_ring* ring = (sdl_event_ring*) malloc(sizeof(sdl_event_ring));
+  if ( ! ring || sdl_event_ring_init(ring, capacity) < 0) {
+    free(ring);
+    mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  }
+  sdl_event_ring_free(mrb, DATA_PTR(self));
+  DATA_PTR(self) = ring;
+  DATA_TYPE(self) = &sdl_event_ring_type;
+
+  // Re-initialising keeps the existing cursor pointed at the new buffer
+  mrb_value value = mrb_iv_get(mrb, self, mrb_intern(mrb, "cursor"));
+  mrb_sdl_event_cursor* cursor;
+  if (sdl_data_p(value, &sdl_event_cursor_type)) {
+    cursor = (mrb_sdl_event_cursor*) DATA_PTR(value);
+  } else {
+    cursor = (mrb_sdl_event_cursor*) malloc(sizeof(mrb_sdl_event_cursor));
+    if ( ! cursor) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+    value = mrb_obj_value(Data_Wrap_Struct(mrb, sdl_event_cursor_class, &sdl_event_cursor_type, cursor));
+    mrb_iv_set(mrb, value, mrb_intern(mrb, "ring"), self);
+    mrb_iv_set(mrb, self, mrb_intern(mrb, "cursor"), value);
+  }
+  cursor->ring = ring;
+  cursor->index = 0;
+  return self;
+}
+static mrb_value mrb_sdl_event_ring_pump (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_mask = mrb_nil_value();
+  mrb_get_args(mrb, "|o", &arg_mask);
+  Uint32 mask = mrb_nil_p(arg_mask) ? SDL_ALLEVENTS : sdl_arg_uint32(mrb, arg_mask);
+  int added = sdl_event_ring_drain(mrb_value_to_sdl_event_ring(mrb, self), mask);
+  if (added < 0) mrb_raise(mrb, E_RUNTIME_ERROR, SDL_GetError());
+  return mrb_fixnum_value(added);
+}
+static mrb_value mrb_sdl_event_ring_length (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_event_ring(mrb, self)->count);
+}
+static mrb_value mrb_sdl_event_ring_capacity (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_event_ring(mrb, self)->capacity);
+}
+static mrb_value mrb_sdl_event_ring_discard (mrb_state *mrb, mrb_value self) {
+  mrb_int count = 1;
+  mrb_get_args(mrb, "|i", &count);
+  sdl_event_ring_discard(mrb_value_to_sdl_event_ring(mrb, self), count);
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_event_ring_clear (mrb_state *mrb, mrb_value self) {
+  sdl_event_ring* ring = mrb_value_to_sdl_event_ring(mrb, self);
+  sdl_event_ring_discard(ring, ring->count);
+  return mrb_nil_value();
+}
+// Points the ring's cursor at an event and returns it. Every call returns
+// the same object, so keep the index, not the cursor, to come back later.
+static mrb_value mrb_sdl_event_ring_at (mrb_state *mrb, mrb_value self) {
+  mrb_int index;
+  mrb_get_args(mrb, "i", &index);
+  sdl_event_ring* ring = mrb_value_to_sdl_event_ring(mrb, self);
+  if (index < 0) index += ring->count;
+  if (index < 0 || index >= ring->count) return mrb_nil_value();
+  sdl_event_ring_cursor(mrb, self)->index = index;
+  return mrb_iv_get(mrb, self, mrb_intern(mrb, "cursor"));
+}
+// Yields the cursor at each buffered event, oldest first, consuming them as
+// it goes. Events the block discards itself aren't consumed twice.
+static mrb_value mrb_sdl_event_ring_each (mrb_state *mrb, mrb_value self) {
+  mrb_value block;
+  int delivered = 0;
+  mrb_get_args(mrb, "&", &block);
+
+  sdl_event_ring* ring = mrb_value_to_sdl_event_ring(mrb, self);
+  mrb_sdl_event_cursor* cursor = sdl_event_ring_cursor(mrb, self);
+  mrb_value value = mrb_iv_get(mrb, self, mrb_intern(mrb, "cursor"));
+  while (ring->count > 0) {
+    int head = ring->head;
+    cursor->index = 0;
+    mrb_yield(mrb, block, value);
+    if (ring->count > 0 && ring->head == head) sdl_event_ring_discard(ring, 1);
+    delivered++;
+  }
+  return mrb_fixnum_value(delivered);
+}
+
+static mrb_value mrb_sdl_event_type (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(sdl_event_arg(mrb, self)->type);
+}
+static mrb_value mrb_sdl_event_which (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  switch (event->type) {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP: return mrb_fixnum_value(event->key.which);
+    case SDL_MOUSEMOTION: return mrb_fixnum_value(event->motion.which);
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP: return mrb_fixnum_value(event->button.which);
+    case SDL_JOYAXISMOTION: return mrb_fixnum_value(event->jaxis.which);
+    case SDL_JOYBALLMOTION: return mrb_fixnum_value(event->jball.which);
+    case SDL_JOYHATMOTION: return mrb_fixnum_value(event->jhat.which);
+    case SDL_JOYBUTTONDOWN:
+    case SDL_JOYBUTTONUP: return mrb_fixnum_value(event->jbutton.which);
+  }
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_event_state (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  switch (event->type) {
+    case SDL_ACTIVEEVENT: return mrb_fixnum_value(event->active.state);
+    case SDL_KEYDOWN:
+    case SDL_KEYUP: return mrb_fixnum_value(event->key.state);
+    case SDL_MOUSEMOTION: return mrb_fixnum_value(event->motion.state);
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP: return mrb_fixnum_value(event->button.state);
+    case SDL_JOYBUTTONDOWN:
+    case SDL_JOYBUTTONUP: return mrb_fixnum_value(event->jbutton.state);
+  }
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_event_gain (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  if (event->type != SDL_ACTIVEEVENT) return mrb_nil_value();
+  return mrb_fixnum_value(event->active.gain);
+}
+static mrb_value mrb_sdl_event_scancode (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  if (event->type != SDL_KEYDOWN && event->type != SDL_KEYUP) return mrb_nil_value();
+  return mrb_fixnum_value(event->key.keysym.scancode);
+}
+static mrb_value mrb_sdl_event_sym (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  if (event->type != SDL_KEYDOWN && event->type != SDL_KEYUP) return mrb_nil_value();
+  return mrb_fixnum_value(event->key.keysym.sym);
+}
+static mrb_value mrb_sdl_event_mod (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  if (event->type != SDL_KEYDOWN && event->type != SDL_KEYUP) return mrb_nil_value();
+  return mrb_fixnum_value(event->key.keysym.mod);
+}
+static mrb_value mrb_sdl_event_unicode (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  if (event->type != SDL_KEYDOWN && event->type != SDL_KEYUP) return mrb_nil_value();
+  return mrb_fixnum_value(event->key.keysym.unicode);
+}
+static mrb_value mrb_sdl_event_x (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  switch (event->type) {
+    case SDL_MOUSEMOTION: return mrb_fixnum_value(event->motion.x);
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP: return mrb_fixnum_value(event->button.x);
+  }
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_event_y (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  switch (event->type) {
+    case SDL_MOUSEMOTION: return mrb_fixnum_value(event->motion.y);
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP: return mrb_fixnum_value(event->button.y);
+  }
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_event_xrel (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  switch (event->type) {
+    case SDL_MOUSEMOTION: return mrb_fixnum_value(event->motion.xrel);
+    case SDL_JOYBALLMOTION: return mrb_fixnum_value(event->jball.xrel);
+  }
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_event_yrel (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  switch (event->type) {
+    case SDL_MOUSEMOTION: return mrb_fixnum_value(event->motion.yrel);
+    case SDL_JOYBALLMOTION: return mrb_fixnum_value(event->jball.yrel);
+  }
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_event_button (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  switch (event->type) {
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP: return mrb_fixnum_value(event->button.button);
+    case SDL_JOYBUTTONDOWN:
+    case SDL_JOYBUTTONUP: return mrb_fixnum_value(event->jbutton.button);
+  }
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_event_axis (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  if (event->type != SDL_JOYAXISMOTION) return mrb_nil_value();
+  return mrb_fixnum_value(event->jaxis.axis);
+}
+static mrb_value mrb_sdl_event_ball (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  if (event->type != SDL_JOYBALLMOTION) return mrb_nil_value();
+  return mrb_fixnum_value(event->jball.ball);
+}
+static mrb_value mrb_sdl_event_hat (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  if (event->type != SDL_JOYHATMOTION) return mrb_nil_value();
+  return mrb_fixnum_value(event->jhat.hat);
+}
+static mrb_value mrb_sdl_event_value (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  switch (event->type) {
+    case SDL_JOYAXISMOTION: return mrb_fixnum_value(event->jaxis.value);
+    case SDL_JOYHATMOTION: return mrb_fixnum_value(event->jhat.value);
+  }
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_event_w (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  if (event->type != SDL_VIDEORESIZE) return mrb_nil_value();
+  return mrb_fixnum_value(event->resize.w);
+}
+static mrb_value mrb_sdl_event_h (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  if (event->type != SDL_VIDEORESIZE) return mrb_nil_value();
+  return mrb_fixnum_value(event->resize.h);
+}
+static mrb_value mrb_sdl_event_code (mrb_state *mrb, mrb_value self) {
+  SDL_Event* event = sdl_event_arg(mrb, self);
+  if (event->type < SDL_USEREVENT) return mrb_nil_value();
+  return mrb_fixnum_value(event->user.code);
+}
+// Filtering happens as SDL takes events in, before they reach its queue.
+// Masks are bit sets of 1 << type.
+static mrb_value mrb_sdl_events_set_filter (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_drop;
+  mrb_value arg_coalesce = mrb_nil_value();
+  mrb_get_args(mrb, "o|o", &arg_drop, &arg_coalesce);
+
+  Uint32 drop = mrb_nil_p(arg_drop) ? 0 : sdl_arg_uint32(mrb, arg_drop);
+  Uint32 coalesce = mrb_nil_p(arg_coalesce) ? 0 : sdl_arg_uint32(mrb, arg_coalesce);
+  if (sdl_event_filter_install(drop, coalesce) < 0) mrb_raise(mrb, E_RUNTIME_ERROR, SDL_GetError());
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_events_clear_filter (mrb_state *mrb, mrb_value self) {
+  sdl_event_filter_remove();
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_events_filter_stats (mrb_state *mrb, mrb_value self) {
+  sdl_event_filter_stats stats;
+  sdl_event_filter_stats_get(&stats);
+  mrb_value hash = mrb_hash_new(mrb);
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "dropped")), mrb_fixnum_value(stats.dropped));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "coalesced")), mrb_fixnum_value(stats.coalesced));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "lost")), mrb_fixnum_value(stats.lost));
+  return hash;
+}
+
+static mrb_value mrb_sdl_event_index (mrb_state *mrb, mrb_value self) {
+  if ( ! sdl_data_p(self, &sdl_event_cursor_type)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");
+  }
+  return mrb_fixnum_value(((mrb_sdl_event_cursor*) DATA_PTR(self))->index);
+}
+
+
+/*******************************************************************************
+ * Audio module
+ *
+ * The device plays from a lock-free ring. Ruby queues PCM from the main loop
+ * and SDL's callback copies it out on the audio thread without ever entering
+ * the interpreter; when the ring runs dry the callback plays silence and
+ * counts an underrun.
+ ******************************************************************************/
+static sdl_audio_device* sdl_audio_get (mrb_state *mrb) {
+  if ( ! sdl_audio_output.open) mrb_raise(mrb, E_RUNTIME_ERROR, "audio is not open");
+  return &sdl_audio_output;
+}
+
+static mrb_value mrb_sdl_audio_open (mrb_state *mrb, mrb_value self) {
+  mrb_int freq, format, channels, samples;
+  mrb_int ring_bytes = 0;
+  mrb_get_args(mrb, "iiii|i", &freq, &format, &channels, &samples, &ring_bytes);
+
+  if (sdl_audio_output.open) mrb_raise(mrb, E_RUNTIME_ERROR, "audio is already open");
+  if (ring_bytes < 0) mrb_raise(mrb, E_ARGUMENT_ERROR, "ring size can't be negative");
+
+  SDL_AudioSpec desired;
+  memset(&desired, 0, sizeof(SDL_AudioSpec));
+  desired.freq = freq;
+  desired.format = format;
+  desired.channels = channels;
+  desired.samples = samples;
+  if (sdl_audio_open(&sdl_audio_output, &desired, ring_bytes) < 0) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, SDL_GetError());
+  }
+
+  // Report what the device actually gave us
+  SDL_AudioSpec* spec = &sdl_audio_output.spec;
+  mrb_value hash = mrb_hash_new(mrb);
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "freq")), mrb_fixnum_value(spec->freq));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "format")), mrb_fixnum_value(spec->format));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "channels")), mrb_fixnum_value(spec->channels));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "samples")), mrb_fixnum_value(spec->samples));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "size")), mrb_fixnum_value(spec->size));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "ring")), mrb_fixnum_value(sdl_audio_output.ring.capacity));
+  return hash;
+}
+static mrb_value mrb_sdl_audio_close (mrb_state *mrb, mrb_value self) {
+  sdl_audio_close(&sdl_audio_output);
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_audio_pause (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_paused;
+  mrb_get_args(mrb, "o", &arg_paused);
+  sdl_audio_get(mrb);
+  SDL_PauseAudio(mrb_test(arg_paused));
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_audio_status (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(SDL_GetAudioStatus());
+}
+// Queue PCM in the device format. offset and length pick a slice of the
+// String without copying it into a new one first. Returns the bytes taken;
+// whatever didn't fit is dropped and counted as an overrun.
+static mrb_value mrb_sdl_audio_queue (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_data;
+  mrb_int offset = 0;
+  mrb_int length = -1;
+  mrb_get_args(mrb, "S|ii", &arg_data, &offset, &length);
+
+  sdl_audio_device* device = sdl_audio_get(mrb);
+  if (length < 0) length = RSTRING_LEN(arg_data) - offset;
+  if (offset < 0 || length < 0 || offset + length > RSTRING_LEN(arg_data)) {
+    mrb_raise(mrb, E_INDEX_ERROR, "slice out of range");
+  }
+  return mrb_fixnum_value(sdl_audio_ring_write(&device->ring, RSTRING_PTR(arg_data) + offset, length));
+}
+static mrb_value mrb_sdl_audio_queued (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(sdl_audio_ring_used(&sdl_audio_get(mrb)->ring));
+}
+static mrb_value mrb_sdl_audio_space (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(sdl_audio_ring_space(&sdl_audio_get(mrb)->ring));
+}
+static mrb_value mrb_sdl_audio_capacity (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(sdl_audio_get(mrb)->ring.capacity);
+}
+static mrb_value mrb_sdl_audio_stats (mrb_state *mrb, mrb_value self) {
+  sdl_audio_ring* ring = &sdl_audio_get(mrb)->ring;
+  mrb_value hash = mrb_hash_new(mrb);
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "underruns")), mrb_fixnum_value(ring->underruns));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "underrun_bytes")), mrb_fixnum_value(ring->underrun_bytes));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "overruns")), mrb_fixnum_value(ring->overruns));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "overrun_bytes")), mrb_fixnum_value(ring->overrun_bytes));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "queued")), mrb_fixnum_value(sdl_audio_ring_used(ring)));
+  return hash;
+}
+
+
+/*******************************************************************************
+ * Mixer module
+ *
+ * Plays preloaded sounds on a fixed set of voices, mixed natively inside the
+ * audio callback over whatever the ring supplies. Play, stop, volume and
+ * loop changes are queued for the audio thread and return straight away;
+ * they report false only if the command queue was full.
+ ******************************************************************************/
+static sdl_mixer* sdl_mixer_get (mrb_state *mrb) {
+  sdl_mixer* mixer = sdl_audio_get(mrb)->mixer;
+  if ( ! mixer) mrb_raise(mrb, E_RUNTIME_ERROR, "mixer is not open");
+  return mixer;
+}
+
+static int sdl_mixer_voice_arg (mrb_state *mrb, sdl_mixer* mixer, mrb_int voice) {
+  if (voice < 0 || voice >= mixer->voice_count) mrb_raise(mrb, E_INDEX_ERROR, "no such voice");
+  return voice;
+}
+
+// Volume 0.0 to 1.0 and pan -1.0 (left) to 1.0 (right) as Q15 gains
+static void sdl_mixer_gains (mrb_float volume, mrb_float pan, sdl_mixer_command* command) {
+  if (volume < 0) volume = 0;
+  if (volume > 1) volume = 1;
+  if (pan < -1) pan = -1;
+  if (pan > 1) pan = 1;
+  command->gain_left = (Sint16) (32767 * volume * (pan > 0 ? 1 - pan : 1));
+  command->gain_right = (Sint16) (32767 * volume * (pan < 0 ? 1 + pan : 1));
+}
+
+static mrb_value sdl_mixer_send_value (sdl_mixer* mixer, sdl_mixer_command* command) {
+  return sdl_mixer_send(mixer, command) < 0 ? mrb_false_value() : mrb_true_value();
+}
+
+static mrb_value mrb_sdl_mixer_open (mrb_state *mrb, mrb_value self) {
+  mrb_int voices = 32;
+  mrb_get_args(mrb, "|i", &voices);
+  if (voices <= 0 || voices > 0x7fff) mrb_raise(mrb, E_ARGUMENT_ERROR, "voices must be 1 to 32767");
+
+  sdl_audio_device* device = sdl_audio_get(mrb);
+  sdl_mixer* mixer = sdl_mixer_new(voices);
+  if ( ! mixer) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  if (sdl_audio_set_mixer(device, mixer) < 0) {
+    sdl_mixer_free(mixer);
+    mrb_raise(mrb, E_RUNTIME_ERROR, SDL_GetError());
+  }
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_mixer_close (mrb_state *mrb, mrb_value self) {
+  if (sdl_audio_output.open) sdl_audio_set_mixer(&sdl_audio_output, NULL);
+  return mrb_nil_value();
+}
+// Copy 16-bit native-endian PCM, mono or stereo, into a sound slot
+static mrb_value mrb_sdl_mixer_load (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_pcm;
+  mrb_int channels = 2;
+  mrb_get_args(mrb, "S|i", &arg_pcm, &channels);
+
+  sdl_mixer* mixer = sdl_mixer_get(mrb);
+  if (channels != 1 && channels != 2) mrb_raise(mrb, E_ARGUMENT_ERROR, "channels must be 1 or 2");
+  int frame_bytes = sizeof(Sint16) * channels;
+  if (RSTRING_LEN(arg_pcm) % frame_bytes) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "PCM must be a whole number of frames");
+  }
+  int sound = sdl_mixer_load(mixer, (const Sint16*) RSTRING_PTR(arg_pcm), RSTRING_LEN(arg_pcm) / frame_bytes, channels);
+  if (sound < 0) mrb_raise(mrb, E_RUNTIME_ERROR, SDL_GetError());
+  return mrb_fixnum_value(sound);
+}
+// Unloading waits for the current callback, so do it between levels, not
+// every frame
+static mrb_value mrb_sdl_mixer_unload (mrb_state *mrb, mrb_value self) {
+  mrb_int sound;
+  mrb_get_args(mrb, "i", &sound);
+  sdl_mixer* mixer = sdl_mixer_get(mrb);
+  if (sound < 0 || sound >= SDL_MIXER_MAX_SOUNDS) return mrb_nil_value();
+  SDL_LockAudio();
+  sdl_mixer_unload(mixer, sound);
+  SDL_UnlockAudio();
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_mixer_play (mrb_state *mrb, mrb_value self) {
+  mrb_int sound;
+  mrb_float volume = 1.0;
+  mrb_float pan = 0.0;
+  mrb_value arg_loop = mrb_false_value();
+  mrb_int voice = -1;
+  mrb_get_args(mrb, "i|ffoi", &sound, &volume, &pan, &arg_loop, &voice);
+
+  sdl_mixer* mixer = sdl_mixer_get(mrb);
+  if (sound < 0 || sound >= SDL_MIXER_MAX_SOUNDS || ! mixer->sounds[sound]) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "no such sound");
+  }
+  sdl_mixer_command command;
+  memset(&command, 0, sizeof(sdl_mixer_command));
+  command.kind = SDL_MIXER_PLAY;
+  command.sound = sound;
+  command.voice = voice < 0 ? -1 : sdl_mixer_voice_arg(mrb, mixer, voice);
+  command.loop = mrb_test(arg_loop);
+  sdl_mixer_gains(volume, pan, &command);
+  return sdl_mixer_send_value(mixer, &command);
+}
+static mrb_value mrb_sdl_mixer_stop (mrb_state *mrb, mrb_value self) {
+  mrb_int voice;
+  mrb_get_args(mrb, "i", &voice);
+  sdl_mixer* mixer = sdl_mixer_get(mrb);
+  sdl_mixer_command command;
+  memset(&command, 0, sizeof(sdl_mixer_command));
+  command.kind = SDL_MIXER_STOP;
+  command.voice = sdl_mixer_voice_arg(mrb, mixer, voice);
+  return sdl_mixer_send_value(mixer, &command);
+}
+static mrb_value mrb_sdl_mixer_stop_all (mrb_state *mrb, mrb_value self) {
+  sdl_mixer* mixer = sdl_mixer_get(mrb);
+  sdl_mixer_command command;
+  memset(&command, 0, sizeof(sdl_mixer_command));
+  command.kind = SDL_MIXER_STOP_ALL;
+  return sdl_mixer_send_value(mixer, &command);
+}
+static mrb_value mrb_sdl_mixer_set_volume (mrb_state *mrb, mrb_value self) {
+  mrb_int voice;
+  mrb_float volume;
+  mrb_float pan = 0.0;
+  mrb_get_args(mrb, "if|f", &voice, &volume, &pan);
+  sdl_mixer* mixer = sdl_mixer_get(mrb);
+  sdl_mixer_command command;
+  memset(&command, 0, sizeof(sdl_mixer_command));
+  command.kind = SDL_MIXER_GAIN;
+  command.voice = sdl_mixer_voice_arg(mrb, mixer, voice);
+  sdl_mixer_gains(volume, pan, &command);
+  return sdl_mixer_send_value(mixer, &command);
+}
+static mrb_value mrb_sdl_mixer_set_loop (mrb_state *mrb, mrb_value self) {
+  mrb_int voice;
+  mrb_value arg_loop;
+  mrb_get_args(mrb, "io", &voice, &arg_loop);
+  sdl_mixer* mixer = sdl_mixer_get(mrb);
+  sdl_mixer_command command;
+  memset(&command, 0, sizeof(sdl_mixer_command));
+  command.kind = SDL_MIXER_LOOP;
+  command.voice = sdl_mixer_voice_arg(mrb, mixer, voice);
+  command.loop = mrb_test(arg_loop);
+  return sdl_mixer_send_value(mixer, &command);
+}
+// Reflects the last callback, so a voice just told to play may not show yet
+static mrb_value mrb_sdl_mixer_playing (mrb_state *mrb, mrb_value self) {
+  mrb_int voice;
+  mrb_get_args(mrb, "i", &voice);
+  sdl_mixer* mixer = sdl_mixer_get(mrb);
+  return sdl_mixer_voice_active(mixer, sdl_mixer_voice_arg(mrb, mixer, voice)) ? mrb_true_value() : mrb_false_value();
+}
+static mrb_value mrb_sdl_mixer_voices (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(sdl_mixer_get(mrb)->voice_count);
+}
+static mrb_value mrb_sdl_mixer_kernel (mrb_state *mrb, mrb_value self) {
+  return mrb_str_new_cstr(mrb, sdl_mixer_kernel_name());
+}
+static mrb_value mrb_sdl_mixer_stats (mrb_state *mrb, mrb_value self) {
+  sdl_mixer* mixer = sdl_mixer_get(mrb);
+  mrb_value hash = mrb_hash_new(mrb);
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "active")), mrb_fixnum_value(sdl_mixer_active_count(mixer)));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "dropped_commands")), mrb_fixnum_value(mixer->dropped_commands));
+  return hash;
+}
+
+
+/*******************************************************************************
+ * Music class
+ *
+ * Streams a WAV file, or a WAV stored in an SDL::Pack, into the audio ring a
+ * chunk at a time. Call fill once a frame to keep the ring topped up; memory
+ * use stays the same however long the track is.
+ ******************************************************************************/
+static void sdl_music_free (mrb_state *mrb, void *p) {
+  if ( ! p) return;
+  sdl_return_pixels(mrb, p);
+  sdl_audio_stream_close((sdl_audio_stream*) p);
+  free(p);
+}
+
+static const struct mrb_data_type sdl_music_type = {
+  "SDL::Music", sdl_music_free,
+};
+
+static sdl_audio_stream* mrb_value_to_sdl_music (mrb_state *mrb, mrb_value self) {
+  if ( ! sdl_data_p(self, &sdl_music_type)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");
+  }
+  sdl_audio_stream* stream = (sdl_audio_stream*) DATA_PTR(self);
+  if ( ! stream->rw) mrb_raise(mrb, E_RUNTIME_ERROR, "music is closed");
+  return stream;
+}
+
+// Music.new(path) or Music.new(pack, name). Music from a pack borrows it like
+// a surface does, so the pack can't be closed under the stream.
+static mrb_value mrb_sdl_music_init (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_source;
+  mrb_value arg_name = mrb_nil_value();
+  mrb_int chunk = 16384;
+  mrb_get_args(mrb, "o|oi", &arg_source, &arg_name, &chunk);
+
+  sdl_audio_device* device = sdl_audio_get(mrb);
+  if (chunk <= 0) mrb_raise(mrb, E_ARGUMENT_ERROR, "chunk size must be positive");
+
+  SDL_RWops* rw;
+  if (mrb_string_p(arg_source)) {
+    rw = SDL_RWFromFile(mrb_string_value_ptr(mrb, arg_source), "rb");
+  } else {
+    if ( ! mrb_string_p(arg_name)) mrb_raise(mrb, E_TYPE_ERROR, "expected a pack entry name");
+    int index = sdl_pack_lookup(mrb, arg_source, arg_name);
+    if (index < 0) mrb_raise(mrb, E_ARGUMENT_ERROR, "no such pack entry");
+    rw = sdl_pack_rwops(mrb_value_to_sdl_pack(mrb, arg_source), index);
+  }
+
+  sdl_audio_stream* stream = (sdl_audio_stream*) malloc(sizeof(sdl_audio_stream));
+  if ( ! stream) {
+    if (rw) SDL_RWclose(rw);
+    mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  }
+  if (sdl_audio_stream_open(stream, rw, &device->spec, chunk) < 0) {
+    free(stream);
+    mrb_raise(mrb, E_RUNTIME_ERROR, SDL_GetError());
+  }
+  if ( ! mrb_string_p(arg_source) && sdl_borrow(mrb, stream, arg_source) < 0) {
+    sdl_audio_stream_close(stream);
+    free(stream);
+    mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  }
+
+  sdl_music_free(mrb, DATA_PTR(self));
+  DATA_PTR(self) = stream;
+  DATA_TYPE(self) = &sdl_music_type;
+  return self;
+}
+static mrb_value mrb_sdl_music_fill (mrb_state *mrb, mrb_value self) {
+  sdl_audio_stream* stream = mrb_value_to_sdl_music(mrb, self);
+  int queued = sdl_audio_stream_fill(stream, &sdl_audio_get(mrb)->ring);
+  if (queued < 0) mrb_raise(mrb, E_RUNTIME_ERROR, SDL_GetError());
+  return mrb_fixnum_value(queued);
+}
+static mrb_value mrb_sdl_music_rewind (mrb_state *mrb, mrb_value self) {
+  if (sdl_audio_stream_rewind(mrb_value_to_sdl_music(mrb, self)) < 0) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, SDL_GetError());
+  }
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_music_set_loop (mrb_state *mrb, mrb_value self) {
+  mrb_value arg_loop;
+  mrb_get_args(mrb, "o", &arg_loop);
+  mrb_value_to_sdl_music(mrb, self)->loop = mrb_test(arg_loop);
+  return arg_loop;
+}
+static mrb_value mrb_sdl_music_loop (mrb_state *mrb, mrb_value self) {
+  return mrb_value_to_sdl_music(mrb, self)->loop ? mrb_true_value() : mrb_false_value();
+}
+static mrb_value mrb_sdl_music_done (mrb_state *mrb, mrb_value self) {
+  return sdl_audio_stream_done(mrb_value_to_sdl_music(mrb, self)) ? mrb_true_value() : mrb_false_value();
+}
+static mrb_value mrb_sdl_music_duration (mrb_state *mrb, mrb_value self) {
+  sdl_audio_stream* stream = mrb_value_to_sdl_music(mrb, self);
+  return mrb_float_value((mrb_float) stream->data_length / stream->frame_bytes / stream->freq);
+}
+static mrb_value mrb_sdl_music_position (mrb_state *mrb, mrb_value self) {
+  sdl_audio_stream* stream = mrb_value_to_sdl_music(mrb, self);
+  return mrb_float_value((mrb_float) stream->data_read / stream->frame_bytes / stream->freq);
+}
+static mrb_value mrb_sdl_music_close (mrb_state *mrb, mrb_value self) {
+  sdl_audio_stream* stream = mrb_value_to_sdl_music(mrb, self);
+  sdl_audio_stream_close(stream);
+  sdl_return_pixels(mrb, stream);
+  return mrb_nil_value();
+}
+
+
+/*******************************************************************************
+ * Clock module
+ ******************************************************************************/
+static mrb_value mrb_sdl_clock_ticks (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(SDL_GetTicks());
+}
+static mrb_value mrb_sdl_clock_delay (mrb_state *mrb, mrb_value self) {
+  mrb_int ms;
+  mrb_get_args(mrb, "i", &ms);
+  if (ms > 0) SDL_Delay(ms);
+  return mrb_nil_value();
+}
+// Monotonic seconds, to well under a millisecond where the OS allows
+static mrb_value mrb_sdl_clock_now (mrb_state *mrb, mrb_value self) {
+  return mrb_float_value(sdl_clock_now() / 1e9);
+}
+
+
+/*******************************************************************************
+ * FramePacer class
+ *
+ * Holds the loop to a steady frame rate, sleeping most of the wait and
+ * spinning the last stretch, and runs simulation at a fixed step:
+ *
+ *   pacer = SDL::FramePacer.new(60)
+ *   loop do
+ *     pacer.update { |dt| world.step(dt) }
+ *     world.draw(pacer.alpha)
+ *     pacer.wait
+ *   end
+ *
+ * Frame times go into a native histogram; the stats return Floats in
+ * milliseconds and allocate nothing.
+ ******************************************************************************/
+static void sdl_frame_pacer_free (mrb_state *mrb, void *p) {
+  free(p);
+}
+
+static const struct mrb_data_type sdl_frame_pacer_type = {
+  "SDL::FramePacer", sdl_frame_pacer_free,
+};
+
+static sdl_frame_pacer* mrb_value_to_sdl_frame_pacer (mrb_state *mrb, mrb_value self) {
+  if ( ! sdl_data_p(self, &sdl_frame_pacer_type)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid argument");
+  }
+  return (sdl_frame_pacer*) DATA_PTR(self);
+}
+
+// FramePacer.new(fps = 60, update_hz = fps). An fps of 0 doesn't wait.
+static mrb_value mrb_sdl_frame_pacer_init (mrb_state *mrb, mrb_value self) {
+  mrb_float fps = 60;
+  mrb_float update_hz = 0;
+  mrb_get_args(mrb, "|ff", &fps, &update_hz);
+  if (fps < 0) mrb_raise(mrb, E_ARGUMENT_ERROR, "fps can't be negative");
+  if (update_hz <= 0) update_hz = fps > 0 ? fps : 60;
+
+  // Periods are whole nanoseconds, and a step of 0 would divide by zero.
+  // The negated tests also catch NaN.
+  mrb_float period = fps > 0 ? 1e9 / fps : 0;
+  mrb_float step = 1e9 / update_hz;
+  if (fps > 0 && ! (period >= 1)) mrb_raise(mrb, E_ARGUMENT_ERROR, "fps is out of range");
+  if ( ! (step >= 1)) mrb_raise(mrb, E_ARGUMENT_ERROR, "update_hz is out of range");
+
+  sdl_frame_pacer* pacer = (sdl_frame_pacer*) malloc(sizeof(sdl_frame_pacer));
+  if ( ! pacer) mrb_raise(mrb, E_RUNTIME_ERROR, "can't alloc memory");
+  sdl_frame_pacer_init(pacer, (Uint64) period, (Uint64) step);
+
+  sdl_frame_pacer_free(mrb, DATA_PTR(self));
+  DATA_PTR(self) = pacer;
+  DATA_TYPE(self) = &sdl_frame_pacer_type;
+  return self;
+}
+// Yields the step length in seconds once per step due; returns the count
+static mrb_value mrb_sdl_frame_pacer_update (mrb_state *mrb, mrb_value self) {
+  mrb_value block;
+  int i;
+  mrb_get_args(mrb, "&", &block);
+
+  sdl_frame_pacer* pacer = mrb_value_to_sdl_frame_pacer(mrb, self);
+  int steps = sdl_frame_pacer_steps(pacer);
+  if (mrb_nil_p(block)) return mrb_fixnum_value(steps);
+  mrb_value dt = mrb_float_value(pacer->step / 1e9);
+  for (i = 0; i < steps; i++) {
+    mrb_yield(mrb, block, dt);
+  }
+  return mrb_fixnum_value(steps);
+}
+// How far into the next step we are, for interpolating the draw
+static mrb_value mrb_sdl_frame_pacer_alpha (mrb_state *mrb, mrb_value self) {
+  sdl_frame_pacer* pacer = mrb_value_to_sdl_frame_pacer(mrb, self);
+  return mrb_float_value((mrb_float) pacer->accumulator / pacer->step);
+}
+static mrb_value mrb_sdl_frame_pacer_wait (mrb_state *mrb, mrb_value self) {
+  sdl_frame_pacer_wait(mrb_value_to_sdl_frame_pacer(mrb, self));
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_frame_pacer_set_spin (mrb_state *mrb, mrb_value self) {
+  mrb_float ms;
+  mrb_get_args(mrb, "f", &ms);
+  mrb_value_to_sdl_frame_pacer(mrb, self)->spin = ms > 0 ? (Uint64) (ms * 1e6) : 0;
+  return mrb_float_value(ms);
+}
+static mrb_value mrb_sdl_frame_pacer_set_max_steps (mrb_state *mrb, mrb_value self) {
+  mrb_int steps;
+  mrb_get_args(mrb, "i", &steps);
+  if (steps < 1) mrb_raise(mrb, E_ARGUMENT_ERROR, "max_steps must be at least 1");
+  mrb_value_to_sdl_frame_pacer(mrb, self)->max_steps = steps;
+  return mrb_fixnum_value(steps);
+}
+static mrb_value mrb_sdl_frame_pacer_percentile (mrb_state *mrb, mrb_value self) {
+  mrb_float percentile;
+  mrb_get_args(mrb, "f", &percentile);
+  sdl_frame_pacer* pacer = mrb_value_to_sdl_frame_pacer(mrb, self);
+  return mrb_float_value(sdl_histogram_percentile(&pacer->frames, percentile / 100) / 1e6);
+}
+static mrb_value mrb_sdl_frame_pacer_p50 (mrb_state *mrb, mrb_value self) {
+  return mrb_float_value(sdl_histogram_percentile(&mrb_value_to_sdl_frame_pacer(mrb, self)->frames, 0.50) / 1e6);
+}
+static mrb_value mrb_sdl_frame_pacer_p95 (mrb_state *mrb, mrb_value self) {
+  return mrb_float_value(sdl_histogram_percentile(&mrb_value_to_sdl_frame_pacer(mrb, self)->frames, 0.95) / 1e6);
+}
+static mrb_value mrb_sdl_frame_pacer_p99 (mrb_state *mrb, mrb_value self) {
+  return mrb_float_value(sdl_histogram_percentile(&mrb_value_to_sdl_frame_pacer(mrb, self)->frames, 0.99) / 1e6);
+}
+static mrb_value mrb_sdl_frame_pacer_frames (mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_value_to_sdl_frame_pacer(mrb, self)->frames.count);
+}
+static mrb_value mrb_sdl_frame_pacer_average (mrb_state *mrb, mrb_value self) {
+  sdl_histogram* frames = &mrb_value_to_sdl_frame_pacer(mrb, self)->frames;
+  return mrb_float_value(frames->count ? (mrb_float) frames->total / frames->count / 1e6 : 0);
+}
+static mrb_value mrb_sdl_frame_pacer_max (mrb_state *mrb, mrb_value self) {
+  return mrb_float_value(mrb_value_to_sdl_frame_pacer(mrb, self)->frames.max / 1e6);
+}
+static mrb_value mrb_sdl_frame_pacer_reset_stats (mrb_state *mrb, mrb_value self) {
+  sdl_frame_pacer* pacer = mrb_value_to_sdl_frame_pacer(mrb, self);
+  memset(&pacer->frames, 0, sizeof(sdl_histogram));
+  return mrb_nil_value();
+}
+
+
+/*******************************************************************************
+ * Stats module
+ *
+ * Call counts, pixel and byte counts, and log2 latency buckets for the hot
+ * video bindings. Only the native work is timed, not argument parsing.
+ ******************************************************************************/
+static mrb_value mrb_sdl_stats_enable (mrb_state *mrb, mrb_value self) {
+#ifdef MRB_SDL_NO_STATS
+  mrb_raise(mrb, E_RUNTIME_ERROR, "built without stats");
+#endif
+  sdl_stats_enabled = 1;
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_stats_disable (mrb_state *mrb, mrb_value self) {
+  sdl_stats_enabled = 0;
+  return mrb_nil_value();
+}
+static mrb_value mrb_sdl_stats_is_enabled (mrb_state *mrb, mrb_value self) {
+  return SDL_STATS_ON ? mrb_true_value() : mrb_false_value();
+}
+static mrb_value mrb_sdl_stats_reset (mrb_state *mrb, mrb_value self) {
+  sdl_stats_reset();
+  return mrb_nil_value();
+}
+
+static mrb_value sdl_stat_to_mrb_value (mrb_state *mrb, const sdl_stat* stat) {
+  mrb_value hash = mrb_hash_new(mrb);
+  int last = SDL_STATS_BUCKETS - 1;
+  int i;
+
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "calls")), mrb_fixnum_value((mrb_int) stat->calls));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "pixels")), mrb_fixnum_value((mrb_int) stat->pixels));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "bytes")), mrb_fixnum_value((mrb_int) stat->bytes));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "total_ms")), mrb_float_value(stat->total_ns / 1e6));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "mean_ms")), mrb_float_value(stat->calls ? (mrb_float) stat->total_ns / stat->calls / 1e6 : 0));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "max_ms")), mrb_float_value(stat->max_ns / 1e6));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "p50_ms")), mrb_float_value(sdl_stat_percentile(stat, 0.50) / 1e6));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "p99_ms")), mrb_float_value(sdl_stat_percentile(stat, 0.99) / 1e6));
+
+  // buckets[k] counts calls taking 2^k to 2^(k+1) ns, up to the slowest
+  while (last > 0 && ! stat->buckets[last]) last--;
+  mrb_value buckets = mrb_ary_new_capa(mrb, last + 1);
+  for (i = 0; i <= last; i++) {
+    mrb_ary_push(mrb, buckets, mrb_fixnum_value(stat->buckets[i]));
+  }
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, "buckets")), buckets);
+  return hash;
+}
+// { :blit_surface => { :calls, :pixels, :bytes, :total_ms, ... }, ... }
+static mrb_value mrb_sdl_stats_snapshot (mrb_state *mrb, mrb_value self) {
+  mrb_value hash = mrb_hash_new(mrb);
+  int ai = mrb_gc_arena_save(mrb);
+  int i;
+  for (i = 0; i < SDL_STAT_COUNT; i++) {
+    mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern(mrb, sdl_stat_name((sdl_stat_id) i))), sdl_stat_to_mrb_value(mrb, &sdl_stats[i]));
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  return hash;
+}
+
+
+/*******************************************************************************
+ * Register module
+ ******************************************************************************/
+void mrb_mruby_sdl_gem_init (mrb_state* mrb) {
+  int ai = mrb_gc_arena_save(mrb);
+
+  sdl_blit_init();
+  sdl_yuv_init();
+  sdl_format_init();
+  sdl_gamma_init(&sdl_video_gamma);
+  sdl_convert_cache_init(&sdl_video_conversions);
+
+  struct RClass* _class_sdl;
+  struct RClass* _class_sdl_rect;
+  struct RClass* _class_sdl_video;
+  struct RClass* _class_sdl_gl;
+  struct RClass* _class_sdl_events;
+  struct RClass* _class_sdl_audio;
+  struct RClass* _class_sdl_mixer;
+  struct RClass* _class_sdl_clock;
+  struct RClass* _class_sdl_stats;
+  
+  // Basic SDL setup
+  _class_sdl = mrb_define_module(mrb, "SDL");
+  mrb_define_module_function(mrb, _class_sdl, "init", mrb_sdl_init, ARGS_OPT(1));
+  mrb_define_module_function(mrb, _class_sdl, "init_subsystem", mrb_sdl_init_sub_system, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl, "quit", mrb_sdl_quit, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl, "quit_subsystem", mrb_sdl_quit_sub_system, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl, "was_init", mrb_sdl_was_init, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl, "get_error", mrb_sdl_get_error, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl, "set_error_by_code", mrb_sdl_error, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl, "clear_error", mrb_sdl_clear_error, ARGS_NONE());
+  mrb_gc_arena_restore(mrb, ai);
+
+  // Handles for structs SDL owns. They have no methods of their own and are
+  // only passed back into SDL::Video.
+  sdl_video_info_class = mrb_define_class_under(mrb, _class_sdl, "VideoInfo", mrb->object_class);
+  MRB_SET_INSTANCE_TT(sdl_video_info_class, MRB_TT_DATA);
+  sdl_modes_class = mrb_define_class_under(mrb, _class_sdl, "ModeList", mrb->object_class);
+  MRB_SET_INSTANCE_TT(sdl_modes_class, MRB_TT_DATA);
+  sdl_pixel_format_class = mrb_define_class_under(mrb, _class_sdl, "PixelFormat", mrb->object_class);
+  MRB_SET_INSTANCE_TT(sdl_pixel_format_class, MRB_TT_DATA);
+  sdl_overlay_class = mrb_define_class_under(mrb, _class_sdl, "Overlay", mrb->object_class);
+  MRB_SET_INSTANCE_TT(sdl_overlay_class, MRB_TT_DATA);
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "Surface", mrb->object_class);
+  MRB_SET_INSTANCE_TT(_class_sdl_rect, MRB_TT_DATA);
+  mrb_define_method(mrb, _class_sdl_rect, "w", mrb_sdl_surface_w, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "h", mrb_sdl_surface_h, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "pitch", mrb_sdl_surface_pitch, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "depth", mrb_sdl_surface_depth, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "flags", mrb_sdl_surface_flags, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "owned?", mrb_sdl_surface_is_owned, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "freed?", mrb_sdl_surface_is_freed, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "free", mrb_sdl_surface_free, ARGS_NONE());
+  sdl_surface_class = _class_sdl_rect;
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "Rect", mrb->object_class);
+  MRB_SET_INSTANCE_TT(_class_sdl_rect, MRB_TT_DATA);
+  mrb_define_method(mrb, _class_sdl_rect, "initialize", mrb_sdl_rect_init, ARGS_OPT(4));
+  mrb_define_method(mrb, _class_sdl_rect, "destroy", mrb_sdl_rect_destroy, ARGS_NONE());
+  SDL_DEFINE_ACCESSOR(_class_sdl_rect, rect, x);
+  SDL_DEFINE_ACCESSOR(_class_sdl_rect, rect, y);
+  SDL_DEFINE_ACCESSOR(_class_sdl_rect, rect, w);
+  SDL_DEFINE_ACCESSOR(_class_sdl_rect, rect, h);
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "Color", mrb->object_class);
+  MRB_SET_INSTANCE_TT(_class_sdl_rect, MRB_TT_DATA);
+  mrb_define_method(mrb, _class_sdl_rect, "initialize", mrb_sdl_color_init, ARGS_OPT(4));
+  mrb_define_method(mrb, _class_sdl_rect, "destroy", mrb_sdl_color_destroy, ARGS_NONE());
+  SDL_DEFINE_ACCESSOR(_class_sdl_rect, color, r);
+  SDL_DEFINE_ACCESSOR(_class_sdl_rect, color, g);
+  SDL_DEFINE_ACCESSOR(_class_sdl_rect, color, b);
+  SDL_DEFINE_ACCESSOR(_class_sdl_rect, color, a);
+  sdl_color_class = _class_sdl_rect;
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "Palette", mrb->object_class);
+  MRB_SET_INSTANCE_TT(_class_sdl_rect, MRB_TT_DATA);
+  mrb_define_method(mrb, _class_sdl_rect, "initialize", mrb_sdl_palette_init, ARGS_REQ(1) | ARGS_OPT(1));
+  mrb_define_method(mrb, _class_sdl_rect, "destroy", mrb_sdl_palette_destroy, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "size", mrb_sdl_palette_size, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "[]", mrb_sdl_palette_get, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "[]=", mrb_sdl_palette_set, ARGS_REQ(2));
+  mrb_define_method(mrb, _class_sdl_rect, "set", mrb_sdl_palette_set_rgb, ARGS_REQ(4));
+  mrb_define_method(mrb, _class_sdl_rect, "read", mrb_sdl_palette_read, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "write", mrb_sdl_palette_write, ARGS_REQ(2));
+  mrb_define_method(mrb, _class_sdl_rect, "rotate", mrb_sdl_palette_rotate, ARGS_REQ(2) | ARGS_OPT(1));
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "RectArray", mrb->object_class);
+  MRB_SET_INSTANCE_TT(_class_sdl_rect, MRB_TT_DATA);
+  mrb_define_method(mrb, _class_sdl_rect, "initialize", mrb_sdl_rect_array_init, ARGS_OPT(1));
+  mrb_define_method(mrb, _class_sdl_rect, "push", mrb_sdl_rect_array_push, ARGS_REQ(1) | ARGS_OPT(3));
+  mrb_define_method(mrb, _class_sdl_rect, "clear", mrb_sdl_rect_array_clear, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "length", mrb_sdl_rect_array_length, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "size", mrb_sdl_rect_array_length, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "capacity", mrb_sdl_rect_array_capacity, ARGS_NONE());
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "PixelBuffer", mrb->object_class);
+  MRB_SET_INSTANCE_TT(_class_sdl_rect, MRB_TT_DATA);
+  mrb_define_method(mrb, _class_sdl_rect, "[]", mrb_sdl_pixel_buffer_get, ARGS_REQ(2));
+  mrb_define_method(mrb, _class_sdl_rect, "[]=", mrb_sdl_pixel_buffer_set, ARGS_REQ(3));
+  mrb_define_method(mrb, _class_sdl_rect, "read", mrb_sdl_pixel_buffer_read, ARGS_OPT(2));
+  mrb_define_method(mrb, _class_sdl_rect, "write", mrb_sdl_pixel_buffer_write, ARGS_REQ(2));
+  mrb_define_method(mrb, _class_sdl_rect, "length", mrb_sdl_pixel_buffer_length, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "size", mrb_sdl_pixel_buffer_length, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "pitch", mrb_sdl_pixel_buffer_pitch, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "width", mrb_sdl_pixel_buffer_width, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "height", mrb_sdl_pixel_buffer_height, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "bytes_per_pixel", mrb_sdl_pixel_buffer_bytes_per_pixel, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "valid?", mrb_sdl_pixel_buffer_valid, ARGS_NONE());
+  sdl_pixel_buffer_class = _class_sdl_rect;
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "Pack", mrb->object_class);
+  MRB_SET_INSTANCE_TT(_class_sdl_rect, MRB_TT_DATA);
+  mrb_define_class_method(mrb, _class_sdl_rect, "write", mrb_sdl_pack_write, ARGS_REQ(2));
+  mrb_define_method(mrb, _class_sdl_rect, "initialize", mrb_sdl_pack_init, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "surface", mrb_sdl_pack_surface, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "load_bmp", mrb_sdl_pack_load_bmp, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "read", mrb_sdl_pack_read, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "include?", mrb_sdl_pack_include, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "names", mrb_sdl_pack_names, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "length", mrb_sdl_pack_length, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "size", mrb_sdl_pack_length, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "close", mrb_sdl_pack_close, ARGS_NONE());
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "Atlas", mrb->object_class);
+  MRB_SET_INSTANCE_TT(_class_sdl_rect, MRB_TT_DATA);
+  mrb_define_method(mrb, _class_sdl_rect, "initialize", mrb_sdl_atlas_init, ARGS_OPT(3));
+  mrb_define_method(mrb, _class_sdl_rect, "add", mrb_sdl_atlas_add, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "page_count", mrb_sdl_atlas_page_count, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "page", mrb_sdl_atlas_page, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "occupancy", mrb_sdl_atlas_occupancy, ARGS_NONE());
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "AtlasRegion", mrb->object_class);
+  MRB_SET_INSTANCE_TT(_class_sdl_rect, MRB_TT_DATA);
+  mrb_define_method(mrb, _class_sdl_rect, "x", mrb_sdl_atlas_region_x, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "y", mrb_sdl_atlas_region_y, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "w", mrb_sdl_atlas_region_w, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "h", mrb_sdl_atlas_region_h, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "page_index", mrb_sdl_atlas_region_page_index, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "surface", mrb_sdl_atlas_region_surface, ARGS_NONE());
+  sdl_atlas_region_class = _class_sdl_rect;
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "SurfacePool", mrb->object_class);
+  MRB_SET_INSTANCE_TT(_class_sdl_rect, MRB_TT_DATA);
+  mrb_define_method(mrb, _class_sdl_rect, "initialize", mrb_sdl_surface_pool_init, ARGS_OPT(1));
+  mrb_define_method(mrb, _class_sdl_rect, "acquire", mrb_sdl_surface_pool_acquire, ARGS_REQ(8));
+  mrb_define_method(mrb, _class_sdl_rect, "release", mrb_sdl_surface_pool_release, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "size", mrb_sdl_surface_pool_size, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "capacity", mrb_sdl_surface_pool_capacity, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "clear", mrb_sdl_surface_pool_clear, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "stats", mrb_sdl_surface_pool_stats, ARGS_NONE());
+  mrb_gc_arena_restore(mrb, ai);
+
+  // Events setup
+  _class_sdl_events = mrb_define_module_under(mrb, _class_sdl, "Events");
+  mrb_define_const(mrb, _class_sdl_events, "NOEVENT", mrb_fixnum_value(SDL_NOEVENT));
+  mrb_define_const(mrb, _class_sdl_events, "ACTIVEEVENT", mrb_fixnum_value(SDL_ACTIVEEVENT));
+  mrb_define_const(mrb, _class_sdl_events, "KEYDOWN", mrb_fixnum_value(SDL_KEYDOWN));
+  mrb_define_const(mrb, _class_sdl_events, "KEYUP", mrb_fixnum_value(SDL_KEYUP));
+  mrb_define_const(mrb, _class_sdl_events, "MOUSEMOTION", mrb_fixnum_value(SDL_MOUSEMOTION));
+  mrb_define_const(mrb, _class_sdl_events, "MOUSEBUTTONDOWN", mrb_fixnum_value(SDL_MOUSEBUTTONDOWN));
+  mrb_define_const(mrb, _class_sdl_events, "MOUSEBUTTONUP", mrb_fixnum_value(SDL_MOUSEBUTTONUP));
+  mrb_define_const(mrb, _class_sdl_events, "JOYAXISMOTION", mrb_fixnum_value(SDL_JOYAXISMOTION));
+  mrb_define_const(mrb, _class_sdl_events, "JOYBALLMOTION", mrb_fixnum_value(SDL_JOYBALLMOTION));
+  mrb_define_const(mrb, _class_sdl_events, "JOYHATMOTION", mrb_fixnum_value(SDL_JOYHATMOTION));
+  mrb_define_const(mrb, _class_sdl_events, "JOYBUTTONDOWN", mrb_fixnum_value(SDL_JOYBUTTONDOWN));
+  mrb_define_const(mrb, _class_sdl_events, "JOYBUTTONUP", mrb_fixnum_value(SDL_JOYBUTTONUP));
+  mrb_define_const(mrb, _class_sdl_events, "QUIT", mrb_fixnum_value(SDL_QUIT));
+  mrb_define_const(mrb, _class_sdl_events, "SYSWMEVENT", mrb_fixnum_value(SDL_SYSWMEVENT));
+  mrb_define_const(mrb, _class_sdl_events, "VIDEORESIZE", mrb_fixnum_value(SDL_VIDEORESIZE));
+  mrb_define_const(mrb, _class_sdl_events, "VIDEOEXPOSE", mrb_fixnum_value(SDL_VIDEOEXPOSE));
+  mrb_define_const(mrb, _class_sdl_events, "USEREVENT", mrb_fixnum_value(SDL_USEREVENT));
+  mrb_define_module_function(mrb, _class_sdl_events, "set_filter", mrb_sdl_events_set_filter, ARGS_REQ(1) | ARGS_OPT(1));
+  mrb_define_module_function(mrb, _class_sdl_events, "clear_filter", mrb_sdl_events_clear_filter, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_events, "filter_stats", mrb_sdl_events_filter_stats, ARGS_NONE());
+  mrb_gc_arena_restore(mrb, ai);
+
+  // Audio setup
+  _class_sdl_audio = mrb_define_module_under(mrb, _class_sdl, "Audio");
+  mrb_define_const(mrb, _class_sdl_audio, "U8", mrb_fixnum_value(AUDIO_U8));
+  mrb_define_const(mrb, _class_sdl_audio, "S8", mrb_fixnum_value(AUDIO_S8));
+  mrb_define_const(mrb, _class_sdl_audio, "U16LSB", mrb_fixnum_value(AUDIO_U16LSB));
+  mrb_define_const(mrb, _class_sdl_audio, "S16LSB", mrb_fixnum_value(AUDIO_S16LSB));
+  mrb_define_const(mrb, _class_sdl_audio, "U16MSB", mrb_fixnum_value(AUDIO_U16MSB));
+  mrb_define_const(mrb, _class_sdl_audio, "S16MSB", mrb_fixnum_value(AUDIO_S16MSB));
+  mrb_define_const(mrb, _class_sdl_audio, "U16SYS", mrb_fixnum_value(AUDIO_U16SYS));
+  mrb_define_const(mrb, _class_sdl_audio, "S16SYS", mrb_fixnum_value(AUDIO_S16SYS));
+  mrb_define_module_function(mrb, _class_sdl_audio, "open", mrb_sdl_audio_open, ARGS_REQ(4) | ARGS_OPT(1));
+  mrb_define_module_function(mrb, _class_sdl_audio, "close", mrb_sdl_audio_close, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_audio, "pause", mrb_sdl_audio_pause, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_audio, "status", mrb_sdl_audio_status, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_audio, "queue", mrb_sdl_audio_queue, ARGS_REQ(1) | ARGS_OPT(2));
+  mrb_define_module_function(mrb, _class_sdl_audio, "queued", mrb_sdl_audio_queued, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_audio, "space", mrb_sdl_audio_space, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_audio, "capacity", mrb_sdl_audio_capacity, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_audio, "stats", mrb_sdl_audio_stats, ARGS_NONE());
+  mrb_gc_arena_restore(mrb, ai);
+
+  // Time setup
+  _class_sdl_clock = mrb_define_module_under(mrb, _class_sdl, "Clock");
+  mrb_define_module_function(mrb, _class_sdl_clock, "ticks", mrb_sdl_clock_ticks, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_clock, "delay", mrb_sdl_clock_delay, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_clock, "now", mrb_sdl_clock_now, ARGS_NONE());
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "FramePacer", mrb->object_class);
+  MRB_SET_INSTANCE_TT(_class_sdl_rect, MRB_TT_DATA);
+  mrb_define_method(mrb, _class_sdl_rect, "initialize", mrb_sdl_frame_pacer_init, ARGS_OPT(2));
+  mrb_define_method(mrb, _class_sdl_rect, "update", mrb_sdl_frame_pacer_update, ARGS_BLOCK());
+  mrb_define_method(mrb, _class_sdl_rect, "alpha", mrb_sdl_frame_pacer_alpha, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "wait", mrb_sdl_frame_pacer_wait, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "spin_ms=", mrb_sdl_frame_pacer_set_spin, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "max_steps=", mrb_sdl_frame_pacer_set_max_steps, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "percentile", mrb_sdl_frame_pacer_percentile, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "p50", mrb_sdl_frame_pacer_p50, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "p95", mrb_sdl_frame_pacer_p95, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "p99", mrb_sdl_frame_pacer_p99, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "frames", mrb_sdl_frame_pacer_frames, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "average", mrb_sdl_frame_pacer_average, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "max", mrb_sdl_frame_pacer_max, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "reset_stats", mrb_sdl_frame_pacer_reset_stats, ARGS_NONE());
+  mrb_gc_arena_restore(mrb, ai);
+
+  // Stats setup
+  _class_sdl_stats = mrb_define_module_under(mrb, _class_sdl, "Stats");
+  mrb_define_module_function(mrb, _class_sdl_stats, "enable", mrb_sdl_stats_enable, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_stats, "disable", mrb_sdl_stats_disable, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_stats, "enabled?", mrb_sdl_stats_is_enabled, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_stats, "reset", mrb_sdl_stats_reset, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_stats, "snapshot", mrb_sdl_stats_snapshot, ARGS_NONE());
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "Music", mrb->object_class);
+  MRB_SET_INSTANCE_TT(_class_sdl_rect, MRB_TT_DATA);
+  mrb_define_method(mrb, _class_sdl_rect, "initialize", mrb_sdl_music_init, ARGS_REQ(1) | ARGS_OPT(2));
+  mrb_define_method(mrb, _class_sdl_rect, "fill", mrb_sdl_music_fill, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "rewind", mrb_sdl_music_rewind, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "loop=", mrb_sdl_music_set_loop, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "loop?", mrb_sdl_music_loop, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "done?", mrb_sdl_music_done, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "duration", mrb_sdl_music_duration, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "position", mrb_sdl_music_position, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "close", mrb_sdl_music_close, ARGS_NONE());
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_mixer = mrb_define_module_under(mrb, _class_sdl, "Mixer");
+  mrb_define_module_function(mrb, _class_sdl_mixer, "open", mrb_sdl_mixer_open, ARGS_OPT(1));
+  mrb_define_module_function(mrb, _class_sdl_mixer, "close", mrb_sdl_mixer_close, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_mixer, "load", mrb_sdl_mixer_load, ARGS_REQ(1) | ARGS_OPT(1));
+  mrb_define_module_function(mrb, _class_sdl_mixer, "unload", mrb_sdl_mixer_unload, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_mixer, "play", mrb_sdl_mixer_play, ARGS_REQ(1) | ARGS_OPT(4));
+  mrb_define_module_function(mrb, _class_sdl_mixer, "stop", mrb_sdl_mixer_stop, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_mixer, "stop_all", mrb_sdl_mixer_stop_all, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_mixer, "set_volume", mrb_sdl_mixer_set_volume, ARGS_REQ(2) | ARGS_OPT(1));
+  mrb_define_module_function(mrb, _class_sdl_mixer, "set_loop", mrb_sdl_mixer_set_loop, ARGS_REQ(2));
+  mrb_define_module_function(mrb, _class_sdl_mixer, "playing?", mrb_sdl_mixer_playing, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_mixer, "voices", mrb_sdl_mixer_voices, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_mixer, "kernel", mrb_sdl_mixer_kernel, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_mixer, "stats", mrb_sdl_mixer_stats, ARGS_NONE());
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "EventRing", mrb->object_class);
+  MRB_SET_INSTANCE_TT(_class_sdl_rect, MRB_TT_DATA);
+  mrb_define_method(mrb, _class_sdl_rect, "initialize", mrb_sdl_event_ring_init, ARGS_OPT(1));
+  mrb_define_method(mrb, _class_sdl_rect, "pump", mrb_sdl_event_ring_pump, ARGS_OPT(1));
+  mrb_define_method(mrb, _class_sdl_rect, "length", mrb_sdl_event_ring_length, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "size", mrb_sdl_event_ring_length, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "capacity", mrb_sdl_event_ring_capacity, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "discard", mrb_sdl_event_ring_discard, ARGS_OPT(1));
+  mrb_define_method(mrb, _class_sdl_rect, "clear", mrb_sdl_event_ring_clear, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "[]", mrb_sdl_event_ring_at, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "each", mrb_sdl_event_ring_each, ARGS_BLOCK());
+  mrb_define_method(mrb, _class_sdl_rect, "type", mrb_sdl_event_type, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "which", mrb_sdl_event_which, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "state", mrb_sdl_event_state, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "gain", mrb_sdl_event_gain, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "scancode", mrb_sdl_event_scancode, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "sym", mrb_sdl_event_sym, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "mod", mrb_sdl_event_mod, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "unicode", mrb_sdl_event_unicode, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "x", mrb_sdl_event_x, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "y", mrb_sdl_event_y, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "xrel", mrb_sdl_event_xrel, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "yrel", mrb_sdl_event_yrel, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "button", mrb_sdl_event_button, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "axis", mrb_sdl_event_axis, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "ball", mrb_sdl_event_ball, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "hat", mrb_sdl_event_hat, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "value", mrb_sdl_event_value, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "w", mrb_sdl_event_w, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "h", mrb_sdl_event_h, ARGS_REQ(1));
+  mrb_define_method(mrb, _class_sdl_rect, "code", mrb_sdl_event_code, ARGS_REQ(1));
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_rect = mrb_define_class_under(mrb, _class_sdl, "Event", mrb->object_class);
+  MRB_SET_INSTANCE_TT(_class_sdl_rect, MRB_TT_DATA);
+  mrb_define_method(mrb, _class_sdl_rect, "index", mrb_sdl_event_index, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "type", mrb_sdl_event_type, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "which", mrb_sdl_event_which, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "state", mrb_sdl_event_state, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "gain", mrb_sdl_event_gain, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "scancode", mrb_sdl_event_scancode, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "sym", mrb_sdl_event_sym, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "mod", mrb_sdl_event_mod, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "unicode", mrb_sdl_event_unicode, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "x", mrb_sdl_event_x, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "y", mrb_sdl_event_y, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "xrel", mrb_sdl_event_xrel, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "yrel", mrb_sdl_event_yrel, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "button", mrb_sdl_event_button, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "axis", mrb_sdl_event_axis, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "ball", mrb_sdl_event_ball, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "hat", mrb_sdl_event_hat, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "value", mrb_sdl_event_value, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "w", mrb_sdl_event_w, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "h", mrb_sdl_event_h, ARGS_NONE());
+  mrb_define_method(mrb, _class_sdl_rect, "code", mrb_sdl_event_code, ARGS_NONE());
+  sdl_event_cursor_class = _class_sdl_rect;
+  mrb_gc_arena_restore(mrb, ai);
+
+  // Video setup
+  _class_sdl_video = mrb_define_module_under(mrb, _class_sdl, "Video");
+  mrb_define_module_function(mrb, _class_sdl_video, "surface", mrb_sdl_get_video_surface, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "info", mrb_sdl_get_video_info, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "driver_name", mrb_sdl_video_driver_name, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "modes", mrb_sdl_video_list_modes, ARGS_OPT(2));
+  mrb_define_module_function(mrb, _class_sdl_video, "mode_ok", mrb_sdl_video_mode_ok, ARGS_REQ(4));
+  mrb_define_module_function(mrb, _class_sdl_video, "set_mode", mrb_sdl_video_set_mode, ARGS_REQ(4));
+  mrb_define_module_function(mrb, _class_sdl_video, "update_rect", mrb_sdl_video_update_rect, ARGS_REQ(5));
+  mrb_define_module_function(mrb, _class_sdl_video, "update_rects", mrb_sdl_video_update_rects, ARGS_REQ(2) | ARGS_OPT(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "flip", mrb_sdl_video_flip, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "track_damage", mrb_sdl_video_track_damage, ARGS_REQ(1) | ARGS_OPT(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "track_damage_tiles", mrb_sdl_video_track_damage_tiles, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "add_damage", mrb_sdl_video_add_damage, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "damage_count", mrb_sdl_video_damage_count, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "present", mrb_sdl_video_present, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "blit_kernel", mrb_sdl_video_blit_kernel, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "use_blit_kernels", mrb_sdl_video_use_blit_kernels, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "use_compositor", mrb_sdl_video_use_compositor, ARGS_REQ(1) | ARGS_OPT(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "compositor_threads", mrb_sdl_video_compositor_threads, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "composite", mrb_sdl_video_composite, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "cache_conversions", mrb_sdl_video_cache_conversions, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "clear_conversion_cache", mrb_sdl_video_clear_conversion_cache, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "invalidate_conversions", mrb_sdl_video_invalidate_conversions, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "conversion_cache_stats", mrb_sdl_video_conversion_cache_stats, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "set_colors", mrb_sdl_video_set_colors, ARGS_REQ(2) | ARGS_OPT(2));
+  mrb_define_module_function(mrb, _class_sdl_video, "set_palette", mrb_sdl_video_set_palette, ARGS_REQ(3) | ARGS_OPT(2));
+  mrb_define_module_function(mrb, _class_sdl_video, "palette_lut_builds", mrb_sdl_video_palette_lut_builds, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "set_gamma", mrb_sdl_video_set_gamma, ARGS_REQ(3));
+  mrb_define_module_function(mrb, _class_sdl_video, "set_gamma_ramp", mrb_sdl_video_set_gamma_ramp, ARGS_REQ(3));
+  mrb_define_module_function(mrb, _class_sdl_video, "gamma_ramp", mrb_sdl_video_get_gamma_ramp, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "use_software_gamma", mrb_sdl_video_use_software_gamma, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "gamma_kernel", mrb_sdl_video_gamma_kernel, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "map_rgb", mrb_sdl_video_map_rgb, ARGS_REQ(4));
+  mrb_define_module_function(mrb, _class_sdl_video, "map_rgba", mrb_sdl_video_map_rgba, ARGS_REQ(5));
+  mrb_define_module_function(mrb, _class_sdl_video, "rgb", mrb_sdl_video_get_rgb, ARGS_REQ(2));
+  mrb_define_module_function(mrb, _class_sdl_video, "rgba", mrb_sdl_video_get_rgba, ARGS_REQ(2));
+  mrb_define_module_function(mrb, _class_sdl_video, "map_rgba_buffer", mrb_sdl_video_map_rgba_buffer, ARGS_REQ(2));
+  mrb_define_module_function(mrb, _class_sdl_video, "rgba_buffer", mrb_sdl_video_rgba_buffer, ARGS_REQ(2));
+  mrb_define_module_function(mrb, _class_sdl_video, "format_kernel", mrb_sdl_video_format_kernel, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "create_rgb_surface", mrb_sdl_video_create_rgb_surface, ARGS_REQ(8));
+  mrb_define_module_function(mrb, _class_sdl_video, "create_rgb_surface_from", mrb_sdl_video_create_rgb_surface_from, ARGS_REQ(9));
+  mrb_define_module_function(mrb, _class_sdl_video, "free_surface", mrb_sdl_video_free_surface, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "lock_surface", mrb_sdl_video_lock_surface, ARGS_REQ(1) | ARGS_BLOCK());
+  mrb_define_module_function(mrb, _class_sdl_video, "unlock_surface", mrb_sdl_video_unlock_surface, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "convert_surface", mrb_sdl_video_convert_surface, ARGS_REQ(3));
+  mrb_define_module_function(mrb, _class_sdl_video, "display_format", mrb_sdl_video_display_format, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "display_format_alpha", mrb_sdl_video_display_format_alpha, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "pixel_format", mrb_sdl_video_pixel_format, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "load_bmp", mrb_sdl_video_load_bmp, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "save_bmp", mrb_sdl_video_save_bmp, ARGS_REQ(2));
+  mrb_define_module_function(mrb, _class_sdl_video, "set_color_key", mrb_sdl_video_set_color_key, ARGS_REQ(3));
+  mrb_define_module_function(mrb, _class_sdl_video, "set_alpha", mrb_sdl_video_set_alpha, ARGS_REQ(3));
+  mrb_define_module_function(mrb, _class_sdl_video, "set_clipping_rect", mrb_sdl_video_set_clipping_rect, ARGS_REQ(2));
+  mrb_define_module_function(mrb, _class_sdl_video, "get_clipping_rect", mrb_sdl_video_get_clipping_rect, ARGS_REQ(2));
+  mrb_define_module_function(mrb, _class_sdl_video, "blit_surface", mrb_sdl_video_blit_surface, ARGS_REQ(4));
+  mrb_define_module_function(mrb, _class_sdl_video, "blit_batch", mrb_sdl_video_blit_batch, ARGS_REQ(3) | ARGS_OPT(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "fill_rect", mrb_sdl_video_fill_rect, ARGS_REQ(3));
+  mrb_define_module_function(mrb, _class_sdl_video, "create_yuv_overlay", mrb_sdl_video_create_yuv_overlay, ARGS_REQ(4));
+  mrb_define_module_function(mrb, _class_sdl_video, "lock_yuv_overlay", mrb_sdl_video_lock_yuv_overlay, ARGS_REQ(1) | ARGS_BLOCK());
+  mrb_define_module_function(mrb, _class_sdl_video, "unlock_yuv_overlay", mrb_sdl_video_unlock_yuv_overlay, ARGS_REQ(1));
+  mrb_define_module_function(mrb, _class_sdl_video, "convert_to_yuv", mrb_sdl_video_convert_to_yuv, ARGS_REQ(2));
+  mrb_define_module_function(mrb, _class_sdl_video, "yuv_kernel", mrb_sdl_video_yuv_kernel, ARGS_NONE());
+  mrb_define_module_function(mrb, _class_sdl_video, "display_yuv_overlay", mrb_sdl_video_display_yuv_overlay, ARGS_REQ(2));
+  mrb_define_module_function(mrb, _class_sdl_video, "free_yuv_overlay", mrb_sdl_video_free_yuv_overlay, ARGS_REQ(1));
+  mrb_gc_arena_restore(mrb, ai);
+
+  _class_sdl_gl = mrb_define_module_under(mrb, _class_sdl, "GL");
+  mrb_define_module_function(mrb, _class_sdl_gl, "load_library", mrb_sdl_gl_load_library, ARGS_REQ(1));
+  // mrb_define_module_function(mrb, _class_sdl_gl, "proc_address", mrb_sdl_gl_get_proc_address, ARGS_REQ(1));
+  // mrb_define_module_function(mrb, _class_sdl_gl, "attribute", mrb_sdl_gl_get_attribute, ARGS_REQ(2));
+  // mrb_define_module_function(mrb, _class_sdl_gl, "set_attribute", mrb_sdl_gl_set_attribute, ARGS_REQ(2));
+  mrb_define_module_function(mrb, _class_sdl_gl, "swap_buffers", mrb_sdl_gl_swap_buffers, ARGS_NONE());
+  mrb_gc_arena_restore(mrb, ai);
+
+  // Do I really need a GC table?
+  sdl_gc_table = mrb_ary_new(mrb);
+  mrb_define_const(mrb, _class_sdl, "$GC", sdl_gc_table);
+}
+
+void mrb_mruby_sdl_gem_final (mrb_state* mrb) {
+  sdl_gc_table = mrb_nil_value();
+  sdl_video_info_last = NULL;
+  sdl_modes_last = NULL;
+  free(sdl_surface_map);
+  sdl_surface_map = NULL;
+  sdl_surface_map_count = 0;
+  sdl_surface_map_capa = 0;
+  free(sdl_blit_sort_buf);
+  sdl_blit_sort_buf = NULL;
+  sdl_blit_sort_capa = 0;
+  // Borrowers collected after this have nothing left to hand back
+  free(sdl_borrowed);
+  sdl_borrowed = NULL;
+  sdl_borrowed_count = 0;
+  sdl_borrowed_capa = 0;
+  sdl_audio_close(&sdl_audio_output);
+  sdl_event_filter_shutdown();
+  sdl_convert_cache_clear(&sdl_video_conversions);
+  if (sdl_video_compositor) {
+    sdl_compositor_free(sdl_video_compositor);
+    sdl_video_compositor = NULL;
+  }
+  sdl_gamma_destroy(&sdl_video_gamma);
+}
\ No newline at end of file
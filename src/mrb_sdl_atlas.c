@@ -0,0 +1,235 @@
+/**
+ * mruby-sdl
+ *
+ * Skyline texture atlas
+ */
+#include <SDL/SDL.h>
+#include "mrb_sdl_atlas.h"
+
+void sdl_atlas_init (sdl_atlas* atlas, int page_w, int page_h, int padding) {
+  memset(atlas, 0, sizeof(sdl_atlas));
+  atlas->page_w = page_w;
+  atlas->page_h = page_h;
+  atlas->padding = padding > 0 ? padding : 0;
+}
+
+void sdl_atlas_destroy (sdl_atlas* atlas) {
+  int i;
+  for (i = 0; i < atlas->page_count; i++) {
+    SDL_FreeSurface(atlas->pages[i].surface);
+    free(atlas->pages[i].nodes);
+  }
+  free(atlas->pages);
+  atlas->pages = NULL;
+  atlas->page_count = 0;
+}
+
+
+/*******************************************************************************
+ * Skyline
+ ******************************************************************************/
+// The lowest y a w x h box can sit at with its left edge on node index, or
+// -1 if it runs off the page
+static int sdl_skyline_fit (const sdl_atlas* atlas, const sdl_atlas_page* page, int index, int w, int h) {
+  int x = page->nodes[index].x;
+  int y = 0;
+  int left = w;
+  if (x + w > atlas->page_w) return -1;
+  while (left > 0) {
+    const sdl_skyline_node* node = &page->nodes[index];
+    if (node->y > y) y = node->y;
+    if (y + h > atlas->page_h) return -1;
+    left -= node->w;
+    index++;
+  }
+  return y;
+}
+
+// Pick the spot whose top ends lowest, breaking ties on the narrowest step
+static int sdl_skyline_find (const sdl_atlas* atlas, const sdl_atlas_page* page, int w, int h, int* best_x, int* best_y) {
+  int best = -1;
+  int best_top = 0;
+  int best_w = 0;
+  int i;
+  for (i = 0; i < page->node_count; i++) {
+    int y = sdl_skyline_fit(atlas, page, i, w, h);
+    if (y < 0) continue;
+    int top = y + h;
+    if (best < 0 || top < best_top || (top == best_top && page->nodes[i].w < best_w)) {
+      best = i;
+      best_top = top;
+      best_w = page->nodes[i].w;
+      *best_x = page->nodes[i].x;
+      *best_y = y;
+    }
+  }
+  return best;
+}
+
+static int sdl_skyline_place (sdl_atlas_page* page, int index, int x, int y, int w, int h) {
+  int i;
+  if (page->node_count == page->node_capacity) {
+    int capacity = page->node_capacity * 2;
+    sdl_skyline_node* nodes = (sdl_skyline_node*) realloc(page->nodes, sizeof(sdl_skyline_node) * capacity);
+    if ( ! nodes) return -1;
+    page->nodes = nodes;
+    page->node_capacity = capacity;
+  }
+
+  memmove(&page->nodes[index + 1], &page->nodes[index], sizeof(sdl_skyline_node) * (page->node_count - index));
+  page->node_count++;
+  page->nodes[index].x = x;
+  page->nodes[index].y = y + h;
+  page->nodes[index].w = w;
+
+  // Trim the steps the new one now covers
+  for (i = index + 1; i < page->node_count; i++) {
+    sdl_skyline_node* node = &page->nodes[i];
+    int covered = x + w - node->x;
+    if (covered <= 0) break;
+    if (covered < node->w) {
+      node->x += covered;
+      node->w -= covered;
+      break;
+    }
+    memmove(node, node + 1, sizeof(sdl_skyline_node) * (page->node_count - i - 1));
+    page->node_count--;
+    i--;
+  }
+
+  // Merge neighbouring steps at the same height
+  for (i = 0; i + 1 < page->node_count; i++) {
+    if (page->nodes[i].y == page->nodes[i + 1].y) {
+      page->nodes[i].w += page->nodes[i + 1].w;
+      memmove(&page->nodes[i + 1], &page->nodes[i + 2], sizeof(sdl_skyline_node) * (page->node_count - i - 2));
+      page->node_count--;
+      i--;
+    }
+  }
+  return 0;
+}
+
+
+/*******************************************************************************
+ * Pages
+ ******************************************************************************/
+static int sdl_atlas_page_matches (const sdl_atlas_page* page, const SDL_Surface* image) {
+  const SDL_PixelFormat* pf = page->surface->format;
+  const SDL_PixelFormat* f = image->format;
+  Uint32 blend = SDL_SRCCOLORKEY | SDL_SRCALPHA;
+  if ((page->surface->flags & blend) != (image->flags & blend)) return 0;
+  if (pf->BitsPerPixel != f->BitsPerPixel || pf->Rmask != f->Rmask || pf->Gmask != f->Gmask ||
+      pf->Bmask != f->Bmask || pf->Amask != f->Amask) return 0;
+  if ((image->flags & SDL_SRCCOLORKEY) && pf->colorkey != f->colorkey) return 0;
+  if ((image->flags & SDL_SRCALPHA) && pf->alpha != f->alpha) return 0;
+  // Indices are copied raw, so paletted images only share a page when their
+  // palettes agree
+  if ( ! pf->palette != ! f->palette) return 0;
+  if (f->palette && (pf->palette->ncolors != f->palette->ncolors ||
+      memcmp(pf->palette->colors, f->palette->colors, sizeof(SDL_Color) * f->palette->ncolors))) return 0;
+  return 1;
+}
+
+static sdl_atlas_page* sdl_atlas_add_page (sdl_atlas* atlas, SDL_Surface* image) {
+  const SDL_PixelFormat* f = image->format;
+  sdl_atlas_page* pages = (sdl_atlas_page*) realloc(atlas->pages, sizeof(sdl_atlas_page) * (atlas->page_count + 1));
+  if ( ! pages) return NULL;
+  atlas->pages = pages;
+
+  sdl_atlas_page* page = &atlas->pages[atlas->page_count];
+  memset(page, 0, sizeof(sdl_atlas_page));
+  page->surface = SDL_CreateRGBSurface(SDL_SWSURFACE, atlas->page_w, atlas->page_h,
+    f->BitsPerPixel, f->Rmask, f->Gmask, f->Bmask, f->Amask);
+  page->nodes = (sdl_skyline_node*) malloc(sizeof(sdl_skyline_node) * 16);
+  if ( ! page->surface || ! page->nodes) {
+    if (page->surface) SDL_FreeSurface(page->surface);
+    free(page->nodes);
+    return NULL;
+  }
+  if (f->palette) SDL_SetColors(page->surface, f->palette->colors, 0, f->palette->ncolors);
+  // Images are copied in raw, so the page starts out with no blending and
+  // picks up the image's attributes afterwards
+  SDL_SetAlpha(page->surface, 0, SDL_ALPHA_OPAQUE);
+  page->node_capacity = 16;
+  page->node_count = 1;
+  page->nodes[0].x = 0;
+  page->nodes[0].y = 0;
+  page->nodes[0].w = atlas->page_w;
+  atlas->page_count++;
+  return page;
+}
+
+// Copy the image's pixels as they are, without blending them onto the page
+static int sdl_atlas_copy (SDL_Surface* image, SDL_Surface* page, SDL_Rect* rect) {
+  Uint32 flags = image->flags & (SDL_SRCCOLORKEY | SDL_SRCALPHA | SDL_RLEACCEL);
+  Uint32 colorkey = image->format->colorkey;
+  Uint8 alpha = image->format->alpha;
+  SDL_Rect dest = *rect;
+
+  SDL_SetAlpha(image, 0, alpha);
+  SDL_SetColorKey(image, 0, colorkey);
+  int result = SDL_BlitSurface(image, NULL, page, &dest);
+  SDL_SetColorKey(image, flags & (SDL_SRCCOLORKEY | SDL_RLEACCEL), colorkey);
+  SDL_SetAlpha(image, flags & (SDL_SRCALPHA | SDL_RLEACCEL), alpha);
+  return result;
+}
+
+int sdl_atlas_insert (sdl_atlas* atlas, SDL_Surface* image, SDL_Rect* rect) {
+  int w = image->w + atlas->padding;
+  int h = image->h + atlas->padding;
+  int x = 0;
+  int y = 0;
+  int i;
+
+  if (image->w > atlas->page_w || image->h > atlas->page_h) {
+    SDL_SetError("Image is larger than an atlas page");
+    return -1;
+  }
+  // Padding only matters between images, so it may hang off the page edge
+  if (w > atlas->page_w) w = atlas->page_w;
+  if (h > atlas->page_h) h = atlas->page_h;
+
+  sdl_atlas_page* page = NULL;
+  int index = -1;
+  for (i = 0; i < atlas->page_count && index < 0; i++) {
+    if ( ! sdl_atlas_page_matches(&atlas->pages[i], image)) continue;
+    index = sdl_skyline_find(atlas, &atlas->pages[i], w, h, &x, &y);
+    if (index >= 0) page = &atlas->pages[i];
+  }
+  if ( ! page) {
+    page = sdl_atlas_add_page(atlas, image);
+    if ( ! page) {
+      SDL_SetError("Out of memory");
+      return -1;
+    }
+    index = 0;
+  }
+  if (sdl_skyline_place(page, index, x, y, w, h) < 0) {
+    SDL_SetError("Out of memory");
+    return -1;
+  }
+
+  rect->x = x;
+  rect->y = y;
+  rect->w = image->w;
+  rect->h = image->h;
+  if (sdl_atlas_copy(image, page->surface, rect) < 0) return -1;
+
+  // A fresh page takes the blit attributes of the first image on it
+  if (page->used_area == 0) {
+    if (image->flags & SDL_SRCCOLORKEY) SDL_SetColorKey(page->surface, SDL_SRCCOLORKEY, image->format->colorkey);
+    SDL_SetAlpha(page->surface, image->flags & SDL_SRCALPHA, image->format->alpha);
+  }
+  page->used_area += (long) image->w * image->h;
+  return (int) (page - atlas->pages);
+}
+
+double sdl_atlas_occupancy (const sdl_atlas* atlas) {
+  long used = 0;
+  int i;
+  if ( ! atlas->page_count) return 0;
+  for (i = 0; i < atlas->page_count; i++) {
+    used += atlas->pages[i].used_area;
+  }
+  return (double) used / ((double) atlas->page_w * atlas->page_h * atlas->page_count);
+}
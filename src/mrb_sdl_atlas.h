@@ -0,0 +1,47 @@
+#ifndef MRB_SDL_ATLAS_H
+#define MRB_SDL_ATLAS_H
+
+#include <SDL/SDL.h>
+
+// One step of a page's skyline: the free space above y, from x for w pixels
+typedef struct {
+  int x;
+  int y;
+  int w;
+} sdl_skyline_node;
+
+/*
+ * A sheet of packed images. Every image on a page shares its pixel format and
+ * blit attributes (colour key, surface alpha), since a blit from the page
+ * uses the page's.
+ */
+typedef struct {
+  SDL_Surface* surface;
+  sdl_skyline_node* nodes;
+  int node_count;
+  int node_capacity;
+  long used_area;
+} sdl_atlas_page;
+
+/*
+ * Incremental skyline (bottom-left) packer over a growing set of pages. Each
+ * insert copies the image onto the first page with matching attributes that
+ * has room, opening a new page when none does.
+ */
+typedef struct {
+  int page_w;
+  int page_h;
+  int padding;
+  sdl_atlas_page* pages;
+  int page_count;
+} sdl_atlas;
+
+void sdl_atlas_init(sdl_atlas* atlas, int page_w, int page_h, int padding);
+void sdl_atlas_destroy(sdl_atlas* atlas);
+
+// Copy image into the atlas. Returns the page index, with its place on that
+// page in rect, or -1 on error.
+int sdl_atlas_insert(sdl_atlas* atlas, SDL_Surface* image, SDL_Rect* rect);
+double sdl_atlas_occupancy(const sdl_atlas* atlas);
+
+#endif	/* MRB_SDL_ATLAS_H */
@@ -0,0 +1,126 @@
+/**
+ * mruby-sdl
+ *
+ * Lock-free audio output
+ */
+#include <SDL/SDL.h>
+#include "mrb_sdl_audio.h"
+
+#define SDL_AUDIO_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define SDL_AUDIO_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+/*******************************************************************************
+ * Ring
+ ******************************************************************************/
+int sdl_audio_ring_init (sdl_audio_ring* ring, Uint32 capacity) {
+  Uint32 size = 1024;
+  memset(ring, 0, sizeof(sdl_audio_ring));
+  while (size < capacity && size < 0x40000000) size <<= 1;
+  ring->data = (Uint8*) malloc(size);
+  if ( ! ring->data) return -1;
+  ring->capacity = size;
+  return 0;
+}
+
+void sdl_audio_ring_destroy (sdl_audio_ring* ring) {
+  free(ring->data);
+  memset(ring, 0, sizeof(sdl_audio_ring));
+}
+
+Uint32 sdl_audio_ring_used (const sdl_audio_ring* ring) {
+  return SDL_AUDIO_LOAD(&ring->tail) - SDL_AUDIO_LOAD(&ring->head);
+}
+
+Uint32 sdl_audio_ring_space (const sdl_audio_ring* ring) {
+  return ring->capacity - sdl_audio_ring_used(ring);
+}
+
+Uint32 sdl_audio_ring_write (sdl_audio_ring* ring, const void* data, Uint32 length) {
+  Uint32 tail = ring->tail;
+  Uint32 space = ring->capacity - (tail - SDL_AUDIO_LOAD(&ring->head));
+  Uint32 count = length < space ? length : space;
+  Uint32 offset = tail & (ring->capacity - 1);
+  Uint32 first = ring->capacity - offset;
+  if (first > count) first = count;
+
+  memcpy(ring->data + offset, data, first);
+  memcpy(ring->data, (const Uint8*) data + first, count - first);
+  SDL_AUDIO_STORE(&ring->tail, tail + count);
+
+  if (count < length) {
+    ring->overruns++;
+    ring->overrun_bytes += length - count;
+  }
+  return count;
+}
+
+void sdl_audio_ring_read (sdl_audio_ring* ring, Uint8* out, Uint32 length, Uint8 silence) {
+  Uint32 head = ring->head;
+  Uint32 used = SDL_AUDIO_LOAD(&ring->tail) - head;
+  Uint32 count = length < used ? length : used;
+  Uint32 offset = head & (ring->capacity - 1);
+  Uint32 first = ring->capacity - offset;
+  if (first > count) first = count;
+
+  memcpy(out, ring->data + offset, first);
+  memcpy(out + first, ring->data, count - first);
+  SDL_AUDIO_STORE(&ring->head, head + count);
+
+  if (count < length) {
+    memset(out + count, silence, length - count);
+    ring->underruns++;
+    ring->underrun_bytes += length - count;
+  }
+}
+
+
+/*******************************************************************************
+ * Device
+ ******************************************************************************/
+static void sdl_audio_callback (void* userdata, Uint8* stream, int length) {
+  sdl_audio_device* device = (sdl_audio_device*) userdata;
+  sdl_audio_ring_read(&device->ring, stream, length, device->spec.silence);
+  // SDL holds the audio lock around the callback, which guards mixer
+  if (device->mixer) sdl_mixer_mix(device->mixer, (Sint16*) stream, length / 4);
+}
+
+int sdl_audio_open (sdl_audio_device* device, const SDL_AudioSpec* desired, Uint32 ring_bytes) {
+  SDL_AudioSpec wanted = *desired;
+  memset(device, 0, sizeof(sdl_audio_device));
+  wanted.callback = sdl_audio_callback;
+  wanted.userdata = device;
+  if (SDL_OpenAudio(&wanted, &device->spec) < 0) return -1;
+
+  // By default, hold four device buffers' worth
+  if ( ! ring_bytes) ring_bytes = device->spec.size * 4;
+  if (sdl_audio_ring_init(&device->ring, ring_bytes) < 0) {
+    SDL_CloseAudio();
+    SDL_SetError("Out of memory");
+    return -1;
+  }
+  device->open = 1;
+  return 0;
+}
+
+void sdl_audio_close (sdl_audio_device* device) {
+  if ( ! device->open) return;
+  // Waits for the callback to finish, so the ring can go
+  SDL_CloseAudio();
+  sdl_audio_ring_destroy(&device->ring);
+  sdl_mixer_free(device->mixer);
+  device->mixer = NULL;
+  device->open = 0;
+}
+
+int sdl_audio_set_mixer (sdl_audio_device* device, sdl_mixer* mixer) {
+  if (mixer && (device->spec.format != AUDIO_S16SYS || device->spec.channels != 2)) {
+    SDL_SetError("The mixer needs 16-bit native-endian stereo output");
+    return -1;
+  }
+  SDL_LockAudio();
+  sdl_mixer* old = device->mixer;
+  device->mixer = mixer;
+  SDL_UnlockAudio();
+  sdl_mixer_free(old);
+  return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef MRB_SDL_AUDIO_H
+#define MRB_SDL_AUDIO_H
+
+#include <SDL/SDL.h>
+#include "mrb_sdl_mixer.h"
+
+/*
+ * Single-producer, single-consumer byte ring. The main thread writes and
+ * SDL's audio thread reads, with no locks: each side only ever stores its
+ * own position, published with release ordering and read with acquire.
+ * Positions count bytes since the ring was made and wrap at 2^32, which
+ * works out because the capacity is a power of two.
+ */
+typedef struct {
+  Uint8* data;
+  Uint32 capacity;
+  Uint32 head;
+  Uint32 tail;
+
+  // Written by the consumer
+  Uint32 underruns;
+  Uint32 underrun_bytes;
+
+  // Written by the producer
+  Uint32 overruns;
+  Uint32 overrun_bytes;
+} sdl_audio_ring;
+
+// capacity is rounded up to a power of two
+int sdl_audio_ring_init(sdl_audio_ring* ring, Uint32 capacity);
+void sdl_audio_ring_destroy(sdl_audio_ring* ring);
+
+// Producer side. Copies as much of data as fits and returns how much that
+// was; anything left over counts as an overrun.
+Uint32 sdl_audio_ring_write(sdl_audio_ring* ring, const void* data, Uint32 length);
+Uint32 sdl_audio_ring_space(const sdl_audio_ring* ring);
+
+// Consumer side. Fills out from the ring, padding with silence and counting
+// an underrun when the ring runs dry.
+void sdl_audio_ring_read(sdl_audio_ring* ring, Uint8* out, Uint32 length, Uint8 silence);
+Uint32 sdl_audio_ring_used(const sdl_audio_ring* ring);
+
+/*
+ * The audio device. SDL's callback drains the ring, then mixes any playing
+ * voices over it; nothing on the audio thread touches the interpreter.
+ */
+typedef struct {
+  SDL_AudioSpec spec;
+  sdl_audio_ring ring;
+  sdl_mixer* mixer;
+  int open;
+} sdl_audio_device;
+
+int sdl_audio_open(sdl_audio_device* device, const SDL_AudioSpec* desired, Uint32 ring_bytes);
+void sdl_audio_close(sdl_audio_device* device);
+
+// The mixer needs 16-bit native-endian stereo. Attaching replaces and frees
+// any mixer already attached; pass NULL to remove it.
+int sdl_audio_set_mixer(sdl_audio_device* device, sdl_mixer* mixer);
+
+#endif	/* MRB_SDL_AUDIO_H */
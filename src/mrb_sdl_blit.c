@@ -0,0 +1,656 @@
+/**
+ * mruby-sdl
+ *
+ * 32bpp blit and fill kernels with runtime CPU dispatch
+ *
+ * The blend kernels reproduce SDL 1.2's C blitters bit for bit: each channel
+ * becomes (d * (256 - a) + s * a) >> 8, with a per-pixel alpha of 255 taken
+ * as a straight copy. Per-pixel alpha keeps the destination alpha, and
+ * per-surface alpha writes an opaque destination alpha. Palette expansion
+ * maps each entry the way SDL_MapRGB does, as SDL's own 1toN blitters do.
+ */
+#include <SDL/SDL.h>
+#include "mrb_sdl_blit.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SDL_BLIT_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+typedef void (*sdl_blit_kernel)(const sdl_blit_op* op, int first_row, int rows);
+
+typedef struct {
+  const char* name;
+  sdl_blit_kernel kernels[SDL_BLIT_OP_FILL + 1];
+} sdl_blit_kernel_set;
+
+#define SDL_BLIT_SRC_ROW(op, y) ((const Uint32*) ((op)->src + (y) * (op)->src_pitch))
+#define SDL_BLIT_DST_ROW(op, y) ((Uint32*) ((op)->dst + (y) * (op)->dst_pitch))
+
+
+/*******************************************************************************
+ * Scalar kernels
+ ******************************************************************************/
+static inline Uint32 sdl_blend_channels (Uint32 s, Uint32 d, Uint32 alpha) {
+  Uint32 s1 = s & 0xff00ff;
+  Uint32 d1 = d & 0xff00ff;
+  d1 = (d1 + ((s1 - d1) * alpha >> 8)) & 0xff00ff;
+  s &= 0xff00;
+  d &= 0xff00;
+  d = (d + ((s - d) * alpha >> 8)) & 0xff00;
+  return d1 | d;
+}
+
+static void sdl_blit_copy (const sdl_blit_op* op, int first_row, int rows) {
+  int y;
+  for (y = first_row; y < first_row + rows; y++) {
+    memcpy(SDL_BLIT_DST_ROW(op, y), SDL_BLIT_SRC_ROW(op, y), op->w * 4);
+  }
+}
+
+static void sdl_blit_color_key_scalar (const sdl_blit_op* op, int first_row, int rows) {
+  int x, y;
+  for (y = first_row; y < first_row + rows; y++) {
+    const Uint32* src = SDL_BLIT_SRC_ROW(op, y);
+    Uint32* dst = SDL_BLIT_DST_ROW(op, y);
+    for (x = 0; x < op->w; x++) {
+      if (src[x] != op->param) dst[x] = src[x] & op->mask;
+    }
+  }
+}
+
+static void sdl_blit_pixel_alpha_scalar (const sdl_blit_op* op, int first_row, int rows) {
+  int x, y;
+  for (y = first_row; y < first_row + rows; y++) {
+    const Uint32* src = SDL_BLIT_SRC_ROW(op, y);
+    Uint32* dst = SDL_BLIT_DST_ROW(op, y);
+    for (x = 0; x < op->w; x++) {
+      Uint32 s = src[x];
+      Uint32 alpha = s >> 24;
+      if (alpha == SDL_ALPHA_OPAQUE) {
+        dst[x] = (s & 0x00ffffff) | (dst[x] & 0xff000000);
+      } else if (alpha) {
+        dst[x] = sdl_blend_channels(s, dst[x], alpha) | (dst[x] & 0xff000000);
+      }
+    }
+  }
+}
+
+static void sdl_blit_surface_alpha_scalar (const sdl_blit_op* op, int first_row, int rows) {
+  int x, y;
+  for (y = first_row; y < first_row + rows; y++) {
+    const Uint32* src = SDL_BLIT_SRC_ROW(op, y);
+    Uint32* dst = SDL_BLIT_DST_ROW(op, y);
+    for (x = 0; x < op->w; x++) {
+      dst[x] = sdl_blend_channels(src[x], dst[x], op->param) | 0xff000000;
+    }
+  }
+}
+
+// Expansion is a table lookup per pixel, which no vector unit here does
+// faster than scalar loads, so every kernel set shares these. An op->param
+// past 255 means no color key.
+static void sdl_blit_expand_16 (const sdl_blit_op* op, int first_row, int rows) {
+  int x, y;
+  for (y = first_row; y < first_row + rows; y++) {
+    const Uint8* src = op->src + y * op->src_pitch;
+    Uint16* dst = (Uint16*) (op->dst + y * op->dst_pitch);
+    if (op->param > 0xff) {
+      for (x = 0; x < op->w; x++) dst[x] = (Uint16) op->lut[src[x]];
+    } else {
+      for (x = 0; x < op->w; x++) {
+        if (src[x] != op->param) dst[x] = (Uint16) op->lut[src[x]];
+      }
+    }
+  }
+}
+
+static void sdl_blit_expand_32 (const sdl_blit_op* op, int first_row, int rows) {
+  int x, y;
+  for (y = first_row; y < first_row + rows; y++) {
+    const Uint8* src = op->src + y * op->src_pitch;
+    Uint32* dst = SDL_BLIT_DST_ROW(op, y);
+    if (op->param > 0xff) {
+      for (x = 0; x + 4 <= op->w; x += 4) {
+        dst[x] = op->lut[src[x]];
+        dst[x + 1] = op->lut[src[x + 1]];
+        dst[x + 2] = op->lut[src[x + 2]];
+        dst[x + 3] = op->lut[src[x + 3]];
+      }
+      for (; x < op->w; x++) dst[x] = op->lut[src[x]];
+    } else {
+      for (x = 0; x < op->w; x++) {
+        if (src[x] != op->param) dst[x] = op->lut[src[x]];
+      }
+    }
+  }
+}
+
+static void sdl_fill_scalar (const sdl_blit_op* op, int first_row, int rows) {
+  int x, y;
+  for (y = first_row; y < first_row + rows; y++) {
+    Uint32* dst = SDL_BLIT_DST_ROW(op, y);
+    for (x = 0; x < op->w; x++) {
+      dst[x] = op->param;
+    }
+  }
+}
+
+static const sdl_blit_kernel_set sdl_blit_kernels_scalar = {
+  "scalar",
+  { NULL, sdl_blit_copy, sdl_blit_color_key_scalar, sdl_blit_pixel_alpha_scalar,
+    sdl_blit_surface_alpha_scalar, sdl_blit_expand_16, sdl_blit_expand_32, sdl_fill_scalar }
+};
+
+
+#ifdef SDL_BLIT_X86
+/*******************************************************************************
+ * SSE2 kernels
+ ******************************************************************************/
+#define SDL_SSE2 __attribute__((target("sse2")))
+
+// Blend four pixels. weight holds the alpha to use for each pixel, already
+// spread across that pixel's four 16-bit lanes.
+SDL_SSE2 static inline __m128i sdl_blend_sse2 (__m128i s, __m128i d, __m128i weight_lo, __m128i weight_hi) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i v256 = _mm_set1_epi16(256);
+  __m128i s_lo = _mm_unpacklo_epi8(s, zero);
+  __m128i s_hi = _mm_unpackhi_epi8(s, zero);
+  __m128i d_lo = _mm_unpacklo_epi8(d, zero);
+  __m128i d_hi = _mm_unpackhi_epi8(d, zero);
+  __m128i c_lo = _mm_add_epi16(_mm_mullo_epi16(s_lo, weight_lo), _mm_mullo_epi16(d_lo, _mm_sub_epi16(v256, weight_lo)));
+  __m128i c_hi = _mm_add_epi16(_mm_mullo_epi16(s_hi, weight_hi), _mm_mullo_epi16(d_hi, _mm_sub_epi16(v256, weight_hi)));
+  return _mm_packus_epi16(_mm_srli_epi16(c_lo, 8), _mm_srli_epi16(c_hi, 8));
+}
+
+SDL_SSE2 static inline __m128i sdl_pixel_weight_sse2 (__m128i pixels) {
+  const __m128i v255 = _mm_set1_epi16(255);
+  __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, 0xff), 0xff);
+  // Opaque pixels weigh 256 so they copy exactly
+  return _mm_sub_epi16(alpha, _mm_cmpeq_epi16(alpha, v255));
+}
+
+SDL_SSE2 static void sdl_blit_color_key_sse2 (const sdl_blit_op* op, int first_row, int rows) {
+  const __m128i key = _mm_set1_epi32((int) op->param);
+  const __m128i mask = _mm_set1_epi32((int) op->mask);
+  int x, y;
+  for (y = first_row; y < first_row + rows; y++) {
+    const Uint32* src = SDL_BLIT_SRC_ROW(op, y);
+    Uint32* dst = SDL_BLIT_DST_ROW(op, y);
+    for (x = 0; x + 4 <= op->w; x += 4) {
+      __m128i s = _mm_loadu_si128((const __m128i*) (src + x));
+      __m128i d = _mm_loadu_si128((const __m128i*) (dst + x));
+      __m128i keyed = _mm_cmpeq_epi32(s, key);
+      d = _mm_or_si128(_mm_and_si128(keyed, d), _mm_andnot_si128(keyed, _mm_and_si128(s, mask)));
+      _mm_storeu_si128((__m128i*) (dst + x), d);
+    }
+    for (; x < op->w; x++) {
+      if (src[x] != op->param) dst[x] = src[x] & op->mask;
+    }
+  }
+}
+
+SDL_SSE2 static void sdl_blit_pixel_alpha_sse2 (const sdl_blit_op* op, int first_row, int rows) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i dst_alpha = _mm_set1_epi32((int) 0xff000000);
+  int x, y;
+  for (y = first_row; y < first_row + rows; y++) {
+    const Uint32* src = SDL_BLIT_SRC_ROW(op, y);
+    Uint32* dst = SDL_BLIT_DST_ROW(op, y);
+    for (x = 0; x + 4 <= op->w; x += 4) {
+      __m128i s = _mm_loadu_si128((const __m128i*) (src + x));
+      __m128i d = _mm_loadu_si128((const __m128i*) (dst + x));
+      __m128i weight_lo = sdl_pixel_weight_sse2(_mm_unpacklo_epi8(s, zero));
+      __m128i weight_hi = sdl_pixel_weight_sse2(_mm_unpackhi_epi8(s, zero));
+      __m128i c = sdl_blend_sse2(s, d, weight_lo, weight_hi);
+      c = _mm_or_si128(_mm_andnot_si128(dst_alpha, c), _mm_and_si128(dst_alpha, d));
+      _mm_storeu_si128((__m128i*) (dst + x), c);
+    }
+    if (x < op->w) {
+      sdl_blit_op tail = *op;
+      tail.src = (const Uint8*) (src + x) - y * op->src_pitch;
+      tail.dst = (Uint8*) (dst + x) - y * op->dst_pitch;
+      tail.w = op->w - x;
+      sdl_blit_pixel_alpha_scalar(&tail, y, 1);
+    }
+  }
+}
+
+SDL_SSE2 static void sdl_blit_surface_alpha_sse2 (const sdl_blit_op* op, int first_row, int rows) {
+  const __m128i weight = _mm_set1_epi16((short) op->param);
+  const __m128i opaque = _mm_set1_epi32((int) 0xff000000);
+  int x, y;
+  for (y = first_row; y < first_row + rows; y++) {
+    const Uint32* src = SDL_BLIT_SRC_ROW(op, y);
+    Uint32* dst = SDL_BLIT_DST_ROW(op, y);
+    for (x = 0; x + 4 <= op->w; x += 4) {
+      __m128i s = _mm_loadu_si128((const __m128i*) (src + x));
+      __m128i d = _mm_loadu_si128((const __m128i*) (dst + x));
+      _mm_storeu_si128((__m128i*) (dst + x), _mm_or_si128(sdl_blend_sse2(s, d, weight, weight), opaque));
+    }
+    for (; x < op->w; x++) {
+      dst[x] = sdl_blend_channels(src[x], dst[x], op->param) | 0xff000000;
+    }
+  }
+}
+
+SDL_SSE2 static void sdl_fill_sse2 (const sdl_blit_op* op, int first_row, int rows) {
+  const __m128i color = _mm_set1_epi32((int) op->param);
+  int x, y;
+  for (y = first_row; y < first_row + rows; y++) {
+    Uint32* dst = SDL_BLIT_DST_ROW(op, y);
+    for (x = 0; x + 4 <= op->w; x += 4) {
+      _mm_storeu_si128((__m128i*) (dst + x), color);
+    }
+    for (; x < op->w; x++) {
+      dst[x] = op->param;
+    }
+  }
+}
+
+static const sdl_blit_kernel_set sdl_blit_kernels_sse2 = {
+  "sse2",
+  { NULL, sdl_blit_copy, sdl_blit_color_key_sse2, sdl_blit_pixel_alpha_sse2,
+    sdl_blit_surface_alpha_sse2, sdl_blit_expand_16, sdl_blit_expand_32, sdl_fill_sse2 }
+};
+
+
+/*******************************************************************************
+ * AVX2 kernels
+ ******************************************************************************/
+#define SDL_AVX2 __attribute__((target("avx2")))
+
+SDL_AVX2 static inline __m256i sdl_blend_avx2 (__m256i s, __m256i d, __m256i weight_lo, __m256i weight_hi) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i v256 = _mm256_set1_epi16(256);
+  __m256i s_lo = _mm256_unpacklo_epi8(s, zero);
+  __m256i s_hi = _mm256_unpackhi_epi8(s, zero);
+  __m256i d_lo = _mm256_unpacklo_epi8(d, zero);
+  __m256i d_hi = _mm256_unpackhi_epi8(d, zero);
+  __m256i c_lo = _mm256_add_epi16(_mm256_mullo_epi16(s_lo, weight_lo), _mm256_mullo_epi16(d_lo, _mm256_sub_epi16(v256, weight_lo)));
+  __m256i c_hi = _mm256_add_epi16(_mm256_mullo_epi16(s_hi, weight_hi), _mm256_mullo_epi16(d_hi, _mm256_sub_epi16(v256, weight_hi)));
+  return _mm256_packus_epi16(_mm256_srli_epi16(c_lo, 8), _mm256_srli_epi16(c_hi, 8));
+}
+
+SDL_AVX2 static inline __m256i sdl_pixel_weight_avx2 (__m256i pixels) {
+  const __m256i v255 = _mm256_set1_epi16(255);
+  __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(pixels, 0xff), 0xff);
+  return _mm256_sub_epi16(alpha, _mm256_cmpeq_epi16(alpha, v255));
+}
+
+SDL_AVX2 static void sdl_blit_color_key_avx2 (const sdl_blit_op* op, int first_row, int rows) {
+  const __m256i key = _mm256_set1_epi32((int) op->param);
+  const __m256i mask = _mm256_set1_epi32((int) op->mask);
+  int x, y;
+  for (y = first_row; y < first_row + rows; y++) {
+    const Uint32* src = SDL_BLIT_SRC_ROW(op, y);
+    Uint32* dst = SDL_BLIT_DST_ROW(op, y);
+    for (x = 0; x + 8 <= op->w; x += 8) {
+      __m256i s = _mm256_loadu_si256((const __m256i*) (src + x));
+      __m256i d = _mm256_loadu_si256((const __m256i*) (dst + x));
+      __m256i keyed = _mm256_cmpeq_epi32(s, key);
+      _mm256_storeu_si256((__m256i*) (dst + x), _mm256_blendv_epi8(_mm256_and_si256(s, mask), d, keyed));
+    }
+    for (; x < op->w; x++) {
+      if (src[x] != op->param) dst[x] = src[x] & op->mask;
+    }
+  }
+}
+
+SDL_AVX2 static void sdl_blit_pixel_alpha_avx2 (const sdl_blit_op* op, int first_row, int rows) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i dst_alpha = _mm256_set1_epi32((int) 0xff000000);
+  int x, y;
+  for (y = first_row; y < first_row + rows; y++) {
+    const Uint32* src = SDL_BLIT_SRC_ROW(op, y);
+    Uint32* dst = SDL_BLIT_DST_ROW(op, y);
+    for (x = 0; x + 8 <= op->w; x += 8) {
+      __m256i s = _mm256_loadu_si256((const __m256i*) (src + x));
+      __m256i d = _mm256_loadu_si256((const __m256i*) (dst + x));
+      __m256i weight_lo = sdl_pixel_weight_avx2(_mm256_unpacklo_epi8(s, zero));
+      __m256i weight_hi = sdl_pixel_weight_avx2(_mm256_unpackhi_epi8(s, zero));
+      __m256i c = sdl_blend_avx2(s, d, weight_lo, weight_hi);
+      _mm256_storeu_si256((__m256i*) (dst + x), _mm256_blendv_epi8(c, d, dst_alpha));
+    }
+    if (x < op->w) {
+      sdl_blit_op tail = *op;
+      tail.src = (const Uint8*) (src + x) - y * op->src_pitch;
+      tail.dst = (Uint8*) (dst + x) - y * op->dst_pitch;
+      tail.w = op->w - x;
+      sdl_blit_pixel_alpha_scalar(&tail, y, 1);
+    }
+  }
+}
+
+SDL_AVX2 static void sdl_blit_surface_alpha_avx2 (const sdl_blit_op* op, int first_row, int rows) {
+  const __m256i weight = _mm256_set1_epi16((short) op->param);
+  const __m256i opaque = _mm256_set1_epi32((int) 0xff000000);
+  int x, y;
+  for (y = first_row; y < first_row + rows; y++) {
+    const Uint32* src = SDL_BLIT_SRC_ROW(op, y);
+    Uint32* dst = SDL_BLIT_DST_ROW(op, y);
+    for (x = 0; x + 8 <= op->w; x += 8) {
+      __m256i s = _mm256_loadu_si256((const __m256i*) (src + x));
+      __m256i d = _mm256_loadu_si256((const __m256i*) (dst + x));
+      _mm256_storeu_si256((__m256i*) (dst + x), _mm256_or_si256(sdl_blend_avx2(s, d, weight, weight), opaque));
+    }
+    for (; x < op->w; x++) {
+      dst[x] = sdl_blend_channels(src[x], dst[x], op->param) | 0xff000000;
+    }
+  }
+}
+
+SDL_AVX2 static void sdl_fill_avx2 (const sdl_blit_op* op, int first_row, int rows) {
+  const __m256i color = _mm256_set1_epi32((int) op->param);
+  int x, y;
+  for (y = first_row; y < first_row + rows; y++) {
+    Uint32* dst = SDL_BLIT_DST_ROW(op, y);
+    for (x = 0; x + 8 <= op->w; x += 8) {
+      _mm256_storeu_si256((__m256i*) (dst + x), color);
+    }
+    for (; x < op->w; x++) {
+      dst[x] = op->param;
+    }
+  }
+}
+
+static const sdl_blit_kernel_set sdl_blit_kernels_avx2 = {
+  "avx2",
+  { NULL, sdl_blit_copy, sdl_blit_color_key_avx2, sdl_blit_pixel_alpha_avx2,
+    sdl_blit_surface_alpha_avx2, sdl_blit_expand_16, sdl_blit_expand_32, sdl_fill_avx2 }
+};
+#endif
+
+
+/*******************************************************************************
+ * Dispatch
+ ******************************************************************************/
+static const sdl_blit_kernel_set* sdl_blit_kernels = &sdl_blit_kernels_scalar;
+static int sdl_blit_on = 1;
+
+void sdl_blit_init (void) {
+  sdl_blit_kernels = &sdl_blit_kernels_scalar;
+#ifdef SDL_BLIT_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    sdl_blit_kernels = &sdl_blit_kernels_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    sdl_blit_kernels = &sdl_blit_kernels_sse2;
+  }
+#endif
+}
+
+const char* sdl_blit_kernel_name (void) {
+  return sdl_blit_on ? sdl_blit_kernels->name : "sdl";
+}
+
+void sdl_blit_set_enabled (int enabled) {
+  sdl_blit_on = enabled;
+}
+
+int sdl_blit_enabled (void) {
+  return sdl_blit_on;
+}
+
+void sdl_blit_run (const sdl_blit_op* op, int first_row, int rows) {
+  if (op->type == SDL_BLIT_OP_NONE || rows <= 0) return;
+  sdl_blit_kernels->kernels[op->type](op, first_row, rows);
+}
+
+
+/*******************************************************************************
+ * Palette lookup tables
+ *
+ * Tables are kept for the last few palette and destination format pairs,
+ * each with a copy of the colors it was built from. A table whose palette no
+ * longer matches its copy is rebuilt, so set_colors and palette cycling
+ * need no bookkeeping, and an unchanged palette costs one memcmp per blit.
+ ******************************************************************************/
+#define SDL_BLIT_LUTS 8
+
+typedef struct {
+  const SDL_Palette* palette;
+  int ncolors;
+  SDL_Color colors[256];
+  Uint8 bytes_per_pixel;
+  Uint32 rmask;
+  Uint32 gmask;
+  Uint32 bmask;
+  Uint32 amask;
+  Uint32 used;
+  Uint32 lut[256];
+} sdl_blit_lut;
+
+static sdl_blit_lut sdl_blit_luts[SDL_BLIT_LUTS];
+static Uint32 sdl_blit_lut_clock = 0;
+static Uint32 sdl_blit_lut_count = 0;
+
+static int sdl_blit_lut_for (const sdl_blit_lut* lut, const SDL_Palette* palette, const SDL_PixelFormat* dst) {
+  return lut->palette == palette && lut->bytes_per_pixel == dst->BytesPerPixel &&
+    lut->rmask == dst->Rmask && lut->gmask == dst->Gmask && lut->bmask == dst->Bmask && lut->amask == dst->Amask;
+}
+
+static const Uint32* sdl_blit_lut_get (const SDL_Palette* palette, const SDL_PixelFormat* dst) {
+  int ncolors = palette->ncolors < 256 ? palette->ncolors : 256;
+  sdl_blit_lut* lut = &sdl_blit_luts[0];
+  int i;
+  for (i = 0; i < SDL_BLIT_LUTS; i++) {
+    if (sdl_blit_lut_for(&sdl_blit_luts[i], palette, dst)) {
+      lut = &sdl_blit_luts[i];
+      break;
+    }
+    if (sdl_blit_luts[i].used < lut->used) lut = &sdl_blit_luts[i];
+  }
+  lut->used = ++sdl_blit_lut_clock;
+  if (i < SDL_BLIT_LUTS && lut->ncolors == ncolors &&
+      memcmp(lut->colors, palette->colors, sizeof(SDL_Color) * ncolors) == 0) {
+    return lut->lut;
+  }
+
+  lut->palette = palette;
+  lut->ncolors = ncolors;
+  memcpy(lut->colors, palette->colors, sizeof(SDL_Color) * ncolors);
+  lut->bytes_per_pixel = dst->BytesPerPixel;
+  lut->rmask = dst->Rmask;
+  lut->gmask = dst->Gmask;
+  lut->bmask = dst->Bmask;
+  lut->amask = dst->Amask;
+  for (i = 0; i < ncolors; i++) {
+    lut->lut[i] = SDL_MapRGB((SDL_PixelFormat*) dst, palette->colors[i].r, palette->colors[i].g, palette->colors[i].b);
+  }
+  // Indices past the palette come out black rather than as stale entries
+  for (; i < 256; i++) lut->lut[i] = 0;
+  sdl_blit_lut_count++;
+  return lut->lut;
+}
+
+Uint32 sdl_blit_lut_builds (void) {
+  return sdl_blit_lut_count;
+}
+
+
+/*******************************************************************************
+ * Planning
+ ******************************************************************************/
+static int sdl_is_rgb888 (const SDL_PixelFormat* format) {
+  return format->BytesPerPixel == 4 && format->Gmask == 0x0000ff00 &&
+    ((format->Rmask == 0x00ff0000 && format->Bmask == 0x000000ff) ||
+     (format->Rmask == 0x000000ff && format->Bmask == 0x00ff0000));
+}
+
+static int sdl_same_rgb (const SDL_PixelFormat* a, const SDL_PixelFormat* b) {
+  return a->Rmask == b->Rmask && a->Gmask == b->Gmask && a->Bmask == b->Bmask;
+}
+
+// Only the cases where SDL's own choice of blitter is known are taken over
+static sdl_blit_op_type sdl_blit_choose (SDL_Surface* src, SDL_Surface* dst) {
+  if (src == dst) return SDL_BLIT_OP_NONE;
+  if (src->format->BytesPerPixel == 1 && src->format->palette) {
+    // Per-surface alpha blends rather than copies, so it stays with SDL
+    if ((src->flags & SDL_SRCALPHA) || SDL_MUSTLOCK(src) || SDL_MUSTLOCK(dst)) return SDL_BLIT_OP_NONE;
+    if (dst->format->BytesPerPixel == 2) return SDL_BLIT_OP_EXPAND_16;
+    if (dst->format->BytesPerPixel == 4) return SDL_BLIT_OP_EXPAND_32;
+    return SDL_BLIT_OP_NONE;
+  }
+  if (src->format->BytesPerPixel != 4 || dst->format->BytesPerPixel != 4) return SDL_BLIT_OP_NONE;
+  if (SDL_MUSTLOCK(src) || SDL_MUSTLOCK(dst)) return SDL_BLIT_OP_NONE;
+
+  const SDL_PixelFormat* sf = src->format;
+  const SDL_PixelFormat* df = dst->format;
+  switch (src->flags & (SDL_SRCALPHA | SDL_SRCCOLORKEY)) {
+    case 0:
+      if (sdl_same_rgb(sf, df) && sf->Amask == df->Amask) return SDL_BLIT_OP_COPY;
+      break;
+    case SDL_SRCCOLORKEY:
+      if (sdl_same_rgb(sf, df) && ! sf->Amask && ! df->Amask) return SDL_BLIT_OP_COLOR_KEY;
+      break;
+    case SDL_SRCALPHA:
+      if ( ! sdl_is_rgb888(sf) || ! sdl_same_rgb(sf, df)) break;
+      if (sf->Amask == 0xff000000) return SDL_BLIT_OP_PIXEL_ALPHA;
+      if ( ! sf->Amask && ! df->Amask && sf->alpha > 0 && sf->alpha < 255) return SDL_BLIT_OP_SURFACE_ALPHA;
+      break;
+  }
+  return SDL_BLIT_OP_NONE;
+}
+
+int sdl_blit_plan (SDL_Surface* src, SDL_Rect* srcrect, SDL_Surface* dst, SDL_Rect* dstrect, sdl_blit_op* op) {
+  SDL_Rect fulldst;
+  int srcx, srcy, w, h;
+
+  if ( ! src || ! dst) {
+    SDL_SetError("SDL_UpperBlit: passed a NULL surface");
+    return -1;
+  }
+  if (src->locked || dst->locked) {
+    SDL_SetError("Surfaces must not be locked during blit");
+    return -1;
+  }
+
+  op->type = sdl_blit_on ? sdl_blit_choose(src, dst) : SDL_BLIT_OP_NONE;
+  if (op->type == SDL_BLIT_OP_NONE) return -2;
+
+  // Clip exactly as SDL_UpperBlit does, writing the final rect back
+  if ( ! dstrect) {
+    fulldst.x = fulldst.y = 0;
+    dstrect = &fulldst;
+  }
+  if (srcrect) {
+    srcx = srcrect->x;
+    w = srcrect->w;
+    if (srcx < 0) {
+      w += srcx;
+      dstrect->x -= srcx;
+      srcx = 0;
+    }
+    if (src->w - srcx < w) w = src->w - srcx;
+
+    srcy = srcrect->y;
+    h = srcrect->h;
+    if (srcy < 0) {
+      h += srcy;
+      dstrect->y -= srcy;
+      srcy = 0;
+    }
+    if (src->h - srcy < h) h = src->h - srcy;
+  } else {
+    srcx = srcy = 0;
+    w = src->w;
+    h = src->h;
+  }
+
+  SDL_Rect* clip = &dst->clip_rect;
+  int dx = clip->x - dstrect->x;
+  if (dx > 0) {
+    w -= dx;
+    dstrect->x += dx;
+    srcx += dx;
+  }
+  dx = dstrect->x + w - clip->x - clip->w;
+  if (dx > 0) w -= dx;
+
+  int dy = clip->y - dstrect->y;
+  if (dy > 0) {
+    h -= dy;
+    dstrect->y += dy;
+    srcy += dy;
+  }
+  dy = dstrect->y + h - clip->y - clip->h;
+  if (dy > 0) h -= dy;
+
+  if (w <= 0 || h <= 0) {
+    dstrect->w = dstrect->h = 0;
+    return 0;
+  }
+  dstrect->w = w;
+  dstrect->h = h;
+
+  op->src = (const Uint8*) src->pixels + srcy * src->pitch + srcx * src->format->BytesPerPixel;
+  op->src_pitch = src->pitch;
+  op->dst = (Uint8*) dst->pixels + dstrect->y * dst->pitch + dstrect->x * dst->format->BytesPerPixel;
+  op->dst_pitch = dst->pitch;
+  op->w = w;
+  op->h = h;
+  op->mask = src->format->Rmask | src->format->Gmask | src->format->Bmask;
+  op->param = op->type == SDL_BLIT_OP_COLOR_KEY ? src->format->colorkey : src->format->alpha;
+  op->lut = NULL;
+  if (op->type == SDL_BLIT_OP_EXPAND_16 || op->type == SDL_BLIT_OP_EXPAND_32) {
+    op->param = (src->flags & SDL_SRCCOLORKEY) ? (src->format->colorkey & 0xff) : 0x100;
+    op->lut = sdl_blit_lut_get(src->format->palette, dst->format);
+  }
+  return 1;
+}
+
+int sdl_fill_plan (SDL_Surface* dst, SDL_Rect* dstrect, Uint32 color, sdl_blit_op* op) {
+  op->type = SDL_BLIT_OP_NONE;
+  if ( ! dst || ! sdl_blit_on || dst->format->BytesPerPixel != 4 || SDL_MUSTLOCK(dst)) return -2;
+
+  // Clip exactly as SDL_FillRect does
+  if (dstrect) {
+    int x1 = dstrect->x > dst->clip_rect.x ? dstrect->x : dst->clip_rect.x;
+    int y1 = dstrect->y > dst->clip_rect.y ? dstrect->y : dst->clip_rect.y;
+    int x2 = dstrect->x + dstrect->w < dst->clip_rect.x + dst->clip_rect.w ?
+      dstrect->x + dstrect->w : dst->clip_rect.x + dst->clip_rect.w;
+    int y2 = dstrect->y + dstrect->h < dst->clip_rect.y + dst->clip_rect.h ?
+      dstrect->y + dstrect->h : dst->clip_rect.y + dst->clip_rect.h;
+    dstrect->x = x1;
+    dstrect->y = y1;
+    dstrect->w = x2 > x1 ? x2 - x1 : 0;
+    dstrect->h = y2 > y1 ? y2 - y1 : 0;
+    if ( ! dstrect->w || ! dstrect->h) return 0;
+  } else {
+    dstrect = &dst->clip_rect;
+  }
+
+  op->type = SDL_BLIT_OP_FILL;
+  op->src = NULL;
+  op->src_pitch = 0;
+  op->dst = (Uint8*) dst->pixels + dstrect->y * dst->pitch + dstrect->x * 4;
+  op->dst_pitch = dst->pitch;
+  op->w = dstrect->w;
+  op->h = dstrect->h;
+  op->param = color;
+  op->mask = 0;
+  op->lut = NULL;
+  return 1;
+}
+
+
+/*******************************************************************************
+ * Drop-in replacements
+ ******************************************************************************/
+int sdl_blit_surface (SDL_Surface* src, SDL_Rect* srcrect, SDL_Surface* dst, SDL_Rect* dstrect) {
+  sdl_blit_op op;
+  int result = sdl_blit_plan(src, srcrect, dst, dstrect, &op);
+  if (result == -2) return SDL_BlitSurface(src, srcrect, dst, dstrect);
+  if (result == 1) sdl_blit_run(&op, 0, op.h);
+  return result < 0 ? result : 0;
+}
+
+int sdl_fill_rect (SDL_Surface* dst, SDL_Rect* dstrect, Uint32 color) {
+  sdl_blit_op op;
+  int result = sdl_fill_plan(dst, dstrect, color, &op);
+  if (result == -2) return SDL_FillRect(dst, dstrect, color);
+  if (result == 1) sdl_blit_run(&op, 0, op.h);
+  return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef MRB_SDL_BLIT_H
+#define MRB_SDL_BLIT_H
+
+#include <SDL/SDL.h>
+
+/*
+ * 32bpp software blit and fill kernels. sdl_blit_surface and sdl_fill_rect
+ * behave like SDL_BlitSurface and SDL_FillRect (same clipping, same results,
+ * same rect write-back), but run the SSE2/AVX2 kernel picked at init when
+ * both surfaces are plain 32bpp software surfaces, and defer to SDL
+ * otherwise. 8bpp palette sources expand to 16 or 32bpp through a lookup
+ * table built from the palette.
+ */
+typedef enum {
+  SDL_BLIT_OP_NONE = 0,
+  SDL_BLIT_OP_COPY,
+  SDL_BLIT_OP_COLOR_KEY,
+  SDL_BLIT_OP_PIXEL_ALPHA,
+  SDL_BLIT_OP_SURFACE_ALPHA,
+  SDL_BLIT_OP_EXPAND_16,
+  SDL_BLIT_OP_EXPAND_32,
+  SDL_BLIT_OP_FILL
+} sdl_blit_op_type;
+
+// A clipped blit or fill, ready to run over any subset of its rows
+typedef struct {
+  sdl_blit_op_type type;
+  const Uint8* src;
+  int src_pitch;
+  Uint8* dst;
+  int dst_pitch;
+  int w;
+  int h;
+  Uint32 param;
+  Uint32 mask;
+  // Palette expansions: destination pixels by source index, valid until the
+  // next sdl_blit_plan
+  const Uint32* lut;
+} sdl_blit_op;
+
+void sdl_blit_init(void);
+const char* sdl_blit_kernel_name(void);
+void sdl_blit_set_enabled(int enabled);
+int sdl_blit_enabled(void);
+
+// Clip like SDL_UpperBlit/SDL_FillRect and describe the work in op. Returns
+// 1 if op should be run, 0 if the result was clipped away, -1 on error, and
+// -2 if a kernel can't handle these surfaces and SDL has to do it.
+int sdl_blit_plan(SDL_Surface* src, SDL_Rect* srcrect, SDL_Surface* dst, SDL_Rect* dstrect, sdl_blit_op* op);
+int sdl_fill_plan(SDL_Surface* dst, SDL_Rect* dstrect, Uint32 color, sdl_blit_op* op);
+void sdl_blit_run(const sdl_blit_op* op, int first_row, int rows);
+
+// Lookup tables built so far, for telling palette changes from cache hits
+Uint32 sdl_blit_lut_builds(void);
+
+int sdl_blit_surface(SDL_Surface* src, SDL_Rect* srcrect, SDL_Surface* dst, SDL_Rect* dstrect);
+int sdl_fill_rect(SDL_Surface* dst, SDL_Rect* dstrect, Uint32 color);
+
+#endif	/* MRB_SDL_BLIT_H */
@@ -0,0 +1,115 @@
+/**
+ * mruby-sdl
+ *
+ * Frame pacing and frame-time histograms
+ */
+#include <SDL/SDL.h>
+#include "mrb_sdl_clock.h"
+
+#ifdef _WIN32
+#define SDL_CLOCK_TICKS 1
+#else
+#include <time.h>
+#endif
+
+/*******************************************************************************
+ * Clock
+ ******************************************************************************/
+Uint64 sdl_clock_now (void) {
+#ifdef SDL_CLOCK_TICKS
+  // No CLOCK_MONOTONIC here, so make do with milliseconds
+  return (Uint64) SDL_GetTicks() * 1000000;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (Uint64) now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+void sdl_clock_wait_until (Uint64 deadline, Uint64 spin_ns) {
+  Uint64 now = sdl_clock_now();
+  while (now + spin_ns < deadline) {
+    Uint32 ms = (Uint32) ((deadline - spin_ns - now) / 1000000);
+    SDL_Delay(ms ? ms : 1);
+    now = sdl_clock_now();
+  }
+  while (now < deadline) now = sdl_clock_now();
+}
+
+
+/*******************************************************************************
+ * Histogram
+ ******************************************************************************/
+void sdl_histogram_add (sdl_histogram* histogram, Uint64 ns) {
+  Uint64 bin = ns / SDL_HISTOGRAM_BIN_NS;
+  if (bin >= SDL_HISTOGRAM_BINS) bin = SDL_HISTOGRAM_BINS - 1;
+  histogram->bins[bin]++;
+  histogram->count++;
+  histogram->total += ns;
+  if (ns > histogram->max) histogram->max = ns;
+}
+
+// The middle of the bin holding the given fraction of frames
+Uint64 sdl_histogram_percentile (const sdl_histogram* histogram, double percentile) {
+  Uint64 rank;
+  Uint64 seen = 0;
+  int i;
+  if ( ! histogram->count) return 0;
+  if (percentile < 0) percentile = 0;
+  if (percentile > 1) percentile = 1;
+
+  rank = (Uint64) (percentile * histogram->count + 0.5);
+  if (rank < 1) rank = 1;
+  for (i = 0; i < SDL_HISTOGRAM_BINS - 1; i++) {
+    seen += histogram->bins[i];
+    if (seen >= rank) {
+      Uint64 middle = (Uint64) i * SDL_HISTOGRAM_BIN_NS + SDL_HISTOGRAM_BIN_NS / 2;
+      return middle < histogram->max ? middle : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+
+/*******************************************************************************
+ * Pacer
+ ******************************************************************************/
+void sdl_frame_pacer_init (sdl_frame_pacer* pacer, Uint64 period, Uint64 step) {
+  memset(pacer, 0, sizeof(sdl_frame_pacer));
+  pacer->period = period;
+  pacer->step = step;
+  pacer->spin = 2000000;
+  pacer->max_steps = 8;
+  pacer->last_frame = sdl_clock_now();
+  pacer->last_update = pacer->last_frame;
+  pacer->deadline = pacer->last_frame + period;
+}
+
+void sdl_frame_pacer_wait (sdl_frame_pacer* pacer) {
+  Uint64 now = sdl_clock_now();
+  // More than a whole frame late: start again from now rather than rushing
+  // frames out to catch up
+  if (now > pacer->deadline + pacer->period) pacer->deadline = now;
+  if (pacer->period) sdl_clock_wait_until(pacer->deadline, pacer->spin);
+
+  now = sdl_clock_now();
+  sdl_histogram_add(&pacer->frames, now - pacer->last_frame);
+  pacer->last_frame = now;
+  pacer->deadline += pacer->period;
+}
+
+int sdl_frame_pacer_steps (sdl_frame_pacer* pacer) {
+  Uint64 now = sdl_clock_now();
+  Uint64 due;
+  pacer->accumulator += now - pacer->last_update;
+  pacer->last_update = now;
+
+  due = pacer->accumulator / pacer->step;
+  if (due > (Uint64) pacer->max_steps) {
+    // Too far behind to catch up; drop the backlog
+    pacer->accumulator %= pacer->step;
+    return pacer->max_steps;
+  }
+  pacer->accumulator -= due * pacer->step;
+  return (int) due;
+}
@@ -0,0 +1,55 @@
+#ifndef MRB_SDL_CLOCK_H
+#define MRB_SDL_CLOCK_H
+
+#include <SDL/SDL.h>
+
+#define SDL_HISTOGRAM_BIN_NS 50000
+#define SDL_HISTOGRAM_BINS 2000
+
+// Monotonic time in nanoseconds
+Uint64 sdl_clock_now(void);
+
+// Sleep with SDL_Delay until spin_ns before the deadline, then spin the
+// rest of the way
+void sdl_clock_wait_until(Uint64 deadline, Uint64 spin_ns);
+
+/*
+ * Frame-time histogram in 50us bins up to 100ms. Anything slower lands in
+ * the last bin, which reports the slowest frame seen.
+ */
+typedef struct {
+  Uint32 bins[SDL_HISTOGRAM_BINS];
+  Uint32 count;
+  Uint64 total;
+  Uint64 max;
+} sdl_histogram;
+
+void sdl_histogram_add(sdl_histogram* histogram, Uint64 ns);
+Uint64 sdl_histogram_percentile(const sdl_histogram* histogram, double percentile);
+
+/*
+ * Paces frames to a fixed period and runs simulation at a fixed step,
+ * carrying leftover time between frames in an accumulator.
+ */
+typedef struct {
+  Uint64 period;
+  Uint64 step;
+  Uint64 spin;
+  Uint64 deadline;
+  Uint64 last_frame;
+  Uint64 last_update;
+  Uint64 accumulator;
+  int max_steps;
+  sdl_histogram frames;
+} sdl_frame_pacer;
+
+void sdl_frame_pacer_init(sdl_frame_pacer* pacer, Uint64 period, Uint64 step);
+
+// Wait out the rest of the frame and record how long it took
+void sdl_frame_pacer_wait(sdl_frame_pacer* pacer);
+
+// Add the time since the last call to the accumulator and return how many
+// fixed steps are due, at most max_steps
+int sdl_frame_pacer_steps(sdl_frame_pacer* pacer);
+
+#endif	/* MRB_SDL_CLOCK_H */
@@ -0,0 +1,217 @@
+/**
+ * mruby-sdl
+ *
+ * Banded multi-threaded compositor for 32bpp software surfaces
+ */
+#include <SDL/SDL.h>
+#include "mrb_sdl_compositor.h"
+
+/*******************************************************************************
+ * Worker pool
+ ******************************************************************************/
+static void sdl_compositor_run_band (sdl_compositor* compositor, int band) {
+  int top = band * compositor->band_height;
+  int bottom = top + compositor->band_height;
+  int i;
+  for (i = 0; i < compositor->count; i++) {
+    const sdl_compositor_item* item = &compositor->items[i];
+    int first = item->dst_y > top ? item->dst_y : top;
+    int last = item->dst_y + item->op.h < bottom ? item->dst_y + item->op.h : bottom;
+    if (first < last) {
+      sdl_blit_run(&item->op, first - item->dst_y, last - first);
+    }
+  }
+}
+
+// Hand out bands until there are none left. Called with the lock held.
+static void sdl_compositor_drain (sdl_compositor* compositor) {
+  while (compositor->next_band < compositor->bands) {
+    int band = compositor->next_band++;
+    SDL_mutexV(compositor->lock);
+    sdl_compositor_run_band(compositor, band);
+    SDL_mutexP(compositor->lock);
+    if (++compositor->bands_done == compositor->bands) {
+      SDL_CondSignal(compositor->done);
+    }
+  }
+}
+
+static int sdl_compositor_worker (void* data) {
+  sdl_compositor* compositor = (sdl_compositor*) data;
+  int seen = 0;
+
+  SDL_mutexP(compositor->lock);
+  for (;;) {
+    while ( ! compositor->quit && compositor->generation == seen) {
+      SDL_CondWait(compositor->work, compositor->lock);
+    }
+    if (compositor->quit) break;
+    seen = compositor->generation;
+    sdl_compositor_drain(compositor);
+  }
+  SDL_mutexV(compositor->lock);
+  return 0;
+}
+
+sdl_compositor* sdl_compositor_new (int threads, int band_height) {
+  sdl_compositor* compositor = (sdl_compositor*) malloc(sizeof(sdl_compositor));
+  if ( ! compositor) return NULL;
+  memset(compositor, 0, sizeof(sdl_compositor));
+
+  if (threads < 1) threads = 1;
+  if (threads > SDL_COMPOSITOR_MAX_THREADS) threads = SDL_COMPOSITOR_MAX_THREADS;
+  compositor->band_height = band_height > 0 ? band_height : 64;
+
+  compositor->lock = SDL_CreateMutex();
+  compositor->work = SDL_CreateCond();
+  compositor->done = SDL_CreateCond();
+  if ( ! compositor->lock || ! compositor->work || ! compositor->done) {
+    sdl_compositor_free(compositor);
+    return NULL;
+  }
+
+  // The caller is the first thread; the rest are spawned
+  compositor->thread_count = 1;
+  while (compositor->thread_count < threads) {
+    SDL_Thread* thread = SDL_CreateThread(sdl_compositor_worker, compositor);
+    if ( ! thread) break;
+    compositor->threads[compositor->thread_count++] = thread;
+  }
+  return compositor;
+}
+
+void sdl_compositor_free (sdl_compositor* compositor) {
+  int i;
+  if ( ! compositor) return;
+  if (compositor->lock) {
+    SDL_mutexP(compositor->lock);
+    compositor->quit = 1;
+    if (compositor->work) SDL_CondBroadcast(compositor->work);
+    SDL_mutexV(compositor->lock);
+  }
+  for (i = 1; i < compositor->thread_count; i++) {
+    SDL_WaitThread(compositor->threads[i], NULL);
+  }
+  if (compositor->done) SDL_DestroyCond(compositor->done);
+  if (compositor->work) SDL_DestroyCond(compositor->work);
+  if (compositor->lock) SDL_DestroyMutex(compositor->lock);
+  free(compositor->items);
+  free(compositor);
+}
+
+
+/*******************************************************************************
+ * Queue
+ ******************************************************************************/
+static int sdl_compositor_has (SDL_Surface** list, int count, SDL_Surface* surface) {
+  int i;
+  for (i = 0; i < count; i++) {
+    if (list[i] == surface) return 1;
+  }
+  return 0;
+}
+
+static int sdl_compositor_note (SDL_Surface** list, int* count, SDL_Surface* surface) {
+  if ( ! surface || sdl_compositor_has(list, *count, surface)) return 1;
+  if (*count == SDL_COMPOSITOR_MAX_SURFACES) return 0;
+  list[(*count)++] = surface;
+  return 1;
+}
+
+// Bands only order ops against the same rows, so an op may not read a
+// surface that is queued to be written, or write one queued to be read.
+static int sdl_compositor_conflicts (sdl_compositor* compositor, SDL_Surface* src, SDL_Surface* dst) {
+  if (src && sdl_compositor_has(compositor->writes, compositor->write_count, src)) return 1;
+  return sdl_compositor_has(compositor->reads, compositor->read_count, dst);
+}
+
+static int sdl_compositor_push (sdl_compositor* compositor, SDL_Surface* src, SDL_Surface* dst, const sdl_blit_op* op) {
+  if (compositor->count == compositor->capacity) {
+    int capacity = compositor->capacity ? compositor->capacity * 2 : 256;
+    sdl_compositor_item* items = (sdl_compositor_item*) realloc(compositor->items, sizeof(sdl_compositor_item) * capacity);
+    if ( ! items) {
+      SDL_SetError("Out of memory");
+      return -1;
+    }
+    compositor->items = items;
+    compositor->capacity = capacity;
+  }
+  if ( ! sdl_compositor_note(compositor->reads, &compositor->read_count, src) ||
+       ! sdl_compositor_note(compositor->writes, &compositor->write_count, dst)) {
+    sdl_compositor_flush(compositor);
+    sdl_compositor_note(compositor->reads, &compositor->read_count, src);
+    sdl_compositor_note(compositor->writes, &compositor->write_count, dst);
+  }
+
+  sdl_compositor_item* item = &compositor->items[compositor->count++];
+  item->op = *op;
+  item->src = src;
+  item->dst = dst;
+  item->dst_y = (int) ((op->dst - (Uint8*) dst->pixels) / dst->pitch);
+  return 0;
+}
+
+int sdl_compositor_blit (sdl_compositor* compositor, SDL_Surface* src, SDL_Rect* srcrect, SDL_Surface* dst, SDL_Rect* dstrect) {
+  sdl_blit_op op;
+  if (sdl_compositor_conflicts(compositor, src, dst)) sdl_compositor_flush(compositor);
+
+  int result = sdl_blit_plan(src, srcrect, dst, dstrect, &op);
+  if (result == -2) {
+    sdl_compositor_flush(compositor);
+    return SDL_BlitSurface(src, srcrect, dst, dstrect);
+  }
+  if (result != 1) return result < 0 ? result : 0;
+  result = sdl_compositor_push(compositor, src, dst, &op);
+  // A palette table only lasts until the next plan, so run it now
+  if (op.lut && result == 0) sdl_compositor_flush(compositor);
+  return result;
+}
+
+int sdl_compositor_fill (sdl_compositor* compositor, SDL_Surface* dst, SDL_Rect* dstrect, Uint32 color) {
+  sdl_blit_op op;
+  if (sdl_compositor_conflicts(compositor, NULL, dst)) sdl_compositor_flush(compositor);
+
+  int result = sdl_fill_plan(dst, dstrect, color, &op);
+  if (result == -2) {
+    sdl_compositor_flush(compositor);
+    return SDL_FillRect(dst, dstrect, color);
+  }
+  if (result != 1) return 0;
+  return sdl_compositor_push(compositor, NULL, dst, &op);
+}
+
+int sdl_compositor_flush (sdl_compositor* compositor) {
+  int count = compositor->count;
+  int bottom = 0;
+  int i;
+  if ( ! count) return 0;
+
+  for (i = 0; i < count; i++) {
+    const sdl_compositor_item* item = &compositor->items[i];
+    if (item->dst_y + item->op.h > bottom) bottom = item->dst_y + item->op.h;
+  }
+  int bands = (bottom + compositor->band_height - 1) / compositor->band_height;
+
+  if (compositor->thread_count == 1 || bands == 1) {
+    for (i = 0; i < bands; i++) {
+      sdl_compositor_run_band(compositor, i);
+    }
+  } else {
+    SDL_mutexP(compositor->lock);
+    compositor->bands = bands;
+    compositor->next_band = 0;
+    compositor->bands_done = 0;
+    compositor->generation++;
+    SDL_CondBroadcast(compositor->work);
+    sdl_compositor_drain(compositor);
+    while (compositor->bands_done < compositor->bands) {
+      SDL_CondWait(compositor->done, compositor->lock);
+    }
+    SDL_mutexV(compositor->lock);
+  }
+
+  compositor->count = 0;
+  compositor->read_count = 0;
+  compositor->write_count = 0;
+  return count;
+}
@@ -0,0 +1,55 @@
+#ifndef MRB_SDL_COMPOSITOR_H
+#define MRB_SDL_COMPOSITOR_H
+
+#include <SDL/SDL.h>
+#include "mrb_sdl_blit.h"
+
+#define SDL_COMPOSITOR_MAX_THREADS 16
+#define SDL_COMPOSITOR_MAX_SURFACES 16
+
+/*
+ * Deferred blits and fills, run on a pool of worker threads at flush time.
+ * Destination rows are split into horizontal bands, and each band replays
+ * every queued op that touches it in submission order, so overlapping ops
+ * land exactly as they would have one at a time. Ops the blit kernels can't
+ * take, or that read a surface an earlier op writes, flush the queue first.
+ */
+typedef struct {
+  sdl_blit_op op;
+  SDL_Surface* src;
+  SDL_Surface* dst;
+  int dst_y;
+} sdl_compositor_item;
+
+typedef struct {
+  sdl_compositor_item* items;
+  int count;
+  int capacity;
+  int band_height;
+
+  SDL_Surface* reads[SDL_COMPOSITOR_MAX_SURFACES];
+  int read_count;
+  SDL_Surface* writes[SDL_COMPOSITOR_MAX_SURFACES];
+  int write_count;
+
+  int thread_count;
+  SDL_Thread* threads[SDL_COMPOSITOR_MAX_THREADS];
+  SDL_mutex* lock;
+  SDL_cond* work;
+  SDL_cond* done;
+  int generation;
+  int bands;
+  int next_band;
+  int bands_done;
+  int quit;
+} sdl_compositor;
+
+// threads counts the calling thread, which works through bands alongside
+// the pool during a flush
+sdl_compositor* sdl_compositor_new(int threads, int band_height);
+void sdl_compositor_free(sdl_compositor* compositor);
+int sdl_compositor_blit(sdl_compositor* compositor, SDL_Surface* src, SDL_Rect* srcrect, SDL_Surface* dst, SDL_Rect* dstrect);
+int sdl_compositor_fill(sdl_compositor* compositor, SDL_Surface* dst, SDL_Rect* dstrect, Uint32 color);
+int sdl_compositor_flush(sdl_compositor* compositor);
+
+#endif	/* MRB_SDL_COMPOSITOR_H */
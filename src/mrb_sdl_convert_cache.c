@@ -0,0 +1,201 @@
+/**
+ * mruby-sdl
+ *
+ * LRU cache for SDL_ConvertSurface and SDL_DisplayFormat(Alpha) results
+ */
+#include <SDL/SDL.h>
+#include "mrb_sdl_convert_cache.h"
+
+void sdl_convert_cache_init (sdl_convert_cache* cache) {
+  memset(cache, 0, sizeof(sdl_convert_cache));
+}
+
+static unsigned int sdl_convert_bucket (SDL_Surface* source) {
+  size_t bits = (size_t) source;
+  return (unsigned int) ((bits >> 4) ^ (bits >> 12)) % SDL_CONVERT_CACHE_BUCKETS;
+}
+
+static Uint32 sdl_convert_palette_hash (const SDL_Palette* palette) {
+  Uint32 hash = 2166136261u;
+  int i;
+  if ( ! palette) return 0;
+  for (i = 0; i < palette->ncolors; i++) {
+    const SDL_Color* color = &palette->colors[i];
+    hash = (hash ^ color->r) * 16777619u;
+    hash = (hash ^ color->g) * 16777619u;
+    hash = (hash ^ color->b) * 16777619u;
+  }
+  return hash ^ (Uint32) palette->ncolors;
+}
+
+static int sdl_convert_make_key (sdl_convert_key* key, SDL_Surface* source, sdl_convert_kind kind, SDL_PixelFormat* format, Uint32 flags) {
+  memset(key, 0, sizeof(sdl_convert_key));
+  if (kind != SDL_CONVERT_SURFACE) {
+    SDL_Surface* screen = SDL_GetVideoSurface();
+    if ( ! screen) return 0;
+    format = screen->format;
+  }
+  if ( ! source || ! format) return 0;
+
+  key->source = source;
+  key->kind = kind;
+  key->flags = flags;
+  key->source_flags = source->flags & (SDL_SRCCOLORKEY | SDL_SRCALPHA | SDL_RLEACCELOK);
+  key->source_colorkey = source->format->colorkey;
+  key->source_alpha = source->format->alpha;
+  key->bits_per_pixel = format->BitsPerPixel;
+  key->rmask = format->Rmask;
+  key->gmask = format->Gmask;
+  key->bmask = format->Bmask;
+  key->amask = format->Amask;
+  key->palette_hash = sdl_convert_palette_hash(format->palette);
+  return 1;
+}
+
+static int sdl_convert_key_equal (const sdl_convert_key* a, const sdl_convert_key* b) {
+  return a->source == b->source && a->kind == b->kind && a->flags == b->flags &&
+    a->source_flags == b->source_flags && a->source_colorkey == b->source_colorkey &&
+    a->source_alpha == b->source_alpha && a->bits_per_pixel == b->bits_per_pixel &&
+    a->rmask == b->rmask && a->gmask == b->gmask && a->bmask == b->bmask &&
+    a->amask == b->amask && a->palette_hash == b->palette_hash;
+}
+
+
+/*******************************************************************************
+ * Entry bookkeeping
+ ******************************************************************************/
+static void sdl_convert_unlink_lru (sdl_convert_cache* cache, sdl_convert_entry* entry) {
+  if (entry->newer) entry->newer->older = entry->older;
+  else cache->newest = entry->older;
+  if (entry->older) entry->older->newer = entry->newer;
+  else cache->oldest = entry->newer;
+  entry->newer = entry->older = NULL;
+}
+
+static void sdl_convert_link_newest (sdl_convert_cache* cache, sdl_convert_entry* entry) {
+  entry->older = cache->newest;
+  entry->newer = NULL;
+  if (cache->newest) cache->newest->newer = entry;
+  cache->newest = entry;
+  if ( ! cache->oldest) cache->oldest = entry;
+}
+
+static void sdl_convert_remove (sdl_convert_cache* cache, sdl_convert_entry* entry) {
+  sdl_convert_entry** link = &cache->buckets[sdl_convert_bucket(entry->key.source)];
+  while (*link != entry) link = &(*link)->chain;
+  *link = entry->chain;
+
+  sdl_convert_unlink_lru(cache, entry);
+  cache->bytes -= entry->bytes;
+  cache->count--;
+  // Drops the cache's reference; callers still holding it keep it alive
+  SDL_FreeSurface(entry->result);
+  free(entry);
+}
+
+static void sdl_convert_trim (sdl_convert_cache* cache) {
+  while (cache->oldest && cache->bytes > cache->budget) {
+    sdl_convert_remove(cache, cache->oldest);
+    cache->evictions++;
+  }
+}
+
+void sdl_convert_cache_set_budget (sdl_convert_cache* cache, size_t budget) {
+  cache->budget = budget;
+  sdl_convert_trim(cache);
+}
+
+static void sdl_convert_forget_source (sdl_convert_cache* cache, SDL_Surface* source) {
+  sdl_convert_entry* entry = cache->buckets[sdl_convert_bucket(source)];
+  while (entry) {
+    sdl_convert_entry* next = entry->chain;
+    if (entry->key.source == source) sdl_convert_remove(cache, entry);
+    entry = next;
+  }
+}
+
+// The pixels of surface changed: drop every conversion of it, and surface
+// itself if it is a cached result. Results that have been handed out carry
+// at least two references, which saves the full scan for ordinary surfaces.
+void sdl_convert_cache_forget (sdl_convert_cache* cache, SDL_Surface* surface) {
+  if ( ! cache->count) return;
+  sdl_convert_forget_source(cache, surface);
+  if (surface->refcount > 1) {
+    sdl_convert_entry* entry = cache->oldest;
+    while (entry) {
+      sdl_convert_entry* newer = entry->newer;
+      if (entry->result == surface) sdl_convert_remove(cache, entry);
+      entry = newer;
+    }
+  }
+}
+
+// surface is about to be freed. Its conversions go with it, unless this is
+// only one of several references; a cached result keeps the cache's own.
+void sdl_convert_cache_release (sdl_convert_cache* cache, SDL_Surface* surface) {
+  if ( ! cache->count || surface->refcount > 1) return;
+  sdl_convert_forget_source(cache, surface);
+}
+
+void sdl_convert_cache_clear (sdl_convert_cache* cache) {
+  while (cache->oldest) {
+    sdl_convert_remove(cache, cache->oldest);
+  }
+}
+
+
+/*******************************************************************************
+ * Lookup
+ ******************************************************************************/
+static SDL_Surface* sdl_convert_run (SDL_Surface* source, sdl_convert_kind kind, SDL_PixelFormat* format, Uint32 flags) {
+  switch (kind) {
+    case SDL_CONVERT_DISPLAY_FORMAT:
+      return SDL_DisplayFormat(source);
+    case SDL_CONVERT_DISPLAY_FORMAT_ALPHA:
+      return SDL_DisplayFormatAlpha(source);
+    default:
+      return SDL_ConvertSurface(source, format, flags);
+  }
+}
+
+SDL_Surface* sdl_convert_cache_get (sdl_convert_cache* cache, SDL_Surface* source, sdl_convert_kind kind, SDL_PixelFormat* format, Uint32 flags) {
+  sdl_convert_key key;
+  if ( ! cache->budget || ! sdl_convert_make_key(&key, source, kind, format, flags)) {
+    return sdl_convert_run(source, kind, format, flags);
+  }
+
+  unsigned int bucket = sdl_convert_bucket(source);
+  sdl_convert_entry* entry;
+  for (entry = cache->buckets[bucket]; entry; entry = entry->chain) {
+    if (sdl_convert_key_equal(&entry->key, &key)) {
+      cache->hits++;
+      sdl_convert_unlink_lru(cache, entry);
+      sdl_convert_link_newest(cache, entry);
+      entry->result->refcount++;
+      return entry->result;
+    }
+  }
+
+  cache->misses++;
+  SDL_Surface* result = sdl_convert_run(source, kind, format, flags);
+  if ( ! result) return NULL;
+
+  size_t bytes = (size_t) result->pitch * result->h + sizeof(SDL_Surface);
+  if (bytes > cache->budget) return result;
+
+  entry = (sdl_convert_entry*) malloc(sizeof(sdl_convert_entry));
+  if ( ! entry) return result;
+  entry->key = key;
+  entry->result = result;
+  entry->bytes = bytes;
+  entry->chain = cache->buckets[bucket];
+  cache->buckets[bucket] = entry;
+  sdl_convert_link_newest(cache, entry);
+  cache->bytes += bytes;
+  cache->count++;
+
+  // One reference for the caller, one for the cache
+  result->refcount++;
+  sdl_convert_trim(cache);
+  return result;
+}
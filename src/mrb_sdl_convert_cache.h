@@ -0,0 +1,69 @@
+#ifndef MRB_SDL_CONVERT_CACHE_H
+#define MRB_SDL_CONVERT_CACHE_H
+
+#include <SDL/SDL.h>
+
+#define SDL_CONVERT_CACHE_BUCKETS 64
+
+typedef enum {
+  SDL_CONVERT_SURFACE = 0,
+  SDL_CONVERT_DISPLAY_FORMAT,
+  SDL_CONVERT_DISPLAY_FORMAT_ALPHA
+} sdl_convert_kind;
+
+/*
+ * Everything SDL_ConvertSurface and SDL_DisplayFormat(Alpha) look at: the
+ * source, its blit attributes, and the target format. The display kinds take
+ * the target format from the video surface at lookup time, so a mode change
+ * simply misses.
+ */
+typedef struct {
+  SDL_Surface* source;
+  sdl_convert_kind kind;
+  Uint32 flags;
+  Uint32 source_flags;
+  Uint32 source_colorkey;
+  Uint8 source_alpha;
+  Uint8 bits_per_pixel;
+  Uint32 rmask;
+  Uint32 gmask;
+  Uint32 bmask;
+  Uint32 amask;
+  Uint32 palette_hash;
+} sdl_convert_key;
+
+typedef struct sdl_convert_entry {
+  sdl_convert_key key;
+  SDL_Surface* result;
+  size_t bytes;
+  struct sdl_convert_entry* newer;
+  struct sdl_convert_entry* older;
+  struct sdl_convert_entry* chain;
+} sdl_convert_entry;
+
+/*
+ * Converted surfaces, looked up by source and evicted least recently used
+ * first once their pixel bytes pass the budget. The cache holds one SDL
+ * reference to every result and hands out another on each lookup, so callers
+ * free what they get exactly as they would a fresh conversion.
+ */
+typedef struct {
+  sdl_convert_entry* buckets[SDL_CONVERT_CACHE_BUCKETS];
+  sdl_convert_entry* newest;
+  sdl_convert_entry* oldest;
+  size_t bytes;
+  size_t budget;
+  int count;
+  Uint32 hits;
+  Uint32 misses;
+  Uint32 evictions;
+} sdl_convert_cache;
+
+void sdl_convert_cache_init(sdl_convert_cache* cache);
+void sdl_convert_cache_set_budget(sdl_convert_cache* cache, size_t budget);
+SDL_Surface* sdl_convert_cache_get(sdl_convert_cache* cache, SDL_Surface* source, sdl_convert_kind kind, SDL_PixelFormat* format, Uint32 flags);
+void sdl_convert_cache_forget(sdl_convert_cache* cache, SDL_Surface* surface);
+void sdl_convert_cache_release(sdl_convert_cache* cache, SDL_Surface* surface);
+void sdl_convert_cache_clear(sdl_convert_cache* cache);
+
+#endif	/* MRB_SDL_CONVERT_CACHE_H */
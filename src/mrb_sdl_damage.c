@@ -0,0 +1,210 @@
+/**
+ * mruby-sdl
+ *
+ * Dirty-region tracking and coalescing for SDL_UpdateRects
+ */
+#include <SDL/SDL.h>
+#include "mrb_sdl_damage.h"
+
+void sdl_damage_init (sdl_damage* damage, int max_rects) {
+  memset(damage, 0, sizeof(sdl_damage));
+  sdl_damage_clear(damage);
+  if (max_rects < 1) max_rects = 1;
+  if (max_rects > SDL_DAMAGE_MAX_RECTS) max_rects = SDL_DAMAGE_MAX_RECTS;
+  damage->max_rects = max_rects;
+}
+
+void sdl_damage_clear (sdl_damage* damage) {
+  damage->count = 0;
+}
+
+void sdl_damage_destroy (sdl_damage* damage) {
+  free(damage->tile_hashes);
+  damage->tile_hashes = NULL;
+  damage->tile_size = 0;
+  damage->count = 0;
+}
+
+void sdl_damage_set_tiles (sdl_damage* damage, int tile_size) {
+  free(damage->tile_hashes);
+  damage->tile_hashes = NULL;
+  damage->tiles_x = 0;
+  damage->tiles_y = 0;
+  damage->tile_size = tile_size > 0 ? tile_size : 0;
+}
+
+
+/*******************************************************************************
+ * Rect coalescing
+ ******************************************************************************/
+// Overlapping, or sharing an edge. Rects that only meet at a corner are left
+// apart since their union would be mostly undamaged pixels.
+static int sdl_damage_touches (const SDL_Rect* a, const SDL_Rect* b) {
+  int touch_x = a->x <= b->x + b->w && b->x <= a->x + a->w;
+  int touch_y = a->y <= b->y + b->h && b->y <= a->y + a->h;
+  int overlap_x = a->x < b->x + b->w && b->x < a->x + a->w;
+  int overlap_y = a->y < b->y + b->h && b->y < a->y + a->h;
+  return touch_x && touch_y && (overlap_x || overlap_y);
+}
+
+static void sdl_damage_union (SDL_Rect* into, const SDL_Rect* other) {
+  int x1 = into->x < other->x ? into->x : other->x;
+  int y1 = into->y < other->y ? into->y : other->y;
+  int x2 = into->x + into->w > other->x + other->w ? into->x + into->w : other->x + other->w;
+  int y2 = into->y + into->h > other->y + other->h ? into->y + into->h : other->y + other->h;
+  into->x = x1;
+  into->y = y1;
+  into->w = x2 - x1;
+  into->h = y2 - y1;
+}
+
+static void sdl_damage_remove (sdl_damage* damage, int i) {
+  damage->rects[i] = damage->rects[--damage->count];
+}
+
+// Fold every rect the new one touches into it, repeating until the grown rect
+// touches nothing else.
+static void sdl_damage_absorb (sdl_damage* damage, SDL_Rect* rect) {
+  int i = 0;
+  while (i < damage->count) {
+    if (sdl_damage_touches(rect, &damage->rects[i])) {
+      sdl_damage_union(rect, &damage->rects[i]);
+      sdl_damage_remove(damage, i);
+      i = 0;
+    } else {
+      i++;
+    }
+  }
+}
+
+void sdl_damage_add (sdl_damage* damage, SDL_Surface* surface, const SDL_Rect* rect) {
+  int x1 = rect->x > 0 ? rect->x : 0;
+  int y1 = rect->y > 0 ? rect->y : 0;
+  int x2 = rect->x + rect->w < surface->w ? rect->x + rect->w : surface->w;
+  int y2 = rect->y + rect->h < surface->h ? rect->y + rect->h : surface->h;
+  if (x2 <= x1 || y2 <= y1) return;
+
+  SDL_Rect clipped;
+  clipped.x = x1;
+  clipped.y = y1;
+  clipped.w = x2 - x1;
+  clipped.h = y2 - y1;
+
+  sdl_damage_absorb(damage, &clipped);
+
+  // Still full, so merge with whichever rect adds the least undamaged area
+  if (damage->count >= damage->max_rects) {
+    int best = 0;
+    long best_cost = -1;
+    int i;
+    for (i = 0; i < damage->count; i++) {
+      SDL_Rect merged = clipped;
+      sdl_damage_union(&merged, &damage->rects[i]);
+      long cost = (long) merged.w * merged.h
+        - (long) clipped.w * clipped.h
+        - (long) damage->rects[i].w * damage->rects[i].h;
+      if (best_cost < 0 || cost < best_cost) {
+        best = i;
+        best_cost = cost;
+      }
+    }
+    sdl_damage_union(&clipped, &damage->rects[best]);
+    sdl_damage_remove(damage, best);
+    sdl_damage_absorb(damage, &clipped);
+  }
+
+  damage->rects[damage->count++] = clipped;
+}
+
+void sdl_damage_add_all (sdl_damage* damage, SDL_Surface* surface) {
+  damage->count = 1;
+  damage->rects[0].x = 0;
+  damage->rects[0].y = 0;
+  damage->rects[0].w = surface->w;
+  damage->rects[0].h = surface->h;
+}
+
+
+/*******************************************************************************
+ * Tile hashing
+ ******************************************************************************/
+static Uint32 sdl_damage_hash_tile (const Uint8* pixels, int pitch, int bytes, int rows) {
+  Uint32 hash = 2166136261u;
+  int y, i;
+  for (y = 0; y < rows; y++) {
+    const Uint8* row = pixels + y * pitch;
+    for (i = 0; i + 4 <= bytes; i += 4) {
+      Uint32 word;
+      memcpy(&word, row + i, 4);
+      hash = (hash ^ word) * 16777619u;
+    }
+    for (; i < bytes; i++) {
+      hash = (hash ^ row[i]) * 16777619u;
+    }
+  }
+  return hash;
+}
+
+// Hash every tile and add the ones that changed since the last diff. The
+// first diff after enabling tiles, or after the surface changes shape, marks
+// the whole surface.
+int sdl_damage_diff_tiles (sdl_damage* damage, SDL_Surface* surface) {
+  int tile = damage->tile_size;
+  if ( ! tile) return 0;
+
+  int tiles_x = (surface->w + tile - 1) / tile;
+  int tiles_y = (surface->h + tile - 1) / tile;
+  int fresh = 0;
+  if ( ! damage->tile_hashes || damage->tiles_x != tiles_x || damage->tiles_y != tiles_y ||
+       damage->tile_w != surface->w || damage->tile_h != surface->h || damage->tile_pitch != surface->pitch) {
+    free(damage->tile_hashes);
+    damage->tile_hashes = (Uint32*) malloc(sizeof(Uint32) * tiles_x * tiles_y);
+    if ( ! damage->tile_hashes) return -1;
+    damage->tiles_x = tiles_x;
+    damage->tiles_y = tiles_y;
+    damage->tile_w = surface->w;
+    damage->tile_h = surface->h;
+    damage->tile_pitch = surface->pitch;
+    fresh = 1;
+  }
+
+  if (SDL_MUSTLOCK(surface) && SDL_LockSurface(surface) < 0) return -1;
+
+  int bpp = surface->format->BytesPerPixel;
+  int changed = 0;
+  int tx, ty;
+  for (ty = 0; ty < tiles_y; ty++) {
+    for (tx = 0; tx < tiles_x; tx++) {
+      SDL_Rect rect;
+      rect.x = tx * tile;
+      rect.y = ty * tile;
+      rect.w = rect.x + tile > surface->w ? surface->w - rect.x : tile;
+      rect.h = rect.y + tile > surface->h ? surface->h - rect.y : tile;
+
+      const Uint8* origin = (const Uint8*) surface->pixels + rect.y * surface->pitch + rect.x * bpp;
+      Uint32 hash = sdl_damage_hash_tile(origin, surface->pitch, rect.w * bpp, rect.h);
+      Uint32* slot = &damage->tile_hashes[ty * tiles_x + tx];
+      if (fresh || *slot != hash) {
+        *slot = hash;
+        sdl_damage_add(damage, surface, &rect);
+        changed++;
+      }
+    }
+  }
+
+  if (SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
+  return changed;
+}
+
+
+/*******************************************************************************
+ * Present
+ ******************************************************************************/
+int sdl_damage_flush (sdl_damage* damage, SDL_Surface* surface) {
+  int count = damage->count;
+  if (count > 0) {
+    SDL_UpdateRects(surface, count, damage->rects);
+  }
+  damage->count = 0;
+  return count;
+}
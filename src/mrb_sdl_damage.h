@@ -0,0 +1,38 @@
+#ifndef MRB_SDL_DAMAGE_H
+#define MRB_SDL_DAMAGE_H
+
+#include <SDL/SDL.h>
+
+#define SDL_DAMAGE_MAX_RECTS 128
+
+/*
+ * Dirty-region tracker for a single surface. Rects added to it are clipped to
+ * the surface, merged with any rect they overlap or share an edge with, and
+ * kept under max_rects by merging the cheapest pair. In tile mode the surface
+ * is also split into tiles whose pixel hashes are compared on every flush, to
+ * pick up writes that never went through a tracked blit or fill.
+ */
+typedef struct {
+  SDL_Rect rects[SDL_DAMAGE_MAX_RECTS];
+  int count;
+  int max_rects;
+
+  int tile_size;
+  int tiles_x;
+  int tiles_y;
+  int tile_w;
+  int tile_h;
+  int tile_pitch;
+  Uint32* tile_hashes;
+} sdl_damage;
+
+void sdl_damage_init(sdl_damage* damage, int max_rects);
+void sdl_damage_set_tiles(sdl_damage* damage, int tile_size);
+void sdl_damage_add(sdl_damage* damage, SDL_Surface* surface, const SDL_Rect* rect);
+void sdl_damage_add_all(sdl_damage* damage, SDL_Surface* surface);
+int sdl_damage_diff_tiles(sdl_damage* damage, SDL_Surface* surface);
+int sdl_damage_flush(sdl_damage* damage, SDL_Surface* surface);
+void sdl_damage_clear(sdl_damage* damage);
+void sdl_damage_destroy(sdl_damage* damage);
+
+#endif	/* MRB_SDL_DAMAGE_H */
@@ -0,0 +1,196 @@
+/**
+ * mruby-sdl
+ *
+ * Event ring
+ */
+#include <SDL/SDL.h>
+#include "mrb_sdl_events.h"
+
+int sdl_event_ring_init (sdl_event_ring* ring, int capacity) {
+  memset(ring, 0, sizeof(sdl_event_ring));
+  ring->events = (SDL_Event*) malloc(sizeof(SDL_Event) * capacity);
+  if ( ! ring->events) return -1;
+  ring->capacity = capacity;
+  return 0;
+}
+
+void sdl_event_ring_destroy (sdl_event_ring* ring) {
+  free(ring->events);
+  memset(ring, 0, sizeof(sdl_event_ring));
+}
+
+int sdl_event_ring_drain (sdl_event_ring* ring, Uint32 mask) {
+  int added = 0;
+  SDL_PumpEvents();
+  sdl_event_filter_flush();
+
+  // At most two reads: up to the end of the buffer, then from its start
+  while (ring->count < ring->capacity) {
+    int tail = (ring->head + ring->count) % ring->capacity;
+    int space = ring->capacity - ring->count;
+    if (space > ring->capacity - tail) space = ring->capacity - tail;
+
+    int got = SDL_PeepEvents(&ring->events[tail], space, SDL_GETEVENT, mask);
+    if (got < 0) return -1;
+    ring->count += got;
+    added += got;
+    if (got < space) break;
+  }
+  return added;
+}
+
+void sdl_event_ring_discard (sdl_event_ring* ring, int count) {
+  if (count >= ring->count) {
+    ring->head = 0;
+    ring->count = 0;
+    return;
+  }
+  if (count <= 0) return;
+  ring->head = (ring->head + count) % ring->capacity;
+  ring->count -= count;
+}
+
+
+/*******************************************************************************
+ * Filter
+ ******************************************************************************/
+// The filter runs on whichever thread pumps events, so the masks and the
+// held-back event are guarded. SDL_PushEvent doesn't go back through the
+// filter. Once installed the filter stays in place, and set_filter and
+// clear_filter only change the masks: swapping filters empties SDL's queue,
+// and the event thread may be inside the filter at any moment.
+#define SDL_FILTER_QUEUE_SIZE 128
+
+static SDL_mutex* sdl_filter_lock = NULL;
+static Uint32 sdl_filter_drop = 0;
+static Uint32 sdl_filter_coalesce = 0;
+static SDL_Event sdl_filter_pending;
+static int sdl_filter_has_pending = 0;
+static sdl_event_filter_stats sdl_filter_stats;
+
+static Sint16 sdl_filter_add (Sint16 a, Sint16 b) {
+  int sum = a + b;
+  if (sum > 32767) return 32767;
+  if (sum < -32768) return -32768;
+  return (Sint16) sum;
+}
+
+// Merge event into the pending one if both come from the same device
+static int sdl_filter_merge (SDL_Event* pending, const SDL_Event* event) {
+  if (pending->type != event->type) return 0;
+  switch (event->type) {
+    case SDL_MOUSEMOTION:
+      if (pending->motion.which != event->motion.which) return 0;
+      pending->motion.state = event->motion.state;
+      pending->motion.x = event->motion.x;
+      pending->motion.y = event->motion.y;
+      pending->motion.xrel = sdl_filter_add(pending->motion.xrel, event->motion.xrel);
+      pending->motion.yrel = sdl_filter_add(pending->motion.yrel, event->motion.yrel);
+      return 1;
+    case SDL_JOYAXISMOTION:
+      if (pending->jaxis.which != event->jaxis.which || pending->jaxis.axis != event->jaxis.axis) return 0;
+      pending->jaxis.value = event->jaxis.value;
+      return 1;
+    case SDL_JOYBALLMOTION:
+      if (pending->jball.which != event->jball.which || pending->jball.ball != event->jball.ball) return 0;
+      pending->jball.xrel = sdl_filter_add(pending->jball.xrel, event->jball.xrel);
+      pending->jball.yrel = sdl_filter_add(pending->jball.yrel, event->jball.yrel);
+      return 1;
+  }
+  return 0;
+}
+
+// Call with the lock held
+static void sdl_filter_release_pending (void) {
+  if ( ! sdl_filter_has_pending) return;
+  sdl_filter_has_pending = 0;
+  if (SDL_PushEvent(&sdl_filter_pending) < 0) sdl_filter_stats.lost++;
+}
+
+static int sdl_event_filter (const SDL_Event* event) {
+  Uint32 bit = SDL_EVENTMASK(event->type);
+
+  SDL_LockMutex(sdl_filter_lock);
+  if (sdl_filter_drop & bit) {
+    sdl_filter_stats.dropped++;
+    SDL_UnlockMutex(sdl_filter_lock);
+    return 0;
+  }
+
+  int coalescable = (sdl_filter_coalesce & bit) && (event->type == SDL_MOUSEMOTION ||
+    event->type == SDL_JOYAXISMOTION || event->type == SDL_JOYBALLMOTION);
+  if (coalescable) {
+    if (sdl_filter_has_pending && sdl_filter_merge(&sdl_filter_pending, event)) {
+      sdl_filter_stats.coalesced++;
+    } else {
+      sdl_filter_release_pending();
+      sdl_filter_pending = *event;
+      sdl_filter_has_pending = 1;
+    }
+    SDL_UnlockMutex(sdl_filter_lock);
+    return 0;
+  }
+
+  // Anything else lets the held motion through first, keeping the order
+  sdl_filter_release_pending();
+  SDL_UnlockMutex(sdl_filter_lock);
+  return 1;
+}
+
+// SDL_SetEventFilter drains SDL's queue, which holds at most 128 events, so
+// set them aside and queue them again behind the new filter
+static void sdl_filter_set (SDL_EventFilter filter) {
+  SDL_Event queued[SDL_FILTER_QUEUE_SIZE];
+  int count = SDL_PeepEvents(queued, SDL_FILTER_QUEUE_SIZE, SDL_GETEVENT, SDL_ALLEVENTS);
+  int i;
+  SDL_SetEventFilter(filter);
+  for (i = 0; i < count; i++) {
+    if (SDL_PushEvent(&queued[i]) < 0) sdl_filter_stats.lost++;
+  }
+}
+
+static void sdl_filter_set_masks (Uint32 drop_mask, Uint32 coalesce_mask) {
+  SDL_LockMutex(sdl_filter_lock);
+  sdl_filter_release_pending();
+  sdl_filter_drop = drop_mask;
+  sdl_filter_coalesce = coalesce_mask;
+  SDL_UnlockMutex(sdl_filter_lock);
+}
+
+int sdl_event_filter_install (Uint32 drop_mask, Uint32 coalesce_mask) {
+  if ( ! sdl_filter_lock) {
+    sdl_filter_lock = SDL_CreateMutex();
+    if ( ! sdl_filter_lock) return -1;
+  }
+  sdl_filter_set_masks(drop_mask, coalesce_mask);
+  // SDL_Init forgets the filter, so check SDL's copy rather than a flag
+  if (SDL_GetEventFilter() != sdl_event_filter) sdl_filter_set(sdl_event_filter);
+  return 0;
+}
+
+// The filter stays installed and lets everything through
+void sdl_event_filter_remove (void) {
+  if ( ! sdl_filter_lock) return;
+  sdl_filter_set_masks(0, 0);
+}
+
+void sdl_event_filter_shutdown (void) {
+  if ( ! sdl_filter_lock) return;
+  if (SDL_GetEventFilter() == sdl_event_filter) sdl_filter_set(NULL);
+  sdl_event_filter_flush();
+  SDL_DestroyMutex(sdl_filter_lock);
+  sdl_filter_lock = NULL;
+  sdl_filter_drop = 0;
+  sdl_filter_coalesce = 0;
+}
+
+void sdl_event_filter_stats_get (sdl_event_filter_stats* stats) {
+  *stats = sdl_filter_stats;
+}
+
+void sdl_event_filter_flush (void) {
+  if ( ! sdl_filter_lock) return;
+  SDL_LockMutex(sdl_filter_lock);
+  sdl_filter_release_pending();
+  SDL_UnlockMutex(sdl_filter_lock);
+}
@@ -0,0 +1,56 @@
+#ifndef MRB_SDL_EVENTS_H
+#define MRB_SDL_EVENTS_H
+
+#include <SDL/SDL.h>
+
+/*
+ * Fixed-capacity ring of SDL_Event records. Draining moves events out of
+ * SDL's queue in as few SDL_PeepEvents calls as the wrap allows; anything
+ * that doesn't fit stays queued in SDL for the next drain.
+ */
+typedef struct {
+  SDL_Event* events;
+  int capacity;
+  int head;
+  int count;
+} sdl_event_ring;
+
+int sdl_event_ring_init(sdl_event_ring* ring, int capacity);
+void sdl_event_ring_destroy(sdl_event_ring* ring);
+
+// Pump SDL and append the queued events matching mask. Returns how many
+// were added, or -1 on error.
+int sdl_event_ring_drain(sdl_event_ring* ring, Uint32 mask);
+void sdl_event_ring_discard(sdl_event_ring* ring, int count);
+
+// The index'th buffered event, oldest first
+static inline SDL_Event* sdl_event_ring_at (sdl_event_ring* ring, int index) {
+  if (index < 0 || index >= ring->count) return NULL;
+  return &ring->events[(ring->head + index) % ring->capacity];
+}
+
+/*
+ * Native event filter, installed with SDL_SetEventFilter. Types in the drop
+ * mask never reach the queue. Runs of motion events of a type in the
+ * coalesce mask from the same device are held back and merged, relative
+ * motion summed, until another event arrives or the queue is drained.
+ */
+typedef struct {
+  Uint32 dropped;
+  Uint32 coalesced;
+  Uint32 lost;
+} sdl_event_filter_stats;
+
+// Installs the filter once; later calls only change the masks. Removing
+// clears the masks and leaves the filter in place, as swapping filters would
+// throw away SDL's queue.
+int sdl_event_filter_install(Uint32 drop_mask, Uint32 coalesce_mask);
+void sdl_event_filter_remove(void);
+// Uninstalls the filter and frees its lock, at gem shutdown
+void sdl_event_filter_shutdown(void);
+void sdl_event_filter_stats_get(sdl_event_filter_stats* stats);
+
+// Queue the motion event being held back, if any
+void sdl_event_filter_flush(void);
+
+#endif	/* MRB_SDL_EVENTS_H */
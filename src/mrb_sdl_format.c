@@ -0,0 +1,361 @@
+/**
+ * mruby-sdl
+ *
+ * Bulk pixel format mapping with runtime CPU dispatch
+ */
+#include <SDL/SDL.h>
+#include "mrb_sdl_format.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SDL_FORMAT_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// Where each channel of a 32bpp format with 8-bit channels sits
+typedef struct {
+  int rshift;
+  int gshift;
+  int bshift;
+  int ashift;
+  Uint32 amask;
+} sdl_format_shifts;
+
+typedef void (*sdl_format_kernel)(const Uint32* src, Uint32* dst, size_t count, const sdl_format_shifts* shifts);
+
+typedef struct {
+  const char* name;
+  sdl_format_kernel map;
+  sdl_format_kernel get;
+} sdl_format_kernel_set;
+
+
+/*******************************************************************************
+ * 32bpp kernels
+ *
+ * RGBA quads are read as little-endian words, red in the low byte, so the
+ * vector kernels only exist for x86.
+ ******************************************************************************/
+static inline Uint32 sdl_format_quad (const Uint8* rgba) {
+  return rgba[0] | (Uint32) rgba[1] << 8 | (Uint32) rgba[2] << 16 | (Uint32) rgba[3] << 24;
+}
+
+static inline void sdl_format_store_quad (Uint8* rgba, Uint32 quad) {
+  rgba[0] = quad;
+  rgba[1] = quad >> 8;
+  rgba[2] = quad >> 16;
+  rgba[3] = quad >> 24;
+}
+
+static inline Uint32 sdl_format_map_32 (Uint32 q, const sdl_format_shifts* shifts) {
+  return (q & 0xff) << shifts->rshift | ((q >> 8) & 0xff) << shifts->gshift |
+    ((q >> 16) & 0xff) << shifts->bshift | ((q >> 24) << shifts->ashift & shifts->amask);
+}
+
+static inline Uint32 sdl_format_get_32 (Uint32 p, const sdl_format_shifts* shifts) {
+  Uint32 a = shifts->amask ? (p >> shifts->ashift) & 0xff : SDL_ALPHA_OPAQUE;
+  return ((p >> shifts->rshift) & 0xff) | ((p >> shifts->gshift) & 0xff) << 8 |
+    ((p >> shifts->bshift) & 0xff) << 16 | a << 24;
+}
+
+static void sdl_format_map_scalar (const Uint32* src, Uint32* dst, size_t count, const sdl_format_shifts* shifts) {
+  size_t i;
+  for (i = 0; i < count; i++) {
+    dst[i] = sdl_format_map_32(sdl_format_quad((const Uint8*) (src + i)), shifts);
+  }
+}
+
+static void sdl_format_get_scalar (const Uint32* src, Uint32* dst, size_t count, const sdl_format_shifts* shifts) {
+  size_t i;
+  for (i = 0; i < count; i++) {
+    sdl_format_store_quad((Uint8*) (dst + i), sdl_format_get_32(src[i], shifts));
+  }
+}
+
+static const sdl_format_kernel_set sdl_format_kernels_scalar = {
+  "scalar", sdl_format_map_scalar, sdl_format_get_scalar
+};
+
+
+#ifdef SDL_FORMAT_X86
+#define SDL_SSE2 __attribute__((target("sse2")))
+
+SDL_SSE2 static void sdl_format_map_sse2 (const Uint32* src, Uint32* dst, size_t count, const sdl_format_shifts* shifts) {
+  const __m128i ff = _mm_set1_epi32(0xff);
+  const __m128i amask = _mm_set1_epi32((int) shifts->amask);
+  const __m128i rs = _mm_cvtsi32_si128(shifts->rshift);
+  const __m128i gs = _mm_cvtsi32_si128(shifts->gshift);
+  const __m128i bs = _mm_cvtsi32_si128(shifts->bshift);
+  const __m128i as = _mm_cvtsi32_si128(shifts->ashift);
+  size_t i;
+  for (i = 0; i + 4 <= count; i += 4) {
+    __m128i q = _mm_loadu_si128((const __m128i*) (src + i));
+    __m128i r = _mm_sll_epi32(_mm_and_si128(q, ff), rs);
+    __m128i g = _mm_sll_epi32(_mm_and_si128(_mm_srli_epi32(q, 8), ff), gs);
+    __m128i b = _mm_sll_epi32(_mm_and_si128(_mm_srli_epi32(q, 16), ff), bs);
+    __m128i a = _mm_and_si128(_mm_sll_epi32(_mm_srli_epi32(q, 24), as), amask);
+    _mm_storeu_si128((__m128i*) (dst + i), _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, a)));
+  }
+  sdl_format_map_scalar(src + i, dst + i, count - i, shifts);
+}
+
+SDL_SSE2 static void sdl_format_get_sse2 (const Uint32* src, Uint32* dst, size_t count, const sdl_format_shifts* shifts) {
+  const __m128i ff = _mm_set1_epi32(0xff);
+  const __m128i rs = _mm_cvtsi32_si128(shifts->rshift);
+  const __m128i gs = _mm_cvtsi32_si128(shifts->gshift);
+  const __m128i bs = _mm_cvtsi32_si128(shifts->bshift);
+  const __m128i as = _mm_cvtsi32_si128(shifts->ashift);
+  const __m128i opaque = _mm_set1_epi32(shifts->amask ? 0 : (int) 0xff000000);
+  size_t i;
+  for (i = 0; i + 4 <= count; i += 4) {
+    __m128i p = _mm_loadu_si128((const __m128i*) (src + i));
+    __m128i r = _mm_and_si128(_mm_srl_epi32(p, rs), ff);
+    __m128i g = _mm_slli_epi32(_mm_and_si128(_mm_srl_epi32(p, gs), ff), 8);
+    __m128i b = _mm_slli_epi32(_mm_and_si128(_mm_srl_epi32(p, bs), ff), 16);
+    __m128i a = shifts->amask ? _mm_slli_epi32(_mm_srl_epi32(p, as), 24) : opaque;
+    _mm_storeu_si128((__m128i*) (dst + i), _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, a)));
+  }
+  sdl_format_get_scalar(src + i, dst + i, count - i, shifts);
+}
+
+static const sdl_format_kernel_set sdl_format_kernels_sse2 = {
+  "sse2", sdl_format_map_sse2, sdl_format_get_sse2
+};
+
+#define SDL_AVX2 __attribute__((target("avx2")))
+
+SDL_AVX2 static void sdl_format_map_avx2 (const Uint32* src, Uint32* dst, size_t count, const sdl_format_shifts* shifts) {
+  const __m256i ff = _mm256_set1_epi32(0xff);
+  const __m256i amask = _mm256_set1_epi32((int) shifts->amask);
+  const __m128i rs = _mm_cvtsi32_si128(shifts->rshift);
+  const __m128i gs = _mm_cvtsi32_si128(shifts->gshift);
+  const __m128i bs = _mm_cvtsi32_si128(shifts->bshift);
+  const __m128i as = _mm_cvtsi32_si128(shifts->ashift);
+  size_t i;
+  for (i = 0; i + 8 <= count; i += 8) {
+    __m256i q = _mm256_loadu_si256((const __m256i*) (src + i));
+    __m256i r = _mm256_sll_epi32(_mm256_and_si256(q, ff), rs);
+    __m256i g = _mm256_sll_epi32(_mm256_and_si256(_mm256_srli_epi32(q, 8), ff), gs);
+    __m256i b = _mm256_sll_epi32(_mm256_and_si256(_mm256_srli_epi32(q, 16), ff), bs);
+    __m256i a = _mm256_and_si256(_mm256_sll_epi32(_mm256_srli_epi32(q, 24), as), amask);
+    _mm256_storeu_si256((__m256i*) (dst + i), _mm256_or_si256(_mm256_or_si256(r, g), _mm256_or_si256(b, a)));
+  }
+  sdl_format_map_scalar(src + i, dst + i, count - i, shifts);
+}
+
+SDL_AVX2 static void sdl_format_get_avx2 (const Uint32* src, Uint32* dst, size_t count, const sdl_format_shifts* shifts) {
+  const __m256i ff = _mm256_set1_epi32(0xff);
+  const __m128i rs = _mm_cvtsi32_si128(shifts->rshift);
+  const __m128i gs = _mm_cvtsi32_si128(shifts->gshift);
+  const __m128i bs = _mm_cvtsi32_si128(shifts->bshift);
+  const __m128i as = _mm_cvtsi32_si128(shifts->ashift);
+  const __m256i opaque = _mm256_set1_epi32(shifts->amask ? 0 : (int) 0xff000000);
+  size_t i;
+  for (i = 0; i + 8 <= count; i += 8) {
+    __m256i p = _mm256_loadu_si256((const __m256i*) (src + i));
+    __m256i r = _mm256_and_si256(_mm256_srl_epi32(p, rs), ff);
+    __m256i g = _mm256_slli_epi32(_mm256_and_si256(_mm256_srl_epi32(p, gs), ff), 8);
+    __m256i b = _mm256_slli_epi32(_mm256_and_si256(_mm256_srl_epi32(p, bs), ff), 16);
+    __m256i a = shifts->amask ? _mm256_slli_epi32(_mm256_srl_epi32(p, as), 24) : opaque;
+    _mm256_storeu_si256((__m256i*) (dst + i), _mm256_or_si256(_mm256_or_si256(r, g), _mm256_or_si256(b, a)));
+  }
+  sdl_format_get_scalar(src + i, dst + i, count - i, shifts);
+}
+
+static const sdl_format_kernel_set sdl_format_kernels_avx2 = {
+  "avx2", sdl_format_map_avx2, sdl_format_get_avx2
+};
+#endif
+
+
+/*******************************************************************************
+ * Dispatch
+ ******************************************************************************/
+static const sdl_format_kernel_set* sdl_format_kernels = &sdl_format_kernels_scalar;
+
+void sdl_format_init (void) {
+  sdl_format_kernels = &sdl_format_kernels_scalar;
+#ifdef SDL_FORMAT_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    sdl_format_kernels = &sdl_format_kernels_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    sdl_format_kernels = &sdl_format_kernels_sse2;
+  }
+#endif
+}
+
+const char* sdl_format_kernel_name (void) {
+  return sdl_format_kernels->name;
+}
+
+static int sdl_format_byte_channel (Uint32 mask, Uint8 shift) {
+  return mask == (Uint32) 0xff << shift;
+}
+
+static int sdl_format_is_8888 (const SDL_PixelFormat* format, sdl_format_shifts* shifts) {
+  if (format->palette || format->BytesPerPixel != 4) return 0;
+  if ( ! sdl_format_byte_channel(format->Rmask, format->Rshift) || ! sdl_format_byte_channel(format->Gmask, format->Gshift) ||
+       ! sdl_format_byte_channel(format->Bmask, format->Bshift)) return 0;
+  if (format->Amask && ! sdl_format_byte_channel(format->Amask, format->Ashift)) return 0;
+  shifts->rshift = format->Rshift;
+  shifts->gshift = format->Gshift;
+  shifts->bshift = format->Bshift;
+  shifts->ashift = format->Ashift;
+  shifts->amask = format->Amask;
+  return 1;
+}
+
+
+/*******************************************************************************
+ * Other formats
+ ******************************************************************************/
+static inline Uint32 sdl_format_load (const Uint8* p, int bpp) {
+  switch (bpp) {
+    case 1: return *p;
+    case 2: return *(const Uint16*) p;
+    case 3:
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+      return p[0] | (Uint32) p[1] << 8 | (Uint32) p[2] << 16;
+#else
+      return (Uint32) p[0] << 16 | (Uint32) p[1] << 8 | p[2];
+#endif
+    default: return *(const Uint32*) p;
+  }
+}
+
+static inline void sdl_format_store (Uint8* p, int bpp, Uint32 pixel) {
+  switch (bpp) {
+    case 1: *p = pixel; break;
+    case 2: *(Uint16*) p = pixel; break;
+    case 3:
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+      p[0] = pixel;
+      p[1] = pixel >> 8;
+      p[2] = pixel >> 16;
+#else
+      p[0] = pixel >> 16;
+      p[1] = pixel >> 8;
+      p[2] = pixel;
+#endif
+      break;
+    default: *(Uint32*) p = pixel; break;
+  }
+}
+
+// SDL widens a lossy channel by repeating its top bits. Rather than copy
+// its arithmetic, each table is filled by asking SDL, once per format.
+typedef struct {
+  SDL_PixelFormat format;
+  Uint8 tables[4][256];
+  int valid;
+} sdl_format_expansion;
+
+static sdl_format_expansion sdl_format_expanded;
+
+static int sdl_format_channel_fits (Uint32 mask, Uint8 shift) {
+  return (mask >> shift) <= 0xff;
+}
+
+static const sdl_format_expansion* sdl_format_expansion_for (const SDL_PixelFormat* format) {
+  sdl_format_expansion* e = &sdl_format_expanded;
+  const Uint32 masks[4] = { format->Rmask, format->Gmask, format->Bmask, format->Amask };
+  const Uint8 shifts[4] = { format->Rshift, format->Gshift, format->Bshift, format->Ashift };
+  int c, v;
+  for (c = 0; c < 4; c++) {
+    if ( ! sdl_format_channel_fits(masks[c], shifts[c])) return NULL;
+  }
+  if (e->valid && e->format.BytesPerPixel == format->BytesPerPixel && e->format.Rmask == format->Rmask &&
+      e->format.Gmask == format->Gmask && e->format.Bmask == format->Bmask && e->format.Amask == format->Amask) {
+    return e;
+  }
+
+  e->format = *format;
+  e->format.palette = NULL;
+  for (c = 0; c < 4; c++) {
+    for (v = 0; v <= (int) (masks[c] >> shifts[c]); v++) {
+      Uint8 channels[4];
+      SDL_GetRGBA((Uint32) v << shifts[c], (SDL_PixelFormat*) format, &channels[0], &channels[1], &channels[2], &channels[3]);
+      e->tables[c][v] = channels[c];
+    }
+  }
+  e->valid = 1;
+  return e;
+}
+
+
+/*******************************************************************************
+ * Bulk conversion
+ ******************************************************************************/
+void sdl_format_map_rgba (const SDL_PixelFormat* format, const Uint8* rgba, Uint8* pixels, size_t count) {
+  int bpp = format->BytesPerPixel;
+  sdl_format_shifts shifts;
+  size_t i;
+
+  if (sdl_format_is_8888(format, &shifts)) {
+    sdl_format_kernels->map((const Uint32*) rgba, (Uint32*) pixels, count, &shifts);
+    return;
+  }
+  if (format->palette) {
+    // Nearest-color search is SDL's to do; runs of one color only ask once
+    Uint32 last_quad = 0, last_pixel = 0;
+    int have_last = 0;
+    for (i = 0; i < count; i++, rgba += 4, pixels += bpp) {
+      Uint32 quad = sdl_format_quad(rgba);
+      if ( ! have_last || quad != last_quad) {
+        last_pixel = SDL_MapRGBA((SDL_PixelFormat*) format, rgba[0], rgba[1], rgba[2], rgba[3]);
+        last_quad = quad;
+        have_last = 1;
+      }
+      sdl_format_store(pixels, bpp, last_pixel);
+    }
+    return;
+  }
+  for (i = 0; i < count; i++, rgba += 4, pixels += bpp) {
+    Uint32 pixel = (Uint32) (rgba[0] >> format->Rloss) << format->Rshift |
+      (Uint32) (rgba[1] >> format->Gloss) << format->Gshift |
+      (Uint32) (rgba[2] >> format->Bloss) << format->Bshift |
+      ((Uint32) (rgba[3] >> format->Aloss) << format->Ashift & format->Amask);
+    sdl_format_store(pixels, bpp, pixel);
+  }
+}
+
+void sdl_format_get_rgba (const SDL_PixelFormat* format, const Uint8* pixels, Uint8* rgba, size_t count) {
+  int bpp = format->BytesPerPixel;
+  sdl_format_shifts shifts;
+  size_t i;
+
+  if (sdl_format_is_8888(format, &shifts)) {
+    sdl_format_kernels->get((const Uint32*) pixels, (Uint32*) rgba, count, &shifts);
+    return;
+  }
+  if (format->palette) {
+    const SDL_Palette* palette = format->palette;
+    for (i = 0; i < count; i++, pixels += bpp, rgba += 4) {
+      Uint32 index = sdl_format_load(pixels, bpp);
+      // SDL would read past the palette; give black instead
+      if (index < (Uint32) palette->ncolors) {
+        rgba[0] = palette->colors[index].r;
+        rgba[1] = palette->colors[index].g;
+        rgba[2] = palette->colors[index].b;
+      } else {
+        rgba[0] = rgba[1] = rgba[2] = 0;
+      }
+      rgba[3] = SDL_ALPHA_OPAQUE;
+    }
+    return;
+  }
+
+  const sdl_format_expansion* e = sdl_format_expansion_for(format);
+  for (i = 0; i < count; i++, pixels += bpp, rgba += 4) {
+    Uint32 pixel = sdl_format_load(pixels, bpp);
+    if ( ! e) {
+      SDL_GetRGBA(pixel, (SDL_PixelFormat*) format, &rgba[0], &rgba[1], &rgba[2], &rgba[3]);
+      continue;
+    }
+    rgba[0] = e->tables[0][(pixel & format->Rmask) >> format->Rshift];
+    rgba[1] = e->tables[1][(pixel & format->Gmask) >> format->Gshift];
+    rgba[2] = e->tables[2][(pixel & format->Bmask) >> format->Bshift];
+    rgba[3] = format->Amask ? e->tables[3][(pixel & format->Amask) >> format->Ashift] : SDL_ALPHA_OPAQUE;
+  }
+}
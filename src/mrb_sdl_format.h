@@ -0,0 +1,19 @@
+#ifndef MRB_SDL_FORMAT_H
+#define MRB_SDL_FORMAT_H
+
+#include <SDL/SDL.h>
+
+/*
+ * Bulk SDL_MapRGBA and SDL_GetRGBA. RGBA buffers hold r, g, b, a bytes per
+ * pixel; pixel buffers hold each pixel in the format's BytesPerPixel, in
+ * native byte order. 32bpp formats with 8-bit channels run an SSE2/AVX2
+ * kernel picked at init, and everything else a table-driven scalar loop.
+ * Results match SDL's own per-pixel calls.
+ */
+void sdl_format_init(void);
+const char* sdl_format_kernel_name(void);
+
+void sdl_format_map_rgba(const SDL_PixelFormat* format, const Uint8* rgba, Uint8* pixels, size_t count);
+void sdl_format_get_rgba(const SDL_PixelFormat* format, const Uint8* pixels, Uint8* rgba, size_t count);
+
+#endif	/* MRB_SDL_FORMAT_H */
@@ -0,0 +1,227 @@
+/**
+ * mruby-sdl
+ *
+ * Software gamma ramps with runtime CPU dispatch
+ *
+ * Each 16-bit ramp entry is cut to its top 8 bits, and every pixel becomes
+ * table[r] | table[g] | table[b] plus whatever bits lie outside the color
+ * masks. The AVX2 kernel gathers eight pixels' entries at a time; SSE2 has
+ * no gather, so it shares the scalar kernel.
+ */
+#include <math.h>
+#include <SDL/SDL.h>
+#include "mrb_sdl_gamma.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SDL_GAMMA_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*sdl_gamma_kernel)(const Uint32* src, Uint32* dst, int w, const sdl_gamma* gamma,
+  int rshift, int gshift, int bshift);
+
+typedef struct {
+  const char* name;
+  sdl_gamma_kernel row;
+} sdl_gamma_kernel_set;
+
+
+/*******************************************************************************
+ * Kernels
+ ******************************************************************************/
+static void sdl_gamma_row_scalar (const Uint32* src, Uint32* dst, int w, const sdl_gamma* gamma,
+    int rshift, int gshift, int bshift) {
+  Uint32 keep = ~(gamma->rmask | gamma->gmask | gamma->bmask);
+  int x;
+  for (x = 0; x < w; x++) {
+    Uint32 p = src[x];
+    dst[x] = gamma->tables[0][(p >> rshift) & 0xff] | gamma->tables[1][(p >> gshift) & 0xff] |
+      gamma->tables[2][(p >> bshift) & 0xff] | (p & keep);
+  }
+}
+
+static const sdl_gamma_kernel_set sdl_gamma_kernels_scalar = { "scalar", sdl_gamma_row_scalar };
+
+#ifdef SDL_GAMMA_X86
+#define SDL_AVX2 __attribute__((target("avx2")))
+
+SDL_AVX2 static void sdl_gamma_row_avx2 (const Uint32* src, Uint32* dst, int w, const sdl_gamma* gamma,
+    int rshift, int gshift, int bshift) {
+  const __m256i ff = _mm256_set1_epi32(0xff);
+  const __m256i keep = _mm256_set1_epi32((int) ~(gamma->rmask | gamma->gmask | gamma->bmask));
+  const __m128i rs = _mm_cvtsi32_si128(rshift);
+  const __m128i gs = _mm_cvtsi32_si128(gshift);
+  const __m128i bs = _mm_cvtsi32_si128(bshift);
+  int x;
+  for (x = 0; x + 8 <= w; x += 8) {
+    __m256i p = _mm256_loadu_si256((const __m256i*) (src + x));
+    __m256i r = _mm256_i32gather_epi32((const int*) gamma->tables[0], _mm256_and_si256(_mm256_srl_epi32(p, rs), ff), 4);
+    __m256i g = _mm256_i32gather_epi32((const int*) gamma->tables[1], _mm256_and_si256(_mm256_srl_epi32(p, gs), ff), 4);
+    __m256i b = _mm256_i32gather_epi32((const int*) gamma->tables[2], _mm256_and_si256(_mm256_srl_epi32(p, bs), ff), 4);
+    __m256i out = _mm256_or_si256(_mm256_or_si256(r, g), _mm256_or_si256(b, _mm256_and_si256(p, keep)));
+    _mm256_storeu_si256((__m256i*) (dst + x), out);
+  }
+  sdl_gamma_row_scalar(src + x, dst + x, w - x, gamma, rshift, gshift, bshift);
+}
+
+static const sdl_gamma_kernel_set sdl_gamma_kernels_avx2 = { "avx2", sdl_gamma_row_avx2 };
+#endif
+
+static const sdl_gamma_kernel_set* sdl_gamma_kernels = &sdl_gamma_kernels_scalar;
+
+const char* sdl_gamma_kernel_name (void) {
+  return sdl_gamma_kernels->name;
+}
+
+
+/*******************************************************************************
+ * Ramps
+ ******************************************************************************/
+void sdl_gamma_init (sdl_gamma* gamma) {
+  int i;
+  sdl_gamma_kernels = &sdl_gamma_kernels_scalar;
+#ifdef SDL_GAMMA_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) sdl_gamma_kernels = &sdl_gamma_kernels_avx2;
+#endif
+
+  memset(gamma, 0, sizeof(sdl_gamma));
+  for (i = 0; i < 256; i++) {
+    gamma->ramps[0][i] = gamma->ramps[1][i] = gamma->ramps[2][i] = (Uint16) ((i << 8) | i);
+  }
+}
+
+void sdl_gamma_destroy (sdl_gamma* gamma) {
+  free(gamma->saved);
+  sdl_gamma_init(gamma);
+}
+
+void sdl_gamma_set_ramps (sdl_gamma* gamma, const Uint16* red, const Uint16* green, const Uint16* blue) {
+  if (red) memcpy(gamma->ramps[0], red, sizeof(gamma->ramps[0]));
+  if (green) memcpy(gamma->ramps[1], green, sizeof(gamma->ramps[1]));
+  if (blue) memcpy(gamma->ramps[2], blue, sizeof(gamma->ramps[2]));
+  gamma->enabled = 1;
+  // Rebuild the tables on the next apply
+  gamma->rmask = gamma->gmask = gamma->bmask = 0;
+}
+
+// Same curve as SDL_SetGamma's own
+void sdl_gamma_calculate (float value, Uint16* ramp) {
+  int i;
+  if (value <= 0.0f) {
+    memset(ramp, 0, sizeof(Uint16) * 256);
+    return;
+  }
+  if (value == 1.0f) {
+    for (i = 0; i < 256; i++) ramp[i] = (Uint16) ((i << 8) | i);
+    return;
+  }
+  double exponent = 1.0 / value;
+  for (i = 0; i < 256; i++) {
+    int v = (int) (pow((double) i / 256.0, exponent) * 65535.0 + 0.5);
+    ramp[i] = (Uint16) (v > 65535 ? 65535 : v);
+  }
+}
+
+
+/*******************************************************************************
+ * Applying
+ ******************************************************************************/
+int sdl_gamma_supported (const SDL_Surface* surface) {
+  const SDL_PixelFormat* format = surface->format;
+  // Hardware screens may flip to another buffer, so there'd be nothing to
+  // restore into
+  return ! (surface->flags & SDL_HWSURFACE) && ! SDL_MUSTLOCK(surface) && format->BytesPerPixel == 4 &&
+    format->Rmask == (Uint32) 0xff << format->Rshift && format->Gmask == (Uint32) 0xff << format->Gshift &&
+    format->Bmask == (Uint32) 0xff << format->Bshift;
+}
+
+static void sdl_gamma_prepare (sdl_gamma* gamma, const SDL_PixelFormat* format) {
+  int i;
+  if (gamma->rmask == format->Rmask && gamma->gmask == format->Gmask && gamma->bmask == format->Bmask) return;
+  for (i = 0; i < 256; i++) {
+    gamma->tables[0][i] = (Uint32) (gamma->ramps[0][i] >> 8) << format->Rshift;
+    gamma->tables[1][i] = (Uint32) (gamma->ramps[1][i] >> 8) << format->Gshift;
+    gamma->tables[2][i] = (Uint32) (gamma->ramps[2][i] >> 8) << format->Bshift;
+  }
+  gamma->rmask = format->Rmask;
+  gamma->gmask = format->Gmask;
+  gamma->bmask = format->Bmask;
+}
+
+// An all-zero rect means the whole surface, as for SDL_UpdateRect
+static int sdl_gamma_clip (const SDL_Surface* surface, const SDL_Rect* rect, SDL_Rect* clipped) {
+  if ( ! rect->x && ! rect->y && ! rect->w && ! rect->h) {
+    clipped->x = clipped->y = 0;
+    clipped->w = surface->w;
+    clipped->h = surface->h;
+    return 1;
+  }
+  int x1 = rect->x > 0 ? rect->x : 0;
+  int y1 = rect->y > 0 ? rect->y : 0;
+  int x2 = rect->x + rect->w < surface->w ? rect->x + rect->w : surface->w;
+  int y2 = rect->y + rect->h < surface->h ? rect->y + rect->h : surface->h;
+  if (x2 <= x1 || y2 <= y1) return 0;
+  clipped->x = x1;
+  clipped->y = y1;
+  clipped->w = x2 - x1;
+  clipped->h = y2 - y1;
+  return 1;
+}
+
+#define SDL_GAMMA_ROW(surface, r, y) ((Uint32*) ((Uint8*) (surface)->pixels + ((r).y + (y)) * (surface)->pitch) + (r).x)
+
+int sdl_gamma_apply (sdl_gamma* gamma, SDL_Surface* surface, const SDL_Rect* rects, int count) {
+  const SDL_PixelFormat* format = surface->format;
+  SDL_Rect clipped;
+  size_t needed = 0;
+  int i, y;
+
+  gamma->applied = 0;
+  if ( ! gamma->enabled || count <= 0 || ! sdl_gamma_supported(surface)) return 0;
+  for (i = 0; i < count; i++) {
+    if (sdl_gamma_clip(surface, &rects[i], &clipped)) needed += (size_t) clipped.w * clipped.h;
+  }
+  if ( ! needed) return 0;
+  if (needed > gamma->saved_capacity) {
+    Uint32* saved = (Uint32*) realloc(gamma->saved, needed * sizeof(Uint32));
+    if ( ! saved) return 0;
+    gamma->saved = saved;
+    gamma->saved_capacity = needed;
+  }
+  sdl_gamma_prepare(gamma, format);
+
+  // Save every rect before correcting any, and correct from the saved
+  // copies, so overlapping rects aren't corrected twice
+  Uint32* saved = gamma->saved;
+  for (i = 0; i < count; i++) {
+    if ( ! sdl_gamma_clip(surface, &rects[i], &clipped)) continue;
+    for (y = 0; y < clipped.h; y++, saved += clipped.w) {
+      memcpy(saved, SDL_GAMMA_ROW(surface, clipped, y), clipped.w * sizeof(Uint32));
+    }
+  }
+  saved = gamma->saved;
+  for (i = 0; i < count; i++) {
+    if ( ! sdl_gamma_clip(surface, &rects[i], &clipped)) continue;
+    for (y = 0; y < clipped.h; y++, saved += clipped.w) {
+      sdl_gamma_kernels->row(saved, SDL_GAMMA_ROW(surface, clipped, y), clipped.w, gamma,
+        format->Rshift, format->Gshift, format->Bshift);
+    }
+  }
+  gamma->applied = 1;
+  return 1;
+}
+
+void sdl_gamma_restore (sdl_gamma* gamma, SDL_Surface* surface, const SDL_Rect* rects, int count) {
+  SDL_Rect clipped;
+  int i, y;
+  if ( ! gamma->applied) return;
+  const Uint32* saved = gamma->saved;
+  for (i = 0; i < count; i++) {
+    if ( ! sdl_gamma_clip(surface, &rects[i], &clipped)) continue;
+    for (y = 0; y < clipped.h; y++, saved += clipped.w) {
+      memcpy(SDL_GAMMA_ROW(surface, clipped, y), saved, clipped.w * sizeof(Uint32));
+    }
+  }
+  gamma->applied = 0;
+}
@@ -0,0 +1,46 @@
+#ifndef MRB_SDL_GAMMA_H
+#define MRB_SDL_GAMMA_H
+
+#include <SDL/SDL.h>
+
+/*
+ * Software gamma for drivers that can't set a hardware ramp. The ramps are
+ * applied to the rects of a 32bpp software screen just before they go out,
+ * and the untouched pixels are put back straight after, so what the game
+ * draws into is never corrected twice.
+ */
+typedef struct {
+  int enabled;
+  Uint16 ramps[3][256];
+
+  // Per-channel tables with the corrected value already in place for the
+  // format they were built for
+  Uint32 tables[3][256];
+  Uint32 rmask;
+  Uint32 gmask;
+  Uint32 bmask;
+
+  Uint32* saved;
+  size_t saved_capacity;
+  int applied;
+} sdl_gamma;
+
+// Identity ramps with the software path off. Also picks the kernel.
+void sdl_gamma_init(sdl_gamma* gamma);
+void sdl_gamma_destroy(sdl_gamma* gamma);
+const char* sdl_gamma_kernel_name(void);
+
+// Like SDL_SetGammaRamp: a NULL ramp leaves that channel as it was. Turns
+// the software path on.
+void sdl_gamma_set_ramps(sdl_gamma* gamma, const Uint16* red, const Uint16* green, const Uint16* blue);
+// The ramp SDL_SetGamma would build for the given exponent
+void sdl_gamma_calculate(float value, Uint16* ramp);
+
+int sdl_gamma_supported(const SDL_Surface* surface);
+
+// Correct the rects in place before an update, keeping the originals.
+// Returns 1 if anything was changed and sdl_gamma_restore must follow.
+int sdl_gamma_apply(sdl_gamma* gamma, SDL_Surface* surface, const SDL_Rect* rects, int count);
+void sdl_gamma_restore(sdl_gamma* gamma, SDL_Surface* surface, const SDL_Rect* rects, int count);
+
+#endif	/* MRB_SDL_GAMMA_H */
@@ -0,0 +1,273 @@
+/**
+ * mruby-sdl
+ *
+ * Multi-voice software mixer
+ *
+ * Each voice adds (sample * gain) >> 15 to the output with signed 16-bit
+ * saturation, gains being Q15 per channel. The SSE2 kernel gives the same
+ * result as the scalar one, sample for sample.
+ */
+#include <SDL/SDL.h>
+#include "mrb_sdl_mixer.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SDL_MIXER_X86 1
+#include <emmintrin.h>
+#endif
+
+#define SDL_MIXER_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define SDL_MIXER_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+typedef void (*sdl_mixer_kernel)(Sint16* out, const Sint16* in, Uint32 frames, Sint16 gain_left, Sint16 gain_right);
+
+/*******************************************************************************
+ * Kernels
+ ******************************************************************************/
+static inline Sint16 sdl_mixer_clamp (int sample) {
+  if (sample > 32767) return 32767;
+  if (sample < -32768) return -32768;
+  return (Sint16) sample;
+}
+
+static void sdl_mixer_add_scalar (Sint16* out, const Sint16* in, Uint32 frames, Sint16 gain_left, Sint16 gain_right) {
+  Uint32 i;
+  for (i = 0; i < frames; i++) {
+    out[i * 2] = sdl_mixer_clamp(out[i * 2] + ((in[i * 2] * gain_left) >> 15));
+    out[i * 2 + 1] = sdl_mixer_clamp(out[i * 2 + 1] + ((in[i * 2 + 1] * gain_right) >> 15));
+  }
+}
+
+#ifdef SDL_MIXER_X86
+#define SDL_SSE2 __attribute__((target("sse2")))
+
+// Four frames at a time: widen the products to 32 bits, shift them back
+// down, then add with saturation
+SDL_SSE2 static void sdl_mixer_add_sse2 (Sint16* out, const Sint16* in, Uint32 frames, Sint16 gain_left, Sint16 gain_right) {
+  const __m128i gain = _mm_set_epi16(gain_right, gain_left, gain_right, gain_left,
+    gain_right, gain_left, gain_right, gain_left);
+  Uint32 i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    __m128i s = _mm_loadu_si128((const __m128i*) (in + i * 2));
+    __m128i d = _mm_loadu_si128((const __m128i*) (out + i * 2));
+    __m128i lo = _mm_mullo_epi16(s, gain);
+    __m128i hi = _mm_mulhi_epi16(s, gain);
+    __m128i p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15);
+    __m128i p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 15);
+    _mm_storeu_si128((__m128i*) (out + i * 2), _mm_adds_epi16(d, _mm_packs_epi32(p0, p1)));
+  }
+  sdl_mixer_add_scalar(out + i * 2, in + i * 2, frames - i, gain_left, gain_right);
+}
+#endif
+
+static sdl_mixer_kernel sdl_mixer_add = NULL;
+static const char* sdl_mixer_add_name = "scalar";
+
+static void sdl_mixer_init_kernel (void) {
+  sdl_mixer_add = sdl_mixer_add_scalar;
+#ifdef SDL_MIXER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    sdl_mixer_add = sdl_mixer_add_sse2;
+    sdl_mixer_add_name = "sse2";
+  }
+#endif
+}
+
+const char* sdl_mixer_kernel_name (void) {
+  if ( ! sdl_mixer_add) sdl_mixer_init_kernel();
+  return sdl_mixer_add_name;
+}
+
+
+/*******************************************************************************
+ * Main thread
+ ******************************************************************************/
+sdl_mixer* sdl_mixer_new (int voices) {
+  if ( ! sdl_mixer_add) sdl_mixer_init_kernel();
+  sdl_mixer* mixer = (sdl_mixer*) calloc(1, sizeof(sdl_mixer));
+  if ( ! mixer) return NULL;
+  mixer->voices = (sdl_mixer_voice*) calloc(voices, sizeof(sdl_mixer_voice));
+  if ( ! mixer->voices) {
+    free(mixer);
+    return NULL;
+  }
+  mixer->voice_count = voices;
+  return mixer;
+}
+
+void sdl_mixer_free (sdl_mixer* mixer) {
+  int i;
+  if ( ! mixer) return;
+  for (i = 0; i < SDL_MIXER_MAX_SOUNDS; i++) {
+    if (mixer->sounds[i]) {
+      free(mixer->sounds[i]->samples);
+      free(mixer->sounds[i]);
+    }
+  }
+  free(mixer->voices);
+  free(mixer);
+}
+
+int sdl_mixer_send (sdl_mixer* mixer, const sdl_mixer_command* command) {
+  Uint32 tail = mixer->command_tail;
+  if (tail - SDL_MIXER_LOAD(&mixer->command_head) == SDL_MIXER_COMMANDS) {
+    mixer->dropped_commands++;
+    return -1;
+  }
+  mixer->commands[tail % SDL_MIXER_COMMANDS] = *command;
+  SDL_MIXER_STORE(&mixer->command_tail, tail + 1);
+  return 0;
+}
+
+// The slot is filled in before any play command naming it is published, so
+// loading needs no lock
+int sdl_mixer_load (sdl_mixer* mixer, const Sint16* samples, Uint32 frames, int channels) {
+  int slot;
+  Uint32 i;
+  for (slot = 0; slot < SDL_MIXER_MAX_SOUNDS && mixer->sounds[slot]; slot++);
+  if (slot == SDL_MIXER_MAX_SOUNDS) {
+    SDL_SetError("Too many sounds loaded");
+    return -1;
+  }
+
+  sdl_mixer_sound* sound = (sdl_mixer_sound*) malloc(sizeof(sdl_mixer_sound));
+  Sint16* copy = (Sint16*) malloc(sizeof(Sint16) * 2 * (frames ? frames : 1));
+  if ( ! sound || ! copy) {
+    free(sound);
+    free(copy);
+    SDL_SetError("Out of memory");
+    return -1;
+  }
+  if (channels == 1) {
+    for (i = 0; i < frames; i++) {
+      copy[i * 2] = samples[i];
+      copy[i * 2 + 1] = samples[i];
+    }
+  } else {
+    memcpy(copy, samples, sizeof(Sint16) * 2 * frames);
+  }
+  sound->samples = copy;
+  sound->frames = frames;
+  mixer->sounds[slot] = sound;
+  return slot;
+}
+
+static void sdl_mixer_apply(sdl_mixer* mixer, const sdl_mixer_command* command);
+
+// Run queued commands. Only the consumer may do this: the audio thread, or
+// the main thread while the device is locked.
+static void sdl_mixer_run_commands (sdl_mixer* mixer) {
+  Uint32 head = mixer->command_head;
+  Uint32 tail = SDL_MIXER_LOAD(&mixer->command_tail);
+  for (; head != tail; head++) {
+    sdl_mixer_apply(mixer, &mixer->commands[head % SDL_MIXER_COMMANDS]);
+  }
+  SDL_MIXER_STORE(&mixer->command_head, head);
+}
+
+void sdl_mixer_unload (sdl_mixer* mixer, int slot) {
+  int i;
+  sdl_mixer_sound* sound = mixer->sounds[slot];
+  if ( ! sound) return;
+
+  // Plays already queued for this slot must not pick up whatever is loaded
+  // into it next
+  sdl_mixer_run_commands(mixer);
+  for (i = 0; i < mixer->voice_count; i++) {
+    if (mixer->voices[i].sound == sound) {
+      mixer->voices[i].active = 0;
+      mixer->voices[i].sound = NULL;
+    }
+  }
+  mixer->sounds[slot] = NULL;
+  free(sound->samples);
+  free(sound);
+}
+
+int sdl_mixer_voice_active (const sdl_mixer* mixer, int voice) {
+  return __atomic_load_n(&mixer->voices[voice].active, __ATOMIC_RELAXED);
+}
+
+int sdl_mixer_active_count (const sdl_mixer* mixer) {
+  int count = 0;
+  int i;
+  for (i = 0; i < mixer->voice_count; i++) {
+    count += sdl_mixer_voice_active(mixer, i);
+  }
+  return count;
+}
+
+
+/*******************************************************************************
+ * Audio thread
+ ******************************************************************************/
+static void sdl_mixer_apply (sdl_mixer* mixer, const sdl_mixer_command* command) {
+  int i;
+  sdl_mixer_voice* voice = NULL;
+  if (command->voice >= 0 && command->voice < mixer->voice_count) {
+    voice = &mixer->voices[command->voice];
+  }
+
+  switch (command->kind) {
+    case SDL_MIXER_PLAY:
+      if (command->voice < 0) {
+        for (i = 0; i < mixer->voice_count && ! voice; i++) {
+          if ( ! mixer->voices[i].active) voice = &mixer->voices[i];
+        }
+      }
+      // Sounds unloaded since the command was sent play nothing
+      if ( ! voice || command->sound >= SDL_MIXER_MAX_SOUNDS || ! mixer->sounds[command->sound]) return;
+      voice->sound = mixer->sounds[command->sound];
+      voice->position = 0;
+      voice->gain_left = command->gain_left;
+      voice->gain_right = command->gain_right;
+      voice->loop = command->loop;
+      __atomic_store_n(&voice->active, 1, __ATOMIC_RELAXED);
+      break;
+    case SDL_MIXER_STOP:
+      if (voice) __atomic_store_n(&voice->active, 0, __ATOMIC_RELAXED);
+      break;
+    case SDL_MIXER_STOP_ALL:
+      for (i = 0; i < mixer->voice_count; i++) {
+        __atomic_store_n(&mixer->voices[i].active, 0, __ATOMIC_RELAXED);
+      }
+      break;
+    case SDL_MIXER_GAIN:
+      if ( ! voice) return;
+      voice->gain_left = command->gain_left;
+      voice->gain_right = command->gain_right;
+      break;
+    case SDL_MIXER_LOOP:
+      if (voice) voice->loop = command->loop;
+      break;
+  }
+}
+
+void sdl_mixer_mix (sdl_mixer* mixer, Sint16* out, Uint32 frames) {
+  int i;
+  sdl_mixer_run_commands(mixer);
+
+  for (i = 0; i < mixer->voice_count; i++) {
+    sdl_mixer_voice* voice = &mixer->voices[i];
+    Uint32 done = 0;
+    if ( ! voice->active) continue;
+
+    while (done < frames) {
+      const sdl_mixer_sound* sound = voice->sound;
+      Uint32 count = sound->frames - voice->position;
+      if (count > frames - done) count = frames - done;
+      sdl_mixer_add(out + done * 2, sound->samples + voice->position * 2, count,
+        voice->gain_left, voice->gain_right);
+      done += count;
+      voice->position += count;
+
+      if (voice->position == sound->frames) {
+        if ( ! voice->loop || ! sound->frames) {
+          __atomic_store_n(&voice->active, 0, __ATOMIC_RELAXED);
+          break;
+        }
+        voice->position = 0;
+      }
+    }
+  }
+}
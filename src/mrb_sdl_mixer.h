@@ -0,0 +1,79 @@
+#ifndef MRB_SDL_MIXER_H
+#define MRB_SDL_MIXER_H
+
+#include <SDL/SDL.h>
+
+#define SDL_MIXER_MAX_SOUNDS 256
+#define SDL_MIXER_COMMANDS 256
+
+// Interleaved 16-bit stereo in native byte order
+typedef struct {
+  Sint16* samples;
+  Uint32 frames;
+} sdl_mixer_sound;
+
+// Only the audio thread touches voices, apart from reading active
+typedef struct {
+  const sdl_mixer_sound* sound;
+  Uint32 position;
+  Sint16 gain_left;
+  Sint16 gain_right;
+  Uint8 loop;
+  Uint8 active;
+} sdl_mixer_voice;
+
+typedef enum {
+  SDL_MIXER_PLAY = 0,
+  SDL_MIXER_STOP,
+  SDL_MIXER_STOP_ALL,
+  SDL_MIXER_GAIN,
+  SDL_MIXER_LOOP
+} sdl_mixer_command_kind;
+
+// A voice of -1 in a play command takes the first idle voice
+typedef struct {
+  Uint8 kind;
+  Uint8 loop;
+  Sint16 voice;
+  Uint16 sound;
+  Sint16 gain_left;
+  Sint16 gain_right;
+} sdl_mixer_command;
+
+/*
+ * Software mixer run from the audio callback. The main thread sends it
+ * commands through a lock-free single-producer ring and never waits on the
+ * audio thread, except to load or unload sounds. Voices are mixed onto the
+ * output with 16-bit saturation.
+ */
+typedef struct {
+  sdl_mixer_command commands[SDL_MIXER_COMMANDS];
+  Uint32 command_head;
+  Uint32 command_tail;
+  Uint32 dropped_commands;
+
+  sdl_mixer_sound* sounds[SDL_MIXER_MAX_SOUNDS];
+  sdl_mixer_voice* voices;
+  int voice_count;
+} sdl_mixer;
+
+sdl_mixer* sdl_mixer_new(int voices);
+void sdl_mixer_free(sdl_mixer* mixer);
+
+// Main thread. Returns 0 if the command was queued, -1 if the ring was full.
+int sdl_mixer_send(sdl_mixer* mixer, const sdl_mixer_command* command);
+
+// Main thread, with the audio device locked for unloading. Returns the sound
+// slot, or -1 if every slot is taken.
+int sdl_mixer_load(sdl_mixer* mixer, const Sint16* samples, Uint32 frames, int channels);
+void sdl_mixer_unload(sdl_mixer* mixer, int sound);
+
+int sdl_mixer_voice_active(const sdl_mixer* mixer, int voice);
+int sdl_mixer_active_count(const sdl_mixer* mixer);
+
+// Audio thread. Applies queued commands and mixes every voice into out.
+void sdl_mixer_mix(sdl_mixer* mixer, Sint16* out, Uint32 frames);
+
+const char* sdl_mixer_kernel_name(void);
+
+#endif	/* MRB_SDL_MIXER_H */
@@ -0,0 +1,308 @@
+/**
+ * mruby-sdl
+ *
+ * Memory-mapped asset packs
+ */
+#include <stdio.h>
+#include <SDL/SDL.h>
+#include "mrb_sdl_pack.h"
+
+#ifdef _WIN32
+#define SDL_PACK_NO_MMAP 1
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/*******************************************************************************
+ * Reading
+ ******************************************************************************/
+static int sdl_pack_map (sdl_pack* pack, const char* path) {
+#ifdef SDL_PACK_NO_MMAP
+  // No mmap here, so read the whole file instead
+  FILE* file = fopen(path, "rb");
+  if ( ! file) return -1;
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (size <= 0 || ! (pack->base = (Uint8*) malloc(size))) {
+    fclose(file);
+    return -1;
+  }
+  if (fread(pack->base, 1, size, file) != (size_t) size) {
+    fclose(file);
+    free(pack->base);
+    pack->base = NULL;
+    return -1;
+  }
+  fclose(file);
+  pack->size = size;
+  pack->mapped = 0;
+  return 0;
+#else
+  struct stat info;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+  if (fstat(fd, &info) < 0 || info.st_size <= 0) {
+    close(fd);
+    return -1;
+  }
+  void* base = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return -1;
+  pack->base = (Uint8*) base;
+  pack->size = info.st_size;
+  pack->mapped = 1;
+  return 0;
+#endif
+}
+
+static int sdl_pack_within (const sdl_pack* pack, Uint32 offset, Uint32 length) {
+  return offset <= pack->size && length <= pack->size - offset;
+}
+
+static int sdl_pack_validate (sdl_pack* pack) {
+  const sdl_pack_header* header = (const sdl_pack_header*) pack->base;
+  Uint32 i;
+
+  if (pack->size < sizeof(sdl_pack_header) || memcmp(header->magic, SDL_PACK_MAGIC, 8)) return 0;
+  if (header->byte_order != SDL_PACK_BYTE_ORDER || header->version != SDL_PACK_VERSION) return 0;
+  if (header->count > (pack->size - sizeof(sdl_pack_header)) / sizeof(sdl_pack_entry)) return 0;
+  if ( ! sdl_pack_within(pack, header->names_offset, header->names_length)) return 0;
+
+  pack->header = header;
+  pack->entries = (const sdl_pack_entry*) (pack->base + sizeof(sdl_pack_header));
+  pack->names = (const char*) pack->base + header->names_offset;
+
+  for (i = 0; i < header->count; i++) {
+    const sdl_pack_entry* entry = &pack->entries[i];
+    if (entry->name_offset > header->names_length ||
+        entry->name_length > header->names_length - entry->name_offset) return 0;
+    if ( ! sdl_pack_within(pack, entry->data_offset, entry->data_length)) return 0;
+    if (entry->kind == SDL_PACK_IMAGE) {
+      if (entry->w <= 0 || entry->h <= 0 || entry->depth < 16 || entry->depth > 32) return 0;
+      // Rows must hold w pixels and fit the surface's 16-bit pitch
+      if (entry->pitch > 0xffff || entry->pitch < (Uint64) entry->w * ((entry->depth + 7) / 8)) return 0;
+      if ((Uint64) entry->pitch * entry->h > entry->data_length) return 0;
+    }
+  }
+  return 1;
+}
+
+int sdl_pack_open (sdl_pack* pack, const char* path) {
+  memset(pack, 0, sizeof(sdl_pack));
+  if (sdl_pack_map(pack, path) < 0) {
+    SDL_SetError("Couldn't open %s", path);
+    return -1;
+  }
+  if ( ! sdl_pack_validate(pack)) {
+    sdl_pack_close(pack);
+    SDL_SetError("%s is not an asset pack for this machine", path);
+    return -1;
+  }
+  return 0;
+}
+
+void sdl_pack_close (sdl_pack* pack) {
+  if ( ! pack->base) return;
+#ifndef SDL_PACK_NO_MMAP
+  if (pack->mapped) munmap(pack->base, pack->size);
+  else
+#endif
+  free(pack->base);
+  memset(pack, 0, sizeof(sdl_pack));
+}
+
+static int sdl_pack_compare_name (const char* a, size_t a_length, const char* b, size_t b_length) {
+  int order = memcmp(a, b, a_length < b_length ? a_length : b_length);
+  if (order) return order;
+  return a_length < b_length ? -1 : a_length > b_length;
+}
+
+int sdl_pack_find (const sdl_pack* pack, const char* name, size_t name_length) {
+  int low = 0;
+  int high = pack->header ? (int) pack->header->count - 1 : -1;
+  while (low <= high) {
+    int mid = (low + high) / 2;
+    const sdl_pack_entry* entry = &pack->entries[mid];
+    int order = sdl_pack_compare_name(pack->names + entry->name_offset, entry->name_length, name, name_length);
+    if ( ! order) return mid;
+    if (order < 0) low = mid + 1;
+    else high = mid - 1;
+  }
+  return -1;
+}
+
+SDL_Surface* sdl_pack_surface (const sdl_pack* pack, int index) {
+  const sdl_pack_entry* entry = &pack->entries[index];
+  if (entry->kind != SDL_PACK_IMAGE) {
+    SDL_SetError("Pack entry is not an image");
+    return NULL;
+  }
+
+  SDL_Surface* surface = SDL_CreateRGBSurfaceFrom(pack->base + entry->data_offset, entry->w, entry->h,
+    entry->depth, entry->pitch, entry->rmask, entry->gmask, entry->bmask, entry->amask);
+  if ( ! surface) return NULL;
+  if (entry->flags & SDL_SRCCOLORKEY) SDL_SetColorKey(surface, SDL_SRCCOLORKEY, entry->colorkey);
+  SDL_SetAlpha(surface, entry->flags & SDL_SRCALPHA, (Uint8) entry->alpha);
+  return surface;
+}
+
+SDL_RWops* sdl_pack_rwops (const sdl_pack* pack, int index) {
+  const sdl_pack_entry* entry = &pack->entries[index];
+  return SDL_RWFromConstMem(pack->base + entry->data_offset, entry->data_length);
+}
+
+
+/*******************************************************************************
+ * Writing
+ ******************************************************************************/
+static const sdl_pack_item* sdl_pack_sort_items = NULL;
+
+static int sdl_pack_sort_compare (const void* a, const void* b) {
+  const sdl_pack_item* left = &sdl_pack_sort_items[*(const int*) a];
+  const sdl_pack_item* right = &sdl_pack_sort_items[*(const int*) b];
+  return sdl_pack_compare_name(left->name, left->name_length, right->name, right->name_length);
+}
+
+static Uint64 sdl_pack_align (Uint64 offset) {
+  return (offset + SDL_PACK_ALIGN - 1) / SDL_PACK_ALIGN * SDL_PACK_ALIGN;
+}
+
+static int sdl_pack_pad (FILE* file, Uint64 from, Uint64 to) {
+  static const Uint8 zeros[256] = { 0 };
+  while (from < to) {
+    size_t chunk = to - from < sizeof(zeros) ? (size_t) (to - from) : sizeof(zeros);
+    if (fwrite(zeros, 1, chunk, file) != chunk) return -1;
+    from += chunk;
+  }
+  return 0;
+}
+
+static int sdl_pack_write_surface (FILE* file, SDL_Surface* surface) {
+  if (SDL_MUSTLOCK(surface) && SDL_LockSurface(surface) < 0) return -1;
+  size_t length = (size_t) surface->pitch * surface->h;
+  int result = fwrite(surface->pixels, 1, length, file) == length ? 0 : -1;
+  if (SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
+  return result;
+}
+
+static int sdl_pack_layout (const sdl_pack_item* items, const int* order, int count, sdl_pack_header* header, sdl_pack_entry* entries) {
+  Uint64 offset = sizeof(sdl_pack_header) + (Uint64) sizeof(sdl_pack_entry) * count;
+  Uint64 names = 0;
+  int i;
+
+  memset(header, 0, sizeof(sdl_pack_header));
+  memcpy(header->magic, SDL_PACK_MAGIC, 8);
+  header->byte_order = SDL_PACK_BYTE_ORDER;
+  header->version = SDL_PACK_VERSION;
+  header->count = count;
+  header->align = SDL_PACK_ALIGN;
+  header->names_offset = (Uint32) offset;
+
+  for (i = 0; i < count; i++) {
+    const sdl_pack_item* item = &items[order[i]];
+    sdl_pack_entry* entry = &entries[i];
+    memset(entry, 0, sizeof(sdl_pack_entry));
+    if (i > 0 && ! sdl_pack_sort_compare(&order[i - 1], &order[i])) {
+      SDL_SetError("Duplicate pack entry %.*s", (int) item->name_length, item->name);
+      return -1;
+    }
+    entry->name_offset = (Uint32) names;
+    entry->name_length = (Uint32) item->name_length;
+    names += item->name_length;
+
+    SDL_Surface* surface = item->surface;
+    if (surface) {
+      if (surface->format->BytesPerPixel < 2) {
+        SDL_SetError("Paletted surfaces can't be packed");
+        return -1;
+      }
+      entry->kind = SDL_PACK_IMAGE;
+      entry->flags = surface->flags & (SDL_SRCCOLORKEY | SDL_SRCALPHA);
+      entry->w = surface->w;
+      entry->h = surface->h;
+      entry->pitch = surface->pitch;
+      entry->depth = surface->format->BitsPerPixel;
+      entry->rmask = surface->format->Rmask;
+      entry->gmask = surface->format->Gmask;
+      entry->bmask = surface->format->Bmask;
+      entry->amask = surface->format->Amask;
+      entry->colorkey = surface->format->colorkey;
+      entry->alpha = surface->format->alpha;
+      entry->data_length = (Uint32) surface->pitch * surface->h;
+    } else {
+      entry->kind = SDL_PACK_BLOB;
+      entry->data_length = (Uint32) item->length;
+    }
+  }
+  header->names_length = (Uint32) names;
+
+  offset += names;
+  for (i = 0; i < count; i++) {
+    offset = sdl_pack_align(offset);
+    entries[i].data_offset = (Uint32) offset;
+    offset += entries[i].data_length;
+  }
+  if (offset > 0xffffffffu) {
+    SDL_SetError("Asset pack would be over 4GB");
+    return -1;
+  }
+  return 0;
+}
+
+int sdl_pack_write (const char* path, const sdl_pack_item* items, int count) {
+  sdl_pack_header header;
+  int* order = (int*) malloc(sizeof(int) * (count ? count : 1));
+  sdl_pack_entry* entries = (sdl_pack_entry*) malloc(sizeof(sdl_pack_entry) * (count ? count : 1));
+  FILE* file = NULL;
+  Uint64 offset;
+  int result = -1;
+  int i;
+
+  if ( ! order || ! entries) {
+    SDL_SetError("Out of memory");
+    goto done;
+  }
+  for (i = 0; i < count; i++) order[i] = i;
+  sdl_pack_sort_items = items;
+  qsort(order, count, sizeof(int), sdl_pack_sort_compare);
+  if (sdl_pack_layout(items, order, count, &header, entries) < 0) goto done;
+
+  file = fopen(path, "wb");
+  if ( ! file) {
+    SDL_SetError("Couldn't open %s for writing", path);
+    goto done;
+  }
+  if (fwrite(&header, sizeof(header), 1, file) != 1) goto failed;
+  if (count && fwrite(entries, sizeof(sdl_pack_entry), count, file) != (size_t) count) goto failed;
+  for (i = 0; i < count; i++) {
+    const sdl_pack_item* item = &items[order[i]];
+    if (fwrite(item->name, 1, item->name_length, file) != item->name_length) goto failed;
+  }
+
+  offset = header.names_offset + header.names_length;
+  for (i = 0; i < count; i++) {
+    const sdl_pack_item* item = &items[order[i]];
+    if (sdl_pack_pad(file, offset, entries[i].data_offset) < 0) goto failed;
+    if (item->surface) {
+      if (sdl_pack_write_surface(file, item->surface) < 0) goto failed;
+    } else if (item->length && fwrite(item->data, 1, item->length, file) != item->length) {
+      goto failed;
+    }
+    offset = (Uint64) entries[i].data_offset + entries[i].data_length;
+  }
+  result = 0;
+  goto done;
+
+failed:
+  SDL_SetError("Couldn't write %s", path);
+done:
+  if (file && fclose(file) != 0) result = -1;
+  free(order);
+  free(entries);
+  sdl_pack_sort_items = NULL;
+  return result;
+}
@@ -0,0 +1,81 @@
+#ifndef MRB_SDL_PACK_H
+#define MRB_SDL_PACK_H
+
+#include <SDL/SDL.h>
+
+#define SDL_PACK_MAGIC "MRBSDLPK"
+#define SDL_PACK_VERSION 1
+#define SDL_PACK_BYTE_ORDER 0x01020304
+#define SDL_PACK_ALIGN 4096
+
+/*
+ * Asset pack file. A header, then the index, then the names, then each
+ * entry's data starting on its own page. Everything is in the byte order of
+ * the machine that wrote it, and images hold their pixels exactly as the
+ * source surface laid them out, so a reader on the same machine can point
+ * surfaces straight into the mapped file. Names are stored sorted.
+ */
+typedef struct {
+  char magic[8];
+  Uint32 byte_order;
+  Uint32 version;
+  Uint32 count;
+  Uint32 align;
+  Uint32 names_offset;
+  Uint32 names_length;
+} sdl_pack_header;
+
+typedef enum {
+  SDL_PACK_BLOB = 0,
+  SDL_PACK_IMAGE
+} sdl_pack_kind;
+
+typedef struct {
+  Uint32 name_offset;
+  Uint32 name_length;
+  Uint32 data_offset;
+  Uint32 data_length;
+  Uint32 kind;
+  Uint32 flags;
+  Sint32 w;
+  Sint32 h;
+  Uint32 pitch;
+  Uint32 depth;
+  Uint32 rmask;
+  Uint32 gmask;
+  Uint32 bmask;
+  Uint32 amask;
+  Uint32 colorkey;
+  Uint32 alpha;
+} sdl_pack_entry;
+
+typedef struct {
+  Uint8* base;
+  size_t size;
+  int mapped;
+  const sdl_pack_header* header;
+  const sdl_pack_entry* entries;
+  const char* names;
+} sdl_pack;
+
+// One thing to write: an image when surface is set, a blob of data otherwise
+typedef struct {
+  const char* name;
+  size_t name_length;
+  SDL_Surface* surface;
+  const void* data;
+  size_t length;
+} sdl_pack_item;
+
+int sdl_pack_open(sdl_pack* pack, const char* path);
+void sdl_pack_close(sdl_pack* pack);
+int sdl_pack_find(const sdl_pack* pack, const char* name, size_t name_length);
+
+// The surface's pixels live in the mapping, which must outlive it. Writes go
+// to private copy-on-write pages and never reach the file.
+SDL_Surface* sdl_pack_surface(const sdl_pack* pack, int index);
+SDL_RWops* sdl_pack_rwops(const sdl_pack* pack, int index);
+
+int sdl_pack_write(const char* path, const sdl_pack_item* items, int count);
+
+#endif	/* MRB_SDL_PACK_H */
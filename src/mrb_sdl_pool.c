@@ -0,0 +1,65 @@
+/**
+ * mruby-sdl
+ *
+ * Reusable scratch surfaces
+ */
+#include <SDL/SDL.h>
+#include "mrb_sdl_pool.h"
+
+int sdl_surface_pool_init (sdl_surface_pool* pool, int capacity) {
+  memset(pool, 0, sizeof(sdl_surface_pool));
+  if (capacity < 1) capacity = 1;
+  pool->surfaces = (SDL_Surface**) malloc(sizeof(SDL_Surface*) * capacity);
+  if ( ! pool->surfaces) return -1;
+  pool->capacity = capacity;
+  return 0;
+}
+
+void sdl_surface_pool_clear (sdl_surface_pool* pool) {
+  while (pool->count) SDL_FreeSurface(pool->surfaces[--pool->count]);
+}
+
+void sdl_surface_pool_destroy (sdl_surface_pool* pool) {
+  sdl_surface_pool_clear(pool);
+  free(pool->surfaces);
+  memset(pool, 0, sizeof(sdl_surface_pool));
+}
+
+static int sdl_surface_pool_match (const SDL_Surface* surface, int width, int height, int depth,
+    Uint32 rmask, Uint32 gmask, Uint32 bmask, Uint32 amask) {
+  const SDL_PixelFormat* format = surface->format;
+  return surface->w == width && surface->h == height && format->BitsPerPixel == depth &&
+    format->Rmask == rmask && format->Gmask == gmask && format->Bmask == bmask && format->Amask == amask;
+}
+
+SDL_Surface* sdl_surface_pool_acquire (sdl_surface_pool* pool, Uint32 flags, int width, int height, int depth,
+    Uint32 rmask, Uint32 gmask, Uint32 bmask, Uint32 amask) {
+  int i;
+  if ( ! (flags & SDL_HWSURFACE)) {
+    // Newest first, since its pixels are likelier to still be in cache
+    for (i = pool->count - 1; i >= 0; i--) {
+      SDL_Surface* surface = pool->surfaces[i];
+      if (sdl_surface_pool_match(surface, width, height, depth, rmask, gmask, bmask, amask)) {
+        pool->surfaces[i] = pool->surfaces[--pool->count];
+        pool->hits++;
+        return surface;
+      }
+    }
+  }
+  pool->misses++;
+  return SDL_CreateRGBSurface(flags, width, height, depth, rmask, gmask, bmask, amask);
+}
+
+int sdl_surface_pool_release (sdl_surface_pool* pool, SDL_Surface* surface) {
+  if (pool->count == pool->capacity) return -1;
+  if (surface->flags & (SDL_HWSURFACE | SDL_PREALLOC | SDL_RLEACCEL)) return -1;
+  if (surface->refcount != 1 || surface->locked || surface->format->palette) return -1;
+
+  // Back to how SDL_CreateRGBSurface leaves a surface
+  SDL_SetColorKey(surface, 0, 0);
+  SDL_SetAlpha(surface, surface->format->Amask ? SDL_SRCALPHA : 0, SDL_ALPHA_OPAQUE);
+  SDL_SetClipRect(surface, NULL);
+
+  pool->surfaces[pool->count++] = surface;
+  return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef MRB_SDL_POOL_H
+#define MRB_SDL_POOL_H
+
+#include <SDL/SDL.h>
+
+/*
+ * Scratch surfaces kept for reuse, matched on size and pixel layout. Only
+ * plain software surfaces the pool can put back exactly as
+ * SDL_CreateRGBSurface made them are kept: no palette, no borrowed pixels,
+ * no other references. Pixel contents are left as they were.
+ */
+typedef struct {
+  SDL_Surface** surfaces;
+  int count;
+  int capacity;
+  Uint32 hits;
+  Uint32 misses;
+} sdl_surface_pool;
+
+int sdl_surface_pool_init(sdl_surface_pool* pool, int capacity);
+void sdl_surface_pool_destroy(sdl_surface_pool* pool);
+void sdl_surface_pool_clear(sdl_surface_pool* pool);
+
+// A pooled surface if one matches, otherwise a new one
+SDL_Surface* sdl_surface_pool_acquire(sdl_surface_pool* pool, Uint32 flags, int width, int height, int depth,
+  Uint32 rmask, Uint32 gmask, Uint32 bmask, Uint32 amask);
+
+// Keep the surface for reuse. Returns -1 if the pool is full or can't take
+// it, in which case the caller still owns it.
+int sdl_surface_pool_release(sdl_surface_pool* pool, SDL_Surface* surface);
+
+#endif	/* MRB_SDL_POOL_H */
@@ -0,0 +1,65 @@
+/**
+ * mruby-sdl
+ *
+ * Per-binding call counters and latency histograms
+ */
+#include <SDL/SDL.h>
+#include "mrb_sdl_stats.h"
+
+int sdl_stats_enabled = 0;
+sdl_stat sdl_stats[SDL_STAT_COUNT];
+
+static const char* sdl_stat_names[SDL_STAT_COUNT] = {
+  "flip",
+  "update_rects",
+  "blit_surface",
+  "blit_batch",
+  "fill_rect",
+  "convert_surface",
+  "display_format",
+  "lock_surface",
+  "composite"
+};
+
+const char* sdl_stat_name (sdl_stat_id id) {
+  return sdl_stat_names[id];
+}
+
+void sdl_stats_reset (void) {
+  memset(sdl_stats, 0, sizeof(sdl_stats));
+}
+
+void sdl_stat_record (sdl_stat_id id, Uint64 ns, Uint64 pixels, Uint64 bytes) {
+  sdl_stat* stat = &sdl_stats[id];
+  int bucket = 0;
+  while (bucket < SDL_STATS_BUCKETS - 1 && (ns >> (bucket + 1))) bucket++;
+
+  stat->calls++;
+  stat->pixels += pixels;
+  stat->bytes += bytes;
+  stat->total_ns += ns;
+  if (ns > stat->max_ns) stat->max_ns = ns;
+  stat->buckets[bucket]++;
+}
+
+// The top of the bucket holding the given fraction of calls, which is never
+// more than twice the true value
+Uint64 sdl_stat_percentile (const sdl_stat* stat, double percentile) {
+  Uint64 rank;
+  Uint64 seen = 0;
+  int i;
+  if ( ! stat->calls) return 0;
+  if (percentile < 0) percentile = 0;
+  if (percentile > 1) percentile = 1;
+
+  rank = (Uint64) (percentile * stat->calls + 0.5);
+  if (rank < 1) rank = 1;
+  for (i = 0; i < SDL_STATS_BUCKETS; i++) {
+    seen += stat->buckets[i];
+    if (seen >= rank) {
+      Uint64 top = ((Uint64) 2 << i) - 1;
+      return top < stat->max_ns ? top : stat->max_ns;
+    }
+  }
+  return stat->max_ns;
+}
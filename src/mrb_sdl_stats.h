@@ -0,0 +1,64 @@
+#ifndef MRB_SDL_STATS_H
+#define MRB_SDL_STATS_H
+
+#include <SDL/SDL.h>
+#include "mrb_sdl_clock.h"
+
+// Latency bucket k holds calls that took [2^k, 2^(k+1)) nanoseconds
+#define SDL_STATS_BUCKETS 32
+
+typedef enum {
+  SDL_STAT_FLIP = 0,
+  SDL_STAT_UPDATE_RECTS,
+  SDL_STAT_BLIT_SURFACE,
+  SDL_STAT_BLIT_BATCH,
+  SDL_STAT_FILL_RECT,
+  SDL_STAT_CONVERT_SURFACE,
+  SDL_STAT_DISPLAY_FORMAT,
+  SDL_STAT_LOCK_SURFACE,
+  SDL_STAT_COMPOSITE,
+  SDL_STAT_COUNT
+} sdl_stat_id;
+
+/*
+ * Per-binding counters. pixels counts what the call touched after
+ * clipping; bytes is what it had to read or convert.
+ */
+typedef struct {
+  Uint64 calls;
+  Uint64 pixels;
+  Uint64 bytes;
+  Uint64 total_ns;
+  Uint64 max_ns;
+  Uint32 buckets[SDL_STATS_BUCKETS];
+} sdl_stat;
+
+extern int sdl_stats_enabled;
+extern sdl_stat sdl_stats[SDL_STAT_COUNT];
+
+// Build with MRB_SDL_NO_STATS defined to compile the probes out entirely.
+// Otherwise they cost a flag test until SDL::Stats.enable.
+#ifdef MRB_SDL_NO_STATS
+#define SDL_STATS_ON 0
+#else
+#define SDL_STATS_ON sdl_stats_enabled
+#endif
+
+const char* sdl_stat_name(sdl_stat_id id);
+void sdl_stats_reset(void);
+
+// Approximate latency at the given fraction of calls, from the buckets
+Uint64 sdl_stat_percentile(const sdl_stat* stat, double percentile);
+
+void sdl_stat_record(sdl_stat_id id, Uint64 ns, Uint64 pixels, Uint64 bytes);
+
+// Returns 0 when stats are off, which sdl_stat_end takes as "not timing"
+static inline Uint64 sdl_stat_begin (void) {
+  return SDL_STATS_ON ? sdl_clock_now() : 0;
+}
+
+static inline void sdl_stat_end (sdl_stat_id id, Uint64 start, Uint64 pixels, Uint64 bytes) {
+  if (SDL_STATS_ON && start) sdl_stat_record(id, sdl_clock_now() - start, pixels, bytes);
+}
+
+#endif	/* MRB_SDL_STATS_H */
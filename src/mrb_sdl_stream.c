@@ -0,0 +1,156 @@
+/**
+ * mruby-sdl
+ *
+ * Streaming WAV playback
+ */
+#include <SDL/SDL.h>
+#include "mrb_sdl_stream.h"
+
+static Uint32 sdl_le32 (const Uint8* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((Uint32) p[3] << 24);
+}
+
+static Uint16 sdl_le16 (const Uint8* p) {
+  return p[0] | (p[1] << 8);
+}
+
+/*******************************************************************************
+ * Header
+ ******************************************************************************/
+// Find the fmt and data chunks, leaving rw at the start of the samples
+static int sdl_audio_stream_header (sdl_audio_stream* stream) {
+  Uint8 header[16];
+  int have_format = 0;
+
+  if (SDL_RWread(stream->rw, header, 12, 1) != 1 ||
+      memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4)) {
+    SDL_SetError("Not a WAV file");
+    return -1;
+  }
+
+  while (SDL_RWread(stream->rw, header, 8, 1) == 1) {
+    Uint32 size = sdl_le32(header + 4);
+    int here = SDL_RWtell(stream->rw);
+
+    if ( ! memcmp(header, "fmt ", 4)) {
+      if (size < 16 || SDL_RWread(stream->rw, header, 16, 1) != 1) break;
+      Uint16 encoding = sdl_le16(header);
+      Uint16 bits = sdl_le16(header + 14);
+      if (encoding != 1 || (bits != 8 && bits != 16)) {
+        SDL_SetError("Only 8 and 16-bit PCM WAV files can be streamed");
+        return -1;
+      }
+      stream->channels = (Uint8) sdl_le16(header + 2);
+      stream->freq = (int) sdl_le32(header + 4);
+      stream->format = bits == 8 ? AUDIO_U8 : AUDIO_S16LSB;
+      stream->frame_bytes = bits / 8 * stream->channels;
+      have_format = stream->channels > 0;
+    } else if ( ! memcmp(header, "data", 4)) {
+      if ( ! have_format) break;
+      stream->data_start = here;
+      stream->data_length = size;
+      return 0;
+    }
+    // Chunks are padded to an even length
+    if (SDL_RWseek(stream->rw, here + size + (size & 1), RW_SEEK_SET) < 0) break;
+  }
+  SDL_SetError("WAV file has no usable fmt and data chunks");
+  return -1;
+}
+
+
+/*******************************************************************************
+ * Stream
+ ******************************************************************************/
+int sdl_audio_stream_open (sdl_audio_stream* stream, SDL_RWops* rw, const SDL_AudioSpec* device, Uint32 chunk) {
+  memset(stream, 0, sizeof(sdl_audio_stream));
+  stream->rw = rw;
+  if ( ! rw) return -1;
+  if (sdl_audio_stream_header(stream) < 0) goto failed;
+
+  if (SDL_BuildAudioCVT(&stream->cvt, stream->format, stream->channels, stream->freq,
+      device->format, device->channels, device->freq) < 0) goto failed;
+
+  // Whole frames only, and the staging buffer has room to convert in place
+  stream->chunk = chunk / stream->frame_bytes * stream->frame_bytes;
+  if ( ! stream->chunk) stream->chunk = stream->frame_bytes;
+  stream->buffer = (Uint8*) malloc(stream->chunk * stream->cvt.len_mult);
+  if ( ! stream->buffer) {
+    SDL_SetError("Out of memory");
+    goto failed;
+  }
+  return 0;
+
+failed:
+  SDL_RWclose(rw);
+  stream->rw = NULL;
+  return -1;
+}
+
+void sdl_audio_stream_close (sdl_audio_stream* stream) {
+  if (stream->rw) SDL_RWclose(stream->rw);
+  free(stream->buffer);
+  memset(stream, 0, sizeof(sdl_audio_stream));
+}
+
+int sdl_audio_stream_rewind (sdl_audio_stream* stream) {
+  if (SDL_RWseek(stream->rw, stream->data_start, RW_SEEK_SET) < 0) return -1;
+  stream->data_read = 0;
+  stream->pending_length = 0;
+  stream->ended = 0;
+  return 0;
+}
+
+int sdl_audio_stream_done (const sdl_audio_stream* stream) {
+  return stream->ended && ! stream->pending_length;
+}
+
+// Read and convert the next chunk. Returns 0 at the end of the data.
+static int sdl_audio_stream_decode (sdl_audio_stream* stream) {
+  Uint32 left = stream->data_length - stream->data_read;
+  if ( ! left && stream->loop && stream->data_length) {
+    if (sdl_audio_stream_rewind(stream) < 0) return -1;
+    left = stream->data_length;
+  }
+  if ( ! left) return 0;
+
+  Uint32 want = left < stream->chunk ? left : stream->chunk;
+  int got = SDL_RWread(stream->rw, stream->buffer, 1, want);
+  if (got < 0) return -1;
+  // A truncated file ends at its last whole frame
+  got -= got % stream->frame_bytes;
+  if ( ! got) {
+    stream->data_length = stream->data_read;
+    return stream->loop && stream->data_length ? sdl_audio_stream_decode(stream) : 0;
+  }
+  stream->data_read += got;
+
+  stream->cvt.buf = stream->buffer;
+  stream->cvt.len = got;
+  if (SDL_ConvertAudio(&stream->cvt) < 0) return -1;
+  stream->pending_offset = 0;
+  stream->pending_length = stream->cvt.len_cvt;
+  return 1;
+}
+
+int sdl_audio_stream_fill (sdl_audio_stream* stream, sdl_audio_ring* ring) {
+  int queued = 0;
+  for (;;) {
+    if (stream->pending_length) {
+      Uint32 space = sdl_audio_ring_space(ring);
+      Uint32 count = stream->pending_length < space ? stream->pending_length : space;
+      if ( ! count) break;
+      sdl_audio_ring_write(ring, stream->buffer + stream->pending_offset, count);
+      stream->pending_offset += count;
+      stream->pending_length -= count;
+      queued += count;
+      if (stream->pending_length) break;
+    }
+    if (stream->ended) break;
+
+    int result = sdl_audio_stream_decode(stream);
+    if (result < 0) return -1;
+    if ( ! result) stream->ended = 1;
+  }
+  return queued;
+}
@@ -0,0 +1,47 @@
+#ifndef MRB_SDL_STREAM_H
+#define MRB_SDL_STREAM_H
+
+#include <SDL/SDL.h>
+#include "mrb_sdl_audio.h"
+
+/*
+ * WAV file played a chunk at a time. Each fill reads the next fixed-size
+ * chunk of PCM, converts it to the device format with SDL_AudioCVT into a
+ * staging buffer, and moves as much as fits into the audio ring. The ring
+ * and the staging buffer together keep audio ready ahead of the callback,
+ * and neither grows with the length of the track.
+ */
+typedef struct {
+  SDL_RWops* rw;
+  Uint32 data_start;
+  Uint32 data_length;
+  Uint32 data_read;
+
+  Uint16 format;
+  Uint8 channels;
+  int freq;
+  int frame_bytes;
+
+  SDL_AudioCVT cvt;
+  Uint8* buffer;
+  Uint32 chunk;
+  Uint32 pending_offset;
+  Uint32 pending_length;
+
+  int loop;
+  int ended;
+} sdl_audio_stream;
+
+// Takes ownership of rw, closing it on failure too. chunk is in bytes of
+// source PCM.
+int sdl_audio_stream_open(sdl_audio_stream* stream, SDL_RWops* rw, const SDL_AudioSpec* device, Uint32 chunk);
+void sdl_audio_stream_close(sdl_audio_stream* stream);
+
+// Top up the ring. Returns the bytes queued, or -1 on a read error.
+int sdl_audio_stream_fill(sdl_audio_stream* stream, sdl_audio_ring* ring);
+int sdl_audio_stream_rewind(sdl_audio_stream* stream);
+
+// Everything has been read and handed to the ring
+int sdl_audio_stream_done(const sdl_audio_stream* stream);
+
+#endif	/* MRB_SDL_STREAM_H */
@@ -0,0 +1,457 @@
+/**
+ * mruby-sdl
+ *
+ * RGB to YUV overlay conversion with runtime CPU dispatch
+ *
+ * Every kernel computes, in integers,
+ *   Y = ((66R + 129G + 25B + 128) >> 8) + 16
+ *   U = ((-38R - 74G + 112B + 128) >> 8) + 128
+ *   V = ((112R - 94G - 18B + 128) >> 8) + 128
+ * with chroma taken from the rounded mean of the pixels it covers. The sums
+ * stay inside 16 bits, so the vector kernels can do the same sums lane for
+ * lane and agree with the scalar one exactly.
+ */
+#include <SDL/SDL.h>
+#include "mrb_sdl_yuv.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SDL_YUV_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+typedef struct {
+  int r;
+  int g;
+  int b;
+} sdl_yuv_shifts;
+
+// Where chroma sits in a packed macropixel: YUY2 is Y U Y V, UYVY is U Y V Y
+// and YVYU is Y V Y U
+typedef struct {
+  int y_first;
+  int u_first;
+} sdl_yuv_layout;
+
+typedef void (*sdl_yuv_420_kernel)(const Uint32* s0, const Uint32* s1, Uint8* y0, Uint8* y1,
+  Uint8* u, Uint8* v, int w, const sdl_yuv_shifts* shifts);
+typedef void (*sdl_yuv_422_kernel)(const Uint32* s, Uint8* out, int w, const sdl_yuv_shifts* shifts,
+  const sdl_yuv_layout* layout);
+
+typedef struct {
+  const char* name;
+  sdl_yuv_420_kernel rows_420;
+  sdl_yuv_422_kernel row_422;
+} sdl_yuv_kernel_set;
+
+
+/*******************************************************************************
+ * Scalar kernels
+ ******************************************************************************/
+static inline int sdl_yuv_y (int r, int g, int b) {
+  return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+static inline int sdl_yuv_u (int r, int g, int b) {
+  return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline int sdl_yuv_v (int r, int g, int b) {
+  return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+#define SDL_YUV_CH(p, shift) ((int) (((p) >> (shift)) & 0xff))
+
+static inline int sdl_yuv_luma (Uint32 p, const sdl_yuv_shifts* shifts) {
+  return sdl_yuv_y(SDL_YUV_CH(p, shifts->r), SDL_YUV_CH(p, shifts->g), SDL_YUV_CH(p, shifts->b));
+}
+
+// Columns from x on, for the vector kernels' leftovers. An odd last column
+// gets luma only.
+static void sdl_yuv_rows_420_from (const Uint32* s0, const Uint32* s1, Uint8* y0, Uint8* y1,
+    Uint8* u, Uint8* v, int x, int w, const sdl_yuv_shifts* shifts) {
+  for (; x + 1 < w; x += 2) {
+    Uint32 a = s0[x], b = s0[x + 1], c = s1[x], d = s1[x + 1];
+    int r = (SDL_YUV_CH(a, shifts->r) + SDL_YUV_CH(b, shifts->r) + SDL_YUV_CH(c, shifts->r) + SDL_YUV_CH(d, shifts->r) + 2) >> 2;
+    int g = (SDL_YUV_CH(a, shifts->g) + SDL_YUV_CH(b, shifts->g) + SDL_YUV_CH(c, shifts->g) + SDL_YUV_CH(d, shifts->g) + 2) >> 2;
+    int bl = (SDL_YUV_CH(a, shifts->b) + SDL_YUV_CH(b, shifts->b) + SDL_YUV_CH(c, shifts->b) + SDL_YUV_CH(d, shifts->b) + 2) >> 2;
+    y0[x] = sdl_yuv_luma(a, shifts);
+    y0[x + 1] = sdl_yuv_luma(b, shifts);
+    y1[x] = sdl_yuv_luma(c, shifts);
+    y1[x + 1] = sdl_yuv_luma(d, shifts);
+    u[x >> 1] = sdl_yuv_u(r, g, bl);
+    v[x >> 1] = sdl_yuv_v(r, g, bl);
+  }
+  if (x < w) {
+    y0[x] = sdl_yuv_luma(s0[x], shifts);
+    y1[x] = sdl_yuv_luma(s1[x], shifts);
+  }
+}
+
+static void sdl_yuv_row_422_from (const Uint32* s, Uint8* out, int x, int w, const sdl_yuv_shifts* shifts,
+    const sdl_yuv_layout* layout) {
+  int y_at = layout->y_first ? 0 : 1;
+  int u_at = (layout->y_first ? 1 : 0) + (layout->u_first ? 0 : 2);
+  int v_at = (layout->y_first ? 1 : 0) + (layout->u_first ? 2 : 0);
+  for (; x + 1 < w; x += 2) {
+    Uint32 a = s[x], b = s[x + 1];
+    int r = (SDL_YUV_CH(a, shifts->r) + SDL_YUV_CH(b, shifts->r) + 1) >> 1;
+    int g = (SDL_YUV_CH(a, shifts->g) + SDL_YUV_CH(b, shifts->g) + 1) >> 1;
+    int bl = (SDL_YUV_CH(a, shifts->b) + SDL_YUV_CH(b, shifts->b) + 1) >> 1;
+    Uint8* macro = out + x * 2;
+    macro[y_at] = sdl_yuv_luma(a, shifts);
+    macro[y_at + 2] = sdl_yuv_luma(b, shifts);
+    macro[u_at] = sdl_yuv_u(r, g, bl);
+    macro[v_at] = sdl_yuv_v(r, g, bl);
+  }
+  // A lone last pixel fills half a macropixel: its own luma and chroma
+  if (x < w) {
+    Uint32 a = s[x];
+    int r = SDL_YUV_CH(a, shifts->r), g = SDL_YUV_CH(a, shifts->g), bl = SDL_YUV_CH(a, shifts->b);
+    Uint8* macro = out + x * 2;
+    macro[y_at] = sdl_yuv_y(r, g, bl);
+    macro[layout->y_first ? 1 : 0] = layout->u_first ? sdl_yuv_u(r, g, bl) : sdl_yuv_v(r, g, bl);
+  }
+}
+
+static void sdl_yuv_rows_420_scalar (const Uint32* s0, const Uint32* s1, Uint8* y0, Uint8* y1,
+    Uint8* u, Uint8* v, int w, const sdl_yuv_shifts* shifts) {
+  sdl_yuv_rows_420_from(s0, s1, y0, y1, u, v, 0, w, shifts);
+}
+
+static void sdl_yuv_row_422_scalar (const Uint32* s, Uint8* out, int w, const sdl_yuv_shifts* shifts,
+    const sdl_yuv_layout* layout) {
+  sdl_yuv_row_422_from(s, out, 0, w, shifts, layout);
+}
+
+static const sdl_yuv_kernel_set sdl_yuv_kernels_scalar = {
+  "scalar", sdl_yuv_rows_420_scalar, sdl_yuv_row_422_scalar
+};
+
+
+#ifdef SDL_YUV_X86
+/*******************************************************************************
+ * SSE2 kernels
+ *
+ * Sixteen pixels a step: each channel is pulled out into two vectors of
+ * eight 16-bit lanes, pixel pairs are summed with pmaddwd.
+ ******************************************************************************/
+#define SDL_SSE2 __attribute__((target("sse2")))
+
+// One channel of eight pixels as 16-bit lanes
+SDL_SSE2 static inline __m128i sdl_yuv_channel_sse2 (__m128i a, __m128i b, __m128i shift) {
+  const __m128i ff = _mm_set1_epi32(0xff);
+  return _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(a, shift), ff), _mm_and_si128(_mm_srl_epi32(b, shift), ff));
+}
+
+SDL_SSE2 static inline __m128i sdl_yuv_y_sse2 (__m128i r, __m128i g, __m128i b) {
+  __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+    _mm_mullo_epi16(g, _mm_set1_epi16(129))), _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+  // Up to 56228: past signed 16 bits, so shift logically
+  sum = _mm_add_epi16(sum, _mm_set1_epi16(128));
+  return _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+}
+
+SDL_SSE2 static inline __m128i sdl_yuv_chroma_sse2 (__m128i r, __m128i g, __m128i b, short kr, short kg, short kb) {
+  __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(kr)),
+    _mm_mullo_epi16(g, _mm_set1_epi16(kg))), _mm_mullo_epi16(b, _mm_set1_epi16(kb)));
+  sum = _mm_add_epi16(sum, _mm_set1_epi16(128));
+  return _mm_add_epi16(_mm_srai_epi16(sum, 8), _mm_set1_epi16(128));
+}
+
+// Sum neighbouring lanes of two eight-lane vectors, giving eight sums
+SDL_SSE2 static inline __m128i sdl_yuv_pairs_sse2 (__m128i lo, __m128i hi) {
+  const __m128i one = _mm_set1_epi16(1);
+  return _mm_packs_epi32(_mm_madd_epi16(lo, one), _mm_madd_epi16(hi, one));
+}
+
+SDL_SSE2 static void sdl_yuv_rows_420_sse2 (const Uint32* s0, const Uint32* s1, Uint8* y0, Uint8* y1,
+    Uint8* u, Uint8* v, int w, const sdl_yuv_shifts* shifts) {
+  const __m128i rs = _mm_cvtsi32_si128(shifts->r);
+  const __m128i gs = _mm_cvtsi32_si128(shifts->g);
+  const __m128i bs = _mm_cvtsi32_si128(shifts->b);
+  const __m128i two = _mm_set1_epi16(2);
+  int x;
+  for (x = 0; x + 16 <= w; x += 16) {
+    __m128i a0 = _mm_loadu_si128((const __m128i*) (s0 + x));
+    __m128i a1 = _mm_loadu_si128((const __m128i*) (s0 + x + 4));
+    __m128i a2 = _mm_loadu_si128((const __m128i*) (s0 + x + 8));
+    __m128i a3 = _mm_loadu_si128((const __m128i*) (s0 + x + 12));
+    __m128i b0 = _mm_loadu_si128((const __m128i*) (s1 + x));
+    __m128i b1 = _mm_loadu_si128((const __m128i*) (s1 + x + 4));
+    __m128i b2 = _mm_loadu_si128((const __m128i*) (s1 + x + 8));
+    __m128i b3 = _mm_loadu_si128((const __m128i*) (s1 + x + 12));
+
+    __m128i ra_lo = sdl_yuv_channel_sse2(a0, a1, rs), ra_hi = sdl_yuv_channel_sse2(a2, a3, rs);
+    __m128i ga_lo = sdl_yuv_channel_sse2(a0, a1, gs), ga_hi = sdl_yuv_channel_sse2(a2, a3, gs);
+    __m128i ba_lo = sdl_yuv_channel_sse2(a0, a1, bs), ba_hi = sdl_yuv_channel_sse2(a2, a3, bs);
+    __m128i rb_lo = sdl_yuv_channel_sse2(b0, b1, rs), rb_hi = sdl_yuv_channel_sse2(b2, b3, rs);
+    __m128i gb_lo = sdl_yuv_channel_sse2(b0, b1, gs), gb_hi = sdl_yuv_channel_sse2(b2, b3, gs);
+    __m128i bb_lo = sdl_yuv_channel_sse2(b0, b1, bs), bb_hi = sdl_yuv_channel_sse2(b2, b3, bs);
+
+    _mm_storeu_si128((__m128i*) (y0 + x), _mm_packus_epi16(sdl_yuv_y_sse2(ra_lo, ga_lo, ba_lo), sdl_yuv_y_sse2(ra_hi, ga_hi, ba_hi)));
+    _mm_storeu_si128((__m128i*) (y1 + x), _mm_packus_epi16(sdl_yuv_y_sse2(rb_lo, gb_lo, bb_lo), sdl_yuv_y_sse2(rb_hi, gb_hi, bb_hi)));
+
+    __m128i r = _mm_srli_epi16(_mm_add_epi16(sdl_yuv_pairs_sse2(_mm_add_epi16(ra_lo, rb_lo), _mm_add_epi16(ra_hi, rb_hi)), two), 2);
+    __m128i g = _mm_srli_epi16(_mm_add_epi16(sdl_yuv_pairs_sse2(_mm_add_epi16(ga_lo, gb_lo), _mm_add_epi16(ga_hi, gb_hi)), two), 2);
+    __m128i b = _mm_srli_epi16(_mm_add_epi16(sdl_yuv_pairs_sse2(_mm_add_epi16(ba_lo, bb_lo), _mm_add_epi16(ba_hi, bb_hi)), two), 2);
+    _mm_storel_epi64((__m128i*) (u + (x >> 1)), _mm_packus_epi16(sdl_yuv_chroma_sse2(r, g, b, -38, -74, 112), r));
+    _mm_storel_epi64((__m128i*) (v + (x >> 1)), _mm_packus_epi16(sdl_yuv_chroma_sse2(r, g, b, 112, -94, -18), r));
+  }
+  sdl_yuv_rows_420_from(s0, s1, y0, y1, u, v, x, w, shifts);
+}
+
+SDL_SSE2 static void sdl_yuv_row_422_sse2 (const Uint32* s, Uint8* out, int w, const sdl_yuv_shifts* shifts,
+    const sdl_yuv_layout* layout) {
+  const __m128i rs = _mm_cvtsi32_si128(shifts->r);
+  const __m128i gs = _mm_cvtsi32_si128(shifts->g);
+  const __m128i bs = _mm_cvtsi32_si128(shifts->b);
+  const __m128i one = _mm_set1_epi16(1);
+  int x;
+  for (x = 0; x + 16 <= w; x += 16) {
+    __m128i a0 = _mm_loadu_si128((const __m128i*) (s + x));
+    __m128i a1 = _mm_loadu_si128((const __m128i*) (s + x + 4));
+    __m128i a2 = _mm_loadu_si128((const __m128i*) (s + x + 8));
+    __m128i a3 = _mm_loadu_si128((const __m128i*) (s + x + 12));
+
+    __m128i r_lo = sdl_yuv_channel_sse2(a0, a1, rs), r_hi = sdl_yuv_channel_sse2(a2, a3, rs);
+    __m128i g_lo = sdl_yuv_channel_sse2(a0, a1, gs), g_hi = sdl_yuv_channel_sse2(a2, a3, gs);
+    __m128i b_lo = sdl_yuv_channel_sse2(a0, a1, bs), b_hi = sdl_yuv_channel_sse2(a2, a3, bs);
+    __m128i luma = _mm_packus_epi16(sdl_yuv_y_sse2(r_lo, g_lo, b_lo), sdl_yuv_y_sse2(r_hi, g_hi, b_hi));
+
+    __m128i r = _mm_srli_epi16(_mm_add_epi16(sdl_yuv_pairs_sse2(r_lo, r_hi), one), 1);
+    __m128i g = _mm_srli_epi16(_mm_add_epi16(sdl_yuv_pairs_sse2(g_lo, g_hi), one), 1);
+    __m128i b = _mm_srli_epi16(_mm_add_epi16(sdl_yuv_pairs_sse2(b_lo, b_hi), one), 1);
+    __m128i cu = _mm_packus_epi16(sdl_yuv_chroma_sse2(r, g, b, -38, -74, 112), r);
+    __m128i cv = _mm_packus_epi16(sdl_yuv_chroma_sse2(r, g, b, 112, -94, -18), r);
+    __m128i chroma = layout->u_first ? _mm_unpacklo_epi8(cu, cv) : _mm_unpacklo_epi8(cv, cu);
+
+    __m128i* dst = (__m128i*) (out + x * 2);
+    if (layout->y_first) {
+      _mm_storeu_si128(dst, _mm_unpacklo_epi8(luma, chroma));
+      _mm_storeu_si128(dst + 1, _mm_unpackhi_epi8(luma, chroma));
+    } else {
+      _mm_storeu_si128(dst, _mm_unpacklo_epi8(chroma, luma));
+      _mm_storeu_si128(dst + 1, _mm_unpackhi_epi8(chroma, luma));
+    }
+  }
+  sdl_yuv_row_422_from(s, out, x, w, shifts, layout);
+}
+
+static const sdl_yuv_kernel_set sdl_yuv_kernels_sse2 = {
+  "sse2", sdl_yuv_rows_420_sse2, sdl_yuv_row_422_sse2
+};
+
+
+/*******************************************************************************
+ * AVX2 kernels
+ *
+ * The SSE2 steps at twice the width. AVX2 packs work within each 128-bit
+ * half, so every pack is followed by a permute that restores pixel order.
+ ******************************************************************************/
+#define SDL_AVX2 __attribute__((target("avx2")))
+#define SDL_YUV_ORDER(v) _mm256_permute4x64_epi64(v, 0xd8)
+
+SDL_AVX2 static inline __m256i sdl_yuv_channel_avx2 (__m256i a, __m256i b, __m128i shift) {
+  const __m256i ff = _mm256_set1_epi32(0xff);
+  return SDL_YUV_ORDER(_mm256_packs_epi32(_mm256_and_si256(_mm256_srl_epi32(a, shift), ff),
+    _mm256_and_si256(_mm256_srl_epi32(b, shift), ff)));
+}
+
+SDL_AVX2 static inline __m256i sdl_yuv_y_avx2 (__m256i r, __m256i g, __m256i b) {
+  __m256i sum = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(66)),
+    _mm256_mullo_epi16(g, _mm256_set1_epi16(129))), _mm256_mullo_epi16(b, _mm256_set1_epi16(25)));
+  sum = _mm256_add_epi16(sum, _mm256_set1_epi16(128));
+  return _mm256_add_epi16(_mm256_srli_epi16(sum, 8), _mm256_set1_epi16(16));
+}
+
+SDL_AVX2 static inline __m256i sdl_yuv_chroma_avx2 (__m256i r, __m256i g, __m256i b, short kr, short kg, short kb) {
+  __m256i sum = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(kr)),
+    _mm256_mullo_epi16(g, _mm256_set1_epi16(kg))), _mm256_mullo_epi16(b, _mm256_set1_epi16(kb)));
+  sum = _mm256_add_epi16(sum, _mm256_set1_epi16(128));
+  return _mm256_add_epi16(_mm256_srai_epi16(sum, 8), _mm256_set1_epi16(128));
+}
+
+SDL_AVX2 static inline __m256i sdl_yuv_pairs_avx2 (__m256i lo, __m256i hi) {
+  const __m256i one = _mm256_set1_epi16(1);
+  return SDL_YUV_ORDER(_mm256_packs_epi32(_mm256_madd_epi16(lo, one), _mm256_madd_epi16(hi, one)));
+}
+
+// 32 luma values to bytes, in order
+SDL_AVX2 static inline __m256i sdl_yuv_pack_avx2 (__m256i lo, __m256i hi) {
+  return SDL_YUV_ORDER(_mm256_packus_epi16(lo, hi));
+}
+
+// 16 chroma values to bytes, in order
+SDL_AVX2 static inline __m128i sdl_yuv_pack_half_avx2 (__m256i values) {
+  return _mm256_castsi256_si128(SDL_YUV_ORDER(_mm256_packus_epi16(values, values)));
+}
+
+SDL_AVX2 static void sdl_yuv_rows_420_avx2 (const Uint32* s0, const Uint32* s1, Uint8* y0, Uint8* y1,
+    Uint8* u, Uint8* v, int w, const sdl_yuv_shifts* shifts) {
+  const __m128i rs = _mm_cvtsi32_si128(shifts->r);
+  const __m128i gs = _mm_cvtsi32_si128(shifts->g);
+  const __m128i bs = _mm_cvtsi32_si128(shifts->b);
+  const __m256i two = _mm256_set1_epi16(2);
+  int x;
+  for (x = 0; x + 32 <= w; x += 32) {
+    __m256i a0 = _mm256_loadu_si256((const __m256i*) (s0 + x));
+    __m256i a1 = _mm256_loadu_si256((const __m256i*) (s0 + x + 8));
+    __m256i a2 = _mm256_loadu_si256((const __m256i*) (s0 + x + 16));
+    __m256i a3 = _mm256_loadu_si256((const __m256i*) (s0 + x + 24));
+    __m256i b0 = _mm256_loadu_si256((const __m256i*) (s1 + x));
+    __m256i b1 = _mm256_loadu_si256((const __m256i*) (s1 + x + 8));
+    __m256i b2 = _mm256_loadu_si256((const __m256i*) (s1 + x + 16));
+    __m256i b3 = _mm256_loadu_si256((const __m256i*) (s1 + x + 24));
+
+    __m256i ra_lo = sdl_yuv_channel_avx2(a0, a1, rs), ra_hi = sdl_yuv_channel_avx2(a2, a3, rs);
+    __m256i ga_lo = sdl_yuv_channel_avx2(a0, a1, gs), ga_hi = sdl_yuv_channel_avx2(a2, a3, gs);
+    __m256i ba_lo = sdl_yuv_channel_avx2(a0, a1, bs), ba_hi = sdl_yuv_channel_avx2(a2, a3, bs);
+    __m256i rb_lo = sdl_yuv_channel_avx2(b0, b1, rs), rb_hi = sdl_yuv_channel_avx2(b2, b3, rs);
+    __m256i gb_lo = sdl_yuv_channel_avx2(b0, b1, gs), gb_hi = sdl_yuv_channel_avx2(b2, b3, gs);
+    __m256i bb_lo = sdl_yuv_channel_avx2(b0, b1, bs), bb_hi = sdl_yuv_channel_avx2(b2, b3, bs);
+
+    _mm256_storeu_si256((__m256i*) (y0 + x), sdl_yuv_pack_avx2(sdl_yuv_y_avx2(ra_lo, ga_lo, ba_lo), sdl_yuv_y_avx2(ra_hi, ga_hi, ba_hi)));
+    _mm256_storeu_si256((__m256i*) (y1 + x), sdl_yuv_pack_avx2(sdl_yuv_y_avx2(rb_lo, gb_lo, bb_lo), sdl_yuv_y_avx2(rb_hi, gb_hi, bb_hi)));
+
+    __m256i r = _mm256_srli_epi16(_mm256_add_epi16(sdl_yuv_pairs_avx2(_mm256_add_epi16(ra_lo, rb_lo), _mm256_add_epi16(ra_hi, rb_hi)), two), 2);
+    __m256i g = _mm256_srli_epi16(_mm256_add_epi16(sdl_yuv_pairs_avx2(_mm256_add_epi16(ga_lo, gb_lo), _mm256_add_epi16(ga_hi, gb_hi)), two), 2);
+    __m256i b = _mm256_srli_epi16(_mm256_add_epi16(sdl_yuv_pairs_avx2(_mm256_add_epi16(ba_lo, bb_lo), _mm256_add_epi16(ba_hi, bb_hi)), two), 2);
+    _mm_storeu_si128((__m128i*) (u + (x >> 1)), sdl_yuv_pack_half_avx2(sdl_yuv_chroma_avx2(r, g, b, -38, -74, 112)));
+    _mm_storeu_si128((__m128i*) (v + (x >> 1)), sdl_yuv_pack_half_avx2(sdl_yuv_chroma_avx2(r, g, b, 112, -94, -18)));
+  }
+  sdl_yuv_rows_420_from(s0, s1, y0, y1, u, v, x, w, shifts);
+}
+
+SDL_AVX2 static void sdl_yuv_row_422_avx2 (const Uint32* s, Uint8* out, int w, const sdl_yuv_shifts* shifts,
+    const sdl_yuv_layout* layout) {
+  const __m128i rs = _mm_cvtsi32_si128(shifts->r);
+  const __m128i gs = _mm_cvtsi32_si128(shifts->g);
+  const __m128i bs = _mm_cvtsi32_si128(shifts->b);
+  const __m256i one = _mm256_set1_epi16(1);
+  int x;
+  for (x = 0; x + 32 <= w; x += 32) {
+    __m256i a0 = _mm256_loadu_si256((const __m256i*) (s + x));
+    __m256i a1 = _mm256_loadu_si256((const __m256i*) (s + x + 8));
+    __m256i a2 = _mm256_loadu_si256((const __m256i*) (s + x + 16));
+    __m256i a3 = _mm256_loadu_si256((const __m256i*) (s + x + 24));
+
+    __m256i r_lo = sdl_yuv_channel_avx2(a0, a1, rs), r_hi = sdl_yuv_channel_avx2(a2, a3, rs);
+    __m256i g_lo = sdl_yuv_channel_avx2(a0, a1, gs), g_hi = sdl_yuv_channel_avx2(a2, a3, gs);
+    __m256i b_lo = sdl_yuv_channel_avx2(a0, a1, bs), b_hi = sdl_yuv_channel_avx2(a2, a3, bs);
+    __m256i luma = sdl_yuv_pack_avx2(sdl_yuv_y_avx2(r_lo, g_lo, b_lo), sdl_yuv_y_avx2(r_hi, g_hi, b_hi));
+
+    __m256i r = _mm256_srli_epi16(_mm256_add_epi16(sdl_yuv_pairs_avx2(r_lo, r_hi), one), 1);
+    __m256i g = _mm256_srli_epi16(_mm256_add_epi16(sdl_yuv_pairs_avx2(g_lo, g_hi), one), 1);
+    __m256i b = _mm256_srli_epi16(_mm256_add_epi16(sdl_yuv_pairs_avx2(b_lo, b_hi), one), 1);
+    __m128i cu = sdl_yuv_pack_half_avx2(sdl_yuv_chroma_avx2(r, g, b, -38, -74, 112));
+    __m128i cv = sdl_yuv_pack_half_avx2(sdl_yuv_chroma_avx2(r, g, b, 112, -94, -18));
+    __m128i chroma_lo = layout->u_first ? _mm_unpacklo_epi8(cu, cv) : _mm_unpacklo_epi8(cv, cu);
+    __m128i chroma_hi = layout->u_first ? _mm_unpackhi_epi8(cu, cv) : _mm_unpackhi_epi8(cv, cu);
+    __m128i luma_lo = _mm256_castsi256_si128(luma);
+    __m128i luma_hi = _mm256_extracti128_si256(luma, 1);
+
+    __m128i* dst = (__m128i*) (out + x * 2);
+    if (layout->y_first) {
+      _mm_storeu_si128(dst, _mm_unpacklo_epi8(luma_lo, chroma_lo));
+      _mm_storeu_si128(dst + 1, _mm_unpackhi_epi8(luma_lo, chroma_lo));
+      _mm_storeu_si128(dst + 2, _mm_unpacklo_epi8(luma_hi, chroma_hi));
+      _mm_storeu_si128(dst + 3, _mm_unpackhi_epi8(luma_hi, chroma_hi));
+    } else {
+      _mm_storeu_si128(dst, _mm_unpacklo_epi8(chroma_lo, luma_lo));
+      _mm_storeu_si128(dst + 1, _mm_unpackhi_epi8(chroma_lo, luma_lo));
+      _mm_storeu_si128(dst + 2, _mm_unpacklo_epi8(chroma_hi, luma_hi));
+      _mm_storeu_si128(dst + 3, _mm_unpackhi_epi8(chroma_hi, luma_hi));
+    }
+  }
+  sdl_yuv_row_422_from(s, out, x, w, shifts, layout);
+}
+
+static const sdl_yuv_kernel_set sdl_yuv_kernels_avx2 = {
+  "avx2", sdl_yuv_rows_420_avx2, sdl_yuv_row_422_avx2
+};
+#endif
+
+
+/*******************************************************************************
+ * Dispatch
+ ******************************************************************************/
+static const sdl_yuv_kernel_set* sdl_yuv_kernels = &sdl_yuv_kernels_scalar;
+
+void sdl_yuv_init (void) {
+  sdl_yuv_kernels = &sdl_yuv_kernels_scalar;
+#ifdef SDL_YUV_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    sdl_yuv_kernels = &sdl_yuv_kernels_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    sdl_yuv_kernels = &sdl_yuv_kernels_sse2;
+  }
+#endif
+}
+
+const char* sdl_yuv_kernel_name (void) {
+  return sdl_yuv_kernels->name;
+}
+
+
+/*******************************************************************************
+ * Conversion
+ ******************************************************************************/
+static int sdl_yuv_channel_ok (Uint32 mask, Uint8 shift) {
+  return mask == (Uint32) 0xff << shift;
+}
+
+int sdl_yuv_convert (const SDL_Surface* src, SDL_Overlay* overlay) {
+  const SDL_PixelFormat* format = src->format;
+  sdl_yuv_shifts shifts;
+  sdl_yuv_layout layout;
+  int w = src->w < overlay->w ? src->w : overlay->w;
+  int h = src->h < overlay->h ? src->h : overlay->h;
+  int y;
+
+  if (format->BytesPerPixel != 4 || ! sdl_yuv_channel_ok(format->Rmask, format->Rshift) ||
+      ! sdl_yuv_channel_ok(format->Gmask, format->Gshift) || ! sdl_yuv_channel_ok(format->Bmask, format->Bshift)) {
+    SDL_SetError("YUV conversion needs a 32bpp surface with 8-bit channels");
+    return -1;
+  }
+  shifts.r = format->Rshift;
+  shifts.g = format->Gshift;
+  shifts.b = format->Bshift;
+
+  switch (overlay->format) {
+    case SDL_YV12_OVERLAY:
+    case SDL_IYUV_OVERLAY: {
+      int u_plane = overlay->format == SDL_IYUV_OVERLAY ? 1 : 2;
+      int v_plane = 3 - u_plane;
+      for (y = 0; y + 1 < h; y += 2) {
+        const Uint32* s0 = (const Uint32*) ((const Uint8*) src->pixels + y * src->pitch);
+        const Uint32* s1 = (const Uint32*) ((const Uint8*) s0 + src->pitch);
+        Uint8* y0 = overlay->pixels[0] + y * overlay->pitches[0];
+        sdl_yuv_kernels->rows_420(s0, s1, y0, y0 + overlay->pitches[0],
+          overlay->pixels[u_plane] + (y >> 1) * overlay->pitches[u_plane],
+          overlay->pixels[v_plane] + (y >> 1) * overlay->pitches[v_plane], w, &shifts);
+      }
+      // An odd last row only has luma of its own
+      if (y < h) {
+        const Uint32* s0 = (const Uint32*) ((const Uint8*) src->pixels + y * src->pitch);
+        Uint8* y0 = overlay->pixels[0] + y * overlay->pitches[0];
+        int x;
+        for (x = 0; x < w; x++) y0[x] = sdl_yuv_luma(s0[x], &shifts);
+      }
+      return 0;
+    }
+    case SDL_YUY2_OVERLAY:
+    case SDL_UYVY_OVERLAY:
+    case SDL_YVYU_OVERLAY:
+      layout.y_first = overlay->format != SDL_UYVY_OVERLAY;
+      layout.u_first = overlay->format != SDL_YVYU_OVERLAY;
+      for (y = 0; y < h; y++) {
+        sdl_yuv_kernels->row_422((const Uint32*) ((const Uint8*) src->pixels + y * src->pitch),
+          overlay->pixels[0] + y * overlay->pitches[0], w, &shifts, &layout);
+      }
+      return 0;
+  }
+  SDL_SetError("Unsupported YUV overlay format");
+  return -1;
+}
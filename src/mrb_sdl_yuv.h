@@ -0,0 +1,21 @@
+#ifndef MRB_SDL_YUV_H
+#define MRB_SDL_YUV_H
+
+#include <SDL/SDL.h>
+
+/*
+ * RGB to YUV conversion straight into a locked overlay's planes, using the
+ * BT.601 studio-swing coefficients. 4:2:0 formats (YV12, IYUV) average each
+ * 2x2 block and 4:2:2 formats (YUY2, UYVY, YVYU) each pixel pair before
+ * converting the chroma. The SSE2 and AVX2 kernels give the same bytes as
+ * the scalar one.
+ */
+void sdl_yuv_init(void);
+const char* sdl_yuv_kernel_name(void);
+
+// Convert the top-left of a 32bpp surface with 8-bit channels into the
+// overlay, which must be locked, as must the surface if it needs to be.
+// Returns -1 with SDL_SetError if either format isn't supported.
+int sdl_yuv_convert(const SDL_Surface* src, SDL_Overlay* overlay);
+
+#endif	/* MRB_SDL_YUV_H */
@@ -0,0 +1,78 @@
+# SDL::Atlas packing and page sharing
+
+SDL_TEST_MASKS = {
+  8 => [0, 0, 0, 0],
+  16 => [0xf800, 0x07e0, 0x001f, 0],
+  32 => [0xff0000, 0xff00, 0xff, 0],
+}
+
+def sdl_test_surface(depth, w, h)
+  r, g, b, a = SDL_TEST_MASKS[depth]
+  SDL::Video.create_rgb_surface(0, w, h, depth, r, g, b, a)
+end
+
+assert('SDL::Atlas#add places images without overlap') do
+  atlas = SDL::Atlas.new(64, 64, 1)
+  images = []
+  regions = []
+  8.times do |i|
+    image = sdl_test_surface(32, 10 + i, 12)
+    images << image
+    regions << atlas.add(image)
+  end
+  ok = true
+  regions.each_with_index do |a, i|
+    ok = ok && a.x >= 0 && a.y >= 0 && a.x + a.w <= 64 && a.y + a.h <= 64
+    regions.each_with_index do |b, j|
+      next if j <= i || a.page_index != b.page_index
+      ok = ok && (a.x + a.w <= b.x || b.x + b.w <= a.x || a.y + a.h <= b.y || b.y + b.h <= a.y)
+    end
+  end
+  images.each { |image| image.free }
+  ok && regions[0].w == 10 && regions[0].h == 12
+end
+
+assert('SDL::Atlas opens a page per pixel format') do
+  atlas = SDL::Atlas.new(64, 64, 0)
+  a = sdl_test_surface(32, 8, 8)
+  b = sdl_test_surface(16, 8, 8)
+  ok = atlas.add(a).page_index != atlas.add(b).page_index && atlas.page_count == 2
+  a.free
+  b.free
+  ok
+end
+
+assert('SDL::Atlas keeps different palettes apart') do
+  atlas = SDL::Atlas.new(64, 64, 0)
+  a = sdl_test_surface(8, 8, 8)
+  b = sdl_test_surface(8, 8, 8)
+  c = sdl_test_surface(8, 8, 8)
+  SDL::Video.set_colors(b, "\xff\x00\x00\x00", 3)
+  pa = atlas.add(a).page_index
+  pb = atlas.add(b).page_index
+  pc = atlas.add(c).page_index
+  [a, b, c].each { |image| image.free }
+  pa != pb && pa == pc
+end
+
+assert('SDL::Atlas#add rejects images larger than a page') do
+  atlas = SDL::Atlas.new(16, 16, 0)
+  image = sdl_test_surface(32, 32, 8)
+  raised = false
+  begin
+    atlas.add(image)
+  rescue RuntimeError
+    raised = true
+  end
+  image.free
+  raised
+end
+
+assert('SDL::Atlas.new checks its page size') do
+  begin
+    SDL::Atlas.new(0, 64)
+    false
+  rescue ArgumentError
+    true
+  end
+end
@@ -0,0 +1,58 @@
+# SDL::Video.blit_batch with and without sorting
+
+def sdl_test_rgb_surface(w, h)
+  SDL::Video.create_rgb_surface(0, w, h, 32, 0xff0000, 0xff00, 0xff, 0)
+end
+
+# A 1x2 source: red on top, blue below
+def sdl_test_blit_source
+  src = sdl_test_rgb_surface(1, 2)
+  SDL::Video.lock_surface(src) do |pixels|
+    pixels[0, 0] = 0xff0000
+    pixels[0, 1] = 0x0000ff
+  end
+  src
+end
+
+def sdl_test_pixel(surface, x, y)
+  SDL::Video.lock_surface(surface) { |pixels| pixels[x, y] }
+end
+
+# Blue then red onto the same pixel: red must end up on top, sorted or not
+def sdl_test_overlapping_batch(sort)
+  src = sdl_test_blit_source
+  dest = sdl_test_rgb_surface(1, 1)
+  rects = SDL::RectArray.new
+  rects.push(0, 1, 1, 1)
+  rects.push(0, 0, 0, 0)
+  rects.push(0, 0, 1, 1)
+  rects.push(0, 0, 0, 0)
+  SDL::Video.blit_batch(src, dest, rects, sort)
+  pixel = sdl_test_pixel(dest, 0, 0)
+  src.free
+  dest.free
+  pixel
+end
+
+assert('SDL::Video.blit_batch blits in order') do
+  sdl_test_overlapping_batch(false) == 0xff0000
+end
+
+assert('SDL::Video.blit_batch keeps the order of overlapping blits when sorting') do
+  sdl_test_overlapping_batch(true) == 0xff0000
+end
+
+assert('SDL::Video.blit_batch lands every blit when sorting') do
+  src = sdl_test_blit_source
+  dest = sdl_test_rgb_surface(2, 1)
+  rects = SDL::RectArray.new
+  rects.push(0, 1, 1, 1)
+  rects.push(1, 0, 0, 0)
+  rects.push(0, 0, 1, 1)
+  rects.push(0, 0, 0, 0)
+  SDL::Video.blit_batch(src, dest, rects, true)
+  ok = sdl_test_pixel(dest, 0, 0) == 0xff0000 && sdl_test_pixel(dest, 1, 0) == 0x0000ff
+  src.free
+  dest.free
+  ok
+end
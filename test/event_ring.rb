@@ -0,0 +1,34 @@
+# SDL::EventRing bookkeeping. Filling the ring needs a video driver, so only
+# the empty ring is covered here.
+
+assert('SDL::EventRing.new sets the capacity') do
+  SDL::EventRing.new(32).capacity == 32 && SDL::EventRing.new.capacity == 256
+end
+
+assert('SDL::EventRing starts empty') do
+  ring = SDL::EventRing.new(8)
+  ring.length == 0 && ring[0].nil? && ring[-1].nil?
+end
+
+assert('SDL::EventRing#each on an empty ring yields nothing') do
+  ring = SDL::EventRing.new(8)
+  count = 0
+  ring.each { |event| count += 1 }
+  count == 0
+end
+
+assert('SDL::EventRing#clear and #discard on an empty ring') do
+  ring = SDL::EventRing.new(8)
+  ring.discard(4)
+  ring.clear
+  ring.length == 0
+end
+
+assert('SDL::EventRing.new rejects a zero capacity') do
+  begin
+    SDL::EventRing.new(0)
+    false
+  rescue ArgumentError
+    true
+  end
+end
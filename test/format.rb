@@ -0,0 +1,55 @@
+# Pixel format mapping, one pixel at a time and in bulk
+
+def sdl_test_format(depth, r, g, b, a)
+  surface = SDL::Video.create_rgb_surface(0, 1, 1, depth, r, g, b, a)
+  [surface, SDL::Video.pixel_format(surface)]
+end
+
+def sdl_test_rgba(count)
+  rgba = ""
+  count.times { |i| rgba += (i * 7 % 256).chr + (i * 13 % 256).chr + (i * 29 % 256).chr + 255.chr }
+  rgba
+end
+
+assert('SDL::Video.map_rgba and rgba round trip a pixel') do
+  surface, format = sdl_test_format(32, 0xff0000, 0xff00, 0xff, 0xff000000)
+  pixel = SDL::Video.map_rgba(format, 1, 2, 3, 4)
+  ok = SDL::Video.rgba(pixel, format) == [1, 2, 3, 4] && SDL::Video.rgb(pixel, format) == [1, 2, 3]
+  surface.free
+  ok
+end
+
+assert('SDL::Video.map_rgba_buffer round trips 8888 pixels') do
+  surface, format = sdl_test_format(32, 0xff0000, 0xff00, 0xff, 0xff000000)
+  rgba = sdl_test_rgba(37)
+  pixels = SDL::Video.map_rgba_buffer(format, rgba)
+  ok = pixels.length == 37 * 4 && SDL::Video.rgba_buffer(format, pixels) == rgba
+  surface.free
+  ok
+end
+
+assert('SDL::Video.map_rgba_buffer agrees with map_rgb at 16bpp') do
+  surface, format = sdl_test_format(16, 0xf800, 0x07e0, 0x001f, 0)
+  rgba = sdl_test_rgba(19)
+  back = SDL::Video.rgba_buffer(format, SDL::Video.map_rgba_buffer(format, rgba))
+  ok = back.length == rgba.length
+  19.times do |i|
+    r, g, b = rgba[i * 4, 3].bytes
+    expected = SDL::Video.rgb(SDL::Video.map_rgb(format, r, g, b), format) + [255]
+    ok = ok && back[i * 4, 4].bytes == expected
+  end
+  surface.free
+  ok
+end
+
+assert('SDL::Video.map_rgba_buffer checks the buffer length') do
+  surface, format = sdl_test_format(32, 0xff0000, 0xff00, 0xff, 0)
+  raised = false
+  begin
+    SDL::Video.map_rgba_buffer(format, "abc")
+  rescue ArgumentError
+    raised = true
+  end
+  surface.free
+  raised
+end
@@ -0,0 +1,42 @@
+# SDL::FramePacer fixed-step updates
+
+assert('SDL::FramePacer yields fixed steps') do
+  pacer = SDL::FramePacer.new(0, 1000)
+  pacer.update
+  SDL::Clock.delay(20)
+  dts = []
+  steps = pacer.update { |dt| dts << dt }
+  steps >= 1 && dts.length == steps && dts.all? { |dt| (dt - 0.001).abs < 1e-9 }
+end
+
+assert('SDL::FramePacer#alpha stays within a step') do
+  pacer = SDL::FramePacer.new(0, 100)
+  pacer.update
+  alpha = pacer.alpha
+  alpha >= 0 && alpha < 1
+end
+
+assert('SDL::FramePacer rejects a negative fps') do
+  begin
+    SDL::FramePacer.new(-1)
+    false
+  rescue ArgumentError
+    true
+  end
+end
+
+assert('SDL::FramePacer rejects rates with a zero period') do
+  fps_raised = false
+  hz_raised = false
+  begin
+    SDL::FramePacer.new(2e9)
+  rescue ArgumentError
+    fps_raised = true
+  end
+  begin
+    SDL::FramePacer.new(60, 2e9)
+  rescue ArgumentError
+    hz_raised = true
+  end
+  fps_raised && hz_raised
+end
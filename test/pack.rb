@@ -0,0 +1,107 @@
+# SDL::Pack. Every test writes its own pack under /tmp and deletes it again
+# where the build has mruby-io, so tests can run in any order or in parallel.
+
+def sdl_test_image
+  surface = SDL::Video.create_rgb_surface(0, 4, 3, 32, 0xff0000, 0xff00, 0xff, 0)
+  SDL::Video.fill_rect(surface, nil, 0x123456)
+  surface
+end
+
+def sdl_test_pack_path
+  "/tmp/mruby-sdl-test-#{Object.new.object_id}-#{(SDL::Clock.now * 1e9).to_i}.pack"
+end
+
+def sdl_test_pack_delete(path)
+  File.delete(path) if Object.const_defined?(:File) && File.respond_to?(:delete)
+rescue
+  nil
+end
+
+# Yields the count written and the opened pack, then closes and deletes it
+def sdl_test_pack
+  path = sdl_test_pack_path
+  image = sdl_test_image
+  begin
+    count = SDL::Pack.write(path, [["zeta", "hello"], ["alpha", ""], ["image", image]])
+    pack = SDL::Pack.new(path)
+    begin
+      yield count, pack
+    ensure
+      begin
+        pack.close
+      rescue RuntimeError
+        nil
+      end
+    end
+  ensure
+    image.free
+    sdl_test_pack_delete(path)
+  end
+end
+
+assert('SDL::Pack.write returns the entry count') do
+  sdl_test_pack { |count, pack| count == 3 }
+end
+
+assert('SDL::Pack keeps names sorted') do
+  sdl_test_pack { |count, pack| pack.names == ["alpha", "image", "zeta"] }
+end
+
+assert('SDL::Pack#read') do
+  sdl_test_pack do |count, pack|
+    pack.read("zeta") == "hello" && pack.read("alpha") == "" && pack.read("missing").nil?
+  end
+end
+
+assert('SDL::Pack#include? and #length') do
+  sdl_test_pack do |count, pack|
+    pack.include?("zeta") && ! pack.include?("missing") && pack.length == 3
+  end
+end
+
+assert('SDL::Pack#surface maps the stored image') do
+  sdl_test_pack do |count, pack|
+    surface = pack.surface("image")
+    ok = surface.w == 4 && surface.h == 3 && surface.depth == 32
+    surface.free
+    ok
+  end
+end
+
+assert('SDL::Pack#close raises while surfaces borrow the pack') do
+  sdl_test_pack do |count, pack|
+    surface = pack.surface("image")
+    raised = false
+    begin
+      pack.close
+    rescue RuntimeError
+      raised = true
+    end
+    surface.free
+    raised
+  end
+end
+
+assert('SDL::Pack raises once closed') do
+  sdl_test_pack do |count, pack|
+    pack.close
+    begin
+      pack.names
+      false
+    rescue RuntimeError
+      true
+    end
+  end
+end
+
+assert('SDL::Pack.write rejects duplicate names') do
+  path = sdl_test_pack_path
+  begin
+    SDL::Pack.write(path, [["a", "1"], ["a", "2"]])
+    false
+  rescue RuntimeError
+    true
+  ensure
+    sdl_test_pack_delete(path)
+  end
+end
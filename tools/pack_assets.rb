@@ -0,0 +1,55 @@
+# Offline asset packer
+#
+# Loads BMP files, converts them to the display's pixel layout and writes them
+# into a single SDL::Pack file that the game can map at runtime:
+#
+#   SDL_VIDEODRIVER=dummy bin/mruby path/to/mruby-sdl/tools/pack_assets.rb \
+#     assets.pack 640 480 32 images/*.bmp
+#
+# The width, height and depth must match the mode the game runs in, since the
+# pixels are stored exactly as display_format produced them. Images with a
+# name ending in "_alpha.bmp" go through display_format_alpha instead. Any
+# file that isn't a .bmp is stored as a raw blob, readable with Pack#read, or
+# Pack#load_bmp if it is a BMP you want decoded at runtime.
+#
+# Entries are named after the file, without its directory. Blobs are read
+# with File, so build mruby with mruby-io if you pack any.
+
+if ARGV.size < 4
+  puts "usage: pack_assets.rb output.pack width height depth files..."
+  exit 1
+end
+
+output = ARGV[0]
+width = ARGV[1].to_i
+height = ARGV[2].to_i
+depth = ARGV[3].to_i
+files = ARGV[4..-1]
+
+SDL.init(0x20) # SDL_INIT_VIDEO
+SDL::Video.set_mode(width, height, depth, 0)
+
+surfaces = []
+entries = files.map do |path|
+  name = path.split("/").last
+  if name[-4..-1] == ".bmp"
+    loaded = SDL::Video.load_bmp(path)
+    if name[-10..-1] == "_alpha.bmp"
+      converted = SDL::Video.display_format_alpha(loaded)
+    else
+      converted = SDL::Video.display_format(loaded)
+    end
+    SDL::Video.free_surface(loaded)
+    surfaces << converted
+    [name, converted]
+  else
+    data = File.open(path, "rb") { |file| file.read }
+    [name, data]
+  end
+end
+
+count = SDL::Pack.write(output, entries)
+surfaces.each { |surface| SDL::Video.free_surface(surface) }
+puts "wrote #{count} entries to #{output}"
+
+SDL.quit